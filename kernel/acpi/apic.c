@@ -11,6 +11,7 @@
 #include <kprintf.h>
 #include <devmgr.h>
 #include <irq.h>
+#include <cpu.h>
 
 acpi_madt_t *madt;
 char irq_mode = 0;
@@ -30,6 +31,7 @@ void apic_init()
 	lapics = kcalloc(sizeof(lapic_t), MAX_LAPICS);
 	ioapics = kcalloc(sizeof(ioapic_t), MAX_IOAPICS);
 	overrides = kcalloc(sizeof(irq_override_t), MAX_OVERRIDES);
+	cpus = kcalloc(sizeof(cpu_t *), MAX_LAPICS);
 	lapic_count = 0;
 	ioapic_count = 0;
 	override_count = 0;
@@ -60,6 +62,11 @@ void apic_init()
 	}
 
 	apic_parse();
+
+	// this has to be decided before we send any IPIs
+	lapic_detect_x2apic();
+	lapic_enable();
+
 	smp_init();
 
 	if(ioapic_count != 0)
@@ -101,6 +108,7 @@ void apic_parse()
 	uint32_t bytes = 0;
 
 	madt_lapic_t *lapic;
+	madt_x2apic_t *x2apic;
 	madt_ioapic_t *ioapic;
 	madt_override_t *override;
 
@@ -116,6 +124,11 @@ void apic_parse()
 			apic_register_lapic(lapic);
 			break;
 
+		case MADT_ENTRY_X2APIC:
+			x2apic = (madt_x2apic_t*)ptr;
+			apic_register_x2apic(x2apic);
+			break;
+
 		case MADT_ENTRY_IOAPIC:
 			ioapic = (madt_ioapic_t*)ptr;
 			apic_register_ioapic(ioapic);
@@ -131,8 +144,8 @@ void apic_parse()
 			break;
 		}
 
-		ptr += ptr[1];
 		bytes += ptr[1];
+		ptr += ptr[1];
 	}
 }
 
@@ -155,6 +168,34 @@ void apic_register_lapic(madt_lapic_t *data)
 	lapic_count++;
 }
 
+// apic_register_x2apic(): Registers a CPU local x2APIC
+// Firmware uses these for APIC IDs that don't fit in 8 bits
+// Param:	madt_x2apic_t *data - data from MADT table
+// Return:	Nothing
+
+void apic_register_x2apic(madt_x2apic_t *data)
+{
+	kprintf("apic: CPU local x2APIC ID 0x%xd flags 0x%xd\n", data->apic_id, data->flags);
+
+	if(lapic_count >= MAX_LAPICS)
+		return;
+
+	if(!(data->flags & 1))
+		return;
+
+	// some firmware lists the same CPU in both formats
+	size_t i;
+	for(i = 0; i < lapic_count; i++)
+	{
+		if(lapics[i].apic_id == data->apic_id)
+			return;
+	}
+
+	lapics[lapic_count].present = 1;
+	lapics[lapic_count].apic_id = data->apic_id;
+	lapic_count++;
+}
+
 // apic_register_ioapic(): Registers an I/O APIC
 // Param:	madt_ioapic_t *data - data from MADT table
 // Return:	Nothing
@@ -247,6 +247,9 @@ uint8_t ioapic_configure(uint8_t gsi, uint8_t flags)
 	{
 		if(broadcast == 1)
 		{
+			// in x2APIC cluster mode this 8-bit destination means
+			// the first eight CPUs of cluster zero -- without interrupt
+			// remapping, the I/O APIC can't do better than that
 			value |= IOAPIC_LOGICAL;
 			value |= ((uint64_t)LAPIC_CLUSTER_ID << 56);
 		} else
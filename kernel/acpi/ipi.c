@@ -0,0 +1,174 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <acpi.h>
+#include <apic.h>
+#include <mm.h>
+#include <kprintf.h>
+#include <cpu.h>
+#include <idt.h>
+#include <lock.h>
+
+// Cross-CPU function calls
+// Each CPU has a lock-free queue that other CPUs push calls onto. Only the
+// push that finds the queue empty sends an IPI; anything pushed before the
+// target drains its queue rides on that same IPI.
+
+int smp_call_queue(cpu_t *, size_t, void (*)(void *), void *);
+
+// smp_call_init(): Installs the cross-CPU function call handler
+// Param:	Nothing
+// Return:	Nothing
+
+void smp_call_init()
+{
+	idt_install(SMP_CALL_VECTOR, (size_t)&smp_call_stub);
+}
+
+// smp_call_queue(): Queues a function call on another CPU
+// Param:	cpu_t *source - calling CPU
+// Param:	size_t target - CPU index of target
+// Param:	void (*function)(void *) - function to call
+// Param:	void *argument - argument to pass
+// Return:	int - 1 if the target needs an IPI
+
+int smp_call_queue(cpu_t *source, size_t target, void (*function)(void *), void *argument)
+{
+	smp_call_t *call = &source->call_nodes[target];
+
+	// our previous call to this CPU might not have run yet
+	while(call->busy)
+		asm volatile ("pause");
+
+	call->function = function;
+	call->argument = argument;
+	call->busy = 1;
+
+	smp_call_t *old;
+	do
+	{
+		old = cpus[target]->call_queue;
+		call->next = old;
+	} while(atomic_cmpxchg(&cpus[target]->call_queue, old, call) != old);
+
+	source->call_count++;
+
+	// if the queue wasn't empty, an IPI is already on its way
+	return old == NULL;
+}
+
+// smp_call_function(): Runs a function on a set of CPUs
+// Don't call this with interrupts disabled or from an IRQ handler, or two
+// CPUs calling each other can wait on each other forever
+// Param:	cpumask_t *mask - CPUs to run the function on, may include this one
+// Param:	void (*function)(void *) - function to call, runs with IRQs disabled
+// Param:	void *argument - argument to pass
+// Param:	int wait - wait for all CPUs to finish the call
+// Return:	int - 0 on success
+
+int smp_call_function(cpumask_t *mask, void (*function)(void *), void *argument, int wait)
+{
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	size_t self = cpu->index;
+	cpu_t *source = cpus[self];
+
+	size_t i;
+	for(i = 0; i < lapic_count; i++)
+	{
+		if(i == self || !cpumask_test(mask, i) || !cpus[i])
+			continue;
+
+		if(smp_call_queue(source, i, function, argument))
+		{
+			lapic_send_ipi(lapics[i].apic_id, SMP_CALL_VECTOR);
+			source->ipi_count++;
+		}
+	}
+
+	// do our own share while the others are busy
+	size_t flags;
+	if(cpumask_test(mask, self))
+	{
+		asm volatile ("pushf\npop %0\ncli" : "=r"(flags) : : "memory");
+		function(argument);
+		asm volatile ("push %0\npopf" : : "r"(flags) : "memory", "cc");
+	}
+
+	if(!wait)
+		return 0;
+
+	for(i = 0; i < lapic_count; i++)
+	{
+		if(i == self || !cpumask_test(mask, i) || !cpus[i])
+			continue;
+
+		while(source->call_nodes[i].busy)
+			asm volatile ("pause");
+	}
+
+	return 0;
+}
+
+// smp_call_function_single(): Runs a function on one CPU
+// Param:	size_t target - CPU index
+// Param:	void (*function)(void *) - function to call
+// Param:	void *argument - argument to pass
+// Param:	int wait - wait for the CPU to finish the call
+// Return:	int - 0 on success
+
+int smp_call_function_single(size_t target, void (*function)(void *), void *argument, int wait)
+{
+	cpumask_t mask;
+	size_t i;
+	for(i = 0; i < CPUMASK_WORDS; i++)
+		mask.bits[i] = 0;
+
+	cpumask_set(&mask, target);
+	return smp_call_function(&mask, function, argument, wait);
+}
+
+// smp_call_irq(): Cross-CPU function call IPI handler
+// Param:	Nothing
+// Return:	Nothing
+
+void smp_call_irq()
+{
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	cpu_t *self = cpus[cpu->index];
+
+	lapic_eoi();
+
+	// take the whole queue at once; anything pushed after this sends a new IPI
+	smp_call_t *list = atomic_xchg(&self->call_queue, NULL);
+
+	// the queue is a stack, so reverse it to run the calls in order
+	smp_call_t *ordered = NULL;
+	smp_call_t *next;
+	while(list)
+	{
+		next = list->next;
+		list->next = ordered;
+		ordered = list;
+		list = next;
+	}
+
+	void (*function)(void *);
+	void *argument;
+
+	while(ordered)
+	{
+		next = ordered->next;
+		function = ordered->function;
+		argument = ordered->argument;
+
+		function(argument);
+
+		// the caller may reuse this call as soon as we clear it
+		ordered->busy = 0;
+		ordered = next;
+	}
+}
+
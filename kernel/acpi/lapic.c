@@ -9,8 +9,11 @@
 #include <mm.h>
 #include <kprintf.h>
 #include <cpu.h>
+#include <timer.h>
 
 void *lapic_base;
+uint8_t lapic_x2apic = 0;
+uint32_t lapic_timer_frequency = 0;
 
 // lapic_read(): Reads a local APIC register
 // Param:	size_t index - index of register
@@ -18,6 +21,9 @@ void *lapic_base;
 
 uint32_t lapic_read(size_t index)
 {
+	if(lapic_x2apic)
+		return (uint32_t)read_msr(X2APIC_MSR_BASE + (index >> 4));
+
 	volatile uint32_t *ptr = (uint32_t*)(lapic_base + index);
 	return ptr[0];
 }
@@ -29,30 +35,135 @@ uint32_t lapic_read(size_t index)
 
 void lapic_write(size_t index, uint32_t value)
 {
+	if(lapic_x2apic)
+	{
+		write_msr(X2APIC_MSR_BASE + (index >> 4), value);
+		return;
+	}
+
 	volatile uint32_t *ptr = (uint32_t*)(lapic_base + index);
 	ptr[0] = value;
 }
 
+// lapic_detect_x2apic(): Decides whether to use x2APIC mode
+// Param:	Nothing
+// Return:	Nothing
+
+void lapic_detect_x2apic()
+{
+	cpuid_t cpuid;
+	read_cpuid(1, 0, &cpuid);
+
+	if(cpuid.ecx & CPUID_ECX_X2APIC)
+	{
+		kprintf("lapic: using x2APIC mode.\n");
+		lapic_x2apic = 1;
+	} else
+	{
+		kprintf("lapic: x2APIC not supported, using xAPIC mode.\n");
+		lapic_x2apic = 0;
+	}
+}
+
+// lapic_enable(): Enables the local APIC of the current CPU in the chosen mode
+// This has to run on every CPU, before anything else touches its local APIC
+// Param:	Nothing
+// Return:	Nothing
+
+void lapic_enable()
+{
+	uint64_t apic_base = read_msr(MSR_APIC_BASE);
+	apic_base |= LAPIC_BASE_ENABLE;
+
+	if(lapic_x2apic)
+		apic_base |= LAPIC_BASE_X2APIC;
+
+	write_msr(MSR_APIC_BASE, apic_base);
+}
+
 // lapic_get_id(): Returns APIC ID of current CPU
 // Param:	Nothing
-// Return:	uint8_t - local APIC ID
+// Return:	uint32_t - local APIC ID
 
-uint8_t lapic_get_id()
+uint32_t lapic_get_id()
 {
 	cpu_t FS_BASE *cpu = (cpu_t FS_BASE *)0;
 	return lapics[cpu->index].apic_id;
 }
 
+// lapic_read_id(): Reads APIC ID of current CPU from the hardware
+// Unlike lapic_get_id(), this works before the CPU has been registered
+// Param:	Nothing
+// Return:	uint32_t - local APIC ID
+
+uint32_t lapic_read_id()
+{
+	if(lapic_x2apic)
+		return lapic_read(LAPIC_ID);	// full 32-bit ID
+
+	return lapic_read(LAPIC_ID) >> 24;
+}
+
+// lapic_send_ipi(): Sends an inter-processor interrupt
+// Param:	uint32_t apic_id - destination APIC ID
+// Param:	uint32_t command - low half of the ICR, vector and delivery mode
+// Return:	Nothing
+
+void lapic_send_ipi(uint32_t apic_id, uint32_t command)
+{
+	// x2APIC does it in one write, and there's no delivery status to wait on
+	if(lapic_x2apic)
+	{
+		write_msr(X2APIC_MSR_ICR, ((uint64_t)apic_id << 32) | command);
+		return;
+	}
+
+	lapic_write(LAPIC_COMMAND_ID, (apic_id & 0xFF) << 24);
+	lapic_write(LAPIC_COMMAND, command);
+
+	// wait for the local APIC to accept it
+	while(lapic_read(LAPIC_COMMAND) & LAPIC_ICR_PENDING)
+		asm volatile ("pause");
+}
+
+// lapic_send_ipi_logical(): Sends an IPI to a logical destination
+// In x2APIC cluster mode, one IPI reaches up to 16 CPUs of the same cluster
+// Param:	uint32_t logical_id - logical destination, as in lapic_t
+// Param:	uint32_t command - low half of the ICR, vector and delivery mode
+// Return:	Nothing
+
+void lapic_send_ipi_logical(uint32_t logical_id, uint32_t command)
+{
+	lapic_send_ipi(logical_id, command | LAPIC_ICR_LOGICAL);
+}
+
 // lapic_init(): Initializes the local APIC
 // Param:	Nothing
 // Return:	Nothing
 
 void lapic_init()
 {
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE *)0;
+
 	lapic_write(LAPIC_TASK_PRIORITY, 0);
 	lapic_write(LAPIC_SPURIOUS_IRQ, 0x1FF);		// enable spurious IRQ at INT 0xFF
-	lapic_write(LAPIC_DFR, 0xFFFFFFFF);		// destination format = flat
-	lapic_write(LAPIC_LDR, (uint32_t)LAPIC_CLUSTER_ID << 24);
+
+	if(lapic_x2apic)
+	{
+		// x2APIC is always in cluster mode, and the LDR is read-only
+		// it's derived from the APIC ID: cluster in bits 16-31, and
+		// one bit for the CPU in bits 0-15
+		lapics[cpu->index].logical_id = lapic_read(LAPIC_LDR);
+	} else
+	{
+		lapic_write(LAPIC_DFR, 0xFFFFFFFF);		// destination format = flat
+		lapic_write(LAPIC_LDR, (uint32_t)LAPIC_CLUSTER_ID << 24);
+		lapics[cpu->index].logical_id = LAPIC_CLUSTER_ID;
+	}
+
+	// the timer stays masked until something wants to be woken up
+	lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_LVT_MASK);
 
 	// send some EOIs, just in case...
 	lapic_write(LAPIC_EOI, 0);
@@ -84,7 +195,54 @@ void lapic_spurious()
 	kprintf("lapic: spurious IRQ on CPU index %d, total count %d\n", cpu->index, cpu->spurious_count);
 }
 
+// lapic_timer_calibrate(): Measures the local APIC timer against the TSC
+// Every CPU's timer runs off the same bus clock, so this is only done once
+// Param:	Nothing
+// Return:	Nothing
 
+void lapic_timer_calibrate()
+{
+	// it counts down even while it's masked
+	lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_LVT_MASK);
+	lapic_write(LAPIC_TIMER_INIT_COUNT, 0xFFFFFFFF);
 
+	udelay(LAPIC_TIMER_CALIBRATE * 1000);
+
+	uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURR_COUNT);
+	lapic_write(LAPIC_TIMER_INIT_COUNT, 0);
+
+	lapic_timer_frequency = elapsed / LAPIC_TIMER_CALIBRATE;
+	kprintf("lapic: timer frequency is %d kHz\n", lapic_timer_frequency);
+}
 
+// lapic_timer_oneshot(): Interrupts the current CPU once after a while
+// Anything set before is replaced
+// Param:	uint32_t ms - milliseconds from now
+// Return:	Nothing
+
+void lapic_timer_oneshot(uint32_t ms)
+{
+	if(!lapic_timer_frequency)
+		return;
+
+	uint64_t count = (uint64_t)ms * lapic_timer_frequency;
+	if(count > 0xFFFFFFFF)
+		count = 0xFFFFFFFF;
+
+	if(!count)
+		count = 1;
+
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+	lapic_write(LAPIC_TIMER_INIT_COUNT, (uint32_t)count);
+}
+
+// lapic_timer_irq(): Local APIC timer handler, which only wakes the CPU up
+// Param:	Nothing
+// Return:	Nothing
+
+void lapic_timer_irq()
+{
+	lapic_eoi();
+}
 
@@ -12,12 +12,30 @@
 #include <cpu.h>
 #include <gdt.h>
 #include <idt.h>
-
-int smp_boot_ap(size_t);
-void smp_wait();
-
-size_t current_ap;		// this will tell the APs which index they are
-uint8_t ap_flag;		// this will tell the BSP if the AP started up
+#include <lock.h>
+#include <timer.h>
+#include <tasking.h>
+#include <numa.h>
+#include <syscall.h>
+#include <vdso.h>
+#include <ioring.h>
+#include <pcache.h>
+#include <blkdev.h>
+
+#define AP_BOOT_STACK_SIZE	16384
+#define AP_INIT_DELAY		10000		// microseconds
+#define AP_SIPI_DELAY		200		// microseconds
+#define AP_BOOT_TIMEOUT		200000		// microseconds
+
+size_t bsp_index = 0;
+
+void smp_boot_aps(size_t);
+size_t smp_find_index(uint32_t);
+
+size_t ap_boot_ticket;		// each AP takes a ticket in the trampoline
+void **ap_boot_stacks;		// and uses it to find its own boot stack
+size_t ap_started_count;	// this will tell the BSP how many APs started up
+lock_t smp_mutex = 0;
 
 // smp_init(): Initializes application processors
 // Param:	Nothing
@@ -28,9 +46,18 @@ void smp_init()
 	kprintf("smp: total of %d usable CPUs present.\n", lapic_count);
 
 	idt_install(0xFF, (size_t)&lapic_spurious_stub);
+	idt_install(LAPIC_TIMER_VECTOR, (size_t)&lapic_timer_stub);
+	smp_call_init();
+	lapic_timer_calibrate();
 
 	// register the bsp
-	smp_register_cpu(0);
+	size_t bsp = smp_find_index(lapic_read_id());
+	if(bsp >= lapic_count)
+		bsp = 0;
+
+	bsp_index = bsp;
+	lapics[bsp].started = 1;
+	smp_register_cpu(bsp);
 
 	if(lapic_count <= 1)
 	{
@@ -41,9 +68,7 @@ void smp_init()
 	// copy the trampoline code into low memory
 	memcpy((void*)0x1000, trampoline16, trampoline16_size[0]);
 
-	size_t i = 0;
-	for(i = 0; i < lapic_count; i++)
-		smp_boot_ap(i);
+	smp_boot_aps(bsp);
 
 	// all AP local APICs are initialized to logical APIC mode & spurious IRQs
 	// we couldn't do the same for the BSP because we're using it to start
@@ -52,59 +77,80 @@ void smp_init()
 	lapic_init();
 }
 
-// smp_wait(): Waits for IPIs to be sent
-// Param:	Nothing
-// Return:	Nothing
+// smp_find_index(): Finds the CPU index of a local APIC
+// Param:	uint32_t apic_id - local APIC ID
+// Return:	size_t - CPU index, lapic_count if not present
 
-void smp_wait()
+size_t smp_find_index(uint32_t apic_id)
 {
-	int i = 0;
-	while(i < 0xFFFF)
+	size_t i;
+	for(i = 0; i < lapic_count; i++)
 	{
-		write_cr0(read_cr0());
-		i++;
+		if(lapics[i].apic_id == apic_id)
+			return i;
 	}
+
+	return lapic_count;
 }
 
-// smp_boot_ap(): Starts an application processor
-// Param:	size_t ap - processor index
-// Return:	int - 0 on success
+// smp_boot_aps(): Starts all application processors at once
+// Param:	size_t bsp - CPU index of the BSP, which is skipped
+// Return:	Nothing
 
-int smp_boot_ap(size_t ap)
+void smp_boot_aps(size_t bsp)
 {
-	if(lapics[ap].apic_id == 0)	// BSP?
-		return 0;		// skip -- the BSP is obviously running already
+	size_t ap_count = lapic_count - 1;
+	size_t i;
 
-	current_ap = ap;
-	uint8_t apic_id = lapics[ap].apic_id;
-	//kprintf("smp: attempting to start up CPU index %d APIC ID 0x%xb\n", ap, apic_id);
+	// every AP needs its own stack to run the trampoline, because they all
+	// run it at the same time
+	ap_boot_stacks = kcalloc(sizeof(void*), ap_count);
+	for(i = 0; i < ap_count; i++)
+		ap_boot_stacks[i] = kmalloc(AP_BOOT_STACK_SIZE) + AP_BOOT_STACK_SIZE;
 
-	ap_flag = 0;
+	ap_boot_ticket = 0;
+	ap_started_count = 0;
 
-	// send the AP an INIT IPI
-	lapic_write(LAPIC_COMMAND_ID, (uint32_t)(apic_id & 0xF) << 24);
-	lapic_write(LAPIC_COMMAND, 0x4500);
-	smp_wait();
+	// send all the APs an INIT IPI, and then wait once for all of them
+	for(i = 0; i < lapic_count; i++)
+	{
+		if(i != bsp)
+			lapic_send_ipi(lapics[i].apic_id, LAPIC_ICR_ASSERT | LAPIC_ICR_INIT);
+	}
 
-	// send a startup IPI
-	lapic_write(LAPIC_COMMAND_ID, (uint32_t)(apic_id & 0xF) << 24);
-	lapic_write(LAPIC_COMMAND, 0x4601);
-	smp_wait();
+	udelay(AP_INIT_DELAY);
 
-	size_t i = 0;
-	while(i < 0xFF)
+	// two startup IPIs, like the MP spec says
+	// an AP that already started will just ignore the second one
+	for(i = 0; i < lapic_count; i++)
 	{
-		smp_wait();
-		if(ap_flag == 1)
-			return 0;
-		else
-			i++;
+		if(i != bsp)
+			lapic_send_ipi(lapics[i].apic_id, LAPIC_ICR_ASSERT | LAPIC_ICR_STARTUP | 0x01);
+	}
+
+	udelay(AP_SIPI_DELAY);
+
+	for(i = 0; i < lapic_count; i++)
+	{
+		if(i != bsp && lapics[i].started == 0)
+			lapic_send_ipi(lapics[i].apic_id, LAPIC_ICR_ASSERT | LAPIC_ICR_STARTUP | 0x01);
+	}
 
-		continue;
+	// now wait for them to check in
+	uint64_t timeout = 0;
+	while(ap_started_count < ap_count && timeout < AP_BOOT_TIMEOUT)
+	{
+		udelay(100);
+		timeout += 100;
 	}
 
-	kprintf("smp: CPU index %d didn't respond to SIPI.\n", ap);
-	return 1;
+	for(i = 0; i < lapic_count; i++)
+	{
+		if(lapics[i].started == 0)
+			kprintf("smp: CPU index %d APIC ID 0x%xd didn't respond to SIPI.\n", i, lapics[i].apic_id);
+	}
+
+	kprintf("smp: started %d of %d application processors.\n", ap_started_count, ap_count);
 }
 
 // smp_kmain(): Kernel entry point for application processors
@@ -113,15 +159,42 @@ int smp_boot_ap(size_t ap)
 
 void smp_kmain()
 {
-	kprintf("smp: CPU index %d started up.\n", current_ap);
-	smp_register_cpu(current_ap);
+	lapic_enable();
 
+	uint32_t apic_id = lapic_read_id();
+	size_t index = smp_find_index(apic_id);
+	if(index >= lapic_count)
+	{
+		// not in the MADT? shouldn't happen, but don't touch anything
+		while(1)
+			asm volatile ("cli\nhlt");
+	}
+
+	smp_register_cpu(index);
 	lapic_init();
 
-	ap_flag = 1;
+	kprintf("smp: CPU index %d APIC ID 0x%xd started up.\n", index, apic_id);
+
+	acquire_lock(&smp_mutex);
+	lapics[index].started = 1;
+	ap_started_count++;
+	release_lock(&smp_mutex);
 
 	while(1)
-		asm volatile ("sti\nhlt");
+	{
+		// an AP can stand in for a kernel thread polling I/O rings,
+		// completing block I/O or flushing dirty pages, and only halts
+		// once they've been idle for a while; dirty pages that aren't
+		// due yet leave one CPU with a timer set for when they are
+		if(ioring_poll(index) || blkdev_poll(index) || pcache_flush_poll(index))
+			continue;
+
+		asm volatile ("cli");
+		if(ioring_sleep(index) && blkdev_sleep(index) && pcache_sleep(index))
+			asm volatile ("sti\nhlt");
+		else
+			asm volatile ("sti");
+	}
 }
 
 // smp_register_cpu(): Registers a CPU that has started up
@@ -134,6 +207,12 @@ void smp_register_cpu(size_t index)
 	cpu_t *cpu = kmalloc(sizeof(cpu_t));
 	cpu->index = index;
 	cpu->stack = kmalloc(STACK_SIZE) + STACK_SIZE;
+	cpu->call_queue = NULL;
+	cpu->plug = NULL;
+	cpu->blkdev_irq = 0;
+	cpu->call_nodes = kcalloc(sizeof(smp_call_t), lapic_count);
+	topology_detect(cpu);
+	cpu->numa_node = numa_cpu_node(lapics[index].apic_id);
 
 #if __i386__
 	gdt_set_entry(GDT_CPU_INFO + index, (uint32_t)cpu, GDT_ACCESS_PRESENT | GDT_ACCESS_RW, GDT_FLAGS_PMODE);
@@ -145,7 +224,11 @@ void smp_register_cpu(size_t index)
 #if __x86_64__
 	write_msr(MSR_FS_BASE, (uint64_t)cpu);
 #endif
-}
 
+	syscall_init(cpu);
+	vdso_cpu_init(cpu);
 
+	// other CPUs can send us calls from now on
+	cpus[index] = cpu;
+}
 
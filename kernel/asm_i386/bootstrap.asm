@@ -190,14 +190,15 @@ use32
 	and eax, not 0x60000000
 	mov cr0, eax
 
-	; allocate temporary stack
-	extrn kmalloc
-	push 8192
-	mov eax, kmalloc
-	call eax
-
-	mov esp, eax
-	add esp, 8192
+	; all APs run this at the same time, so each takes a ticket and uses
+	; it to find its own boot stack -- until here, they only shared the
+	; temporary stack for pushing the same EFLAGS value
+	extrn ap_boot_ticket
+	extrn ap_boot_stacks
+	mov eax, 1
+	lock xadd [ap_boot_ticket], eax
+	mov ebx, [ap_boot_stacks]
+	mov esp, [ebx+eax*4]
 
 	extrn smp_kmain
 	jmp 0x08:smp_kmain
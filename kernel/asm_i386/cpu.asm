@@ -120,6 +120,44 @@ load_fs:
 	mov fs, ax
 	ret
 
+; void write_msr(uint32_t, uint64_t)
+public write_msr
+write_msr:
+	mov ecx, [esp+4]
+	mov eax, [esp+8]
+	mov edx, [esp+12]
+	wrmsr
+
+	ret
+
+; uint64_t read_msr(uint32_t)
+public read_msr
+read_msr:
+	mov ecx, [esp+4]
+	rdmsr
+
+	ret
+
+; void read_cpuid(uint32_t leaf, uint32_t subleaf, cpuid_t *registers)
+public read_cpuid
+read_cpuid:
+	push ebx
+	push esi
+
+	mov eax, [esp+12]
+	mov ecx, [esp+16]
+	mov esi, [esp+20]
+	cpuid
+
+	mov [esi], eax
+	mov [esi+4], ebx
+	mov [esi+8], ecx
+	mov [esi+12], edx
+
+	pop esi
+	pop ebx
+	ret
+
 ; For exceptions
 extrn exception_handler
 
@@ -246,6 +284,21 @@ gpf_handler:
 
 public page_handler
 page_handler:
+	; demand paging first, and only then is it a real exception
+	pusha
+	push dword[esp+32]
+	extrn vmm_page_fault
+	call vmm_page_fault
+	add esp, 4
+
+	test eax, eax
+	popa
+	jz .exception
+
+	add esp, 4		; error code
+	iret
+
+.exception:
 	push page_text
 	mov ebp, esp
 	call exception_handler
@@ -58,6 +58,36 @@ timer_irq_stub:
 	irq_exit
 	iret
 
+public smp_call_stub
+smp_call_stub:
+	irq_enter
+
+	extrn smp_call_irq
+	call smp_call_irq
+
+	irq_exit
+	iret
+
+public blkdev_irq_stub
+blkdev_irq_stub:
+	irq_enter
+
+	extrn blkdev_irq
+	call blkdev_irq
+
+	irq_exit
+	iret
+
+public lapic_timer_stub
+lapic_timer_stub:
+	irq_enter
+
+	extrn lapic_timer_irq
+	call lapic_timer_irq
+
+	irq_exit
+	iret
+
 
 
 
@@ -0,0 +1,140 @@
+
+;; lux OS kernel
+;; copyright (c) 2018 by Omar Mohammad
+
+format elf
+use32
+
+section '.text'
+
+; keep in sync with syscall.h
+SYSCALL_COUNT			= 36
+SYSCALL_BENCH_EXIT		= 0xFFFF
+ENOSYS				= -16
+
+extrn syscall_table
+
+; syscall_entry
+; SYSENTER comes here with IRQs disabled, on the stack from MSR_SYSENTER_ESP
+; In:	EAX = function
+; In:	EBX, ESI, EDI, EBP = arguments 1 to 4
+; In:	ECX = user ESP, arguments 5 and 6 are at [ECX] and [ECX+4]
+; In:	EDX = user EIP to return to
+; Out:	EAX = return value
+; ECX and EDX are lost, everything else is preserved, and the C function
+; preserves EBX, ESI, EDI and EBP for us
+
+public syscall_entry
+syscall_entry:
+	push ecx
+	push edx
+	push fs
+	mov fs, [esp+24]	; this CPU's FS selector, stored above the stack
+
+	sti
+
+	cmp eax, SYSCALL_COUNT
+	jae .invalid
+
+	push dword[ecx+4]
+	push dword[ecx]
+	push ebp
+	push edi
+	push esi
+	push ebx
+	call dword[syscall_table+eax*4]
+	add esp, 24
+
+.return:
+	cli
+
+	pop fs
+	pop edx
+	pop ecx
+	sysexit
+
+.invalid:
+	cmp eax, SYSCALL_BENCH_EXIT
+	jne .nosys
+
+	cmp dword[syscall_bench_stack], 0
+	je .nosys
+
+	; the benchmark is done, go back to syscall_bench_enter's caller
+	cli
+	mov eax, ebx
+	mov esp, [syscall_bench_stack]
+	mov dword[syscall_bench_stack], 0
+
+	pop edi
+	pop esi
+	pop ebx
+	pop ebp
+	popfd
+	ret
+
+.nosys:
+	mov eax, ENOSYS
+	jmp .return
+
+; size_t syscall_bench_enter(size_t code, size_t stack, size_t iterations)
+; Runs the benchmark code in user mode with IRQs disabled
+; Returns cycles taken by all the iterations
+
+public syscall_bench_enter
+syscall_bench_enter:
+	pushfd
+	push ebp
+	push ebx
+	push esi
+	push edi
+
+	cli
+	mov edx, [esp+24]
+	mov ecx, [esp+28]
+	mov ebx, [esp+32]
+	mov [syscall_bench_stack], esp
+	sysexit
+
+; the benchmark's user mode code, copied to a user page
+; In:	EBX = iterations
+
+public syscall_bench_code
+syscall_bench_code:
+	call .here
+
+.here:
+	pop ebp			; SYSENTER needs a return address, and this code
+	add ebp, .back - .here	; doesn't know where it's been copied to
+
+	rdtsc
+	mov edi, eax
+
+.loop:
+	xor eax, eax		; SYS_NULL
+	mov ecx, esp
+	mov edx, ebp
+	sysenter
+
+.back:
+	dec ebx
+	jnz .loop
+
+	rdtsc
+	sub eax, edi
+
+	mov ebx, eax
+	mov eax, SYSCALL_BENCH_EXIT
+	mov ecx, esp
+	mov edx, ebp
+	sysenter
+
+end_syscall_bench_code:
+
+public syscall_bench_size
+syscall_bench_size:		dw end_syscall_bench_code - syscall_bench_code
+
+align 4
+syscall_bench_stack:		dd 0
+
+
@@ -0,0 +1,213 @@
+
+;; lux OS kernel
+;; copyright (c) 2018 by Omar Mohammad
+
+format elf
+use32
+
+section '.text'
+
+; vDSO code page, copied to VDSO_CODE and run in user mode
+; It only uses absolute addresses of the data page, so it can run anywhere.
+; Keep everything in here in sync with vdso.h, syscall.h and time.h
+
+VDSO_DATA			= 0xD7FFA000
+
+VDSO_SEQUENCE			= 0
+VDSO_FLAGS			= 4
+VDSO_TSC_BASE			= 8
+VDSO_NS_BASE			= 16
+VDSO_WALL_BASE			= 24
+VDSO_WALL_SECONDS		= 32
+VDSO_TSC_MULT			= 40
+VDSO_TSC_SHIFT			= 44
+VDSO_CPUS			= 64
+
+VDSO_CPU_SEQUENCE		= 0
+VDSO_CPU_PID			= 4
+VDSO_CPU_SHIFT			= 4		; 16 bytes per CPU
+
+VDSO_FLAGS_RDTSCP		= 1
+
+CLOCK_REALTIME			= 0
+CLOCK_MONOTONIC			= 1
+EINVAL				= -11
+SYS_GETPID			= 16
+
+public vdso_code
+vdso_code:
+	; entry points, 8 bytes apart
+	jmp near vdso_clock_gettime
+	db 3 dup (0xCC)
+	jmp near vdso_time
+	db 3 dup (0xCC)
+	jmp near vdso_getpid
+	db 3 dup (0xCC)
+
+; int clock_gettime(int clock, struct timespec *time)
+vdso_clock_gettime:
+	cmp dword[esp+4], CLOCK_MONOTONIC
+	ja .invalid
+
+	push ebx
+	push esi
+	push edi
+	push ebp
+
+	mov ebp, VDSO_DATA
+
+.retry:
+	mov edi, [ebp+VDSO_SEQUENCE]
+	test edi, 1
+	jnz .busy
+
+	lfence
+	rdtsc
+	sub eax, [ebp+VDSO_TSC_BASE]
+	sbb edx, [ebp+VDSO_TSC_BASE+4]
+
+	; 64x32 multiply into EBX:EDX:EAX
+	mov ecx, eax
+	mov eax, edx
+	mul dword[ebp+VDSO_TSC_MULT]
+	mov esi, eax
+	mov ebx, edx
+
+	mov eax, ecx
+	mul dword[ebp+VDSO_TSC_MULT]
+	add edx, esi
+	adc ebx, 0
+
+	mov ecx, [ebp+VDSO_TSC_SHIFT]
+	shrd eax, edx, cl
+	shrd edx, ebx, cl
+
+	add eax, [ebp+VDSO_NS_BASE]
+	adc edx, [ebp+VDSO_NS_BASE+4]
+
+	cmp edi, [ebp+VDSO_SEQUENCE]
+	jne .retry
+
+	; EDX:EAX = nanoseconds since boot, which fits in 32-bit seconds
+	mov ecx, 1000000000
+	div ecx
+
+	xor ebx, ebx
+	cmp dword[esp+20], CLOCK_REALTIME
+	jne .store
+
+	; this never changes, so it doesn't need the sequence check
+	add eax, [ebp+VDSO_WALL_BASE]
+	adc ebx, [ebp+VDSO_WALL_BASE+4]
+
+.store:
+	mov esi, [esp+24]
+	mov [esi], eax
+	mov [esi+4], ebx
+	mov [esi+8], edx
+
+	pop ebp
+	pop edi
+	pop esi
+	pop ebx
+	xor eax, eax
+	ret
+
+.busy:
+	pause
+	jmp .retry
+
+.invalid:
+	mov eax, EINVAL
+	ret
+
+; time_t time(time_t *time)
+vdso_time:
+	push ebx
+	mov ecx, VDSO_DATA
+
+.retry:
+	mov ebx, [ecx+VDSO_SEQUENCE]
+	test ebx, 1
+	jnz .busy
+
+	mov eax, [ecx+VDSO_WALL_SECONDS]
+	mov edx, [ecx+VDSO_WALL_SECONDS+4]
+
+	cmp ebx, [ecx+VDSO_SEQUENCE]
+	jne .retry
+
+	mov ecx, [esp+8]
+	test ecx, ecx
+	jz .done
+
+	mov [ecx], eax
+	mov [ecx+4], edx
+
+.done:
+	pop ebx
+	ret
+
+.busy:
+	pause
+	jmp .retry
+
+; pid_t getpid()
+vdso_getpid:
+	push ebx
+	push esi
+	push edi
+	push ebp
+
+	mov esi, VDSO_DATA
+	test dword[esi+VDSO_FLAGS], VDSO_FLAGS_RDTSCP
+	jz .syscall
+
+.retry:
+	; find our CPU's slot, read it, and make sure we're still on that CPU
+	rdtscp
+	mov edi, ecx
+	shl edi, VDSO_CPU_SHIFT
+	add edi, esi
+
+	mov ebx, [edi+VDSO_CPUS+VDSO_CPU_SEQUENCE]
+	test ebx, 1
+	jnz .retry
+
+	mov ebp, [edi+VDSO_CPUS+VDSO_CPU_PID]
+
+	rdtscp
+	shl ecx, VDSO_CPU_SHIFT
+	add ecx, esi
+	cmp ecx, edi
+	jne .retry
+
+	cmp ebx, [edi+VDSO_CPUS+VDSO_CPU_SEQUENCE]
+	jne .retry
+
+	mov eax, ebp
+	jmp .done
+
+.syscall:
+	call .here
+
+.here:
+	pop edx
+	add edx, .done - .here
+	mov ecx, esp
+	mov eax, SYS_GETPID
+	sysenter
+
+.done:
+	pop ebp
+	pop edi
+	pop esi
+	pop ebx
+	ret
+
+end_vdso_code:
+
+public vdso_code_size
+vdso_code_size:			dw end_vdso_code - vdso_code
+
+
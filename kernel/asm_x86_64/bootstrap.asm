@@ -102,7 +102,17 @@ trampoline64:
 	mov es, ax
 	mov fs, ax
 	mov gs, ax
-	mov rsp, ap_stack_top
+
+	; all APs run this at the same time, so each takes a ticket
+	; and uses it to find its own boot stack
+	extrn ap_boot_ticket
+	extrn ap_boot_stacks
+	mov rbx, ap_boot_ticket
+	mov rax, 1
+	lock xadd [rbx], rax
+	mov rbx, ap_boot_stacks
+	mov rbx, [rbx]
+	mov rsp, [rbx+rax*8]
 
 	mov rdx, gdtr
 	lgdt [rdx]
@@ -119,7 +129,6 @@ times 512 - ($-trampoline16) db 0
 	mov es, ax
 	mov fs, ax
 	mov gs, ax
-	mov rsp, ap_stack_top
 
 	mov rdx, idtr
 	lidt [rdx]
@@ -130,14 +139,6 @@ times 512 - ($-trampoline16) db 0
 	finit
 	fwait
 
-	extrn kmalloc
-	mov rdi, 16384		; temporary stack
-	mov rax, kmalloc
-	call rax
-
-	mov rsp, rax
-	add rsp, 16384
-
 	extrn smp_kmain
 	mov rax, smp_kmain
 	jmp rax
@@ -260,9 +261,5 @@ align 16
 stack_bottom:			times 65536*2 db 0
 stack_top:
 
-align 16
-ap_stack_bottom:		times 16384 db 0
-ap_stack_top:
-
 
 
@@ -138,6 +138,24 @@ read_msr:
 
 	ret
 
+; void read_cpuid(uint32_t leaf, uint32_t subleaf, cpuid_t *registers)
+public read_cpuid
+read_cpuid:
+	push rbx
+
+	mov r8, rdx
+	mov eax, edi
+	mov ecx, esi
+	cpuid
+
+	mov [r8], eax
+	mov [r8+4], ebx
+	mov [r8+8], ecx
+	mov [r8+12], edx
+
+	pop rbx
+	ret
+
 ; For exceptions
 extrn exception_handler
 
@@ -255,6 +273,39 @@ gpf_handler:
 
 public page_handler
 page_handler:
+	; demand paging first, and only then is it a real exception
+	push rax
+	push rcx
+	push rdx
+	push rsi
+	push rdi
+	push r8
+	push r9
+	push r10
+	push r11
+	sub rsp, 8
+
+	mov rdi, [rsp+80]
+	extrn vmm_page_fault
+	call vmm_page_fault
+
+	add rsp, 8
+	test eax, eax
+	pop r11
+	pop r10
+	pop r9
+	pop r8
+	pop rdi
+	pop rsi
+	pop rdx
+	pop rcx
+	pop rax
+	jz .exception
+
+	add rsp, 8		; error code
+	iretq
+
+.exception:
 	pop rsi
 	mov rdi, page_text
 	call exception_handler
@@ -0,0 +1,156 @@
+
+;; lux OS kernel
+;; copyright (c) 2018 by Omar Mohammad
+
+format elf64
+use64
+
+section '.text'
+
+; cpu_t fields, keep in sync with cpu.h
+CPU_STACK			= 8
+CPU_USER_STACK			= 16
+
+; keep in sync with syscall.h
+SYSCALL_COUNT			= 36
+SYSCALL_BENCH_EXIT		= 0xFFFF
+ENOSYS				= -16
+
+extrn syscall_table
+
+; syscall_entry
+; SYSCALL comes here with IRQs disabled, RCX = user RIP, R11 = user RFLAGS
+; In:	RAX = function
+; In:	RDI, RSI, RDX, R10, R8, R9 = arguments, like the SysV ABI except R10
+;	takes the place of RCX, which SYSCALL overwrites
+; Out:	RAX = return value
+; RCX and R11 are lost, everything else is preserved. The callee-saved
+; registers are left for the C function to save only if it uses them.
+
+public syscall_entry
+syscall_entry:
+	swapgs
+	mov [gs:CPU_USER_STACK], rsp
+	mov rsp, [gs:CPU_STACK]
+
+	push qword[gs:CPU_USER_STACK]
+	push rcx
+	push r11
+	push rdi
+	push rsi
+	push rdx
+	push r8
+	push r9
+	push r10
+	sub rsp, 8		; align the stack for the C function
+
+	sti
+
+	cmp rax, SYSCALL_COUNT
+	jae .invalid
+
+	mov rcx, r10
+	mov r11, syscall_table
+	call qword[r11+rax*8]
+
+.return:
+	cli
+
+	add rsp, 8
+	pop r10
+	pop r9
+	pop r8
+	pop rdx
+	pop rsi
+	pop rdi
+	pop r11
+	pop rcx
+	pop rsp
+
+	swapgs
+	sysretq
+
+.invalid:
+	cmp rax, SYSCALL_BENCH_EXIT
+	jne .nosys
+
+	cmp qword[syscall_bench_stack], 0
+	je .nosys
+
+	; the benchmark is done, go back to syscall_bench_enter's caller
+	cli
+	mov rax, rdi
+	mov rsp, [syscall_bench_stack]
+	mov qword[syscall_bench_stack], 0
+	swapgs
+
+	pop r15
+	pop r14
+	pop r13
+	pop r12
+	pop rbx
+	pop rbp
+	popfq
+	ret
+
+.nosys:
+	mov rax, ENOSYS
+	jmp .return
+
+; size_t syscall_bench_enter(size_t code, size_t stack, size_t iterations)
+; Runs the benchmark code in user mode with IRQs disabled
+; Returns cycles taken by all the iterations
+
+public syscall_bench_enter
+syscall_bench_enter:
+	pushfq
+	push rbp
+	push rbx
+	push r12
+	push r13
+	push r14
+	push r15
+
+	cli
+	mov [syscall_bench_stack], rsp
+
+	mov rcx, rdi
+	mov rsp, rsi
+	mov rbx, rdx
+	mov r11, 0x02		; IRQs stay disabled in user mode
+	sysretq
+
+; the benchmark's user mode code, copied to a user page
+; In:	RBX = iterations
+
+public syscall_bench_code
+syscall_bench_code:
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	mov r12, rax
+
+.loop:
+	xor eax, eax		; SYS_NULL
+	syscall
+	dec rbx
+	jnz .loop
+
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	sub rax, r12
+
+	mov rdi, rax
+	mov eax, SYSCALL_BENCH_EXIT
+	syscall
+
+end_syscall_bench_code:
+
+public syscall_bench_size
+syscall_bench_size:		dw end_syscall_bench_code - syscall_bench_code
+
+align 8
+syscall_bench_stack:		dq 0
+
+
@@ -0,0 +1,167 @@
+
+;; lux OS kernel
+;; copyright (c) 2018 by Omar Mohammad
+
+format elf64
+use64
+
+section '.text'
+
+; vDSO code page, copied to VDSO_CODE and run in user mode
+; It only uses absolute addresses of the data page, so it can run anywhere.
+; Keep everything in here in sync with vdso.h, syscall.h and time.h
+
+VDSO_DATA			= 0x807FFFA000
+
+VDSO_SEQUENCE			= 0
+VDSO_FLAGS			= 4
+VDSO_TSC_BASE			= 8
+VDSO_NS_BASE			= 16
+VDSO_WALL_BASE			= 24
+VDSO_WALL_SECONDS		= 32
+VDSO_TSC_MULT			= 40
+VDSO_TSC_SHIFT			= 44
+VDSO_CPUS			= 64
+
+VDSO_CPU_SEQUENCE		= 0
+VDSO_CPU_PID			= 4
+VDSO_CPU_SHIFT			= 4		; 16 bytes per CPU
+
+VDSO_FLAGS_RDTSCP		= 1
+
+CLOCK_REALTIME			= 0
+CLOCK_MONOTONIC			= 1
+EINVAL				= -11
+SYS_GETPID			= 16
+
+public vdso_code
+vdso_code:
+	; entry points, 8 bytes apart
+	jmp near vdso_clock_gettime
+	db 3 dup (0xCC)
+	jmp near vdso_time
+	db 3 dup (0xCC)
+	jmp near vdso_getpid
+	db 3 dup (0xCC)
+
+; int clock_gettime(int clock, struct timespec *time)
+vdso_clock_gettime:
+	cmp edi, CLOCK_MONOTONIC
+	ja .invalid
+
+	mov r8, VDSO_DATA
+
+.retry:
+	mov r9d, [r8+VDSO_SEQUENCE]
+	test r9d, 1
+	jnz .busy
+
+	lfence
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+
+	sub rax, [r8+VDSO_TSC_BASE]
+	mov ecx, [r8+VDSO_TSC_MULT]
+	mul rcx
+	mov ecx, [r8+VDSO_TSC_SHIFT]
+	shrd rax, rdx, cl
+	add rax, [r8+VDSO_NS_BASE]
+	mov r10, [r8+VDSO_WALL_BASE]
+
+	cmp r9d, [r8+VDSO_SEQUENCE]
+	jne .retry
+
+	; RAX = nanoseconds since boot
+	xor edx, edx
+	mov ecx, 1000000000
+	div rcx
+
+	cmp edi, CLOCK_REALTIME
+	jne .store
+
+	add rax, r10
+
+.store:
+	mov [rsi], rax
+	mov [rsi+8], rdx
+	xor eax, eax
+	ret
+
+.busy:
+	pause
+	jmp .retry
+
+.invalid:
+	mov eax, EINVAL
+	ret
+
+; time_t time(time_t *time)
+vdso_time:
+	mov r8, VDSO_DATA
+
+.retry:
+	mov ecx, [r8+VDSO_SEQUENCE]
+	test ecx, 1
+	jnz .busy
+
+	mov rax, [r8+VDSO_WALL_SECONDS]
+
+	cmp ecx, [r8+VDSO_SEQUENCE]
+	jne .retry
+
+	test rdi, rdi
+	jz .done
+
+	mov [rdi], rax
+
+.done:
+	ret
+
+.busy:
+	pause
+	jmp .retry
+
+; pid_t getpid()
+vdso_getpid:
+	mov r8, VDSO_DATA
+	test dword[r8+VDSO_FLAGS], VDSO_FLAGS_RDTSCP
+	jz .syscall
+
+.retry:
+	; find our CPU's slot, read it, and make sure we're still on that CPU
+	rdtscp
+	mov r9d, ecx
+	shl r9, VDSO_CPU_SHIFT
+	add r9, r8
+
+	mov r10d, [r9+VDSO_CPUS+VDSO_CPU_SEQUENCE]
+	test r10d, 1
+	jnz .retry
+
+	mov r11d, [r9+VDSO_CPUS+VDSO_CPU_PID]
+
+	rdtscp
+	mov eax, ecx
+	shl rax, VDSO_CPU_SHIFT
+	add rax, r8
+	cmp rax, r9
+	jne .retry
+
+	cmp r10d, [r9+VDSO_CPUS+VDSO_CPU_SEQUENCE]
+	jne .retry
+
+	mov eax, r11d
+	ret
+
+.syscall:
+	mov eax, SYS_GETPID
+	syscall
+	ret
+
+end_vdso_code:
+
+public vdso_code_size
+vdso_code_size:			dw end_vdso_code - vdso_code
+
+
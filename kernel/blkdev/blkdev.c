@@ -8,11 +8,18 @@
 #include <vfs.h>
 #include <mm.h>
 #include <initrd.h>
+#include <virtio.h>
+#include <nvme.h>
+#include <idt.h>
+#include <apic.h>
 #include <string.h>
 #include <kprintf.h>
 
 blkdev_t *blkdevs;
 size_t blkdev_count = 0;
+request_queue_t *blkdev_queues;
+
+int blkdev_transfer(dev_t, int, uint64_t, uint64_t, void *);
 
 // blkdev_init(): Initializes block devices
 // Param:	multiboot_info_t *multiboot_info - pointer to multiboot information
@@ -21,17 +28,23 @@ size_t blkdev_count = 0;
 void blkdev_init(multiboot_info_t *multiboot_info)
 {
 	blkdevs = kcalloc(sizeof(blkdev_t), MAX_BLKDEVS);
+	blkdev_queues = kcalloc(sizeof(request_queue_t), MAX_BLKDEVS);
+	idt_install(BLKDEV_VECTOR, (size_t)&blkdev_irq_stub);
+
 	initrd_init(multiboot_info);
+	virtio_blk_init();
+	nvme_init();
 }
 
 // blkdev_register(): Registers a block device
 // Param:	uint8_t type - type of block device
 // Param:	uint16_t sector_size - size of sectors in bytes
+// Param:	size_t hw_queues - submission queues the device has, at least one
 // Param:	void *info - type-specific information, specific to the driver
 // Param:	char *name - Name of the device
 // Return:	dev_t - VFS-friendly number of the device
 
-dev_t blkdev_register(uint8_t type, uint16_t sector_size, void *info, char *name)
+dev_t blkdev_register(uint8_t type, uint16_t sector_size, size_t hw_queues, void *info, char *name)
 {
 	// find an unused block device slot
 	dev_t device = 0;
@@ -44,7 +57,7 @@ dev_t blkdev_register(uint8_t type, uint16_t sector_size, void *info, char *name
 
 	// and store everything there
 	blkdevs[device].type = type;
-	blkdevs[device].reserved = 0;
+	blkdevs[device].hw_queues = (hw_queues > BLKDEV_MAX_HW_QUEUES) ? BLKDEV_MAX_HW_QUEUES : hw_queues;
 	blkdevs[device].sector_size = sector_size;
 
 	uint16_t *info_size = (uint16_t*)info;
@@ -57,6 +70,9 @@ dev_t blkdev_register(uint8_t type, uint16_t sector_size, void *info, char *name
 
 	blkdevs[device].name[63] = 0;
 
+	// there's no driver behind the queue until it says so
+	blkdev_queues[device].device = device;
+
 	blkdev_count++;
 	return device;
 }
@@ -70,16 +86,7 @@ dev_t blkdev_register(uint8_t type, uint16_t sector_size, void *info, char *name
 
 int blkdev_read(dev_t device, uint64_t lba, uint64_t count, void *buffer)
 {
-	if(!count)
-		return 0;
-
-	blkdev_t *blkdev = &blkdevs[device];
-
-	if(blkdev->type == BLKDEV_INITRD)
-		return initrd_read(blkdev, lba, count, buffer);
-
-	kprintf("blkdev: read non-present device %d, LBA 0x%xq count %d\n", device, lba, count);
-	return BLKDEV_NODEV;
+	return blkdev_transfer(device, BIO_READ, lba, count, buffer);
 }
 
 // blkdev_read_bytes(): Reads from a block device using byte-indexing instead of sectors
@@ -99,9 +106,25 @@ int blkdev_read_bytes(dev_t device, uint64_t base, uint64_t count, void *buffer)
 	if(blkdev->type == 0 || blkdev->sector_size == 0)
 		return BLKDEV_NODEV;
 
+	// devices in memory are one copy, with nothing to allocate
+	uint64_t available;
+	void *direct = blkdev_direct_access(device, base, &available);
+	if(direct)
+	{
+		if(count > available)
+			return BLKDEV_IO;
+
+		memcpy(buffer, direct, count);
+		return 0;
+	}
+
 	uint64_t lba = base / blkdev->sector_size;	// round down
 	uint64_t byte_start = base % blkdev->sector_size;
-	uint64_t count_sectors = (count / blkdev->sector_size) + 1;
+	uint64_t count_sectors = (byte_start + count + blkdev->sector_size - 1) / blkdev->sector_size;
+
+	// and whole sectors don't need a bounce buffer either
+	if(!byte_start && !(count % blkdev->sector_size))
+		return blkdev_read(device, lba, count_sectors, buffer);
 
 	void *tmp_buffer = kcalloc(blkdev->sector_size, count_sectors);
 	int status = blkdev_read(device, lba, count_sectors, tmp_buffer);
@@ -116,6 +139,246 @@ int blkdev_read_bytes(dev_t device, uint64_t base, uint64_t count, void *buffer)
 	return 0;
 }
 
+// blkdev_write(): Writes to a block device
+// Param:	dev_t device - device to write to
+// Param:	uint64_t lba - starting LBA sector
+// Param:	uint64_t count - count of sectors to write
+// Param:	void *buffer - buffer to write from
+// Return:	int - return status
+
+int blkdev_write(dev_t device, uint64_t lba, uint64_t count, void *buffer)
+{
+	return blkdev_transfer(device, BIO_WRITE, lba, count, buffer);
+}
+
+// blkdev_transfer(): Reads or writes a block device, and waits for it
+// Param:	dev_t device - device
+// Param:	int operation - BIO_READ or BIO_WRITE
+// Param:	uint64_t lba - starting LBA sector
+// Param:	uint64_t count - count of sectors
+// Param:	void *buffer - buffer to read into or write from
+// Return:	int - return status
+
+int blkdev_transfer(dev_t device, int operation, uint64_t lba, uint64_t count, void *buffer)
+{
+	if(!count)
+		return 0;
+
+	if(device >= MAX_BLKDEVS || !blkdev_queues[device].ops)
+	{
+		kprintf("blkdev: I/O on non-present device %d, LBA 0x%xq count %d\n", device, lba, count);
+		return BLKDEV_NODEV;
+	}
+
+	// transfers bigger than a request are split up, and all go at once
+	size_t max_sectors = blkdev_queues[device].max_sectors;
+	size_t bio_count = (count + max_sectors - 1) / max_sectors;
+	bio_t *bios = kcalloc(sizeof(bio_t), bio_count);
+	size_t sector_size = blkdevs[device].sector_size;
+	size_t i;
+
+	blk_plug_t plug;
+	blkdev_start_plug(&plug);
+
+	for(i = 0; i < bio_count; i++)
+	{
+		bios[i].device = device;
+		bios[i].operation = operation;
+		bios[i].lba = lba + (i * max_sectors);
+		bios[i].count = count - (i * max_sectors);
+		if(bios[i].count > max_sectors)
+			bios[i].count = max_sectors;
+
+		bios[i].buffer = (uint8_t*)buffer + (i * max_sectors * sector_size);
+		blkdev_submit(&bios[i]);
+	}
+
+	blkdev_finish_plug(&plug);
+
+	int status = 0;
+	for(i = 0; i < bio_count; i++)
+	{
+		if(blkdev_wait(&bios[i]) != 0 && !status)
+			status = bios[i].status;
+	}
+
+	kfree(bios);
+	return status;
+}
+
+// blkdev_write_bytes(): Writes to a block device using byte-indexing instead of sectors
+// Param:	dev_t device - device to write to
+// Param:	uint64_t base - starting byte
+// Param:	uint64_t count - count of bytes to write
+// Param:	void *buffer - buffer to write from
+// Return:	int - return status
+
+int blkdev_write_bytes(dev_t device, uint64_t base, uint64_t count, void *buffer)
+{
+	if(!count)
+		return 0;
+
+	blkdev_t *blkdev = &blkdevs[device];
+
+	if(blkdev->type == 0 || blkdev->sector_size == 0)
+		return BLKDEV_NODEV;
+
+	uint64_t available;
+	void *direct = blkdev_direct_access(device, base, &available);
+	if(direct)
+	{
+		if(count > available)
+			return BLKDEV_IO;
+
+		memcpy(direct, buffer, count);
+		return 0;
+	}
+
+	uint64_t lba = base / blkdev->sector_size;	// round down
+	uint64_t byte_start = base % blkdev->sector_size;
+	uint64_t count_sectors = (byte_start + count + blkdev->sector_size - 1) / blkdev->sector_size;
+
+	if(!byte_start && !(count % blkdev->sector_size))
+		return blkdev_write(device, lba, count_sectors, buffer);
+
+	// the sectors at either end have to be read first, so the bytes
+	// around what we're writing stay the same
+	void *tmp_buffer = kcalloc(blkdev->sector_size, count_sectors);
+	int status = blkdev_read(device, lba, count_sectors, tmp_buffer);
+	if(status == 0)
+	{
+		memcpy(tmp_buffer + byte_start, buffer, count);
+		status = blkdev_write(device, lba, count_sectors, tmp_buffer);
+	}
+
+	kfree(tmp_buffer);
+	return status;
+}
+
+// blkdev_readv(): Reads from a block device into several buffers, using byte-indexing
+// Param:	dev_t device - device to read from
+// Param:	uint64_t base - starting byte
+// Param:	const struct iovec *iov - buffers to read into
+// Param:	int count - count of buffers
+// Return:	int - return status
+
+int blkdev_readv(dev_t device, uint64_t base, const struct iovec *iov, int count)
+{
+	blkdev_t *blkdev = &blkdevs[device];
+	int i, status;
+
+	if(blkdev->type == 0 || blkdev->sector_size == 0)
+		return BLKDEV_NODEV;
+
+	// devices in memory are copied straight out of
+	uint64_t available, total = 0;
+	uint8_t *direct = blkdev_direct_access(device, base, &available);
+	if(direct)
+	{
+		for(i = 0; i < count; i++)
+			total += iov[i].iov_len;
+
+		if(total > available)
+			return BLKDEV_IO;
+
+		for(i = 0; i < count; i++)
+		{
+			memcpy(iov[i].iov_base, direct, iov[i].iov_len);
+			direct += iov[i].iov_len;
+		}
+
+		return 0;
+	}
+
+	// buffers of whole sectors each get a bio, which all merge into as few
+	// requests as they can
+	int whole = !(base % blkdev->sector_size);
+	for(i = 0; i < count; i++)
+	{
+		if((iov[i].iov_len % blkdev->sector_size) || iov[i].iov_len / blkdev->sector_size > blkdev_queues[device].max_sectors)
+			whole = 0;
+	}
+
+	if(whole && count && blkdev_queues[device].ops)
+	{
+		bio_t *bios = kcalloc(sizeof(bio_t), count);
+		uint64_t lba = base / blkdev->sector_size;
+		blk_plug_t plug;
+
+		blkdev_start_plug(&plug);
+		for(i = 0; i < count; i++)
+		{
+			bios[i].device = device;
+			bios[i].operation = BIO_READ;
+			bios[i].lba = lba;
+			bios[i].count = iov[i].iov_len / blkdev->sector_size;
+			bios[i].buffer = iov[i].iov_base;
+			lba += bios[i].count;
+
+			// empty buffers don't need anything
+			if(bios[i].count)
+				blkdev_submit(&bios[i]);
+			else
+				bios[i].done = 1;
+		}
+
+		blkdev_finish_plug(&plug);
+
+		status = 0;
+		for(i = 0; i < count; i++)
+		{
+			if(blkdev_wait(&bios[i]) != 0 && !status)
+				status = bios[i].status;
+		}
+
+		kfree(bios);
+		return status;
+	}
+
+	// anything else gets one transfer for each buffer
+	for(i = 0; i < count; i++)
+	{
+		status = blkdev_read_bytes(device, base, iov[i].iov_len, iov[i].iov_base);
+		if(status != 0)
+			return status;
+
+		base += iov[i].iov_len;
+	}
+
+	return 0;
+}
+
+// blkdev_physical(): Returns the physical address of a byte on a memory-backed block device
+// Param:	dev_t device - device
+// Param:	uint64_t base - byte offset
+// Return:	size_t - physical address, 0 if the device isn't in memory
 
+size_t blkdev_physical(dev_t device, uint64_t base)
+{
+	if(device >= MAX_BLKDEVS || !blkdev_queues[device].ops || !blkdev_queues[device].ops->direct_access)
+		return 0;
+
+	uint64_t available;
+	size_t physical;
+	if(!blkdev_queues[device].ops->direct_access(device, base, &available, &physical))
+		return 0;
+
+	return physical;
+}
+
+// blkdev_direct_access(): Returns a kernel pointer to a byte on a memory-backed block device
+// Param:	dev_t device - device
+// Param:	uint64_t base - byte offset
+// Param:	uint64_t *available - bytes that can be used from there
+// Return:	void * - pointer, NULL if the device isn't in memory
+
+void *blkdev_direct_access(dev_t device, uint64_t base, uint64_t *available)
+{
+	if(device >= MAX_BLKDEVS || !blkdev_queues[device].ops || !blkdev_queues[device].ops->direct_access)
+		return NULL;
+
+	size_t physical;
+	return blkdev_queues[device].ops->direct_access(device, base, available, &physical);
+}
 
 
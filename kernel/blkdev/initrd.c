@@ -13,6 +13,15 @@
 #include <boot.h>
 #include <string.h>
 
+int initrd_start_request(blk_hw_queue_t *, request_t *);
+
+// memory copies are done as soon as they start, and anything that can use
+// the memory itself doesn't need them at all
+const blkdev_ops_t initrd_ops = {
+	.start = &initrd_start_request,
+	.direct_access = &initrd_direct_access,
+};
+
 // initrd_init(): Detects the initial ramdisk
 // Param:	multiboot_info_t *multiboot_info - pointer to multiboot information
 // Return:	Nothing
@@ -32,9 +41,11 @@ void initrd_init(multiboot_info_t *multiboot_info)
 	blkdev_initrd_t *initrd = kmalloc(sizeof(blkdev_initrd_t));
 	initrd->size = sizeof(blkdev_initrd_t);
 	initrd->base = (void*)vmm_request_map((size_t)module->mod_start, size_pages, PAGE_PRESENT | PAGE_RW);
+	initrd->physical = (size_t)module->mod_start;
 	initrd->size_bytes = module->mod_end - module->mod_start;
 	initrd->size_sectors = initrd->size_bytes / INITRD_SECTOR_SIZE;		// round down
-	blkdev_register(BLKDEV_INITRD, INITRD_SECTOR_SIZE, initrd, "Initial ramdisk");
+	dev_t device = blkdev_register(BLKDEV_INITRD, INITRD_SECTOR_SIZE, 1, initrd, "Initial ramdisk");
+	blkdev_set_driver(device, &initrd_ops, 0, 0, 0);
 
 	kprintf("initrd: initrd is at 0x%xd, size 0x%xd bytes\n", module->mod_start, module->mod_end - module->mod_start);
 
@@ -49,7 +60,8 @@ void initrd_init(multiboot_info_t *multiboot_info)
 	kfree(initrd);
 
 	// register the initrd with the /dev filesystem
-	devfs_make_entry("initrd", S_IFBLK | DEVFS_MODE);
+	devfs_entry_t *entry = devfs_make_entry("initrd", S_IFBLK | DEVFS_MODE);
+	entry->device = device;
 }
 
 // initrd_read(): Reads from the initrd
@@ -62,13 +74,74 @@ void initrd_init(multiboot_info_t *multiboot_info)
 int initrd_read(blkdev_t *device, uint64_t lba, uint64_t count, void *buffer)
 {
 	blkdev_initrd_t *initrd = (blkdev_initrd_t*)&device->data[0];
-	if((lba + count) >= initrd->size_sectors)
+	if((lba + count) > initrd->size_sectors)
 		return BLKDEV_IO;
 
 	memcpy(buffer, initrd->base + (lba * INITRD_SECTOR_SIZE), count * INITRD_SECTOR_SIZE);
 	return 0;
 }
 
+// initrd_write(): Writes to the initrd
+// Param:	blkdev_t *device - device to write
+// Param:	uint64_t lba - starting LBA sector
+// Param:	uint64_t count - count of sectors to write
+// Param:	void *buffer - buffer to write from
+// Return:	int - return status
+
+int initrd_write(blkdev_t *device, uint64_t lba, uint64_t count, void *buffer)
+{
+	blkdev_initrd_t *initrd = (blkdev_initrd_t*)&device->data[0];
+	if((lba + count) > initrd->size_sectors)
+		return BLKDEV_IO;
+
+	memcpy(initrd->base + (lba * INITRD_SECTOR_SIZE), buffer, count * INITRD_SECTOR_SIZE);
+	return 0;
+}
+
+// initrd_start_request(): Does a request of the block layer
+// Param:	blk_hw_queue_t *hw_queue - hardware queue, there's only one
+// Param:	request_t *request - request
+// Return:	int - status code, which is also the request's
+
+int initrd_start_request(blk_hw_queue_t *hw_queue, request_t *request)
+{
+	blkdev_t *device = &blkdevs[request->queue->device];
+	bio_t *bio = request->bio_head;
+	int status = 0;
+
+	while(bio && !status)
+	{
+		if(bio->operation == BIO_WRITE)
+			status = initrd_write(device, bio->lba, bio->count, bio->buffer);
+		else
+			status = initrd_read(device, bio->lba, bio->count, bio->buffer);
+
+		bio = bio->next;
+	}
+
+	if(!status)
+		blkdev_end_request(request, 0);
+
+	return status;
+}
+
+// initrd_direct_access(): Returns a kernel pointer to a byte in the initrd
+// Param:	dev_t device - device
+// Param:	uint64_t base - byte offset
+// Param:	uint64_t *available - bytes from there to the end of the initrd
+// Param:	size_t *physical - physical address of the byte
+// Return:	void * - pointer, NULL if out of range
+
+void *initrd_direct_access(dev_t device, uint64_t base, uint64_t *available, size_t *physical)
+{
+	blkdev_initrd_t *initrd = (blkdev_initrd_t*)&blkdevs[device].data[0];
+	if(base >= initrd->size_bytes)
+		return NULL;
+
+	*available = initrd->size_bytes - base;
+	*physical = initrd->physical + (size_t)base;
+	return initrd->base + (size_t)base;
+}
 
 
 
@@ -0,0 +1,596 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <nvme.h>
+#include <blkdev.h>
+#include <pci.h>
+#include <mm.h>
+#include <apic.h>
+#include <timer.h>
+#include <devfs.h>
+#include <devmgr.h>
+#include <lock.h>
+#include <string.h>
+#include <kprintf.h>
+
+// NVMe
+// Each hardware queue of the block layer is its own submission and
+// completion queue pair, up to one for each CPU, so CPUs submitting at the
+// same time never share anything. A request is one command whose ID is its
+// tag, and its PRP list or SGL descriptors go in a page of their own for each
+// tag. Commands are only written to the submission queue when they start;
+// the doorbell is rung once when the block layer commits them, so a plug
+// full of requests costs one MMIO write. Controllers that can't take SGLs
+// only get requests whose buffers meet at page boundaries, which PRPs can
+// describe. Each completion queue interrupts the last CPU of its group, which
+// only wakes it up; requests are finished by polling, like everything else.
+// Only the first namespace of each controller is used.
+
+size_t nvme_count = 0;
+
+int nvme_setup(pci_device_t *);
+int nvme_wait_ready(nvme_t *, uint64_t, int);
+int nvme_alloc_queue(nvme_t *, nvme_queue_t *, size_t, size_t, size_t);
+int nvme_admin(nvme_t *, nvme_command_t *, uint32_t *);
+int nvme_start_request(blk_hw_queue_t *, request_t *);
+void nvme_commit(blk_hw_queue_t *);
+int nvme_poll(blk_hw_queue_t *);
+
+const blkdev_ops_t nvme_ops = {
+	.start = &nvme_start_request,
+	.poll = &nvme_poll,
+	.commit = &nvme_commit,
+};
+
+// nvme_init(): Detects NVMe controllers
+// Param:	Nothing
+// Return:	Nothing
+
+void nvme_init()
+{
+	pci_device_t *pci;
+	size_t i;
+
+	for(i = 0; (pci = pci_find_class(NVME_CLASS, NVME_SUBCLASS, NVME_PROG_IF, i)) && nvme_count < MAX_NVME; i++)
+		nvme_setup(pci);
+}
+
+// nvme_setup(): Starts up an NVMe controller
+// Param:	pci_device_t *pci - PCI function
+// Return:	int - 0 on success
+
+int nvme_setup(pci_device_t *pci)
+{
+	nvme_t *nvme = kcalloc(sizeof(nvme_t), 1);
+	nvme->pci = pci;
+
+	nvme->regs = pci_map(pci, 0, 0, NVME_DOORBELLS);
+	if(!nvme->regs)
+	{
+		kprintf("nvme: controller at %d:%d:%d has no memory BAR, ignoring\n", pci->bus, pci->slot, pci->function);
+		kfree(nvme);
+		return -1;
+	}
+
+	uint64_t cap = *(volatile uint32_t*)(nvme->regs + NVME_CAP);
+	cap |= (uint64_t)*(volatile uint32_t*)(nvme->regs + NVME_CAP + 4) << 32;
+
+	// we only use 4 KB pages
+	if(NVME_CAP_MPSMIN(cap))
+	{
+		kprintf("nvme: controller at %d:%d:%d doesn't take 4 KB pages, ignoring\n", pci->bus, pci->slot, pci->function);
+		kfree(nvme);
+		return -1;
+	}
+
+	nvme->doorbell_stride = 4 << NVME_CAP_DSTRD(cap);
+	nvme->doorbells = pci_map(pci, 0, NVME_DOORBELLS, (BLKDEV_MAX_HW_QUEUES + 1) * 2 * nvme->doorbell_stride);
+
+	uint64_t timeout = NVME_CAP_TO(cap) * 500;
+	if(!timeout)
+		timeout = 500;
+
+	pci_enable(pci);
+
+	// the controller has to be disabled before the admin queue can change
+	volatile uint32_t *cc = (volatile uint32_t*)(nvme->regs + NVME_CC);
+	*cc &= ~NVME_CC_ENABLE;
+	if(nvme_wait_ready(nvme, timeout, 0))
+	{
+		kprintf("nvme: controller at %d:%d:%d didn't reset, ignoring\n", pci->bus, pci->slot, pci->function);
+		kfree(nvme);
+		return -1;
+	}
+
+	if(nvme_alloc_queue(nvme, &nvme->admin, 0, NVME_ADMIN_QUEUE_SIZE, 0))
+	{
+		kfree(nvme);
+		return -1;
+	}
+
+	size_t physical = vmm_get_page((size_t)nvme->admin.sq) & ~(PAGE_SIZE-1);
+	*(volatile uint32_t*)(nvme->regs + NVME_AQA) = ((NVME_ADMIN_QUEUE_SIZE - 1) << 16) | (NVME_ADMIN_QUEUE_SIZE - 1);
+	*(volatile uint32_t*)(nvme->regs + NVME_ASQ) = (uint64_t)physical & 0xFFFFFFFF;
+	*(volatile uint32_t*)(nvme->regs + NVME_ASQ + 4) = (uint64_t)physical >> 32;
+
+	physical = vmm_get_page((size_t)nvme->admin.cq) & ~(PAGE_SIZE-1);
+	*(volatile uint32_t*)(nvme->regs + NVME_ACQ) = (uint64_t)physical & 0xFFFFFFFF;
+	*(volatile uint32_t*)(nvme->regs + NVME_ACQ + 4) = (uint64_t)physical >> 32;
+
+	*cc = NVME_CC_ENABLE | NVME_CC_IOSQES | NVME_CC_IOCQES;
+	if(nvme_wait_ready(nvme, timeout, 1))
+	{
+		kprintf("nvme: controller at %d:%d:%d didn't start, ignoring\n", pci->bus, pci->slot, pci->function);
+		kfree(nvme);
+		return -1;
+	}
+
+	// find out what the controller and its first namespace are like
+	uint8_t *identify = (uint8_t*)vmm_alloc(KERNEL_HEAP, 1, PAGE_PRESENT | PAGE_RW);
+	nvme_command_t command;
+
+	memset(&command, 0, sizeof(nvme_command_t));
+	command.cdw0 = NVME_ADMIN_IDENTIFY;
+	command.prp1 = vmm_get_page((size_t)identify) & ~(PAGE_SIZE-1);
+	command.cdw10 = NVME_IDENTIFY_CONTROLLER;
+	if(nvme_admin(nvme, &command, NULL))
+	{
+		kprintf("nvme: controller at %d:%d:%d didn't identify itself, ignoring\n", pci->bus, pci->slot, pci->function);
+		vmm_free((size_t)identify, 1);
+		kfree(nvme);
+		return -1;
+	}
+
+	size_t mdts = identify[NVME_ID_MDTS];
+	uint32_t namespaces = *(uint32_t*)(identify + NVME_ID_NN);
+	nvme->sgl = (*(uint32_t*)(identify + NVME_ID_SGLS) & 3) == 1;	// byte-aligned SGLs
+	nvme->namespace = 1;
+
+	memset(&command, 0, sizeof(nvme_command_t));
+	command.cdw0 = NVME_ADMIN_IDENTIFY;
+	command.nsid = nvme->namespace;
+	command.prp1 = vmm_get_page((size_t)identify) & ~(PAGE_SIZE-1);
+	command.cdw10 = NVME_IDENTIFY_NAMESPACE;
+	if(!namespaces || nvme_admin(nvme, &command, NULL))
+	{
+		kprintf("nvme: controller at %d:%d:%d has no namespaces, ignoring\n", pci->bus, pci->slot, pci->function);
+		vmm_free((size_t)identify, 1);
+		kfree(nvme);
+		return -1;
+	}
+
+	nvme->sectors = *(uint64_t*)(identify + NVME_ID_NSZE);
+	uint32_t format = *(uint32_t*)(identify + NVME_ID_LBAF + ((identify[NVME_ID_FLBAS] & 0x0F) * 4));
+	vmm_free((size_t)identify, 1);
+
+	size_t lba_shift = (format >> 16) & 0xFF;
+	if(!nvme->sectors || lba_shift < 9 || lba_shift > PAGE_SIZE_SHIFT)
+	{
+		kprintf("nvme: controller at %d:%d:%d has an unusable namespace, ignoring\n", pci->bus, pci->slot, pci->function);
+		kfree(nvme);
+		return -1;
+	}
+
+	nvme->sector_size = (size_t)1 << lba_shift;
+
+	// any buffer of a whole request has to fit, wherever it starts, and
+	// the controller might not take as much as we would give it
+	nvme->max_sectors = ((NVME_MAX_SEGMENTS - 1) * PAGE_SIZE) / nvme->sector_size;
+	if(nvme->max_sectors > BLKDEV_MAX_SECTORS)
+		nvme->max_sectors = BLKDEV_MAX_SECTORS;
+
+	if(mdts && mdts < 20 && ((PAGE_SIZE << mdts) / nvme->sector_size) < nvme->max_sectors)
+		nvme->max_sectors = (PAGE_SIZE << mdts) / nvme->sector_size;
+
+	// one queue pair for each CPU, if it has that many, each with its own
+	// interrupt, and the admin queue has the first one
+	int msix = !pci_msix_enable(pci) && pci->msix_count >= 2;
+	size_t count = lapic_count;
+	if(count > BLKDEV_MAX_HW_QUEUES)
+		count = BLKDEV_MAX_HW_QUEUES;
+	if(msix && count > pci->msix_count - 1)
+		count = pci->msix_count - 1;
+
+	uint32_t result;
+	memset(&command, 0, sizeof(nvme_command_t));
+	command.cdw0 = NVME_ADMIN_SET_FEATURES;
+	command.cdw10 = NVME_FEATURE_QUEUES;
+	command.cdw11 = ((count - 1) << 16) | (count - 1);
+	if(nvme_admin(nvme, &command, &result))
+	{
+		kprintf("nvme: controller at %d:%d:%d has no I/O queues, ignoring\n", pci->bus, pci->slot, pci->function);
+		kfree(nvme);
+		return -1;
+	}
+
+	if((result & 0xFFFF) + 1 < count)
+		count = (result & 0xFFFF) + 1;
+	if((result >> 16) + 1 < count)
+		count = (result >> 16) + 1;
+
+	size_t size = NVME_CAP_MQES(cap) + 1;
+	if(size > NVME_QUEUE_SIZE)
+		size = NVME_QUEUE_SIZE;
+
+	nvme->queues = kcalloc(sizeof(nvme_queue_t), count);
+
+	nvme_queue_t *queue;
+	size_t i;
+	for(i = 0; i < count; i++)
+	{
+		queue = &nvme->queues[i];
+
+		// a full queue is one entry short of its size
+		if(nvme_alloc_queue(nvme, queue, i + 1, size, size - 1))
+			break;
+
+		memset(&command, 0, sizeof(nvme_command_t));
+		command.cdw0 = NVME_ADMIN_CREATE_CQ;
+		command.prp1 = vmm_get_page((size_t)queue->cq) & ~(PAGE_SIZE-1);
+		command.cdw10 = ((size - 1) << 16) | queue->id;
+		command.cdw11 = NVME_QUEUE_CONTIGUOUS;
+		if(msix)
+			command.cdw11 |= (queue->id << 16) | NVME_QUEUE_INTERRUPTS;
+
+		if(nvme_admin(nvme, &command, NULL))
+			break;
+
+		memset(&command, 0, sizeof(nvme_command_t));
+		command.cdw0 = NVME_ADMIN_CREATE_SQ;
+		command.prp1 = vmm_get_page((size_t)queue->sq) & ~(PAGE_SIZE-1);
+		command.cdw10 = ((size - 1) << 16) | queue->id;
+		command.cdw11 = (queue->id << 16) | NVME_QUEUE_CONTIGUOUS;
+
+		if(nvme_admin(nvme, &command, NULL))
+			break;
+	}
+
+	// the queues that did work are enough
+	if(!i)
+	{
+		kprintf("nvme: controller at %d:%d:%d has no usable I/O queues, ignoring\n", pci->bus, pci->slot, pci->function);
+		kfree(nvme->queues);
+		kfree(nvme);
+		return -1;
+	}
+
+	nvme->queue_count = i;
+
+	// register with the block device manager
+	char devfs_name[16];
+	char name[64];
+	strcpy(devfs_name, "nvme0n1");
+	devfs_name[4] += nvme_count;
+
+	strcpy(name, "NVMe namespace ");
+	strcpy(name + strlen(name), devfs_name);
+
+	blkdev_nvme_t *info = kcalloc(sizeof(blkdev_nvme_t), 1);
+	info->size = sizeof(blkdev_nvme_t);
+	info->nvme = nvme;
+
+	dev_t device = blkdev_register(BLKDEV_NVME, nvme->sector_size, nvme->queue_count, info, name);
+	kfree(info);
+
+	// PRPs can only describe buffers that meet at page boundaries
+	if(!nvme->sgl)
+		blkdev_queues[device].boundary = PAGE_SIZE;
+
+	blkdev_set_driver(device, &nvme_ops, size - 1, nvme->max_sectors, NVME_MAX_SEGMENTS);
+
+	// each queue interrupts the last CPU of its group, which is usually an AP
+	// that is halted, so whoever submitted the request isn't the one woken up
+	request_queue_t *request_queue = &blkdev_queues[device];
+	blk_hw_queue_t *hw_queue;
+	for(i = 0; msix && i < request_queue->hw_queue_count; i++)
+	{
+		hw_queue = &request_queue->hw_queues[i];
+		if(!pci_msix_route(pci, i + 1, BLKDEV_VECTOR, hw_queue->first_cpu + hw_queue->cpu_count - 1))
+			hw_queue->wakes = 1;
+	}
+
+	kprintf("nvme: %s is %d MB, %d-byte sectors, %d queues, %s\n", devfs_name, (size_t)((nvme->sectors * nvme->sector_size) >> 20),
+		nvme->sector_size, nvme->queue_count, nvme->sgl ? "SGLs" : "PRPs only");
+
+	// register with the /dev filesystem
+	devfs_entry_t *entry = devfs_make_entry(devfs_name, S_IFBLK | DEVFS_MODE);
+	entry->device = device;
+
+	// and with the device manager
+	device_t *devmgr_device = kcalloc(sizeof(device_t), 1);
+	devmgr_device->category = DEVMGR_CATEGORY_DISK;
+	devmgr_device->irq = 0xFF;
+	devmgr_device->mmio[0].base = pci_bar(pci, 0);
+	devmgr_device->mmio[0].size = NVME_DOORBELLS + ((nvme->queue_count + 1) * 2 * nvme->doorbell_stride);
+	devmgr_register(devmgr_device, name);
+	kfree(devmgr_device);
+
+	nvme_count++;
+	return 0;
+}
+
+// nvme_wait_ready(): Waits for the controller to be enabled or disabled
+// Param:	nvme_t *nvme - controller
+// Param:	uint64_t timeout - ms to wait at most
+// Param:	int ready - 1 to wait until it's enabled, 0 until it's disabled
+// Return:	int - 0 on success
+
+int nvme_wait_ready(nvme_t *nvme, uint64_t timeout, int ready)
+{
+	volatile uint32_t *csts = (volatile uint32_t*)(nvme->regs + NVME_CSTS);
+	uint64_t end = global_uptime + timeout;
+
+	while((*csts & NVME_CSTS_READY) != (uint32_t)ready)
+	{
+		if((*csts & NVME_CSTS_FATAL) || global_uptime > end)
+			return -1;
+
+		asm volatile ("pause");
+	}
+
+	return 0;
+}
+
+// nvme_alloc_queue(): Allocates a submission and completion queue pair
+// Param:	nvme_t *nvme - controller
+// Param:	nvme_queue_t *queue - queue
+// Param:	size_t id - queue ID, 0 for the admin queue
+// Param:	size_t size - entries in each queue
+// Param:	size_t tags - pages for PRP lists and SGLs, 0 for none
+// Return:	int - 0 on success
+
+int nvme_alloc_queue(nvme_t *nvme, nvme_queue_t *queue, size_t id, size_t size, size_t tags)
+{
+	// both fit in a page, and next to each other they're one allocation
+	size_t memory = vmm_alloc(KERNEL_HEAP, 2, PAGE_PRESENT | PAGE_RW);
+	if(!memory)
+		return -1;
+
+	if(tags)
+	{
+		queue->lists = (uint8_t*)vmm_alloc(KERNEL_HEAP, tags, PAGE_PRESENT | PAGE_RW);
+		if(!queue->lists)
+		{
+			vmm_free(memory, 2);
+			return -1;
+		}
+
+		queue->lists_physical = vmm_get_page((size_t)queue->lists) & ~(PAGE_SIZE-1);
+	}
+
+	queue->id = id;
+	queue->size = size;
+	queue->sq = (nvme_command_t*)memory;
+	queue->cq = (volatile nvme_completion_t*)(memory + PAGE_SIZE);
+	queue->sq_doorbell = (volatile uint32_t*)(nvme->doorbells + ((id * 2) * nvme->doorbell_stride));
+	queue->cq_doorbell = (volatile uint32_t*)(nvme->doorbells + (((id * 2) + 1) * nvme->doorbell_stride));
+	queue->phase = 1;
+	return 0;
+}
+
+// nvme_admin(): Sends an admin command and waits for it, only used while starting up
+// Param:	nvme_t *nvme - controller
+// Param:	nvme_command_t *command - command, without its ID
+// Param:	uint32_t *result - where to store the result, or NULL
+// Return:	int - status code of the command, -1 if it timed out
+
+int nvme_admin(nvme_t *nvme, nvme_command_t *command, uint32_t *result)
+{
+	nvme_queue_t *queue = &nvme->admin;
+
+	command->cdw0 = (command->cdw0 & 0xFFFF) | ((uint32_t)nvme->admin_id << 16);
+	nvme->admin_id++;
+
+	memcpy(&queue->sq[queue->sq_tail], command, sizeof(nvme_command_t));
+	queue->sq_tail = (queue->sq_tail + 1) % queue->size;
+	memory_barrier();
+	*queue->sq_doorbell = queue->sq_tail;
+
+	volatile nvme_completion_t *completion = &queue->cq[queue->cq_head];
+	uint64_t end = global_uptime + NVME_ADMIN_TIMEOUT;
+	while((completion->status & 1) != queue->phase)
+	{
+		if(global_uptime > end)
+			return -1;
+
+		asm volatile ("pause");
+	}
+
+	memory_barrier();
+	int status = completion->status >> 1;
+	if(result)
+		*result = completion->result;
+
+	queue->cq_head++;
+	if(queue->cq_head >= queue->size)
+	{
+		queue->cq_head = 0;
+		queue->phase ^= 1;
+	}
+
+	*queue->cq_doorbell = queue->cq_head;
+	return status;
+}
+
+// nvme_start_request(): Writes the command of a request, which the device sees when it's committed
+// Param:	blk_hw_queue_t *hw_queue - hardware queue, which is a queue pair
+// Param:	request_t *request - request
+// Return:	int - status code
+
+int nvme_start_request(blk_hw_queue_t *hw_queue, request_t *request)
+{
+	blkdev_nvme_t *info = (blkdev_nvme_t*)&blkdevs[request->queue->device].data[0];
+	nvme_t *nvme = info->nvme;
+	nvme_queue_t *queue = &nvme->queues[hw_queue->index];
+
+	if(request->lba + request->count > nvme->sectors)
+		return BLKDEV_IO;
+
+	// only one CPU starts requests on a queue at a time
+	nvme_command_t *command = &queue->sq[queue->sq_tail];
+	memset(command, 0, sizeof(nvme_command_t));
+	command->cdw0 = ((request->operation == BIO_WRITE) ? NVME_CMD_WRITE : NVME_CMD_READ) | ((uint32_t)request->tag << 16);
+	command->nsid = nvme->namespace;
+	command->cdw10 = request->lba & 0xFFFFFFFF;
+	command->cdw11 = request->lba >> 32;
+	command->cdw12 = request->count - 1;
+
+	uint8_t *list = queue->lists + (request->tag * PAGE_SIZE);
+	size_t list_physical = queue->lists_physical + (request->tag * PAGE_SIZE);
+	uint64_t *prps = (uint64_t*)list;
+	nvme_sgl_t *sgls = (nvme_sgl_t*)list;
+	size_t count = 0;
+	int aligned = 1;
+
+	size_t virtual, remaining, segment;
+	uint64_t physical;
+	bio_t *bio = request->bio_head;
+
+	// each page of the buffers, which SGLs merge when they're contiguous
+	while(bio)
+	{
+		virtual = (size_t)bio->buffer;
+		remaining = bio->count * nvme->sector_size;
+
+		while(remaining)
+		{
+			segment = PAGE_SIZE - (virtual & (PAGE_SIZE-1));
+			if(segment > remaining)
+				segment = remaining;
+
+			physical = (vmm_get_page(virtual & ~(PAGE_SIZE-1)) & ~(PAGE_SIZE-1)) + (virtual & (PAGE_SIZE-1));
+
+			if(nvme->sgl)
+			{
+				if(count && sgls[count-1].address + sgls[count-1].length == physical)
+					sgls[count-1].length += segment;
+				else
+				{
+					if(count >= NVME_MAX_SEGMENTS)
+						return BLKDEV_IO;
+
+					sgls[count].address = physical;
+					sgls[count].length = segment;
+					sgls[count].type = NVME_SGL_DATA;
+					count++;
+				}
+			} else
+			{
+				// the first PRP can start anywhere, and the rest are whole
+				// pages up to the last one
+				if(!count)
+					command->prp1 = physical;
+				else
+				{
+					if(!aligned || (physical & (PAGE_SIZE-1)) || count > PAGE_SIZE / sizeof(uint64_t))
+						return BLKDEV_IO;
+
+					prps[count-1] = physical;
+				}
+
+				aligned = !((physical + segment) & (PAGE_SIZE-1));
+				count++;
+			}
+
+			virtual += segment;
+			remaining -= segment;
+		}
+
+		bio = bio->next;
+	}
+
+	if(nvme->sgl)
+	{
+		command->cdw0 |= NVME_PSDT_SGL;
+		if(count == 1)
+		{
+			// one segment fits in the command
+			command->prp1 = sgls[0].address;
+			command->prp2 = sgls[0].length | ((uint64_t)NVME_SGL_DATA << 56);
+		} else
+		{
+			command->prp1 = list_physical;
+			command->prp2 = (count * sizeof(nvme_sgl_t)) | ((uint64_t)NVME_SGL_LAST_SEGMENT << 56);
+		}
+	} else
+	{
+		if(count == 2)
+			command->prp2 = prps[0];
+		else if(count > 2)
+			command->prp2 = list_physical;
+	}
+
+	queue->sq_tail = (queue->sq_tail + 1) % queue->size;
+	return 0;
+}
+
+// nvme_commit(): Rings the doorbell of a queue, once for everything that was started
+// Param:	blk_hw_queue_t *hw_queue - hardware queue, which is a queue pair
+// Return:	Nothing
+
+void nvme_commit(blk_hw_queue_t *hw_queue)
+{
+	blkdev_nvme_t *info = (blkdev_nvme_t*)&blkdevs[hw_queue->queue->device].data[0];
+	nvme_queue_t *queue = &info->nvme->queues[hw_queue->index];
+
+	if(queue->sq_tail == queue->sq_committed)
+		return;
+
+	memory_barrier();
+	*queue->sq_doorbell = queue->sq_tail;
+	queue->sq_committed = queue->sq_tail;
+}
+
+// nvme_poll(): Finishes requests the controller is done with
+// Param:	blk_hw_queue_t *hw_queue - hardware queue, which is a queue pair
+// Return:	int - requests finished
+
+int nvme_poll(blk_hw_queue_t *hw_queue)
+{
+	blkdev_nvme_t *info = (blkdev_nvme_t*)&blkdevs[hw_queue->queue->device].data[0];
+	nvme_queue_t *queue = &info->nvme->queues[hw_queue->index];
+	volatile nvme_completion_t *completion;
+	request_t *request;
+	int count = 0;
+	int status;
+
+	do
+	{
+		// whoever is already polling the queue will see the rest
+		if(atomic_xchg(&queue->polling, 1))
+			return count;
+
+		completion = &queue->cq[queue->cq_head];
+		while((completion->status & 1) == queue->phase)
+		{
+			memory_barrier();
+			request = hw_queue->tags[completion->id];
+			status = completion->status >> 1;
+
+			queue->cq_head++;
+			if(queue->cq_head >= queue->size)
+			{
+				queue->cq_head = 0;
+				queue->phase ^= 1;
+			}
+
+			blkdev_end_request(request, status ? BLKDEV_IO : 0);
+			count++;
+			completion = &queue->cq[queue->cq_head];
+		}
+
+		// the completion queue can't fill up, because the submission
+		// queue is always one entry short, so once is enough
+		if(count)
+			*queue->cq_doorbell = queue->cq_head;
+
+		release_lock(&queue->polling);
+		memory_barrier();
+	} while((queue->cq[queue->cq_head].status & 1) == queue->phase);
+
+	return count;
+}
+
@@ -0,0 +1,784 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <blkdev.h>
+#include <mm.h>
+#include <lock.h>
+#include <cpu.h>
+#include <apic.h>
+#include <string.h>
+#include <kprintf.h>
+
+// Request Queues
+// Everything that reads or writes a block device goes through here as bios.
+// Each CPU has its own software queue for each device, so CPUs submitting
+// at the same time never share a lock. A bio joins the request it carries on
+// from if it can, so the driver gets as few transfers as possible. A CPU
+// that's about to submit several bios can plug itself first, so they collect
+// and merge there, sorted, before any of them reach a queue.
+// A device has one or more hardware queues, each fed by the software queues
+// of a group of CPUs, and each lets its driver have up to depth requests at
+// once, known by their tags. A driver with a commit() function is told once
+// it has been given everything that's waiting, so it can tell the device
+// about all of it at once. The driver ends each request with
+// blkdev_end_request(), which frees its tag, starts whatever was waiting
+// behind it, and hands the request back to the CPU that submitted it, so its
+// bios complete where their memory is hot.
+// Nothing here can be used from an IRQ handler, because the locks don't
+// disable IRQs; drivers finish their requests from their poll() function,
+// which whoever is waiting and the idle loop of each AP call. A driver that
+// can interrupt when requests finish does it on BLKDEV_VECTOR, which only
+// wakes the CPU so it polls again; the others keep their CPUs from halting
+// while they have anything in flight.
+
+size_t blkdev_segments(request_queue_t *, bio_t *);
+int blkdev_adjacent(request_queue_t *, bio_t *, bio_t *);
+int blkdev_merge(request_t *, bio_t *, request_queue_t *);
+request_t *blkdev_new_request(request_queue_t *, bio_t *);
+void blkdev_sw_add(blk_sw_queue_t *, request_t *, request_queue_t *);
+request_t *blkdev_take(blk_hw_queue_t *);
+void blkdev_end_bio(bio_t *, int);
+void blkdev_complete(request_t *);
+size_t blkdev_reap(blk_sw_queue_t *);
+void blkdev_wake(void *);
+void blkdev_flush_plug(blk_plug_t *);
+
+// blkdev_set_driver(): Hands a block device to the driver that does its I/O
+// Param:	dev_t device - device, registered with its count of hardware queues
+// Param:	const blkdev_ops_t *ops - what the driver does with requests
+// Param:	size_t depth - requests each hardware queue can have at once, 0 for the default
+// Param:	size_t max_sectors - sectors in one request, 0 for the default
+// Param:	size_t max_segments - pages the buffers of one request can span, 0 for any
+// Return:	Nothing
+
+void blkdev_set_driver(dev_t device, const blkdev_ops_t *ops, size_t depth, size_t max_sectors, size_t max_segments)
+{
+	request_queue_t *queue = &blkdev_queues[device];
+	size_t cpu_count = lapic_count;
+	size_t count = blkdevs[device].hw_queues;
+
+	// more hardware queues than CPUs wouldn't be used
+	if(!count)
+		count = 1;
+	if(count > cpu_count)
+		count = cpu_count;
+	if(count > BLKDEV_MAX_HW_QUEUES)
+		count = BLKDEV_MAX_HW_QUEUES;
+
+	if(!depth)
+		depth = BLKDEV_QUEUE_DEPTH;
+
+	queue->max_sectors = max_sectors ? max_sectors : BLKDEV_MAX_SECTORS;
+	queue->max_segments = max_segments;
+	queue->hw_queue_count = count;
+	queue->hw_queues = kcalloc(sizeof(blk_hw_queue_t), count);
+	queue->sw_queues = kcalloc(sizeof(blk_sw_queue_t), cpu_count);
+
+	// each hardware queue takes a run of CPUs, which are usually close
+	// to each other
+	blk_hw_queue_t *hw_queue;
+	size_t i, cpu;
+	for(i = 0; i < count; i++)
+	{
+		hw_queue = &queue->hw_queues[i];
+		hw_queue->queue = queue;
+		hw_queue->index = i;
+		hw_queue->depth = depth;
+		hw_queue->max_depth = depth;
+		hw_queue->tags = kcalloc(sizeof(request_t *), depth);
+		hw_queue->first_cpu = (i * cpu_count) / count;
+		hw_queue->cpu_count = (((i + 1) * cpu_count) / count) - hw_queue->first_cpu;
+
+		for(cpu = hw_queue->first_cpu; cpu < hw_queue->first_cpu + hw_queue->cpu_count; cpu++)
+			queue->sw_queues[cpu].hw_queue = hw_queue;
+	}
+
+	// nothing can be submitted until everything above is there
+	memory_barrier();
+	queue->ops = ops;
+
+	kprintf("blkdev: device %d has %d hardware queues, depth %d, up to %d sectors per request\n", device, count, depth, queue->max_sectors);
+}
+
+// blkdev_queue_depth(): Returns the queue depth of a block device
+// Param:	dev_t device - device
+// Return:	size_t - requests each hardware queue can have at once, 0 if there's no driver
+
+size_t blkdev_queue_depth(dev_t device)
+{
+	if(device >= MAX_BLKDEVS || !blkdev_queues[device].ops)
+		return 0;
+
+	return blkdev_queues[device].hw_queues[0].depth;
+}
+
+// blkdev_set_queue_depth(): Changes the queue depth of a block device
+// Param:	dev_t device - device
+// Param:	size_t depth - requests each hardware queue can have at once, up to what the driver set
+// Return:	int - status code
+
+int blkdev_set_queue_depth(dev_t device, size_t depth)
+{
+	if(device >= MAX_BLKDEVS || !blkdev_queues[device].ops)
+		return BLKDEV_NODEV;
+
+	request_queue_t *queue = &blkdev_queues[device];
+	if(!depth || depth > queue->hw_queues[0].max_depth)
+		return BLKDEV_IO;
+
+	size_t i;
+	for(i = 0; i < queue->hw_queue_count; i++)
+	{
+		acquire_lock(&queue->hw_queues[i].lock);
+		queue->hw_queues[i].depth = depth;
+		release_lock(&queue->hw_queues[i].lock);
+
+		// a deeper queue can take more now
+		blkdev_run_hw_queue(&queue->hw_queues[i]);
+	}
+
+	return 0;
+}
+
+// blkdev_segments(): Returns how many pages the buffer of a bio spans
+// Param:	request_queue_t *queue - queue of the bio's device
+// Param:	bio_t *bio - bio
+// Return:	size_t - pages, each of which the driver might need a segment for
+
+size_t blkdev_segments(request_queue_t *queue, bio_t *bio)
+{
+	size_t bytes = bio->count * blkdevs[queue->device].sector_size;
+	return (((size_t)bio->buffer & (PAGE_SIZE-1)) + bytes + PAGE_SIZE - 1) >> PAGE_SIZE_SHIFT;
+}
+
+// blkdev_adjacent(): Checks if the buffers of two bios can meet in one request
+// Param:	request_queue_t *queue - queue of their device
+// Param:	bio_t *first - bio that comes first on the disk
+// Param:	bio_t *second - bio right after it
+// Return:	int - 1 if they can
+
+int blkdev_adjacent(request_queue_t *queue, bio_t *first, bio_t *second)
+{
+	if(!queue->boundary)
+		return 1;
+
+	size_t end = (size_t)first->buffer + (first->count * blkdevs[queue->device].sector_size);
+	return !((end | (size_t)second->buffer) & (queue->boundary - 1));
+}
+
+// blkdev_merge(): Adds a bio to a request it's next to on the disk
+// Param:	request_t *request - request
+// Param:	bio_t *bio - bio
+// Param:	request_queue_t *queue - queue, with the size limits of the request
+// Return:	int - 1 if the bio was merged
+
+int blkdev_merge(request_t *request, bio_t *bio, request_queue_t *queue)
+{
+	if(request->operation != bio->operation || request->count + bio->count > queue->max_sectors)
+		return 0;
+
+	size_t segments = blkdev_segments(queue, bio);
+	if(queue->max_segments && request->segments + segments > queue->max_segments)
+		return 0;
+
+	// back merge, the bio carries on where the request ends
+	if(request->lba + request->count == bio->lba && blkdev_adjacent(queue, request->bio_tail, bio))
+	{
+		bio->next = NULL;
+		request->bio_tail->next = bio;
+		request->bio_tail = bio;
+		request->count += bio->count;
+		request->segments += segments;
+		return 1;
+	}
+
+	// front merge, the bio ends where the request starts
+	if(bio->lba + bio->count == request->lba && blkdev_adjacent(queue, bio, request->bio_head))
+	{
+		bio->next = request->bio_head;
+		request->bio_head = bio;
+		request->lba = bio->lba;
+		request->count += bio->count;
+		request->segments += segments;
+		return 1;
+	}
+
+	return 0;
+}
+
+// blkdev_new_request(): Makes a request out of one bio, on the current CPU
+// Param:	request_queue_t *queue - queue of the bio's device
+// Param:	bio_t *bio - bio
+// Return:	request_t * - request
+
+request_t *blkdev_new_request(request_queue_t *queue, bio_t *bio)
+{
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+
+	request_t *request = kcalloc(sizeof(request_t), 1);
+	request->queue = queue;
+	request->cpu = cpu->index;
+	request->operation = bio->operation;
+	request->lba = bio->lba;
+	request->count = bio->count;
+	request->segments = blkdev_segments(queue, bio);
+	request->bio_head = bio;
+	request->bio_tail = bio;
+	bio->next = NULL;
+	return request;
+}
+
+// blkdev_sw_add(): Puts a request on a software queue, merging it if it can
+// Param:	blk_sw_queue_t *sw_queue - software queue, locked
+// Param:	request_t *request - request
+// Param:	request_queue_t *queue - queue, with the size limits of requests
+// Return:	Nothing
+
+void blkdev_sw_add(blk_sw_queue_t *sw_queue, request_t *request, request_queue_t *queue)
+{
+	// a request usually carries on from the last one
+	request_t *last = sw_queue->tail;
+	if(last && last->operation == request->operation && last->lba + last->count == request->lba && last->count + request->count <= queue->max_sectors
+		&& (!queue->max_segments || last->segments + request->segments <= queue->max_segments)
+		&& blkdev_adjacent(queue, last->bio_tail, request->bio_head))
+	{
+		last->bio_tail->next = request->bio_head;
+		last->bio_tail = request->bio_tail;
+		last->count += request->count;
+		last->segments += request->segments;
+		sw_queue->merge_count++;
+		kfree(request);
+		return;
+	}
+
+	request->next = NULL;
+	if(sw_queue->tail)
+		sw_queue->tail->next = request;
+	else
+		sw_queue->head = request;
+
+	sw_queue->tail = request;
+}
+
+// blkdev_submit(): Starts a bio, which completes whenever the device is done
+// Param:	bio_t *bio - bio, which belongs to the block layer until it completes
+// Return:	Nothing
+
+void blkdev_submit(bio_t *bio)
+{
+	bio->status = 0;
+	bio->done = 0;
+	bio->next = NULL;
+
+	if(bio->device >= MAX_BLKDEVS || !blkdev_queues[bio->device].ops)
+	{
+		kprintf("blkdev: I/O on non-present device %d, LBA 0x%xq count %d\n", bio->device, bio->lba, bio->count);
+		blkdev_end_bio(bio, BLKDEV_NODEV);
+		return;
+	}
+
+	request_queue_t *queue = &blkdev_queues[bio->device];
+	if(!bio->count || bio->count > queue->max_sectors || (queue->max_segments && blkdev_segments(queue, bio) > queue->max_segments))
+	{
+		blkdev_end_bio(bio, BLKDEV_IO);
+		return;
+	}
+
+	// only this CPU changes the statistics of its own software queue
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	blk_sw_queue_t *sw_queue = &queue->sw_queues[cpu->index];
+	blk_plug_t *plug = cpu->plug;
+	request_t *request;
+
+	sw_queue->bio_count++;
+
+	if(plug)
+	{
+		// merge with anything the plug already has for the device
+		request = plug->head;
+		while(request)
+		{
+			if(request->queue == queue && blkdev_merge(request, bio, queue))
+			{
+				sw_queue->merge_count++;
+				return;
+			}
+
+			request = request->next;
+		}
+
+		request = blkdev_new_request(queue, bio);
+		if(plug->tail)
+			plug->tail->next = request;
+		else
+			plug->head = request;
+
+		plug->tail = request;
+		plug->count++;
+
+		if(plug->count >= BLKDEV_PLUG_MAX)
+			blkdev_flush_plug(plug);
+
+		return;
+	}
+
+	request = blkdev_new_request(queue, bio);
+
+	acquire_lock(&sw_queue->lock);
+	blkdev_sw_add(sw_queue, request, queue);
+	release_lock(&sw_queue->lock);
+
+	blkdev_run_hw_queue(sw_queue->hw_queue);
+}
+
+// blkdev_take(): Takes the next request for a hardware queue
+// Param:	blk_hw_queue_t *hw_queue - hardware queue, locked
+// Return:	request_t * - request, NULL if nothing is waiting
+
+request_t *blkdev_take(blk_hw_queue_t *hw_queue)
+{
+	request_queue_t *queue = hw_queue->queue;
+	blk_sw_queue_t *sw_queue;
+	request_t *request;
+	size_t i, cpu;
+
+	// the CPUs take turns, so none of them can hog the device
+	for(i = 0; i < hw_queue->cpu_count; i++)
+	{
+		cpu = hw_queue->first_cpu + ((hw_queue->next_cpu + i) % hw_queue->cpu_count);
+		sw_queue = &queue->sw_queues[cpu];
+		if(!sw_queue->head)
+			continue;
+
+		acquire_lock(&sw_queue->lock);
+		request = sw_queue->head;
+		if(request)
+		{
+			sw_queue->head = request->next;
+			if(!sw_queue->head)
+				sw_queue->tail = NULL;
+		}
+
+		release_lock(&sw_queue->lock);
+
+		if(request)
+		{
+			hw_queue->next_cpu = (cpu - hw_queue->first_cpu + 1) % hw_queue->cpu_count;
+			request->next = NULL;
+			return request;
+		}
+	}
+
+	return NULL;
+}
+
+// blkdev_run_hw_queue(): Hands waiting requests to the driver, as many as it can take
+// Param:	blk_hw_queue_t *hw_queue - hardware queue
+// Return:	Nothing
+
+void blkdev_run_hw_queue(blk_hw_queue_t *hw_queue)
+{
+	request_queue_t *queue = hw_queue->queue;
+	blk_sw_queue_t *sw_queue;
+	request_t *request;
+	int status;
+	size_t started;
+
+	acquire_lock(&hw_queue->lock);
+
+	// whoever is running it sees anything that changes while it does,
+	// because it looks again with the lock held every time
+	if(hw_queue->running)
+	{
+		release_lock(&hw_queue->lock);
+		return;
+	}
+
+	hw_queue->running = 1;
+
+	// drivers that can tell the device about several requests at once do
+	// it after starting as many as they can, then we look for more
+	do
+	{
+		started = 0;
+		while(hw_queue->in_flight < hw_queue->depth)
+		{
+			request = blkdev_take(hw_queue);
+			if(!request)
+				break;
+
+			// there's always a free tag while there's room
+			while(hw_queue->tags[hw_queue->next_tag])
+				hw_queue->next_tag = (hw_queue->next_tag + 1) % hw_queue->max_depth;
+
+			request->hw_queue = hw_queue;
+			request->tag = hw_queue->next_tag;
+			hw_queue->tags[request->tag] = request;
+			hw_queue->next_tag = (hw_queue->next_tag + 1) % hw_queue->max_depth;
+			hw_queue->in_flight++;
+			hw_queue->request_count++;
+			release_lock(&hw_queue->lock);
+
+			status = queue->ops->start(hw_queue, request);
+
+			acquire_lock(&hw_queue->lock);
+			if(status == BLKDEV_BUSY)
+			{
+				// it goes back first, and waits for something to finish
+				hw_queue->tags[request->tag] = NULL;
+				hw_queue->in_flight--;
+				hw_queue->request_count--;
+
+				sw_queue = &queue->sw_queues[request->cpu];
+				acquire_lock(&sw_queue->lock);
+				request->next = sw_queue->head;
+				sw_queue->head = request;
+				if(!sw_queue->tail)
+					sw_queue->tail = request;
+
+				release_lock(&sw_queue->lock);
+				break;
+			}
+
+			if(status != 0)
+			{
+				release_lock(&hw_queue->lock);
+				blkdev_end_request(request, status);
+				acquire_lock(&hw_queue->lock);
+			}
+			else
+				started++;
+		}
+
+		if(started && queue->ops->commit)
+		{
+			release_lock(&hw_queue->lock);
+			queue->ops->commit(hw_queue);
+			acquire_lock(&hw_queue->lock);
+		}
+	} while(started && queue->ops->commit);
+
+	hw_queue->running = 0;
+	release_lock(&hw_queue->lock);
+}
+
+// blkdev_end_request(): Completes a request, called by the driver when it's done
+// Param:	request_t *request - request
+// Param:	int status - status code of the whole request
+// Return:	Nothing
+
+void blkdev_end_request(request_t *request, int status)
+{
+	blk_hw_queue_t *hw_queue = request->hw_queue;
+
+	acquire_lock(&hw_queue->lock);
+	hw_queue->tags[request->tag] = NULL;
+	hw_queue->in_flight--;
+	release_lock(&hw_queue->lock);
+
+	request->status = status;
+
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	blk_sw_queue_t *sw_queue;
+	request_t *old;
+
+	if(request->cpu == cpu->index)
+		blkdev_complete(request);
+	else
+	{
+		sw_queue = &request->queue->sw_queues[request->cpu];
+		do
+		{
+			old = sw_queue->completed;
+			request->next = old;
+		} while(atomic_cmpxchg(&sw_queue->completed, old, request) != old);
+
+		// the CPU might be halted, and only the first one has to wake it
+		if(!old)
+			smp_call_function_single(request->cpu, &blkdev_wake, NULL, 0);
+	}
+
+	blkdev_run_hw_queue(hw_queue);
+}
+
+// blkdev_wake(): Wakes a CPU up to complete its requests, which it does outside the IPI
+// Param:	void *argument - unused
+// Return:	Nothing
+
+void blkdev_wake(void *argument)
+{
+}
+
+// blkdev_complete(): Completes the bios of a request on the CPU that submitted it
+// Param:	request_t *request - request, which the driver is done with
+// Return:	Nothing
+
+void blkdev_complete(request_t *request)
+{
+	bio_t *bio = request->bio_head;
+	bio_t *next;
+
+	while(bio)
+	{
+		next = bio->next;
+		blkdev_end_bio(bio, request->status);
+		bio = next;
+	}
+
+	kfree(request);
+}
+
+// blkdev_reap(): Completes requests other CPUs finished for this one
+// Param:	blk_sw_queue_t *sw_queue - software queue of this CPU
+// Return:	size_t - requests completed
+
+size_t blkdev_reap(blk_sw_queue_t *sw_queue)
+{
+	if(!sw_queue->completed)
+		return 0;
+
+	request_t *list = atomic_xchg(&sw_queue->completed, NULL);
+
+	// the list is a stack, so reverse it to complete them in order
+	request_t *ordered = NULL;
+	request_t *next;
+	while(list)
+	{
+		next = list->next;
+		list->next = ordered;
+		ordered = list;
+		list = next;
+	}
+
+	size_t count = 0;
+	while(ordered)
+	{
+		next = ordered->next;
+		blkdev_complete(ordered);
+		ordered = next;
+		count++;
+	}
+
+	return count;
+}
+
+// blkdev_end_bio(): Completes a bio
+// Param:	bio_t *bio - bio
+// Param:	int status - status code
+// Return:	Nothing
+
+void blkdev_end_bio(bio_t *bio, int status)
+{
+	bio->status = status;
+	bio->next = NULL;
+
+	if(bio->end)
+	{
+		bio->end(bio);
+		return;
+	}
+
+	memory_barrier();
+	bio->done = 1;
+}
+
+// blkdev_wait(): Waits for a bio without a completion function, on the CPU that submitted it
+// Param:	bio_t *bio - bio
+// Return:	int - status code of the bio
+
+int blkdev_wait(bio_t *bio)
+{
+	// bios held back by this CPU would never get anywhere
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	if(cpu->plug)
+		blkdev_flush_plug(cpu->plug);
+
+	request_queue_t *queue = NULL;
+	blk_sw_queue_t *sw_queue = NULL;
+	if(bio->device < MAX_BLKDEVS && blkdev_queues[bio->device].ops)
+	{
+		queue = &blkdev_queues[bio->device];
+		sw_queue = &queue->sw_queues[cpu->index];
+	}
+
+	// there's no scheduler to block on yet
+	while(!bio->done)
+	{
+		if(sw_queue && blkdev_reap(sw_queue))
+			continue;
+
+		if(sw_queue && queue->ops->poll && sw_queue->hw_queue->in_flight)
+			queue->ops->poll(sw_queue->hw_queue);
+		else
+			asm volatile ("pause");
+	}
+
+	return bio->status;
+}
+
+// blkdev_poll(): Completes finished requests, called from the idle loop of each AP
+// Param:	size_t index - CPU index
+// Return:	int - 1 if anything was completed
+
+int blkdev_poll(size_t index)
+{
+	request_queue_t *queue;
+	blk_sw_queue_t *sw_queue;
+	size_t device, count = 0;
+
+	// APs start before there are any block devices
+	if(!blkdev_queues)
+		return 0;
+
+	// whatever interrupted us is looked at below
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	cpu->blkdev_irq = 0;
+
+	for(device = 0; device < MAX_BLKDEVS; device++)
+	{
+		queue = &blkdev_queues[device];
+		if(!queue->ops)
+			continue;
+
+		sw_queue = &queue->sw_queues[index];
+		count += blkdev_reap(sw_queue);
+
+		if(queue->ops->poll && sw_queue->hw_queue->in_flight)
+			count += queue->ops->poll(sw_queue->hw_queue);
+	}
+
+	return count != 0;
+}
+
+// blkdev_sleep(): Checks that nothing is waiting to complete on the polling CPU
+// Called with interrupts disabled, so a wakeup can't come before the HLT
+// Param:	size_t index - CPU index
+// Return:	int - 1 if the CPU can halt
+
+int blkdev_sleep(size_t index)
+{
+	request_queue_t *queue;
+	blk_hw_queue_t *hw_queue;
+	size_t device;
+
+	if(!blkdev_queues)
+		return 1;
+
+	// the interrupt that was meant to wake us up might have come already
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	if(cpu->blkdev_irq)
+		return 0;
+
+	for(device = 0; device < MAX_BLKDEVS; device++)
+	{
+		queue = &blkdev_queues[device];
+		if(!queue->ops)
+			continue;
+
+		// and so might the IPI
+		if(queue->sw_queues[index].completed)
+			return 0;
+
+		// nothing would wake us up for a driver that can't interrupt
+		hw_queue = queue->sw_queues[index].hw_queue;
+		if(hw_queue->in_flight && !hw_queue->wakes)
+			return 0;
+	}
+
+	return 1;
+}
+
+// blkdev_irq(): Interrupt handler of block devices, which only wakes the CPU up
+// Param:	Nothing
+// Return:	Nothing
+
+void blkdev_irq()
+{
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	cpu->blkdev_irq = 1;
+	lapic_eoi();
+}
+
+// blkdev_start_plug(): Holds back bios submitted by this CPU until the plug is finished
+// Plugs inside plugs do nothing, and the outermost one is flushed
+// Param:	blk_plug_t *plug - plug, usually on the stack
+// Return:	Nothing
+
+void blkdev_start_plug(blk_plug_t *plug)
+{
+	plug->head = NULL;
+	plug->tail = NULL;
+	plug->count = 0;
+
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	if(!cpu->plug)
+		cpu->plug = plug;
+}
+
+// blkdev_finish_plug(): Lets everything a plug held back go to the drivers
+// Param:	blk_plug_t *plug - plug
+// Return:	Nothing
+
+void blkdev_finish_plug(blk_plug_t *plug)
+{
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	if(cpu->plug != plug)
+		return;
+
+	blkdev_flush_plug(plug);
+	cpu->plug = NULL;
+}
+
+// blkdev_flush_plug(): Moves the requests of a plug to their queues, sorted
+// Param:	blk_plug_t *plug - plug
+// Return:	Nothing
+
+void blkdev_flush_plug(blk_plug_t *plug)
+{
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	request_t *list = plug->head;
+	request_t *sorted = NULL;
+	request_t *request, **link;
+	request_queue_t *queue;
+	blk_sw_queue_t *sw_queue;
+
+	plug->head = NULL;
+	plug->tail = NULL;
+	plug->count = 0;
+
+	// sort by device and LBA, so each queue gets its requests in one go
+	// and in disk order, where they can merge with each other
+	while(list)
+	{
+		request = list;
+		list = list->next;
+
+		link = &sorted;
+		while(*link && ((*link)->queue->device < request->queue->device || ((*link)->queue == request->queue && (*link)->lba <= request->lba)))
+			link = &(*link)->next;
+
+		request->next = *link;
+		*link = request;
+	}
+
+	while(sorted)
+	{
+		queue = sorted->queue;
+		sw_queue = &queue->sw_queues[cpu->index];
+
+		acquire_lock(&sw_queue->lock);
+		while(sorted && sorted->queue == queue)
+		{
+			request = sorted;
+			sorted = sorted->next;
+			blkdev_sw_add(sw_queue, request, queue);
+		}
+
+		release_lock(&sw_queue->lock);
+		blkdev_run_hw_queue(sw_queue->hw_queue);
+	}
+}
+
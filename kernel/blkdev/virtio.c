@@ -0,0 +1,493 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <virtio.h>
+#include <blkdev.h>
+#include <pci.h>
+#include <mm.h>
+#include <apic.h>
+#include <devfs.h>
+#include <devmgr.h>
+#include <lock.h>
+#include <string.h>
+#include <kprintf.h>
+
+// virtio-blk
+// Modern (virtio 1.x) PCI devices with split virtqueues, one for each
+// hardware queue of the block layer when the device has several. Every
+// request is one indirect descriptor, whose table, header and status byte
+// live in a page of their own for each tag, so descriptors are never
+// allocated and the tag is the descriptor number the device hands back.
+// With EVENT_IDX, the device is only notified when it's about to run out of
+// requests, and it only interrupts when it finishes the request we said we'd
+// look at next. Interrupts go to the last CPU of each queue's group and only
+// wake it up; requests are finished by polling, like everything else.
+
+size_t virtio_blk_count = 0;
+
+int virtio_blk_setup(pci_device_t *);
+int virtio_blk_setup_queue(virtio_blk_t *, size_t, int *);
+int virtio_blk_start_request(blk_hw_queue_t *, request_t *);
+int virtio_blk_poll(blk_hw_queue_t *);
+
+const blkdev_ops_t virtio_blk_ops = {
+	.start = &virtio_blk_start_request,
+	.poll = &virtio_blk_poll,
+};
+
+// virtio_blk_init(): Detects virtio block devices
+// Param:	Nothing
+// Return:	Nothing
+
+void virtio_blk_init()
+{
+	pci_device_t *pci;
+	size_t i;
+
+	for(i = 0; (pci = pci_find(VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, i)) && virtio_blk_count < MAX_VIRTIO_BLK; i++)
+		virtio_blk_setup(pci);
+
+	for(i = 0; (pci = pci_find(VIRTIO_VENDOR, VIRTIO_BLK_TRANSITIONAL, i)) && virtio_blk_count < MAX_VIRTIO_BLK; i++)
+		virtio_blk_setup(pci);
+}
+
+// virtio_blk_setup(): Starts up a virtio block device
+// Param:	pci_device_t *pci - PCI function
+// Return:	int - 0 on success
+
+int virtio_blk_setup(pci_device_t *pci)
+{
+	virtio_blk_t *virtio = kcalloc(sizeof(virtio_blk_t), 1);
+	virtio->pci = pci;
+
+	// find the structures the device has in its BARs
+	uint8_t cap = 0;
+	uint8_t type, bar;
+	uint32_t offset, length;
+
+	while((cap = pci_find_capability(pci, PCI_CAP_VENDOR, cap)))
+	{
+		type = pci_read8(pci, cap + VIRTIO_CAP_TYPE);
+		bar = pci_read8(pci, cap + VIRTIO_CAP_BAR);
+		offset = pci_read(pci, cap + VIRTIO_CAP_OFFSET);
+		length = pci_read(pci, cap + VIRTIO_CAP_LENGTH);
+
+		if(type == VIRTIO_CAP_COMMON && !virtio->common)
+			virtio->common = pci_map(pci, bar, offset, length);
+		else if(type == VIRTIO_CAP_DEVICE && !virtio->config)
+			virtio->config = pci_map(pci, bar, offset, length);
+		else if(type == VIRTIO_CAP_NOTIFY && !virtio->notify_base)
+		{
+			virtio->notify_base = pci_map(pci, bar, offset, length);
+			virtio->notify_multiplier = pci_read(pci, cap + VIRTIO_CAP_NOTIFY_MULTIPLIER);
+		}
+	}
+
+	if(!virtio->common || !virtio->config || !virtio->notify_base)
+	{
+		kprintf("virtio: device at %d:%d:%d is not a modern device, ignoring\n", pci->bus, pci->slot, pci->function);
+		kfree(virtio);
+		return -1;
+	}
+
+	pci_enable(pci);
+
+	volatile uint8_t *status = virtio->common + VIRTIO_STATUS;
+
+	// reset, which is done when it reads back as zero
+	*status = 0;
+	while(*status)
+		asm volatile ("pause");
+
+	*status = VIRTIO_STATUS_ACKNOWLEDGE;
+	*status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER;
+
+	*(volatile uint32_t*)(virtio->common + VIRTIO_DEVICE_FEATURE_SELECT) = 0;
+	uint64_t features = *(volatile uint32_t*)(virtio->common + VIRTIO_DEVICE_FEATURE);
+	*(volatile uint32_t*)(virtio->common + VIRTIO_DEVICE_FEATURE_SELECT) = 1;
+	features |= (uint64_t)*(volatile uint32_t*)(virtio->common + VIRTIO_DEVICE_FEATURE) << 32;
+
+	// without indirect descriptors, a queue would only take a few requests
+	uint64_t required = VIRTIO_F_VERSION_1 | VIRTIO_F_INDIRECT_DESC;
+	if((features & required) != required)
+	{
+		kprintf("virtio: device at %d:%d:%d is missing required features, ignoring\n", pci->bus, pci->slot, pci->function);
+		*status = VIRTIO_STATUS_FAILED;
+		kfree(virtio);
+		return -1;
+	}
+
+	// without FLUSH the device has no write cache to lose, so writes are
+	// safe once they finish, which is what fsync() expects
+	virtio->features = features & (required | VIRTIO_F_EVENT_IDX | VIRTIO_BLK_F_MQ | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO);
+
+	*(volatile uint32_t*)(virtio->common + VIRTIO_DRIVER_FEATURE_SELECT) = 0;
+	*(volatile uint32_t*)(virtio->common + VIRTIO_DRIVER_FEATURE) = virtio->features & 0xFFFFFFFF;
+	*(volatile uint32_t*)(virtio->common + VIRTIO_DRIVER_FEATURE_SELECT) = 1;
+	*(volatile uint32_t*)(virtio->common + VIRTIO_DRIVER_FEATURE) = virtio->features >> 32;
+
+	*status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK;
+	if(!(*status & VIRTIO_STATUS_FEATURES_OK))
+	{
+		kprintf("virtio: device at %d:%d:%d didn't accept features, ignoring\n", pci->bus, pci->slot, pci->function);
+		*status = VIRTIO_STATUS_FAILED;
+		kfree(virtio);
+		return -1;
+	}
+
+	// the capacity is two dwords, which could change in between
+	uint32_t high;
+	do
+	{
+		high = *(volatile uint32_t*)(virtio->config + VIRTIO_BLK_CAPACITY + 4);
+		virtio->capacity = *(volatile uint32_t*)(virtio->config + VIRTIO_BLK_CAPACITY);
+	} while(high != *(volatile uint32_t*)(virtio->config + VIRTIO_BLK_CAPACITY + 4));
+
+	virtio->capacity |= (uint64_t)high << 32;
+
+	virtio->max_segments = VIRTIO_BLK_MAX_SEGMENTS;
+	if(virtio->features & VIRTIO_BLK_F_SEG_MAX)
+	{
+		size_t seg_max = *(volatile uint32_t*)(virtio->config + VIRTIO_BLK_SEG_MAX);
+		if(seg_max && seg_max < virtio->max_segments)
+			virtio->max_segments = seg_max;
+	}
+
+	// any buffer of a whole request has to fit, wherever it starts
+	if(virtio->max_segments < 2)
+	{
+		kprintf("virtio: device at %d:%d:%d takes too few segments, ignoring\n", pci->bus, pci->slot, pci->function);
+		*status = VIRTIO_STATUS_FAILED;
+		kfree(virtio);
+		return -1;
+	}
+
+	size_t max_sectors = ((virtio->max_segments - 1) * PAGE_SIZE) / VIRTIO_BLK_SECTOR_SIZE;
+	if(max_sectors > BLKDEV_MAX_SECTORS)
+		max_sectors = BLKDEV_MAX_SECTORS;
+
+	// one queue for each CPU, if it has that many, and each needs its own interrupt
+	virtio->queue_count = 1;
+	if(virtio->features & VIRTIO_BLK_F_MQ)
+		virtio->queue_count = *(volatile uint16_t*)(virtio->config + VIRTIO_BLK_NUM_QUEUES);
+
+	if(!virtio->queue_count)
+		virtio->queue_count = 1;
+	if(virtio->queue_count > lapic_count)
+		virtio->queue_count = lapic_count;
+	if(virtio->queue_count > BLKDEV_MAX_HW_QUEUES)
+		virtio->queue_count = BLKDEV_MAX_HW_QUEUES;
+
+	int msix = !pci_msix_enable(pci);
+	if(msix && pci->msix_count < virtio->queue_count)
+		virtio->queue_count = pci->msix_count;
+
+	*(volatile uint16_t*)(virtio->common + VIRTIO_MSIX_CONFIG) = VIRTIO_NO_VECTOR;
+
+	virtio->queues = kcalloc(sizeof(virtqueue_t), virtio->queue_count);
+	size_t i;
+	for(i = 0; i < virtio->queue_count; i++)
+	{
+		if(!virtio_blk_setup_queue(virtio, i, &msix))
+			continue;
+
+		// the queues that did work are enough
+		if(!i)
+		{
+			kprintf("virtio: device at %d:%d:%d has no usable queues, ignoring\n", pci->bus, pci->slot, pci->function);
+			*status = VIRTIO_STATUS_FAILED;
+			kfree(virtio->queues);
+			kfree(virtio);
+			return -1;
+		}
+
+		virtio->queue_count = i;
+		break;
+	}
+
+	*status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK | VIRTIO_STATUS_DRIVER_OK;
+
+	// register with the block device manager
+	char name[64];
+	char devfs_name[4];
+	strcpy(devfs_name, "vda");
+	devfs_name[2] += virtio_blk_count;
+
+	blkdev_virtio_t *info = kcalloc(sizeof(blkdev_virtio_t), 1);
+	info->size = sizeof(blkdev_virtio_t);
+	info->virtio = virtio;
+
+	strcpy(name, "virtio block device ");
+	strcpy(name + strlen(name), devfs_name);
+
+	dev_t device = blkdev_register(BLKDEV_VIRTIO, VIRTIO_BLK_SECTOR_SIZE, virtio->queue_count, info, name);
+	kfree(info);
+
+	size_t depth = VIRTIO_BLK_DEPTH;
+	if(depth > virtio->queues[0].size)
+		depth = virtio->queues[0].size;
+
+	blkdev_set_driver(device, &virtio_blk_ops, depth, max_sectors, virtio->max_segments);
+
+	// each queue interrupts the last CPU of its group, which is usually an AP
+	// that is halted, so whoever submitted the request isn't the one woken up
+	request_queue_t *queue = &blkdev_queues[device];
+	blk_hw_queue_t *hw_queue;
+	for(i = 0; msix && i < queue->hw_queue_count; i++)
+	{
+		hw_queue = &queue->hw_queues[i];
+		if(!pci_msix_route(pci, i, BLKDEV_VECTOR, hw_queue->first_cpu + hw_queue->cpu_count - 1))
+			hw_queue->wakes = 1;
+	}
+
+	kprintf("virtio: %s is %d MB, %d queues, %s%s\n", devfs_name, (size_t)(virtio->capacity >> 11), virtio->queue_count,
+		(virtio->features & VIRTIO_F_EVENT_IDX) ? "event index" : "no event index",
+		(virtio->features & VIRTIO_BLK_F_RO) ? ", read-only" : "");
+
+	// register with the /dev filesystem
+	devfs_entry_t *entry = devfs_make_entry(devfs_name, S_IFBLK | DEVFS_MODE);
+	entry->device = device;
+
+	// and with the device manager
+	device_t *devmgr_device = kcalloc(sizeof(device_t), 1);
+	devmgr_device->category = DEVMGR_CATEGORY_DISK;
+	devmgr_device->irq = 0xFF;
+	devmgr_device->mmio[0].base = pci_bar(pci, 0);
+	devmgr_device->mmio[0].size = 0;
+	devmgr_register(devmgr_device, name);
+	kfree(devmgr_device);
+
+	virtio_blk_count++;
+	return 0;
+}
+
+// virtio_blk_setup_queue(): Sets up a virtqueue
+// Param:	virtio_blk_t *virtio - device
+// Param:	size_t index - queue number, which is also its MSI-X entry
+// Param:	int *msix - 1 to use MSI-X, cleared if the device can't
+// Return:	int - 0 on success
+
+int virtio_blk_setup_queue(virtio_blk_t *virtio, size_t index, int *msix)
+{
+	virtqueue_t *vq = &virtio->queues[index];
+
+	*(volatile uint16_t*)(virtio->common + VIRTIO_QUEUE_SELECT) = index;
+
+	// queue sizes are powers of two, so a smaller one still is
+	size_t size = *(volatile uint16_t*)(virtio->common + VIRTIO_QUEUE_SIZE);
+	if(!size)
+		return -1;
+
+	if(size > VIRTIO_MAX_QUEUE_SIZE)
+		size = VIRTIO_MAX_QUEUE_SIZE;
+
+	*(volatile uint16_t*)(virtio->common + VIRTIO_QUEUE_SIZE) = size;
+	vq->size = size;
+
+	// at most 256 descriptors fit in a page, as do both rings
+	size_t rings = vmm_alloc(KERNEL_HEAP, 3, PAGE_PRESENT | PAGE_RW);
+	size_t depth = (size > VIRTIO_BLK_DEPTH) ? VIRTIO_BLK_DEPTH : size;
+	vq->tables = (uint8_t*)vmm_alloc(KERNEL_HEAP, depth, PAGE_PRESENT | PAGE_RW);
+	if(!rings || !vq->tables)
+	{
+		if(rings)
+			vmm_free(rings, 3);
+		return -1;
+	}
+
+	vq->tables_physical = vmm_get_page((size_t)vq->tables) & ~(PAGE_SIZE-1);
+	vq->desc = (vring_desc_t*)rings;
+	vq->avail = (vring_avail_t*)(rings + PAGE_SIZE);
+	vq->used = (vring_used_t*)(rings + (PAGE_SIZE * 2));
+	vq->used_event = &vq->avail->ring[size];
+	vq->avail_event = (volatile uint16_t*)&vq->used->ring[size];
+
+	size_t physical = vmm_get_page(rings) & ~(PAGE_SIZE-1);
+	uint64_t address;
+
+	address = physical;
+	*(volatile uint32_t*)(virtio->common + VIRTIO_QUEUE_DESC) = address & 0xFFFFFFFF;
+	*(volatile uint32_t*)(virtio->common + VIRTIO_QUEUE_DESC + 4) = address >> 32;
+
+	address = physical + PAGE_SIZE;
+	*(volatile uint32_t*)(virtio->common + VIRTIO_QUEUE_DRIVER) = address & 0xFFFFFFFF;
+	*(volatile uint32_t*)(virtio->common + VIRTIO_QUEUE_DRIVER + 4) = address >> 32;
+
+	address = physical + (PAGE_SIZE * 2);
+	*(volatile uint32_t*)(virtio->common + VIRTIO_QUEUE_DEVICE) = address & 0xFFFFFFFF;
+	*(volatile uint32_t*)(virtio->common + VIRTIO_QUEUE_DEVICE + 4) = address >> 32;
+
+	size_t notify_offset = *(volatile uint16_t*)(virtio->common + VIRTIO_QUEUE_NOTIFY_OFF);
+	vq->notify = (volatile uint16_t*)(virtio->notify_base + (notify_offset * virtio->notify_multiplier));
+
+	if(*msix)
+	{
+		*(volatile uint16_t*)(virtio->common + VIRTIO_QUEUE_MSIX_VECTOR) = index;
+		if(*(volatile uint16_t*)(virtio->common + VIRTIO_QUEUE_MSIX_VECTOR) != index)
+			*msix = 0;
+	}
+
+	*(volatile uint16_t*)(virtio->common + VIRTIO_QUEUE_ENABLE) = 1;
+	return 0;
+}
+
+// virtio_blk_start_request(): Gives a request to the device
+// Param:	blk_hw_queue_t *hw_queue - hardware queue, which is a virtqueue
+// Param:	request_t *request - request
+// Return:	int - status code
+
+int virtio_blk_start_request(blk_hw_queue_t *hw_queue, request_t *request)
+{
+	blkdev_virtio_t *info = (blkdev_virtio_t*)&blkdevs[request->queue->device].data[0];
+	virtio_blk_t *virtio = info->virtio;
+	virtqueue_t *vq = &virtio->queues[hw_queue->index];
+
+	if(request->lba + request->count > virtio->capacity)
+		return BLKDEV_IO;
+
+	if(request->operation == BIO_WRITE && (virtio->features & VIRTIO_BLK_F_RO))
+		return BLKDEV_IO;
+
+	uint8_t *page = vq->tables + (request->tag * PAGE_SIZE);
+	size_t physical = vq->tables_physical + (request->tag * PAGE_SIZE);
+	vring_desc_t *table = (vring_desc_t*)page;
+	virtio_blk_header_t *header = (virtio_blk_header_t*)(page + VIRTIO_BLK_HEADER);
+
+	header->type = (request->operation == BIO_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	header->reserved = 0;
+	header->sector = request->lba;
+	page[VIRTIO_BLK_STATUS] = 0xFF;
+
+	table[0].address = physical + VIRTIO_BLK_HEADER;
+	table[0].length = sizeof(virtio_blk_header_t);
+	table[0].flags = 0;
+
+	// one segment for each physically contiguous run of the buffers
+	uint16_t data_flags = (request->operation == BIO_WRITE) ? 0 : VRING_DESC_F_WRITE;
+	size_t count = 1;
+	size_t virtual, remaining, segment;
+	uint64_t segment_physical;
+	bio_t *bio = request->bio_head;
+
+	while(bio)
+	{
+		virtual = (size_t)bio->buffer;
+		remaining = bio->count * VIRTIO_BLK_SECTOR_SIZE;
+
+		while(remaining)
+		{
+			segment = PAGE_SIZE - (virtual & (PAGE_SIZE-1));
+			if(segment > remaining)
+				segment = remaining;
+
+			segment_physical = (vmm_get_page(virtual & ~(PAGE_SIZE-1)) & ~(PAGE_SIZE-1)) + (virtual & (PAGE_SIZE-1));
+
+			if(count > 1 && table[count-1].address + table[count-1].length == segment_physical)
+				table[count-1].length += segment;
+			else
+			{
+				// the block layer keeps requests within max_segments
+				if(count > virtio->max_segments)
+					return BLKDEV_IO;
+
+				table[count].address = segment_physical;
+				table[count].length = segment;
+				table[count].flags = data_flags;
+				count++;
+			}
+
+			virtual += segment;
+			remaining -= segment;
+		}
+
+		bio = bio->next;
+	}
+
+	table[count].address = physical + VIRTIO_BLK_STATUS;
+	table[count].length = 1;
+	table[count].flags = VRING_DESC_F_WRITE;
+	count++;
+
+	size_t i;
+	for(i = 0; i < count - 1; i++)
+	{
+		table[i].flags |= VRING_DESC_F_NEXT;
+		table[i].next = i + 1;
+	}
+
+	vq->desc[request->tag].address = physical;
+	vq->desc[request->tag].length = count * sizeof(vring_desc_t);
+	vq->desc[request->tag].flags = VRING_DESC_F_INDIRECT;
+	vq->desc[request->tag].next = 0;
+
+	// only one CPU starts requests on a queue at a time
+	uint16_t old = vq->avail_index;
+	vq->avail->ring[old % vq->size] = request->tag;
+	vq->avail_index = old + 1;
+
+	memory_barrier();
+	vq->avail->index = vq->avail_index;
+	memory_barrier();
+
+	// the device tells us which request it wants to hear about next
+	int notify;
+	if(virtio->features & VIRTIO_F_EVENT_IDX)
+		notify = (uint16_t)(vq->avail_index - *vq->avail_event - 1) < (uint16_t)(vq->avail_index - old);
+	else
+		notify = !(vq->used->flags & VRING_USED_F_NO_NOTIFY);
+
+	if(notify)
+		*vq->notify = hw_queue->index;
+
+	return 0;
+}
+
+// virtio_blk_poll(): Finishes requests the device is done with
+// Param:	blk_hw_queue_t *hw_queue - hardware queue, which is a virtqueue
+// Return:	int - requests finished
+
+int virtio_blk_poll(blk_hw_queue_t *hw_queue)
+{
+	blkdev_virtio_t *info = (blkdev_virtio_t*)&blkdevs[hw_queue->queue->device].data[0];
+	virtio_blk_t *virtio = info->virtio;
+	virtqueue_t *vq = &virtio->queues[hw_queue->index];
+	request_t *request;
+	size_t tag;
+	int count = 0;
+	uint8_t status;
+
+	do
+	{
+		// whoever is already polling the queue will see the rest
+		if(atomic_xchg(&vq->polling, 1))
+			return count;
+
+		while(vq->last_used != vq->used->index)
+		{
+			memory_barrier();
+			tag = vq->used->ring[vq->last_used % vq->size].id;
+			vq->last_used++;
+
+			request = hw_queue->tags[tag];
+			status = vq->tables[(tag * PAGE_SIZE) + VIRTIO_BLK_STATUS];
+			blkdev_end_request(request, (status == VIRTIO_BLK_S_OK) ? 0 : BLKDEV_IO);
+			count++;
+
+			// and interrupt when the next one is done
+			if(virtio->features & VIRTIO_F_EVENT_IDX)
+			{
+				*vq->used_event = vq->last_used;
+				memory_barrier();
+			}
+		}
+
+		release_lock(&vq->polling);
+		memory_barrier();
+	} while(vq->last_used != vq->used->index);
+
+	return count;
+}
+
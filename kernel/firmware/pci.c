@@ -0,0 +1,353 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <pci.h>
+#include <io.h>
+#include <mm.h>
+#include <apic.h>
+#include <kprintf.h>
+
+// PCI Bus
+// Every function on every bus is found once at boot through configuration
+// mechanism #1, which every PC has, and drivers look for theirs in the list.
+// Memory BARs are mapped uncacheable, and only as much of them as a driver
+// asks for. MSI-X messages always go to one CPU by its local APIC ID.
+
+pci_device_t *pci_devices;
+size_t pci_device_count = 0;
+
+uint32_t pci_config_read(uint8_t, uint8_t, uint8_t, uint8_t);
+void pci_scan_function(uint8_t, uint8_t, uint8_t);
+
+// pci_config_read(): Reads configuration space of a function that might not be there
+// Param:	uint8_t bus - bus
+// Param:	uint8_t slot - slot
+// Param:	uint8_t function - function
+// Param:	uint8_t offset - dword-aligned offset
+// Return:	uint32_t - value, all ones if there's nothing there
+
+uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset)
+{
+	outd(PCI_CONFIG_ADDRESS, 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) | ((uint32_t)function << 8) | (offset & 0xFC));
+	return ind(PCI_CONFIG_DATA);
+}
+
+// pci_init(): Finds every PCI function
+// Param:	Nothing
+// Return:	Nothing
+
+void pci_init()
+{
+	pci_devices = kcalloc(sizeof(pci_device_t), MAX_PCI_DEVICES);
+
+	size_t bus, slot, function;
+	uint32_t header;
+
+	for(bus = 0; bus < 256; bus++)
+	{
+		for(slot = 0; slot < 32; slot++)
+		{
+			if((pci_config_read(bus, slot, 0, PCI_VENDOR) & 0xFFFF) == 0xFFFF)
+				continue;
+
+			pci_scan_function(bus, slot, 0);
+
+			// the other functions are only there for multifunction devices
+			header = pci_config_read(bus, slot, 0, PCI_HEADER_TYPE & 0xFC) >> 16;
+			if(!(header & PCI_HEADER_MULTIFUNCTION))
+				continue;
+
+			for(function = 1; function < 8; function++)
+			{
+				if((pci_config_read(bus, slot, function, PCI_VENDOR) & 0xFFFF) != 0xFFFF)
+					pci_scan_function(bus, slot, function);
+			}
+		}
+	}
+
+	kprintf("pci: found %d functions\n", pci_device_count);
+}
+
+// pci_scan_function(): Adds a function to the list
+// Param:	uint8_t bus - bus
+// Param:	uint8_t slot - slot
+// Param:	uint8_t function - function
+// Return:	Nothing
+
+void pci_scan_function(uint8_t bus, uint8_t slot, uint8_t function)
+{
+	if(pci_device_count >= MAX_PCI_DEVICES)
+		return;
+
+	pci_device_t *device = &pci_devices[pci_device_count];
+	device->bus = bus;
+	device->slot = slot;
+	device->function = function;
+
+	uint32_t id = pci_read(device, PCI_VENDOR);
+	device->vendor = id & 0xFFFF;
+	device->device = id >> 16;
+
+	uint32_t class = pci_read(device, PCI_PROG_IF & 0xFC);
+	device->prog_if = (class >> 8) & 0xFF;
+	device->subclass = (class >> 16) & 0xFF;
+	device->class = (class >> 24) & 0xFF;
+	device->irq = pci_read8(device, PCI_INTERRUPT_LINE);
+
+	device->msix = pci_find_capability(device, PCI_CAP_MSIX, 0);
+	if(device->msix)
+		device->msix_count = (pci_read16(device, device->msix + PCI_MSIX_CONTROL) & 0x7FF) + 1;
+
+	pci_device_count++;
+}
+
+// pci_read(): Reads a dword of configuration space
+// Param:	pci_device_t *device - function
+// Param:	uint8_t offset - dword-aligned offset
+// Return:	uint32_t - value
+
+uint32_t pci_read(pci_device_t *device, uint8_t offset)
+{
+	return pci_config_read(device->bus, device->slot, device->function, offset);
+}
+
+// pci_write(): Writes a dword of configuration space
+// Param:	pci_device_t *device - function
+// Param:	uint8_t offset - dword-aligned offset
+// Param:	uint32_t value - value
+// Return:	Nothing
+
+void pci_write(pci_device_t *device, uint8_t offset, uint32_t value)
+{
+	outd(PCI_CONFIG_ADDRESS, 0x80000000 | ((uint32_t)device->bus << 16) | ((uint32_t)device->slot << 11) | ((uint32_t)device->function << 8) | (offset & 0xFC));
+	outd(PCI_CONFIG_DATA, value);
+}
+
+// pci_read16(): Reads a word of configuration space
+// Param:	pci_device_t *device - function
+// Param:	uint8_t offset - word-aligned offset
+// Return:	uint16_t - value
+
+uint16_t pci_read16(pci_device_t *device, uint8_t offset)
+{
+	return (pci_read(device, offset) >> ((offset & 2) * 8)) & 0xFFFF;
+}
+
+// pci_read8(): Reads a byte of configuration space
+// Param:	pci_device_t *device - function
+// Param:	uint8_t offset - offset
+// Return:	uint8_t - value
+
+uint8_t pci_read8(pci_device_t *device, uint8_t offset)
+{
+	return (pci_read(device, offset) >> ((offset & 3) * 8)) & 0xFF;
+}
+
+// pci_write16(): Writes a word of configuration space
+// Param:	pci_device_t *device - function
+// Param:	uint8_t offset - word-aligned offset
+// Param:	uint16_t value - value
+// Return:	Nothing
+
+void pci_write16(pci_device_t *device, uint8_t offset, uint16_t value)
+{
+	uint32_t dword = pci_read(device, offset);
+	size_t shift = (offset & 2) * 8;
+
+	dword &= ~((uint32_t)0xFFFF << shift);
+	dword |= (uint32_t)value << shift;
+	pci_write(device, offset, dword);
+}
+
+// pci_find(): Finds a function by its IDs
+// Param:	uint16_t vendor - vendor ID
+// Param:	uint16_t id - device ID
+// Param:	size_t index - how many matching functions to skip
+// Return:	pci_device_t * - function, NULL if there aren't that many
+
+pci_device_t *pci_find(uint16_t vendor, uint16_t id, size_t index)
+{
+	size_t i;
+	for(i = 0; i < pci_device_count; i++)
+	{
+		if(pci_devices[i].vendor == vendor && pci_devices[i].device == id)
+		{
+			if(!index)
+				return &pci_devices[i];
+
+			index--;
+		}
+	}
+
+	return NULL;
+}
+
+// pci_find_class(): Finds a function by its class
+// Param:	uint8_t class - class
+// Param:	uint8_t subclass - subclass
+// Param:	uint8_t prog_if - programming interface
+// Param:	size_t index - how many matching functions to skip
+// Return:	pci_device_t * - function, NULL if there aren't that many
+
+pci_device_t *pci_find_class(uint8_t class, uint8_t subclass, uint8_t prog_if, size_t index)
+{
+	size_t i;
+	for(i = 0; i < pci_device_count; i++)
+	{
+		if(pci_devices[i].class == class && pci_devices[i].subclass == subclass && pci_devices[i].prog_if == prog_if)
+		{
+			if(!index)
+				return &pci_devices[i];
+
+			index--;
+		}
+	}
+
+	return NULL;
+}
+
+// pci_find_capability(): Finds a capability of a function
+// Param:	pci_device_t *device - function
+// Param:	uint8_t id - capability ID
+// Param:	uint8_t start - offset of the capability to look after, 0 for the first
+// Return:	uint8_t - offset of the capability, 0 if there isn't one
+
+uint8_t pci_find_capability(pci_device_t *device, uint8_t id, uint8_t start)
+{
+	if(!(pci_read16(device, PCI_STATUS) & PCI_STATUS_CAPABILITIES))
+		return 0;
+
+	uint8_t offset;
+	if(start)
+		offset = pci_read8(device, start + 1);
+	else
+		offset = pci_read8(device, PCI_CAPABILITIES);
+
+	// a broken list can't go round forever
+	size_t count = 0;
+	while(offset && count < 48)
+	{
+		offset &= 0xFC;
+		if(pci_read8(device, offset) == id)
+			return offset;
+
+		offset = pci_read8(device, offset + 1);
+		count++;
+	}
+
+	return 0;
+}
+
+// pci_bar(): Returns where a memory BAR is
+// Param:	pci_device_t *device - function
+// Param:	int bar - BAR number
+// Return:	uint64_t - physical address, 0 if it's not a memory BAR
+
+uint64_t pci_bar(pci_device_t *device, int bar)
+{
+	if(bar < 0 || bar > 5)
+		return 0;
+
+	uint32_t low = pci_read(device, PCI_BAR0 + (bar * 4));
+	if(low & PCI_BAR_IO)
+		return 0;
+
+	uint64_t address = low & 0xFFFFFFF0;
+	if((low & 0x06) == PCI_BAR_64 && bar < 5)
+		address |= (uint64_t)pci_read(device, PCI_BAR0 + ((bar + 1) * 4)) << 32;
+
+#if __i386__
+	// we can't map anything above 4 GB
+	if(address >> 32)
+		return 0;
+#endif
+
+	return address;
+}
+
+// pci_map(): Maps part of a memory BAR
+// Param:	pci_device_t *device - function
+// Param:	int bar - BAR number
+// Param:	size_t offset - offset in the BAR
+// Param:	size_t length - bytes to map
+// Return:	void * - virtual address of offset, NULL on error
+
+void *pci_map(pci_device_t *device, int bar, size_t offset, size_t length)
+{
+	uint64_t base = pci_bar(device, bar);
+	if(!base || !length)
+		return NULL;
+
+	size_t physical = (size_t)base + offset;
+	size_t pages = ((physical & (PAGE_SIZE-1)) + length + PAGE_SIZE - 1) >> PAGE_SIZE_SHIFT;
+	return (void*)vmm_request_map(physical, pages, PAGE_PRESENT | PAGE_RW | PAGE_UNCACHEABLE);
+}
+
+// pci_enable(): Lets a function decode memory and do DMA, without legacy interrupts
+// Param:	pci_device_t *device - function
+// Return:	Nothing
+
+void pci_enable(pci_device_t *device)
+{
+	uint16_t command = pci_read16(device, PCI_COMMAND);
+	command |= PCI_COMMAND_MMIO | PCI_COMMAND_MASTER | PCI_COMMAND_INTX_DISABLE;
+	pci_write16(device, PCI_COMMAND, command);
+}
+
+// pci_msix_enable(): Enables MSI-X with every entry masked
+// Param:	pci_device_t *device - function
+// Return:	int - 0 on success
+
+int pci_msix_enable(pci_device_t *device)
+{
+	if(!device->msix)
+		return -1;
+
+	if(device->msix_table)
+		return 0;
+
+	uint32_t table = pci_read(device, device->msix + PCI_MSIX_TABLE);
+	device->msix_table = (volatile uint32_t*)pci_map(device, table & 7, table & ~7, device->msix_count * 16);
+	if(!device->msix_table)
+		return -1;
+
+	size_t i;
+	for(i = 0; i < device->msix_count; i++)
+		device->msix_table[(i * 4) + 3] = PCI_MSIX_ENTRY_MASKED;
+
+	uint16_t control = pci_read16(device, device->msix + PCI_MSIX_CONTROL);
+	control |= PCI_MSIX_ENABLE;
+	control &= ~PCI_MSIX_FUNCTION_MASK;
+	pci_write16(device, device->msix + PCI_MSIX_CONTROL, control);
+	return 0;
+}
+
+// pci_msix_route(): Sends an MSI-X entry to one CPU and unmasks it
+// Param:	pci_device_t *device - function, with MSI-X enabled
+// Param:	size_t entry - entry in the MSI-X table
+// Param:	uint8_t vector - interrupt vector
+// Param:	size_t cpu - CPU index
+// Return:	int - 0 on success
+
+int pci_msix_route(pci_device_t *device, size_t entry, uint8_t vector, size_t cpu)
+{
+	if(!device->msix_table || entry >= device->msix_count || cpu >= lapic_count)
+		return -1;
+
+	// APIC IDs that don't fit in the message need interrupt remapping
+	uint32_t apic_id = lapics[cpu].apic_id;
+	if(apic_id > 0xFF)
+		return -1;
+
+	volatile uint32_t *message = &device->msix_table[entry * 4];
+	message[3] = PCI_MSIX_ENTRY_MASKED;
+	message[0] = PCI_MSI_ADDRESS | (apic_id << 12);
+	message[1] = 0;
+	message[2] = vector;		// fixed delivery, edge-triggered
+	message[3] = 0;
+	return 0;
+}
+
@@ -11,8 +11,6 @@
 #include <mm.h>
 #include <io.h>
 
-#define PIT_DIVIDER			1193182
-
 // pit_init(): Initializes the PIT
 // Param:	Nothing
 // Return:	Nothing
@@ -22,7 +20,7 @@ void pit_init()
 	kprintf("pit: using the PIT as a timer.\n");
 
 	// set frequency and mode
-	uint16_t divider = PIT_DIVIDER / TIMER_FREQUENCY;
+	uint16_t divider = PIT_FREQUENCY / TIMER_FREQUENCY;
 
 	outb(0x43, 0x36);
 	iowait();
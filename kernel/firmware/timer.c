@@ -9,6 +9,8 @@
 #include <cpu.h>
 #include <irq.h>
 #include <lock.h>
+#include <vdso.h>
+#include <apic.h>
 
 uint64_t global_uptime = 0;
 uint8_t timer_irq_line;
@@ -32,8 +34,11 @@ void timer_irq()
 	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
 	cpu->timestamp++;
 
-	if(cpu->index == 0)
+	if(cpu->index == bsp_index)
+	{
 		global_uptime = cpu->timestamp;
+		vdso_update();
+	}
 
 	irq_eoi(timer_irq_line);
 }
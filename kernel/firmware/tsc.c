@@ -0,0 +1,69 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <timer.h>
+#include <kprintf.h>
+#include <io.h>
+
+#define TSC_CALIBRATE_MS		10
+
+uint64_t tsc_frequency = 0;		// TSC ticks per microsecond
+
+// rdtsc(): Reads the time stamp counter
+// Param:	Nothing
+// Return:	uint64_t - current TSC value
+
+inline uint64_t rdtsc()
+{
+	uint32_t low, high;
+	asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
+// tsc_init(): Calibrates the TSC against PIT channel 2
+// This doesn't need IRQs, so it can run before any interrupt controller is
+// set up -- which is what SMP bring-up needs for its INIT/SIPI delays
+// Param:	Nothing
+// Return:	Nothing
+
+void tsc_init()
+{
+	uint16_t count = (PIT_FREQUENCY / 1000) * TSC_CALIBRATE_MS;
+
+	// enable the channel 2 gate, keep the speaker disconnected
+	uint8_t port61 = inb(0x61);
+	outb(0x61, (port61 & 0xFD) | 0x01);
+
+	// channel 2, low/high byte, mode 0 (interrupt on terminal count)
+	outb(0x43, 0xB0);
+	outb(0x42, (uint8_t)count & 0xFF);
+	outb(0x42, (uint8_t)(count >> 8) & 0xFF);
+
+	uint64_t start = rdtsc();
+	while((inb(0x61) & 0x20) == 0);
+	uint64_t end = rdtsc();
+
+	outb(0x61, port61);
+
+	tsc_frequency = (end - start) / (TSC_CALIBRATE_MS * 1000);
+	if(!tsc_frequency)
+		tsc_frequency = 1;
+
+	kprintf("tsc: CPU frequency is %d MHz\n", (uint32_t)tsc_frequency);
+}
+
+// udelay(): Waits for a number of microseconds
+// Param:	uint64_t usec - microseconds
+// Return:	Nothing
+
+void udelay(uint64_t usec)
+{
+	uint64_t end = rdtsc() + (usec * tsc_frequency);
+
+	while(rdtsc() < end)
+		asm volatile ("pause");
+}
+
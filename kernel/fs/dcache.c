@@ -0,0 +1,292 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <dcache.h>
+#include <vfs.h>
+#include <mm.h>
+#include <string.h>
+#include <kprintf.h>
+
+// Dentry Cache
+// Paths are looked up one component at a time, and every component that's
+// been looked up is remembered under its parent, including the ones that
+// weren't there, so looking up the same path again never goes past the hash
+// table. Dentries come from a fixed pool, and when it runs out the least
+// recently used one without children of its own is reused. Everything here
+// is protected by vfs_mutex, and mounting or unmounting anything throws the
+// whole cache away, because either can change what any path means.
+
+dentry_t dcache_root;
+dentry_t *dcache_pool;
+dentry_t *dcache_free;
+dentry_t *dcache_buckets[DCACHE_BUCKETS];
+dentry_t *dcache_lru_head = NULL;		// most recently used
+dentry_t *dcache_lru_tail = NULL;
+
+uint32_t dcache_hash(dentry_t *, const char *, size_t);
+dentry_t *dcache_find(dentry_t *, const char *, size_t, uint32_t);
+dentry_t *dcache_add(dentry_t *, const char *, size_t, uint32_t);
+dentry_t *dcache_reclaim(dentry_t *);
+void dcache_unlink(dentry_t *);
+void dcache_touch(dentry_t *);
+
+// dcache_init(): Initializes the dentry cache
+// Param:	Nothing
+// Return:	Nothing
+
+void dcache_init()
+{
+	dcache_pool = kcalloc(sizeof(dentry_t), DCACHE_SIZE);
+	dcache_invalidate();
+}
+
+// dcache_invalidate(): Throws away every dentry, with vfs_mutex held
+// Param:	Nothing
+// Return:	Nothing
+
+void dcache_invalidate()
+{
+	memset(dcache_buckets, 0, sizeof(dcache_buckets));
+	dcache_lru_head = NULL;
+	dcache_lru_tail = NULL;
+
+	dcache_free = NULL;
+	for(int i = DCACHE_SIZE - 1; i >= 0; i--)
+	{
+		dcache_pool[i].hash_next = dcache_free;
+		dcache_free = &dcache_pool[i];
+	}
+
+	// the root is always there, and is never on the LRU list
+	memset(&dcache_root, 0, sizeof(dentry_t));
+	dcache_root.vnode = vfs_mount_root("/");
+}
+
+// dcache_hash(): Hashes a component under its parent
+// Param:	dentry_t *parent - parent dentry
+// Param:	const char *name - component, not terminated
+// Param:	size_t length - length of component
+// Return:	uint32_t - hash
+
+uint32_t dcache_hash(dentry_t *parent, const char *name, size_t length)
+{
+	uint32_t hash = 2166136261 ^ (uint32_t)((size_t)parent >> 4);	// FNV-1a
+
+	for(size_t i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+// dcache_find(): Finds a cached component under its parent
+// Param:	dentry_t *parent - parent dentry
+// Param:	const char *name - component, not terminated
+// Param:	size_t length - length of component
+// Param:	uint32_t hash - hash from dcache_hash()
+// Return:	dentry_t * - dentry, NULL if it's not cached
+
+dentry_t *dcache_find(dentry_t *parent, const char *name, size_t length, uint32_t hash)
+{
+	dentry_t *dentry = dcache_buckets[hash & (DCACHE_BUCKETS - 1)];
+	while(dentry)
+	{
+		if(dentry->hash == hash && dentry->parent == parent && memcmp(dentry->name, name, length) == 0 && dentry->name[length] == 0)
+			return dentry;
+
+		dentry = dentry->hash_next;
+	}
+
+	return NULL;
+}
+
+// dcache_touch(): Makes a dentry the most recently used one
+// Param:	dentry_t *dentry - dentry, on the LRU list or not
+// Return:	Nothing
+
+void dcache_touch(dentry_t *dentry)
+{
+	if(dcache_lru_head == dentry)
+		return;
+
+	if(dentry->lru_prev)
+		dentry->lru_prev->lru_next = dentry->lru_next;
+	if(dentry->lru_next)
+		dentry->lru_next->lru_prev = dentry->lru_prev;
+	if(dcache_lru_tail == dentry)
+		dcache_lru_tail = dentry->lru_prev;
+
+	dentry->lru_prev = NULL;
+	dentry->lru_next = dcache_lru_head;
+	if(dcache_lru_head)
+		dcache_lru_head->lru_prev = dentry;
+
+	dcache_lru_head = dentry;
+	if(!dcache_lru_tail)
+		dcache_lru_tail = dentry;
+}
+
+// dcache_unlink(): Takes a dentry out of the hash table and the LRU list
+// Param:	dentry_t *dentry - dentry
+// Return:	Nothing
+
+void dcache_unlink(dentry_t *dentry)
+{
+	dentry_t **link = &dcache_buckets[dentry->hash & (DCACHE_BUCKETS - 1)];
+	while(*link != dentry)
+		link = &(*link)->hash_next;
+
+	*link = dentry->hash_next;
+
+	if(dentry->lru_prev)
+		dentry->lru_prev->lru_next = dentry->lru_next;
+	else
+		dcache_lru_head = dentry->lru_next;
+
+	if(dentry->lru_next)
+		dentry->lru_next->lru_prev = dentry->lru_prev;
+	else
+		dcache_lru_tail = dentry->lru_prev;
+
+	dentry->parent->children--;
+}
+
+// dcache_reclaim(): Reuses the least recently used dentry
+// Param:	dentry_t *parent - parent of the new dentry, which can't go
+// Return:	dentry_t * - free dentry, NULL if nothing can be reused
+
+dentry_t *dcache_reclaim(dentry_t *parent)
+{
+	// a dentry with children has to outlive them, and they're always
+	// used more recently than it is, so this doesn't go far
+	dentry_t *dentry = dcache_lru_tail;
+	while(dentry && (dentry->children || dentry == parent))
+		dentry = dentry->lru_prev;
+
+	if(dentry)
+		dcache_unlink(dentry);
+
+	return dentry;
+}
+
+// dcache_add(): Caches a component under its parent
+// Param:	dentry_t *parent - parent dentry
+// Param:	const char *name - component, not terminated
+// Param:	size_t length - length of component, less than DENTRY_NAME_SIZE
+// Param:	uint32_t hash - hash from dcache_hash()
+// Return:	dentry_t * - new dentry, NULL if there's no room
+
+dentry_t *dcache_add(dentry_t *parent, const char *name, size_t length, uint32_t hash)
+{
+	dentry_t *dentry = dcache_free;
+	if(dentry)
+		dcache_free = dentry->hash_next;
+	else
+		dentry = dcache_reclaim(parent);
+
+	if(!dentry)
+		return NULL;
+
+	memset(dentry, 0, sizeof(dentry_t));
+	memcpy(dentry->name, name, length);
+	dentry->parent = parent;
+	dentry->hash = hash;
+	parent->children++;
+
+	dentry_t **bucket = &dcache_buckets[hash & (DCACHE_BUCKETS - 1)];
+	dentry->hash_next = *bucket;
+	*bucket = dentry;
+
+	dcache_touch(dentry);
+	return dentry;
+}
+
+// dcache_lookup(): Finds the vnode of a path, with vfs_mutex held
+// Param:	char *path - fully resolved path, which is changed and put back
+// Param:	vnode_t **destination - vnode
+// Return:	int - status code
+
+int dcache_lookup(char *path, vnode_t **destination)
+{
+	dentry_t *dentry = &dcache_root;	// NULL once we're past the cache
+	dentry_t *child;
+	vnode_t *vnode = dcache_root.vnode;
+	char *name = path;
+	char *end, saved;
+	size_t length;
+	uint32_t hash = 0;
+	int status;
+
+	while(name[0] == '/')
+		name++;
+
+	while(name[0])
+	{
+		// nothing is under a file that isn't a directory
+		if(!(vnode->mode & S_IFDIR))
+			return ENOENT;
+
+		end = name;
+		while(end[0] && end[0] != '/')
+			end++;
+
+		length = (size_t)(end - name);
+
+		// names too long to cache are looked up every time, and so is
+		// everything under them
+		if(length >= DENTRY_NAME_SIZE)
+			dentry = NULL;
+
+		child = NULL;
+		if(dentry)
+		{
+			hash = dcache_hash(dentry, name, length);
+			child = dcache_find(dentry, name, length, hash);
+		}
+
+		if(child)
+		{
+			dcache_touch(child);
+			if(child->status)
+				return child->status;
+
+			vnode = child->vnode;
+		} else
+		{
+			// look up only this much of the path
+			saved = end[0];
+			end[0] = 0;
+			status = vfs_lookup(vnode, path, name, length, &vnode);
+			end[0] = saved;
+
+			// other errors might not happen next time, so only what's
+			// there and what isn't is remembered, if there's room
+			if(dentry && (status == 0 || status == ENOENT))
+				child = dcache_add(dentry, name, length, hash);
+
+			if(child)
+			{
+				child->status = status;
+				if(status == 0)
+					child->vnode = vnode;
+			}
+
+			if(status != 0)
+				return status;
+		}
+
+		dentry = child;
+		name = end;
+		while(name[0] == '/')
+			name++;
+	}
+
+	*destination = vnode;
+	return 0;
+}
+
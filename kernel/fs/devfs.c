@@ -16,12 +16,49 @@
 #include <tty.h>
 #include <tasking.h>
 #include <io.h>
+#include <epoll.h>
 
 // Implementation of /dev filesystem
 devfs_entry_t *devfs_entries;
 size_t devfs_count;
 lock_t devfs_mutex = 0;
 struct stat devfs_stat;
+vnode_t devfs_vnode;
+
+int devfs_vnode_stat(vnode_t *, struct stat *);
+int devfs_readdir(vnode_t *, size_t, directory_entry_t *);
+ssize_t devfs_readv(file_t *, const struct iovec *, int, off_t *);
+ssize_t devfs_writev(file_t *, const struct iovec *, int, off_t *);
+int devfs_fstat(file_t *, struct stat *);
+uint32_t devfs_poll(void *, int);
+poll_list_t *devfs_poll_list(void *);
+void *devfs_direct(file_t *, off_t, size_t *);
+ssize_t devfs_null_read(devfs_entry_t *, char *, size_t, off_t *);
+ssize_t devfs_null_write(devfs_entry_t *, char *, size_t, off_t *);
+ssize_t devfs_io_error(devfs_entry_t *, char *, size_t, off_t *);
+ssize_t devfs_memory_read(devfs_entry_t *, char *, size_t, off_t *);
+ssize_t devfs_memory_write(devfs_entry_t *, char *, size_t, off_t *);
+ssize_t devfs_random_read(devfs_entry_t *, char *, size_t, off_t *);
+ssize_t devfs_port_read(devfs_entry_t *, char *, size_t, off_t *);
+ssize_t devfs_port_write(devfs_entry_t *, char *, size_t, off_t *);
+ssize_t devfs_console_write(devfs_entry_t *, char *, size_t, off_t *);
+ssize_t devfs_tty_write(devfs_entry_t *, char *, size_t, off_t *);
+ssize_t devfs_blkdev_read(devfs_entry_t *, char *, size_t, off_t *);
+
+const file_ops_t devfs_file_ops = {
+	.readv = &devfs_readv,
+	.writev = &devfs_writev,
+	.stat = &devfs_fstat,
+	.poll = &devfs_poll,
+	.poll_list = &devfs_poll_list,
+	.direct = &devfs_direct,
+};
+
+// devices are looked up by name in the table, so /dev only needs listing
+const vnode_ops_t devfs_vnode_ops = {
+	.stat = &devfs_vnode_stat,
+	.readdir = &devfs_readdir,
+};
 
 // devfs_init(): Initializes the /dev filesystem
 // Param:	Nothing
@@ -39,17 +76,55 @@ void devfs_init()
 	devfs_stat.st_mtime = timestamp;
 	devfs_stat.st_ctime = timestamp;
 
+	devfs_vnode.ops = &devfs_vnode_ops;
+	devfs_vnode.mode = devfs_stat.st_mode;
+
 	// these devices are always here
-	devfs_make_entry("null", S_IFCHR | DEVFS_MODE);
-	devfs_make_entry("zero", S_IFCHR | DEVFS_MODE);
-	devfs_make_entry("stdin", S_IFCHR | DEVFS_MODE);
-	devfs_make_entry("stdout", S_IFCHR | DEVFS_MODE);
-	devfs_make_entry("stderr", S_IFCHR | DEVFS_MODE);
-	devfs_make_entry("vesafb", S_IFCHR | DEVFS_MODE);
-	devfs_make_entry("random", S_IFCHR | DEVFS_MODE);
-	devfs_make_entry("urandom", S_IFCHR | DEVFS_MODE);
-	devfs_make_entry("port", S_IFCHR | DEVFS_MODE);
-	devfs_make_entry("tty", S_IFCHR | DEVFS_MODE);
+	devfs_entry_t *entry;
+	entry = devfs_make_entry("null", S_IFCHR | DEVFS_MODE);
+	entry->read = &devfs_null_read;
+	entry->write = &devfs_null_write;
+
+	entry = devfs_make_entry("zero", S_IFCHR | DEVFS_MODE);
+	entry->read = &devfs_null_read;
+	entry->write = &devfs_null_write;
+
+	// there's no keyboard input yet, and terminals are always writable
+	entry = devfs_make_entry("stdin", S_IFCHR | DEVFS_MODE);
+	entry->read = &devfs_io_error;
+	entry->write = &devfs_io_error;
+	entry->events = 0;
+
+	entry = devfs_make_entry("stdout", S_IFCHR | DEVFS_MODE);
+	entry->read = &devfs_io_error;
+	entry->write = &devfs_console_write;
+	entry->events = EPOLLOUT;
+
+	entry = devfs_make_entry("stderr", S_IFCHR | DEVFS_MODE);
+	entry->read = &devfs_io_error;
+	entry->write = &devfs_console_write;
+	entry->events = EPOLLOUT;
+
+	entry = devfs_make_entry("vesafb", S_IFCHR | DEVFS_MODE);
+	entry->memory = (void*)HW_FRAMEBUFFER;
+	entry->memory_size = screen_size;
+	entry->information.st_size = screen_size;
+	entry->read = &devfs_memory_read;
+	entry->write = &devfs_memory_write;
+
+	entry = devfs_make_entry("random", S_IFCHR | DEVFS_MODE);
+	entry->read = &devfs_random_read;
+
+	entry = devfs_make_entry("urandom", S_IFCHR | DEVFS_MODE);
+	entry->read = &devfs_random_read;
+
+	entry = devfs_make_entry("port", S_IFCHR | DEVFS_MODE);
+	entry->read = &devfs_port_read;
+	entry->write = &devfs_port_write;
+
+	entry = devfs_make_entry("tty", S_IFCHR | DEVFS_MODE);
+	entry->write = &devfs_console_write;
+	entry->events = EPOLLOUT;
 
 	// register tty terminals
 	size_t tty = 0;
@@ -57,32 +132,85 @@ void devfs_init()
 	while(tty < TTY_COUNT && tty < 10)
 	{
 		sprintf(tty_name, "tty%d", tty);
-		devfs_make_entry(tty_name, S_IFCHR | DEVFS_MODE);
+		entry = devfs_make_entry(tty_name, S_IFCHR | DEVFS_MODE);
+		entry->minor = tty;
+		entry->write = &devfs_tty_write;
+		entry->events = EPOLLOUT;
 		tty++;
 	}
 }
 
 // devfs_make_entry(): Makes an entry in the /dev filesystem
+// Block devices can be read right away, and the caller sets everything else
 // Param:	char *name - name of entry
 // Param:	mode_t mode - mode of entry
-// Return:	Nothing
+// Return:	devfs_entry_t * - entry
 
-void devfs_make_entry(char *name, mode_t mode)
+devfs_entry_t *devfs_make_entry(char *name, mode_t mode)
 {
 	acquire_lock(&devfs_mutex);
-	strcpy(devfs_entries[devfs_count].name, name);
-	devfs_entries[devfs_count].information.st_mode = mode;
-	devfs_entries[devfs_count].information.st_size = sizeof(size_t);
+	devfs_entry_t *entry = &devfs_entries[devfs_count];
+
+	strcpy(entry->name, name);
+	entry->information.st_mode = mode;
+	entry->information.st_size = sizeof(size_t);
+	entry->events = EPOLLIN | EPOLLOUT;
+
+	if(mode & S_IFBLK)
+		entry->read = &devfs_blkdev_read;
 
 	time_t timestamp = get_time();
-	devfs_entries[devfs_count].information.st_atime = timestamp;
-	devfs_entries[devfs_count].information.st_mtime = timestamp;
-	devfs_entries[devfs_count].information.st_ctime = timestamp;
+	entry->information.st_atime = timestamp;
+	entry->information.st_mtime = timestamp;
+	entry->information.st_ctime = timestamp;
 
 	kprintf("devfs: registered device '%s'\n", name);
 	devfs_count++;
 
 	release_lock(&devfs_mutex);
+	return entry;
+}
+
+// devfs_find(): Finds an entry in the /dev filesystem
+// Param:	const char *name - name of entry
+// Return:	devfs_entry_t * - entry, NULL if there's no such device
+
+devfs_entry_t *devfs_find(const char *name)
+{
+	size_t entry;
+	for(entry = 0; entry < devfs_count; entry++)
+	{
+		if(strcmp(name, devfs_entries[entry].name) == 0)
+			return &devfs_entries[entry];
+	}
+
+	return NULL;
+}
+
+// devfs_vnode_stat(): Returns stat information for /dev itself
+// Param:	vnode_t *vnode - vnode of /dev
+// Param:	struct stat *destination - structure to store information
+// Return:	int - return status
+
+int devfs_vnode_stat(vnode_t *vnode, struct stat *destination)
+{
+	memcpy(destination, &devfs_stat, sizeof(struct stat));
+	return 0;
+}
+
+// devfs_readdir(): Returns the name of a device
+// Param:	vnode_t *vnode - vnode of /dev
+// Param:	size_t index - index of device
+// Param:	directory_entry_t *entry - entry to store
+// Return:	int - return status, ENOENT past the last device
+
+int devfs_readdir(vnode_t *vnode, size_t index, directory_entry_t *entry)
+{
+	if(index >= devfs_count)
+		return ENOENT;
+
+	strcpy(entry->filename, devfs_entries[index].name);
+	return 0;
 }
 
 // devstat(): Returns stat information for a /dev node
@@ -107,153 +235,326 @@ int devstat(const char *name, struct stat *destination)
 	return 0;
 }
 
-// devfs_read(): Reads from a file on /dev
-// Param:	int handle - file handle
-// Param:	char *buffer - buffer to read
-// Param:	size_t count - bytes to read
-// Return:	int - bytes actually read, on error code
+// devfs_open(): Opens a file on /dev
+// Param:	const char *name - name of device, without the /dev/
+// Param:	int flags - open flags
+// Param:	file_t **destination - open file
+// Return:	int - status code
 
-ssize_t devfs_read(int handle, char *buffer, size_t count)
+int devfs_open(const char *name, int flags, file_t **destination)
 {
-	int blkdev_status;
-	uint64_t blkdev_base;
-	size_t random_count = 0;
-	uint8_t *byte;
-	uint16_t *word;
-	uint32_t *dword;
+	devfs_entry_t *entry = devfs_find(name);
+	if(!entry)
+		return ENOENT;
 
-	if(strcmp(files[handle].path, "/dev/vesafb") == 0)
-	{
-		void *framebuffer = (void*)HW_FRAMEBUFFER + files[handle].position;
-		memcpy(buffer, framebuffer, count);
+	*destination = file_alloc(&devfs_file_ops, entry, flags, entry->information.st_mode);
+	return 0;
+}
 
-		files[handle].position += count;
-		release_lock(&vfs_mutex);
-		return count;
-	} else if(strcmp(files[handle].path, "/dev/initrd") == 0)
+// devfs_readv(): Reads from a file on /dev into several buffers
+// Param:	file_t *file - open file
+// Param:	const struct iovec *iov - buffers to read into
+// Param:	int count - count of buffers, at least one
+// Param:	off_t *position - position to read from, which only seekable devices move
+// Return:	ssize_t - bytes actually read, or error code
+
+ssize_t devfs_readv(file_t *file, const struct iovec *iov, int count, off_t *position)
+{
+	devfs_entry_t *entry = (devfs_entry_t*)file->node;
+	ssize_t total = 0, status;
+	int i;
+
+	if(!entry->read)
+		return 0;
+
+	// block devices get the whole vector in one request
+	if(entry->information.st_mode & S_IFBLK)
 	{
-		blkdev_base = (uint64_t)files[handle].position;
-		blkdev_status = blkdev_read_bytes(0, blkdev_base, count, buffer);
-		release_lock(&vfs_mutex);
+		for(i = 0; i < count; i++)
+			total += iov[i].iov_len;
 
-		if(blkdev_status == 0)
-			return count;
+		status = blkdev_readv(entry->device, (uint64_t)*position, iov, count);
+		if(status == 0)
+			return total;
 		else
 			return EIO;
-	} else if(strcmp(files[handle].path, "/dev/zero") == 0 || strcmp(files[handle].path, "/dev/null") == 0)
-	{
-		// simply put zeroes
-		memset(buffer, 0, count);
-		release_lock(&vfs_mutex);
-		return count;
-	} else if(strcmp(files[handle].path, "/dev/random") == 0 || strcmp(files[handle].path, "/dev/urandom") == 0)
+	}
+
+	// everything else is one buffer at a time
+	for(i = 0; i < count; i++)
 	{
-		// random numbers here
-		while(random_count < count)
-		{
-			buffer[random_count] = (char)rand() & 0xFF;
-			random_count++;
-		}
-
-		release_lock(&vfs_mutex);
-		return count;
-	} else if(strcmp(files[handle].path, "/dev/port") == 0)
+		status = entry->read(entry, iov[i].iov_base, iov[i].iov_len, position);
+		if(status < 0)
+			return total ? total : status;
+
+		total += status;
+		if(status < iov[i].iov_len)
+			break;
+	}
+
+	return total;
+}
+
+// devfs_writev(): Writes to a file on /dev from several buffers
+// Param:	file_t *file - open file
+// Param:	const struct iovec *iov - buffers to write
+// Param:	int count - count of buffers, at least one
+// Param:	off_t *position - position to write to, which only seekable devices move
+// Return:	ssize_t - bytes actually written, or error code
+
+ssize_t devfs_writev(file_t *file, const struct iovec *iov, int count, off_t *position)
+{
+	devfs_entry_t *entry = (devfs_entry_t*)file->node;
+	ssize_t total = 0, status;
+	int i;
+
+	if(!entry->write)
+		return 0;
+
+	for(i = 0; i < count; i++)
 	{
-		// read from I/O port here
-		if(count == 1)
-		{
-			byte = (uint8_t*)buffer;
-			byte[0] = inb((uint16_t)files[handle].position);
-		} else if(count == 2)
-		{
-			word = (uint16_t*)buffer;
-			word[0] = inw((uint16_t)files[handle].position);
-		} else if(count == 4)
-		{
-			dword = (uint32_t*)buffer;
-			dword[0] = ind((uint16_t)files[handle].position);
-		} else
-		{
-			kprintf("devfs: attempted to read undefined size %d from I/O port 0x%xw\n", count, (uint16_t)files[handle].position);
-			release_lock(&vfs_mutex);
-			return EIO;
-		}
+		status = entry->write(entry, iov[i].iov_base, iov[i].iov_len, position);
+		if(status < 0)
+			return total ? total : status;
 
-		release_lock(&vfs_mutex);
-		return count;
+		total += status;
+		if(status < iov[i].iov_len)
+			break;
 	}
 
-	release_lock(&vfs_mutex);
+	return total;
+}
+
+// devfs_fstat(): Returns stat information for an open file on /dev
+// Param:	file_t *file - open file
+// Param:	struct stat *destination - structure to store information
+// Return:	int - status code
+
+int devfs_fstat(file_t *file, struct stat *destination)
+{
+	devfs_entry_t *entry = (devfs_entry_t*)file->node;
+	memcpy(destination, &entry->information, sizeof(struct stat));
 	return 0;
 }
 
-// devfs_write(): Writes to a file on /dev
-// Param:	int handle - file handle
+// devfs_direct(): Returns a kernel pointer to the memory behind a file on /dev
+// Param:	file_t *file - open file
+// Param:	off_t position - position in the file
+// Param:	size_t *available - bytes there are from there to the end
+// Return:	void * - pointer, NULL if the device isn't memory or that's past the end
+
+void *devfs_direct(file_t *file, off_t position, size_t *available)
+{
+	devfs_entry_t *entry = (devfs_entry_t*)file->node;
+	if(!entry->memory || position < 0 || (size_t)position >= entry->memory_size)
+		return NULL;
+
+	*available = entry->memory_size - position;
+	return entry->memory + position;
+}
+
+// devfs_poll(): Returns the current events of a device
+// Param:	void *node - device entry
+// Param:	int flags - open flags, unused
+// Return:	uint32_t - events
+
+uint32_t devfs_poll(void *node, int flags)
+{
+	return ((devfs_entry_t*)node)->events;
+}
+
+// devfs_poll_list(): Returns the list of everything watching a device
+// Param:	void *node - device entry
+// Return:	poll_list_t * - watch list
+
+poll_list_t *devfs_poll_list(void *node)
+{
+	return &((devfs_entry_t*)node)->poll;
+}
+
+// devfs_null_read(): Reads from /dev/null and /dev/zero
+// Param:	devfs_entry_t *entry - device
+// Param:	char *buffer - buffer to read
+// Param:	size_t count - bytes to read
+// Param:	off_t *position - unused
+// Return:	ssize_t - bytes actually read
+
+ssize_t devfs_null_read(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
+{
+	// simply put zeroes
+	memset(buffer, 0, count);
+	return count;
+}
+
+// devfs_null_write(): Writes to /dev/null and /dev/zero
+// Param:	devfs_entry_t *entry - device
 // Param:	char *buffer - buffer to write
-// Param:	size_t count - byte count
-// Return:	int - bytes actually written, or error code
+// Param:	size_t count - bytes to write
+// Param:	off_t *position - unused
+// Return:	ssize_t - bytes actually written
 
-ssize_t devfs_write(int handle, char *buffer, size_t count)
+ssize_t devfs_null_write(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
 {
-	uint8_t *byte;
-	uint16_t *word;
-	uint32_t *dword;
+	// don't do anything, but return success
+	return count;
+}
 
-	// handle framebuffer first for graphics performance later on
-	if(strcmp(files[handle].path, "/dev/vesafb") == 0)
-	{
-		void *framebuffer = (void*)HW_FRAMEBUFFER + files[handle].position;
-		memcpy(framebuffer, buffer, count);
+// devfs_io_error(): Fails reads and writes a device can't do
+// Param:	devfs_entry_t *entry - device
+// Param:	char *buffer - unused
+// Param:	size_t count - unused
+// Param:	off_t *position - unused
+// Return:	ssize_t - EIO
 
-		files[handle].position += count;
-		release_lock(&vfs_mutex);
-		return count;
-	} else if(strcmp(files[handle].path, "/dev/zero") == 0 || strcmp(files[handle].path, "/dev/null") == 0)
-	{
-		// don't do anything, but return success
-		release_lock(&vfs_mutex);
-		return count;
-	} else if(strcmp(files[handle].path, "/dev/tty") == 0)
-	{
-		tty_write(buffer, count, get_tty());
-		release_lock(&vfs_mutex);
-		return count;
-	} else if(memcmp(files[handle].path, "/dev/tty", 8) == 0)
+ssize_t devfs_io_error(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
+{
+	return EIO;
+}
+
+// devfs_memory_read(): Reads from memory-backed devices
+// Param:	devfs_entry_t *entry - device
+// Param:	char *buffer - buffer to read
+// Param:	size_t count - bytes to read
+// Param:	off_t *position - position to read from
+// Return:	ssize_t - bytes actually read, 0 at the end
+
+ssize_t devfs_memory_read(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
+{
+	if(*position < 0 || (size_t)*position >= entry->memory_size)
+		return 0;
+
+	if(count > entry->memory_size - *position)
+		count = entry->memory_size - *position;
+
+	memcpy(buffer, entry->memory + *position, count);
+	*position += count;
+	return count;
+}
+
+// devfs_memory_write(): Writes to memory-backed devices
+// Param:	devfs_entry_t *entry - device
+// Param:	char *buffer - buffer to write
+// Param:	size_t count - bytes to write
+// Param:	off_t *position - position to write to
+// Return:	ssize_t - bytes actually written, or error code
+
+ssize_t devfs_memory_write(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
+{
+	if(*position < 0 || (size_t)*position >= entry->memory_size)
+		return EFBIG;
+
+	if(count > entry->memory_size - *position)
+		count = entry->memory_size - *position;
+
+	memcpy(entry->memory + *position, buffer, count);
+	*position += count;
+	return count;
+}
+
+// devfs_random_read(): Reads from /dev/random and /dev/urandom
+// Param:	devfs_entry_t *entry - device
+// Param:	char *buffer - buffer to read
+// Param:	size_t count - bytes to read
+// Param:	off_t *position - unused
+// Return:	ssize_t - bytes actually read
+
+ssize_t devfs_random_read(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
+{
+	size_t random_count = 0;
+	while(random_count < count)
 	{
-		tty_write(buffer, count, (size_t)files[handle].path[8] - 48);
-		release_lock(&vfs_mutex);
-		return count;
-	} else if(strcmp(files[handle].path, "/dev/port") == 0)
+		buffer[random_count] = (char)rand() & 0xFF;
+		random_count++;
+	}
+
+	return count;
+}
+
+// devfs_port_read(): Reads from an I/O port through /dev/port
+// Param:	devfs_entry_t *entry - device
+// Param:	char *buffer - buffer to read
+// Param:	size_t count - 1, 2 or 4 bytes
+// Param:	off_t *position - I/O port
+// Return:	ssize_t - bytes actually read, or error code
+
+ssize_t devfs_port_read(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
+{
+	if(count == 1)
+		((uint8_t*)buffer)[0] = inb((uint16_t)*position);
+	else if(count == 2)
+		((uint16_t*)buffer)[0] = inw((uint16_t)*position);
+	else if(count == 4)
+		((uint32_t*)buffer)[0] = ind((uint16_t)*position);
+	else
 	{
-		// write to I/O ports here!
-		if(count == 1)
-		{
-			byte = (uint8_t*)buffer;
-			outb((uint16_t)files[handle].position, byte[0]);
-		} else if(count == 2)
-		{
-			word = (uint16_t*)buffer;
-			outw((uint16_t)files[handle].position, word[0]);
-		} else if(count == 4)
-		{
-			dword = (uint32_t*)buffer;
-			outd((uint16_t)files[handle].position, dword[0]);
-		} else
-		{
-			kprintf("devfs: attempted to write undefined size %d to I/O port 0x%xw\n", count, (uint16_t)files[handle].position);
-			release_lock(&vfs_mutex);
-			return EIO;
-		}
+		kprintf("devfs: attempted to read undefined size %d from I/O port 0x%xw\n", count, (uint16_t)*position);
+		return EIO;
+	}
+
+	return count;
+}
+
+// devfs_port_write(): Writes to an I/O port through /dev/port
+// Param:	devfs_entry_t *entry - device
+// Param:	char *buffer - buffer to write
+// Param:	size_t count - 1, 2 or 4 bytes
+// Param:	off_t *position - I/O port
+// Return:	ssize_t - bytes actually written, or error code
 
-		release_lock(&vfs_mutex);
-		return count;
+ssize_t devfs_port_write(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
+{
+	if(count == 1)
+		outb((uint16_t)*position, ((uint8_t*)buffer)[0]);
+	else if(count == 2)
+		outw((uint16_t)*position, ((uint16_t*)buffer)[0]);
+	else if(count == 4)
+		outd((uint16_t)*position, ((uint32_t*)buffer)[0]);
+	else
+	{
+		kprintf("devfs: attempted to write undefined size %d to I/O port 0x%xw\n", count, (uint16_t)*position);
+		return EIO;
 	}
 
-	release_lock(&vfs_mutex);
-	return 0;
+	return count;
 }
 
+// devfs_console_write(): Writes to the terminal of the running process
+// Param:	devfs_entry_t *entry - device
+// Param:	char *buffer - buffer to write
+// Param:	size_t count - bytes to write
+// Param:	off_t *position - unused
+// Return:	ssize_t - bytes actually written
 
+ssize_t devfs_console_write(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
+{
+	tty_write(buffer, count, get_tty());
+	return count;
+}
 
+// devfs_tty_write(): Writes to one terminal
+// Param:	devfs_entry_t *entry - device
+// Param:	char *buffer - buffer to write
+// Param:	size_t count - bytes to write
+// Param:	off_t *position - unused
+// Return:	ssize_t - bytes actually written
 
+ssize_t devfs_tty_write(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
+{
+	tty_write(buffer, count, entry->minor);
+	return count;
+}
+
+// devfs_blkdev_read(): Reads from a block device
+// Param:	devfs_entry_t *entry - device
+// Param:	char *buffer - buffer to read
+// Param:	size_t count - bytes to read
+// Param:	off_t *position - byte offset on the device
+// Return:	ssize_t - bytes actually read, or error code
 
+ssize_t devfs_blkdev_read(devfs_entry_t *entry, char *buffer, size_t count, off_t *position)
+{
+	if(blkdev_read_bytes(entry->device, (uint64_t)*position, count, buffer) != 0)
+		return EIO;
+
+	return count;
+}
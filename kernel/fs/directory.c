@@ -11,6 +11,7 @@
 #include <string.h>
 #include <devfs.h>
 #include <lock.h>
+#include <dcache.h>
 
 // dir_open(): Opens a directory
 // Param:	char *path - path of directory
@@ -18,7 +19,22 @@
 
 directory_t *dir_open(char *path)
 {
-	return NULL;
+	directory_t *directory = kcalloc(sizeof(directory_t), 1);
+	vnode_t *vnode;
+
+	acquire_lock(&vfs_mutex);
+	vfs_resolve_path(directory->path, path);
+	int status = dcache_lookup(directory->path, &vnode);
+	release_lock(&vfs_mutex);
+
+	if(status != 0 || !(vnode->mode & S_IFDIR) || !vnode->ops->readdir)
+	{
+		kfree(directory);
+		return NULL;
+	}
+
+	directory->vnode = vnode;
+	return directory;
 }
 
 // dir_close(): Closes a directory
@@ -37,7 +53,11 @@ void dir_close(directory_t *directory)
 
 int dir_query(directory_t *directory, directory_entry_t *entry)
 {
-	return -1;
+	int status = directory->vnode->ops->readdir(directory->vnode, directory->index, entry);
+	if(status == 0)
+		directory->index++;
+
+	return status;
 }
 
 
@@ -0,0 +1,467 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <epoll.h>
+#include <vfs.h>
+#include <mm.h>
+#include <lock.h>
+#include <timer.h>
+#include <tasking.h>
+#include <string.h>
+
+// Event Notification
+// Drivers push events to everything watching a file when its state changes,
+// which puts the watching items on their epoll instance's ready list, so
+// epoll_wait() only ever looks at files that are ready. Level-triggered
+// items go back on the ready list after they're delivered for as long as
+// they're still ready, and edge-triggered items wait for the next push.
+// Devices on /dev are always as ready as they'll ever be for now, so only
+// pipes push anything yet.
+
+file_t *epoll_get(int);
+uint32_t epoll_poll_item(epoll_item_t *);
+int epoll_control(epoll_t *, int, int, file_t *, struct epoll_event *);
+int epoll_wait_events(epoll_t *, struct epoll_event *, int, int);
+void epoll_queue(epoll_item_t *);
+void epoll_detach(epoll_item_t *);
+void epoll_release(file_t *);
+
+const file_ops_t epoll_file_ops = {
+	.release = &epoll_release,
+};
+
+// epoll_create(): Creates an epoll instance
+// Param:	int size - ignored, only for compatibility
+// Return:	int - file handle, or error code
+
+int epoll_create(int size)
+{
+	file_t *file = file_alloc(&epoll_file_ops, kcalloc(sizeof(epoll_t), 1), O_RDONLY, 0);
+
+	int handle = fd_alloc(get_pid(), file);
+	if(handle < 0)
+		file_put(file);
+
+	return handle;
+}
+
+// epoll_get(): Returns the open file of an epoll instance
+// Param:	int handle - file handle
+// Return:	file_t * - open file with a new reference, NULL if it isn't one
+
+file_t *epoll_get(int handle)
+{
+	file_t *file = fd_get(get_pid(), handle);
+	if(file && file->ops != &epoll_file_ops)
+	{
+		file_put(file);
+		return NULL;
+	}
+
+	return file;
+}
+
+// epoll_release(): Destroys an epoll instance after its last reference
+// Param:	file_t *file - open file
+// Return:	Nothing
+
+void epoll_release(file_t *file)
+{
+	epoll_destroy((epoll_t*)file->node);
+}
+
+// epoll_poll_item(): Returns the current events of a watched file
+// Param:	epoll_item_t *item - item, whose file is still there
+// Return:	uint32_t - events
+
+uint32_t epoll_poll_item(epoll_item_t *item)
+{
+	// regular files never have to wait
+	if(!item->ops->poll)
+		return EPOLLIN | EPOLLOUT;
+
+	return item->ops->poll(item->node, item->flags);
+}
+
+// epoll_queue(): Puts an item on the ready list, with the instance locked
+// Param:	epoll_item_t *item - item
+// Return:	Nothing
+
+void epoll_queue(epoll_item_t *item)
+{
+	if(item->ready)
+		return;
+
+	epoll_t *epoll = item->epoll;
+	item->ready = 1;
+	item->ready_next = NULL;
+
+	if(epoll->ready_tail)
+		epoll->ready_tail->ready_next = item;
+	else
+		epoll->ready = item;
+
+	epoll->ready_tail = item;
+}
+
+// epoll_detach(): Takes an item off the watch list of its file
+// Param:	epoll_item_t *item - item
+// Return:	Nothing
+
+void epoll_detach(epoll_item_t *item)
+{
+	poll_list_t *list = item->source;
+	if(!list)
+		return;
+
+	acquire_lock(&list->lock);
+
+	epoll_item_t **link = &list->items;
+	while(*link)
+	{
+		if(*link == item)
+		{
+			*link = item->watch_next;
+			break;
+		}
+
+		link = &(*link)->watch_next;
+	}
+
+	item->source = NULL;
+	release_lock(&list->lock);
+}
+
+// epoll_ctl(): Adds, changes or removes a file of an epoll instance
+// Param:	int epoll_handle - epoll instance
+// Param:	int operation - EPOLL_CTL_*
+// Param:	int handle - file handle
+// Param:	struct epoll_event *event - events and data, unused for EPOLL_CTL_DEL
+// Return:	int - status code
+
+int epoll_ctl(int epoll_handle, int operation, int handle, struct epoll_event *event)
+{
+	file_t *epoll_file = epoll_get(epoll_handle);
+	if(!epoll_file)
+		return EBADF;
+
+	file_t *file = fd_get(get_pid(), handle);
+	int status;
+
+	if(file && file != epoll_file)
+		status = epoll_control((epoll_t*)epoll_file->node, operation, handle, file, event);
+	else
+		status = EBADF;
+
+	if(file)
+		file_put(file);
+
+	file_put(epoll_file);
+	return status;
+}
+
+// epoll_control(): Adds, changes or removes a file of an epoll instance
+// Param:	epoll_t *epoll - epoll instance
+// Param:	int operation - EPOLL_CTL_*
+// Param:	int handle - file handle
+// Param:	file_t *file - open file behind the handle
+// Param:	struct epoll_event *event - events and data, unused for EPOLL_CTL_DEL
+// Return:	int - status code
+
+int epoll_control(epoll_t *epoll, int operation, int handle, file_t *file, struct epoll_event *event)
+{
+	// find the file's item first, and a handle that's been reused for
+	// something else doesn't count
+	acquire_lock(&epoll->lock);
+	epoll_item_t *item = epoll->items;
+	while(item && (item->handle != handle || item->node != file->node))
+		item = item->next;
+
+	release_lock(&epoll->lock);
+
+	poll_list_t *list;
+	epoll_item_t **link;
+
+	switch(operation)
+	{
+	case EPOLL_CTL_ADD:
+		if(item)
+			return EBUSY;
+
+		// regular files are always ready, so they can't be watched
+		if(!file->ops->poll_list)
+			return EPERM;
+
+		list = file->ops->poll_list(file->node);
+		item = kcalloc(sizeof(epoll_item_t), 1);
+		item->epoll = epoll;
+		item->handle = handle;
+		item->ops = file->ops;
+		item->node = file->node;
+		item->flags = file->flags;
+		item->events = event->events;
+		item->data = event->data;
+		item->source = list;
+
+		acquire_lock(&epoll->lock);
+		item->next = epoll->items;
+		epoll->items = item;
+		release_lock(&epoll->lock);
+
+		acquire_lock(&list->lock);
+		item->watch_next = list->items;
+		list->items = item;
+		release_lock(&list->lock);
+		break;
+
+	case EPOLL_CTL_MOD:
+		if(!item)
+			return ENOENT;
+
+		acquire_lock(&epoll->lock);
+		item->events = event->events;
+		item->data = event->data;
+		release_lock(&epoll->lock);
+		break;
+
+	case EPOLL_CTL_DEL:
+		if(!item)
+			return ENOENT;
+
+		// nothing can push to it after this
+		epoll_detach(item);
+
+		acquire_lock(&epoll->lock);
+		link = &epoll->items;
+		while(*link != item)
+			link = &(*link)->next;
+
+		*link = item->next;
+
+		if(item->ready)
+		{
+			link = &epoll->ready;
+			epoll->ready_tail = NULL;
+			while(*link)
+			{
+				if(*link == item)
+					*link = item->ready_next;
+				else
+				{
+					epoll->ready_tail = *link;
+					link = &(*link)->ready_next;
+				}
+			}
+		}
+
+		release_lock(&epoll->lock);
+		kfree(item);
+		return 0;
+
+	default:
+		return EINVAL;
+	}
+
+	// the file might be ready already, and nothing would push that
+	if(epoll_poll_item(item) & (item->events | EPOLL_ALWAYS))
+	{
+		acquire_lock(&epoll->lock);
+		epoll_queue(item);
+		release_lock(&epoll->lock);
+	}
+
+	return 0;
+}
+
+// epoll_wait(): Waits for events
+// Param:	int epoll_handle - epoll instance
+// Param:	struct epoll_event *events - destination
+// Param:	int max_events - size of destination
+// Param:	int timeout - in milliseconds, -1 to wait forever
+// Return:	int - count of events, or error code
+
+int epoll_wait(int epoll_handle, struct epoll_event *events, int max_events, int timeout)
+{
+	if(max_events <= 0)
+		return EINVAL;
+
+	// the reference keeps the instance around while we're waiting
+	file_t *file = epoll_get(epoll_handle);
+	if(!file)
+		return EBADF;
+
+	int count = epoll_wait_events((epoll_t*)file->node, events, max_events, timeout);
+	file_put(file);
+	return count;
+}
+
+// epoll_wait_events(): Waits for events of an epoll instance
+// Param:	epoll_t *epoll - epoll instance
+// Param:	struct epoll_event *events - destination
+// Param:	int max_events - size of destination
+// Param:	int timeout - in milliseconds, -1 to wait forever
+// Return:	int - count of events
+
+int epoll_wait_events(epoll_t *epoll, struct epoll_event *events, int max_events, int timeout)
+{
+	uint64_t deadline = global_uptime + (uint64_t)timeout;
+	epoll_item_t *list, *item, *requeue;
+	uint32_t current;
+	int count;
+
+	while(1)
+	{
+		acquire_lock(&epoll->lock);
+
+		// take the whole ready list, and put back what doesn't fit
+		list = epoll->ready;
+		epoll->ready = NULL;
+		epoll->ready_tail = NULL;
+
+		count = 0;
+		requeue = NULL;
+		item = list;
+		while(item)
+		{
+			list = item->ready_next;
+			item->ready = 0;
+
+			if(count >= max_events)
+			{
+				epoll_queue(item);
+				item = list;
+				continue;
+			}
+
+			if(item->source)
+				current = epoll_poll_item(item);
+			else
+				current = item->pending;
+
+			current &= item->events | EPOLL_ALWAYS;
+			item->pending = 0;
+
+			if(current)
+			{
+				events[count].events = current;
+				events[count].data = item->data;
+				count++;
+
+				if(item->events & EPOLLONESHOT)
+					item->events &= EPOLLET | EPOLLONESHOT;
+				else if(!(item->events & EPOLLET))
+				{
+					item->ready_next = requeue;
+					requeue = item;
+				}
+			}
+
+			item = list;
+		}
+
+		// level-triggered files stay ready until they aren't, and go after
+		// everything that's waiting so they can't starve it
+		while(requeue)
+		{
+			item = requeue;
+			requeue = item->ready_next;
+			epoll_queue(item);
+		}
+
+		release_lock(&epoll->lock);
+
+		if(count || !timeout)
+			return count;
+
+		if(timeout > 0 && global_uptime >= deadline)
+			return 0;
+
+		// there's no scheduler to block on yet
+		while(!epoll->ready)
+		{
+			if(timeout > 0 && global_uptime >= deadline)
+				return 0;
+
+			asm volatile ("pause");
+		}
+	}
+}
+
+// epoll_destroy(): Destroys an epoll instance when its last handle is closed
+// Param:	epoll_t *epoll - epoll instance
+// Return:	Nothing
+
+void epoll_destroy(epoll_t *epoll)
+{
+	epoll_item_t *item = epoll->items;
+	epoll_item_t *next;
+
+	while(item)
+	{
+		next = item->next;
+		epoll_detach(item);
+		kfree(item);
+		item = next;
+	}
+
+	kfree(epoll);
+}
+
+// poll_notify(): Pushes events to everything watching a file
+// Param:	poll_list_t *list - watch list of the file
+// Param:	uint32_t events - events that happened
+// Return:	Nothing
+
+void poll_notify(poll_list_t *list, uint32_t events)
+{
+	acquire_lock(&list->lock);
+
+	epoll_item_t *item = list->items;
+	while(item)
+	{
+		if(events & (item->events | EPOLL_ALWAYS))
+		{
+			acquire_lock(&item->epoll->lock);
+			item->pending |= events & (item->events | EPOLL_ALWAYS);
+			epoll_queue(item);
+			release_lock(&item->epoll->lock);
+		}
+
+		item = item->watch_next;
+	}
+
+	release_lock(&list->lock);
+}
+
+// poll_release(): Detaches everything watching a file that's going away
+// Param:	poll_list_t *list - watch list of the file
+// Return:	Nothing
+
+void poll_release(poll_list_t *list)
+{
+	acquire_lock(&list->lock);
+
+	epoll_item_t *item = list->items;
+	epoll_item_t *next;
+
+	while(item)
+	{
+		next = item->watch_next;
+
+		acquire_lock(&item->epoll->lock);
+		item->source = NULL;
+		item->watch_next = NULL;
+		item->pending |= EPOLLHUP;
+		epoll_queue(item);
+		release_lock(&item->epoll->lock);
+
+		item = next;
+	}
+
+	list->items = NULL;
+	release_lock(&list->lock);
+}
+
@@ -0,0 +1,184 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <vfs.h>
+#include <mm.h>
+#include <lock.h>
+#include <tasking.h>
+#include <string.h>
+#include <kprintf.h>
+
+// File Descriptors
+// Each process has its own table of descriptors, made the first time it
+// uses one, and a descriptor is only a pointer to an open file. Open files
+// are counted, so descriptors can share them, and whatever opened the file
+// gets told when the last one goes away. The lowest free descriptor comes
+// from a bitmap, one word at a time.
+
+lock_t fd_mutex = 0;
+
+// file_alloc(): Creates an open file
+// Param:	const file_ops_t *ops - operations of this kind of file
+// Param:	void *node - driver or filesystem node
+// Param:	int flags - open flags
+// Param:	mode_t mode - file type
+// Return:	file_t * - open file, with one reference
+
+file_t *file_alloc(const file_ops_t *ops, void *node, int flags, mode_t mode)
+{
+	file_t *file = kcalloc(sizeof(file_t), 1);
+	file->ops = ops;
+	file->node = node;
+	file->flags = flags;
+	file->mode = mode & S_IFMT;
+	file->references = 1;
+	return file;
+}
+
+// file_get(): Takes a reference to an open file
+// Param:	file_t *file - open file
+// Return:	Nothing
+
+void file_get(file_t *file)
+{
+	atomic_add(&file->references, 1);
+}
+
+// file_put(): Drops a reference to an open file, closing it with the last one
+// Param:	file_t *file - open file
+// Return:	Nothing
+
+void file_put(file_t *file)
+{
+	if(atomic_add(&file->references, -1) != 1)
+		return;
+
+	if(file->ops->release)
+		file->ops->release(file);
+
+	kfree(file);
+}
+
+// fd_table(): Returns the descriptor table of a process
+// Param:	pid_t pid - process ID
+// Return:	fd_table_t * - descriptor table
+
+fd_table_t *fd_table(pid_t pid)
+{
+	fd_table_t *table = processes[pid].fd_table;
+	if(table)
+		return table;
+
+	acquire_lock(&fd_mutex);
+	if(processes[pid].fd_table)
+	{
+		release_lock(&fd_mutex);
+		return processes[pid].fd_table;
+	}
+
+	table = kcalloc(sizeof(fd_table_t), 1);
+
+	// the first three are always stdin, stdout, stderr
+	file_t *file;
+	if(file_open("/dev/stdin", O_RDONLY, &file) == 0)
+	{
+		table->files[STDIN] = file;
+		table->bitmap[0] |= (size_t)1 << STDIN;
+	}
+
+	if(file_open("/dev/stdout", O_WRONLY, &file) == 0)
+	{
+		table->files[STDOUT] = file;
+		table->bitmap[0] |= (size_t)1 << STDOUT;
+	}
+
+	if(file_open("/dev/stderr", O_WRONLY, &file) == 0)
+	{
+		table->files[STDERR] = file;
+		table->bitmap[0] |= (size_t)1 << STDERR;
+	}
+
+	processes[pid].fd_table = table;
+	release_lock(&fd_mutex);
+	return table;
+}
+
+// fd_alloc(): Gives an open file the lowest free descriptor
+// Param:	pid_t pid - process ID
+// Param:	file_t *file - open file, whose reference the descriptor takes
+// Return:	int - descriptor, or error code
+
+int fd_alloc(pid_t pid, file_t *file)
+{
+	fd_table_t *table = fd_table(pid);
+	size_t word, bit;
+
+	acquire_lock(&table->lock);
+
+	for(word = 0; word < FD_BITMAP_SIZE; word++)
+	{
+		if(table->bitmap[word] == (size_t)-1)
+			continue;
+
+		bit = __builtin_ctzl(~table->bitmap[word]);
+		table->bitmap[word] |= (size_t)1 << bit;
+
+		word = (word * sizeof(size_t) * 8) + bit;
+		table->files[word] = file;
+
+		release_lock(&table->lock);
+		return (int)word;
+	}
+
+	release_lock(&table->lock);
+	return ENOBUFS;
+}
+
+// fd_get(): Returns the open file behind a descriptor
+// Param:	pid_t pid - process ID
+// Param:	int handle - descriptor
+// Return:	file_t * - open file with a new reference, NULL if there isn't one
+
+file_t *fd_get(pid_t pid, int handle)
+{
+	if(handle < 0 || handle >= MAX_FILES)
+		return NULL;
+
+	fd_table_t *table = fd_table(pid);
+
+	acquire_lock(&table->lock);
+	file_t *file = table->files[handle];
+	if(file)
+		file_get(file);
+
+	release_lock(&table->lock);
+	return file;
+}
+
+// fd_remove(): Frees a descriptor
+// Param:	pid_t pid - process ID
+// Param:	int handle - descriptor
+// Return:	file_t * - open file, whose reference goes to the caller, or NULL
+
+file_t *fd_remove(pid_t pid, int handle)
+{
+	if(handle < 0 || handle >= MAX_FILES)
+		return NULL;
+
+	fd_table_t *table = fd_table(pid);
+	size_t bits = sizeof(size_t) * 8;
+
+	acquire_lock(&table->lock);
+	file_t *file = table->files[handle];
+	if(file)
+	{
+		table->files[handle] = NULL;
+		table->bitmap[handle / bits] &= ~((size_t)1 << (handle % bits));
+	}
+
+	release_lock(&table->lock);
+	return file;
+}
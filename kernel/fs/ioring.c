@@ -0,0 +1,423 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <ioring.h>
+#include <vfs.h>
+#include <mm.h>
+#include <lock.h>
+#include <apic.h>
+#include <cpu.h>
+#include <tasking.h>
+#include <string.h>
+#include <kprintf.h>
+
+// I/O Rings
+// A submission ring and a completion ring in memory shared with user space,
+// so one ioring_enter() call can submit any number of VFS operations. With
+// IORING_SETUP_POLL, an otherwise idle CPU keeps polling the submission ring
+// so no system calls are needed at all, and it only halts after it's been
+// idle for a while, setting IORING_SQ_NEED_WAKEUP to say so.
+// Everything under the VFS is synchronous for now, so completions are posted
+// as soon as each operation returns, through ioring_complete().
+
+ioring_t *iorings;
+lock_t ioring_mutex = 0;
+size_t ioring_poll_cpu = IORING_NO_POLL_CPU;	// never the boot CPU
+size_t ioring_idle = 0;
+
+uint32_t ioring_submit(ioring_t *, uint32_t);
+ssize_t ioring_execute(ioring_t *, ioring_sqe_t *);
+void ioring_wake(void *);
+
+// ioring_init(): Initializes I/O rings
+// Param:	Nothing
+// Return:	Nothing
+
+void ioring_init()
+{
+	iorings = kcalloc(sizeof(ioring_t), MAX_IORINGS);
+}
+
+// ioring_setup(): Creates an I/O ring
+// Param:	uint32_t entries - minimum submission ring size
+// Param:	ioring_params_t *params - flags in, and where to find the ring out
+// Return:	int - ring number, or error code
+
+int ioring_setup(uint32_t entries, ioring_params_t *params)
+{
+	if(!entries || entries > IORING_MAX_ENTRIES)
+		return EINVAL;
+
+	uint32_t sq_entries = 1;
+	while(sq_entries < entries)
+		sq_entries <<= 1;
+
+	// twice as many completions, so a full submission ring always fits
+	uint32_t cq_entries = sq_entries << 1;
+
+	size_t size = sizeof(ioring_shared_t) + (sq_entries * sizeof(ioring_sqe_t)) + (cq_entries * sizeof(ioring_cqe_t));
+	size_t pages = (size + PAGE_SIZE - 1) >> PAGE_SIZE_SHIFT;
+
+	acquire_lock(&ioring_mutex);
+
+	int ring = 0;
+	while(ring < MAX_IORINGS && (iorings[ring].present || iorings[ring].closing))
+		ring++;
+
+	if(ring >= MAX_IORINGS)
+	{
+		release_lock(&ioring_mutex);
+		return ENOBUFS;
+	}
+
+	ioring_shared_t *shared = (ioring_shared_t*)vmm_alloc(KERNEL_HEAP, pages, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+	if(!shared)
+	{
+		release_lock(&ioring_mutex);
+		return ENOBUFS;
+	}
+
+	memset(shared, 0, pages << PAGE_SIZE_SHIFT);
+	shared->sq_entries = sq_entries;
+	shared->cq_entries = cq_entries;
+	shared->sq_offset = sizeof(ioring_shared_t);
+	shared->cq_offset = shared->sq_offset + (sq_entries * sizeof(ioring_sqe_t));
+
+	// the last CPU that's up and idle does the polling
+	size_t i;
+	if((params->flags & IORING_SETUP_POLL) && ioring_poll_cpu == IORING_NO_POLL_CPU)
+	{
+		for(i = lapic_count; i > 0; i--)
+		{
+			if(i - 1 != bsp_index && lapics[i - 1].started && cpus[i - 1])
+			{
+				ioring_poll_cpu = i - 1;
+				kprintf("ioring: CPU index %d is polling I/O rings\n", i - 1);
+				break;
+			}
+		}
+	}
+
+	if(ioring_poll_cpu == IORING_NO_POLL_CPU)
+		params->flags &= ~IORING_SETUP_POLL;
+
+	iorings[ring].flags = params->flags & IORING_SETUP_POLL;
+	iorings[ring].pid = get_pid();
+	iorings[ring].shared = shared;
+	iorings[ring].sq = (ioring_sqe_t*)((size_t)shared + shared->sq_offset);
+	iorings[ring].cq = (ioring_cqe_t*)((size_t)shared + shared->cq_offset);
+	iorings[ring].pages = pages;
+	iorings[ring].lock = 0;
+	iorings[ring].closing = 0;
+	iorings[ring].users = 0;
+	iorings[ring].present = 1;
+
+	release_lock(&ioring_mutex);
+
+	params->sq_entries = sq_entries;
+	params->cq_entries = cq_entries;
+	params->ring = shared;
+	params->size = size;
+	return ring;
+}
+
+// ioring_enter(): Submits entries and waits for completions
+// Param:	int ring - ring number
+// Param:	uint32_t to_submit - maximum entries to submit
+// Param:	uint32_t min_complete - completions to wait for
+// Param:	uint32_t flags - IORING_ENTER_* flags
+// Return:	int - entries submitted, or error code
+
+int ioring_enter(int ring, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+	if(ring < 0 || ring >= MAX_IORINGS)
+		return EBADF;
+
+	ioring_t *ioring = &iorings[ring];
+
+	// hold a reference instead of the lock, which the polling CPU needs
+	// while we wait for it, so ioring_destroy() can't free the shared pages
+	acquire_lock(&ioring->lock);
+	if(!ioring->present || ioring->closing)
+	{
+		release_lock(&ioring->lock);
+		return EBADF;
+	}
+
+	atomic_add(&ioring->users, 1);
+	release_lock(&ioring->lock);
+
+	ioring_shared_t *shared = ioring->shared;
+	uint32_t submitted;
+
+	if(ioring->flags & IORING_SETUP_POLL)
+	{
+		// the polling CPU does the submitting
+		if((flags & IORING_ENTER_SQ_WAKEUP) && (shared->flags & IORING_SQ_NEED_WAKEUP))
+			smp_call_function_single(ioring_poll_cpu, &ioring_wake, NULL, 0);
+
+		// so all we can say is how many it has left to take
+		submitted = shared->sq_tail - shared->sq_head;
+		if(submitted > to_submit)
+			submitted = to_submit;
+	} else
+	{
+		acquire_lock(&ioring->lock);
+		submitted = ioring_submit(ioring, to_submit);
+		release_lock(&ioring->lock);
+	}
+
+	if(flags & IORING_ENTER_GETEVENTS)
+	{
+		// an entry stays in the submission ring until it's complete, so
+		// stop waiting once it's empty
+		while((uint32_t)(shared->cq_tail - shared->cq_head) < min_complete)
+		{
+			if(shared->sq_head == shared->sq_tail)
+				break;
+
+			asm volatile ("pause");
+		}
+	}
+
+	atomic_add(&ioring->users, -1);
+	return (int)submitted;
+}
+
+// ioring_destroy(): Destroys an I/O ring
+// Param:	int ring - ring number
+// Return:	int - status code
+
+int ioring_destroy(int ring)
+{
+	if(ring < 0 || ring >= MAX_IORINGS)
+		return EBADF;
+
+	ioring_t *ioring = &iorings[ring];
+
+	// the polling CPU holds the lock while it's using the ring
+	acquire_lock(&ioring->lock);
+	if(!ioring->present || ioring->closing)
+	{
+		release_lock(&ioring->lock);
+		return EBADF;
+	}
+
+	// no new callers after this, then wait for the ones already in
+	ioring->closing = 1;
+	release_lock(&ioring->lock);
+
+	while(ioring->users)
+		asm volatile ("pause");
+
+	acquire_lock(&ioring->lock);
+	vmm_free((size_t)ioring->shared, ioring->pages);
+	ioring->present = 0;
+	ioring->shared = NULL;
+	ioring->closing = 0;
+	release_lock(&ioring->lock);
+	return 0;
+}
+
+// ioring_complete(): Posts a completion
+// Param:	ioring_t *ioring - ring
+// Param:	uint64_t user_data - from the submission
+// Param:	ssize_t result - result of the operation
+// Return:	Nothing
+
+void ioring_complete(ioring_t *ioring, uint64_t user_data, ssize_t result)
+{
+	ioring_shared_t *shared = ioring->shared;
+	uint32_t tail = shared->cq_tail;
+
+	ioring->cq[tail & (shared->cq_entries - 1)].user_data = user_data;
+	ioring->cq[tail & (shared->cq_entries - 1)].result = (int64_t)result;
+
+	// the entry has to be visible before the tail
+	memory_barrier();
+	shared->cq_tail = tail + 1;
+}
+
+// ioring_submit(): Runs entries from the submission ring, with the ring locked
+// Param:	ioring_t *ioring - ring
+// Param:	uint32_t to_submit - maximum entries to run
+// Return:	uint32_t - entries run
+
+uint32_t ioring_submit(ioring_t *ioring, uint32_t to_submit)
+{
+	ioring_shared_t *shared = ioring->shared;
+	ioring_sqe_t sqe;
+	uint32_t head, submitted = 0;
+	ssize_t result;
+
+	while(submitted < to_submit)
+	{
+		head = shared->sq_head;
+		if(head == shared->sq_tail)
+			break;
+
+		// leave it in the ring until there's room for the completion
+		if((uint32_t)(shared->cq_tail - shared->cq_head) >= shared->cq_entries)
+			break;
+
+		// read the entry after the tail, and copy it so user space can't
+		// change it while we're using it
+		memory_barrier();
+		memcpy(&sqe, &ioring->sq[head & (shared->sq_entries - 1)], sizeof(ioring_sqe_t));
+
+		result = ioring_execute(ioring, &sqe);
+		ioring_complete(ioring, sqe.user_data, result);
+
+		shared->sq_head = head + 1;
+		submitted++;
+	}
+
+	return submitted;
+}
+
+// ioring_execute(): Runs one submission entry
+// Param:	ioring_t *ioring - ring, whose process owns the file handles
+// Param:	ioring_sqe_t *sqe - entry
+// Return:	ssize_t - result of the operation
+
+ssize_t ioring_execute(ioring_t *ioring, ioring_sqe_t *sqe)
+{
+	switch(sqe->opcode)
+	{
+	case IORING_OP_NOP:
+		return 0;
+
+	case IORING_OP_STAT:
+		return stat((const char*)(size_t)sqe->path, (struct stat*)(size_t)sqe->buffer);
+
+	case IORING_OP_READ:
+	case IORING_OP_WRITE:
+	case IORING_OP_FSTAT:
+		break;
+
+	default:
+		return EINVAL;
+	}
+
+	// this might be the polling CPU, so the handle can't be looked up in
+	// the running process
+	file_t *file = fd_get(ioring->pid, sqe->handle);
+	if(!file)
+		return EBADF;
+
+	off_t position = (off_t)sqe->offset;
+	off_t *pointer = (sqe->offset == IORING_OFFSET_CURRENT) ? NULL : &position;
+	ssize_t status;
+
+	if(sqe->opcode == IORING_OP_READ)
+		status = file_read(file, (char*)(size_t)sqe->buffer, sqe->length, pointer);
+	else if(sqe->opcode == IORING_OP_WRITE)
+		status = file_write(file, (char*)(size_t)sqe->buffer, sqe->length, pointer);
+	else
+		status = file_stat(file, (struct stat*)(size_t)sqe->buffer);
+
+	file_put(file);
+	return status;
+}
+
+// ioring_wake(): Wakes up the polling CPU, which the IPI itself already does
+// Param:	void *argument - unused
+// Return:	Nothing
+
+void ioring_wake(void *argument)
+{
+}
+
+// ioring_poll(): Polls I/O rings, called from the idle loop of each AP
+// Param:	size_t index - CPU index
+// Return:	int - 1 to keep polling, 0 if idle long enough to halt
+
+int ioring_poll(size_t index)
+{
+	if(index != ioring_poll_cpu)
+		return 0;
+
+	int work = 0;
+	ioring_t *ioring;
+	size_t i;
+
+	for(i = 0; i < MAX_IORINGS; i++)
+	{
+		ioring = &iorings[i];
+		if(!ioring->present || !(ioring->flags & IORING_SETUP_POLL))
+			continue;
+
+		acquire_lock(&ioring->lock);
+		if(ioring->present)
+		{
+			ioring->shared->flags &= ~IORING_SQ_NEED_WAKEUP;
+			if(ioring_submit(ioring, ioring->shared->sq_entries))
+				work = 1;
+		}
+
+		release_lock(&ioring->lock);
+	}
+
+	if(work)
+	{
+		ioring_idle = 0;
+		return 1;
+	}
+
+	ioring_idle++;
+	if(ioring_idle < IORING_POLL_SPINS)
+	{
+		asm volatile ("pause");
+		return 1;
+	}
+
+	return 0;
+}
+
+// ioring_sleep(): Tells user space the polling CPU is about to halt
+// Called with interrupts disabled, so a wakeup can't come before the HLT
+// Param:	size_t index - CPU index
+// Return:	int - 1 if the CPU can halt
+
+int ioring_sleep(size_t index)
+{
+	if(index != ioring_poll_cpu)
+		return 1;
+
+	int pending = 0;
+	ioring_t *ioring;
+	size_t i;
+
+	for(i = 0; i < MAX_IORINGS; i++)
+	{
+		ioring = &iorings[i];
+		if(!ioring->present || !(ioring->flags & IORING_SETUP_POLL))
+			continue;
+
+		acquire_lock(&ioring->lock);
+		if(ioring->present)
+		{
+			// set the flag before checking the tail, and user space does
+			// the opposite, so one of us always sees the other
+			ioring->shared->flags |= IORING_SQ_NEED_WAKEUP;
+			memory_barrier();
+
+			if(ioring->shared->sq_head != ioring->shared->sq_tail)
+				pending = 1;
+		}
+
+		release_lock(&ioring->lock);
+	}
+
+	if(pending)
+	{
+		ioring_idle = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
@@ -9,43 +9,37 @@
 #include <kprintf.h>
 #include <string.h>
 #include <lock.h>
+#include <devfs.h>
+#include <ustar.h>
+#include <dcache.h>
 
-// vfs_determine_mountpoint(): Determines the mountpoint of a path
-// Param:	char *path - fully resolved path
-// Return:	int - mountpoint index containing requested path, -1 on error
+// every kind of filesystem that can be mounted
+const filesystem_t filesystems[] = {
+	{"ustar", &ustar_mount},
+	{NULL, NULL},
+};
 
-int vfs_determine_mountpoint(char *path)
-{
-	int mountpoint = 0, mountpoint2 = 0;
-	size_t size = 0, size2 = 0;
+// vfs_mount_root(): Returns what's mounted on a directory
+// Param:	const char *path - fully resolved path
+// Return:	vnode_t * - root of the filesystem mounted there, NULL if there isn't one
 
-	while(mountpoint < MAX_MOUNTPOINTS)
+vnode_t *vfs_mount_root(const char *path)
+{
+	int mountpoint;
+	for(mountpoint = 0; mountpoint < MAX_MOUNTPOINTS; mountpoint++)
 	{
-		if(mountpoints[mountpoint].present != 1)
-		{
-			mountpoint++;
-			continue;
-		}
-
-		size = strlen(mountpoints[mountpoint].path);
-		if(memcmp(mountpoints[mountpoint].path, path, size) == 0)
-		{
-			// keep the longest path
-			if(size > size2)
-			{
-				size2 = size;
-				mountpoint2 = mountpoint;
-			}
-		}
-
-		mountpoint++;
+		if(mountpoints[mountpoint].present == 1 && strcmp(mountpoints[mountpoint].path, path) == 0)
+			return mountpoints[mountpoint].root;
 	}
 
-	if(size2 != 0 && mountpoint2 < MAX_MOUNTPOINTS)
-		return mountpoint2;
+	// these are always here, underneath everything else
+	if(strcmp(path, "/dev") == 0)
+		return &devfs_vnode;
+
+	if(strcmp(path, "/") == 0)
+		return &vfs_root_vnode;
 
-	else
-		return -1;
+	return NULL;
 }
 
 // mount(): Mounts a filesystem
@@ -80,6 +74,13 @@ int mount(const char *device, const char *dir, const char *fstype, unsigned long
 	if(!stat_info.st_mode & S_IFDIR)
 		return ENOTDIR;
 
+	const filesystem_t *filesystem = filesystems;
+	while(filesystem->name && strcmp(filesystem->name, fstype) != 0)
+		filesystem++;
+
+	if(!filesystem->name)
+		return ENODEV;
+
 	acquire_lock(&vfs_mutex);
 
 	// find an empty mountpoint
@@ -100,6 +101,10 @@ int mount(const char *device, const char *dir, const char *fstype, unsigned long
 	vfs_resolve_path(full_path, device);
 	strcpy(mountpoints[mountpoint].device, full_path);
 
+	// filesystems go straight to the block device
+	devfs_entry_t *entry = devfs_find(full_path + 5);
+	mountpoints[mountpoint].dev = entry ? entry->device : 0;
+
 	vfs_resolve_path(full_path, dir);
 	strcpy(mountpoints[mountpoint].path, full_path);
 
@@ -107,11 +112,72 @@ int mount(const char *device, const char *dir, const char *fstype, unsigned long
 
 	// TO-DO: UID and GID stuff here!
 
+	// the filesystem driver looks at the whole device once, here
+	status = filesystem->mount(&mountpoints[mountpoint]);
+	if(status != 0)
+	{
+		memset(&mountpoints[mountpoint], 0, sizeof(mountpoint_t));
+		release_lock(&vfs_mutex);
+		return status;
+	}
+
+	// anything under dir means something else now
+	dcache_invalidate();
+
 	kprintf("vfs: mounted %s on %s, filesystem type '%s'\n", device, dir, fstype);
 	release_lock(&vfs_mutex);
 	return 0;
 }
 
+// umount(): Unmounts a filesystem
+// Param:	const char *target - directory the filesystem is mounted on
+// Return:	int - status code
 
+int umount(const char *target)
+{
+	return umount2(target, 0);
+}
+
+// umount2(): Unmounts a filesystem
+// Param:	const char *target - directory the filesystem is mounted on
+// Param:	int flags - MNT_* flags, which are ignored for now
+// Return:	int - status code
+
+int umount2(const char *target, int flags)
+{
+	acquire_lock(&vfs_mutex);
+	vfs_resolve_path(full_path, target);
+
+	int mountpoint = 0;
+	while(mountpoint < MAX_MOUNTPOINTS)
+	{
+		if(mountpoints[mountpoint].present == 1 && strcmp(mountpoints[mountpoint].path, full_path) == 0)
+			break;
+
+		mountpoint++;
+	}
+
+	if(mountpoint >= MAX_MOUNTPOINTS)
+	{
+		release_lock(&vfs_mutex);
+		return EINVAL;
+	}
+
+	// the root filesystem stays, because everything else is on it
+	if(strcmp(full_path, "/") == 0)
+	{
+		release_lock(&vfs_mutex);
+		return EBUSY;
+	}
+
+	// open files still point at the mountpoint and the driver's data, so
+	// neither is freed, and the slot can't be used again
+	mountpoints[mountpoint].present = 2;
+	dcache_invalidate();
+
+	kprintf("vfs: unmounted %s from %s\n", mountpoints[mountpoint].device, full_path);
+	release_lock(&vfs_mutex);
+	return 0;
+}
 
 
@@ -0,0 +1,1065 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <pcache.h>
+#include <vfs.h>
+#include <mm.h>
+#include <lock.h>
+#include <string.h>
+#include <kprintf.h>
+#include <timer.h>
+#include <blkdev.h>
+#include <apic.h>
+
+// Page Cache
+// Files of filesystems that have a readpage() function are read a page at a
+// time into here, and read() copies out of these pages while mmap() maps
+// them, so both see the same memory. Each vnode has a radix tree of its
+// pages by index, and every page is on one LRU list, which is where pages
+// that nobody is using come from when the cache is full. Reads that carry on
+// from where the last one ended read ahead of themselves, twice as far each
+// time, and reads anywhere else stop that.
+// Writes only dirty pages, which go on a list for their block device, oldest
+// first. Idle CPUs stand in for flusher threads: each device is flushed by one
+// of them at a time, in batches sorted by file and page, once its oldest page
+// has been dirty long enough or once too much of the cache is dirty. Only one
+// of them keeps an eye on the time though, halting with its local APIC timer
+// set for when the oldest page is due, and the rest halt as usual. With no
+// APs at all, the boot CPU flushes from its idle loop instead. A batch
+// is submitted all at once under a plug, as a bio for each page wherever the
+// filesystem's bmap() says where it goes, so neighbouring pages merge. Writers
+// that get too far ahead flush for themselves, and fsync() and O_SYNC writes
+// don't wait for anyone.
+
+lock_t pcache_mutex = 0;
+cache_page_t *pcache_lru_head = NULL;		// most recently used
+cache_page_t *pcache_lru_tail = NULL;
+cache_page_t *pcache_free = NULL;		// unused descriptors
+size_t pcache_count = 0;
+size_t pcache_limit;
+size_t pcache_dirty_count = 0;
+writeback_t pcache_writeback[MAX_BLKDEVS];
+size_t pcache_flush_cpu = PCACHE_NO_FLUSH_CPU;	// never the boot CPU
+
+void **pcache_alloc_node();
+void **pcache_slot(page_tree_t *, size_t, int);
+cache_page_t *pcache_alloc(vnode_t *, size_t);
+void pcache_free_page(cache_page_t *);
+void pcache_lru_remove(cache_page_t *);
+void pcache_lru_add(cache_page_t *);
+size_t pcache_evict(size_t);
+int pcache_read_page(cache_page_t *);
+void pcache_readahead(file_t *, size_t, size_t);
+cache_page_t *pcache_lookup(vnode_t *, size_t, int);
+void pcache_copy(uint8_t *, const struct iovec *, int *, size_t *, size_t, int);
+void pcache_mark_dirty(cache_page_t *);
+void pcache_dirty_remove(cache_page_t *);
+int pcache_writeback_start(cache_page_t *);
+void pcache_writeback_end(cache_page_t *, int);
+int pcache_writeback_page(cache_page_t *);
+int pcache_writeback_bio(cache_page_t *, bio_t *);
+size_t pcache_write_batch(cache_page_t **, size_t);
+size_t pcache_flush_device(writeback_t *, size_t, int);
+
+// pcache_init(): Initializes the page cache
+// Param:	Nothing
+// Return:	Nothing
+
+void pcache_init()
+{
+	pcache_limit = total_pages / PCACHE_MEMORY_FRACTION;
+	kprintf("pcache: page cache can use up to %d MB\n", (uint32_t)((pcache_limit << PAGE_SIZE_SHIFT) / 1024 / 1024));
+}
+
+// pcache_alloc_node(): Allocates a node of a radix tree
+// Param:	Nothing
+// Return:	void ** - page of empty slots
+
+void **pcache_alloc_node()
+{
+	// kmalloc() would need two pages for this, because of its header
+	return (void**)vmm_alloc(KERNEL_HEAP, 1, PAGE_PRESENT | PAGE_RW);
+}
+
+// pcache_slot(): Finds the slot of a page in a radix tree, with the cache locked
+// Param:	page_tree_t *tree - tree
+// Param:	size_t index - page index
+// Param:	int create - make the nodes on the way if they aren't there
+// Return:	void ** - slot, NULL if it isn't there and create is zero
+
+void **pcache_slot(page_tree_t *tree, size_t index, int create)
+{
+	size_t bits = sizeof(size_t) * 8;
+	void **node;
+	size_t level, slot;
+
+	// the tree grows at the top, so everything that's in it stays put
+	while(!tree->height || (tree->height * PCACHE_RADIX_SHIFT < bits && (index >> (tree->height * PCACHE_RADIX_SHIFT))))
+	{
+		if(!create)
+			return NULL;
+
+		node = pcache_alloc_node();
+		if(!node)
+			return NULL;
+
+		node[0] = tree->root;
+		tree->root = node;
+		tree->height++;
+	}
+
+	// interior nodes are never freed, so slots don't move
+	node = tree->root;
+	for(level = tree->height - 1; level; level--)
+	{
+		slot = (index >> (level * PCACHE_RADIX_SHIFT)) & PCACHE_RADIX_MASK;
+		if(!node[slot])
+		{
+			if(!create)
+				return NULL;
+
+			node[slot] = pcache_alloc_node();
+			if(!node[slot])
+				return NULL;
+		}
+
+		node = (void**)node[slot];
+	}
+
+	return &node[index & PCACHE_RADIX_MASK];
+}
+
+// pcache_lru_remove(): Takes a page off the LRU list, with the cache locked
+// Param:	cache_page_t *page - page
+// Return:	Nothing
+
+void pcache_lru_remove(cache_page_t *page)
+{
+	if(page->lru_prev)
+		page->lru_prev->lru_next = page->lru_next;
+	else
+		pcache_lru_head = page->lru_next;
+
+	if(page->lru_next)
+		page->lru_next->lru_prev = page->lru_prev;
+	else
+		pcache_lru_tail = page->lru_prev;
+
+	page->lru_prev = NULL;
+	page->lru_next = NULL;
+}
+
+// pcache_lru_add(): Makes a page the most recently used one, with the cache locked
+// Param:	cache_page_t *page - page, not on the LRU list
+// Return:	Nothing
+
+void pcache_lru_add(cache_page_t *page)
+{
+	page->lru_prev = NULL;
+	page->lru_next = pcache_lru_head;
+	if(pcache_lru_head)
+		pcache_lru_head->lru_prev = page;
+
+	pcache_lru_head = page;
+	if(!pcache_lru_tail)
+		pcache_lru_tail = page;
+}
+
+// pcache_alloc(): Makes an empty page, with the cache locked
+// Param:	vnode_t *vnode - file
+// Param:	size_t index - page index
+// Return:	cache_page_t * - page with one reference, NULL if there's no memory
+
+cache_page_t *pcache_alloc(vnode_t *vnode, size_t index)
+{
+	if(pcache_count >= pcache_limit && !pcache_evict(1))
+		return NULL;
+
+	// descriptors are carved out of whole pages
+	size_t i;
+	if(!pcache_free)
+	{
+		cache_page_t *descriptors = (cache_page_t*)vmm_alloc(KERNEL_HEAP, 1, PAGE_PRESENT | PAGE_RW);
+		if(!descriptors)
+			return NULL;
+
+		for(i = 0; i < PAGE_SIZE / sizeof(cache_page_t); i++)
+		{
+			descriptors[i].lru_next = pcache_free;
+			pcache_free = &descriptors[i];
+		}
+	}
+
+	uint8_t *data = (uint8_t*)vmm_alloc(KERNEL_HEAP, 1, PAGE_PRESENT | PAGE_RW);
+	if(!data)
+		return NULL;
+
+	cache_page_t *page = pcache_free;
+	pcache_free = page->lru_next;
+
+	memset(page, 0, sizeof(cache_page_t));
+	page->vnode = vnode;
+	page->index = index;
+	page->data = data;
+	page->physical = vmm_get_page((size_t)data) & (~(PAGE_SIZE-1));
+	page->references = 1;
+
+	pcache_lru_add(page);
+	pcache_count++;
+	return page;
+}
+
+// pcache_free_page(): Frees a page that's not in its tree, with the cache locked
+// Param:	cache_page_t *page - page, not on the LRU list
+// Return:	Nothing
+
+void pcache_free_page(cache_page_t *page)
+{
+	vmm_free((size_t)page->data, 1);
+	page->lru_next = pcache_free;
+	pcache_free = page;
+	pcache_count--;
+}
+
+// pcache_evict(): Frees the least recently used pages, with the cache locked
+// Param:	size_t count - pages to free
+// Return:	size_t - pages actually freed
+
+size_t pcache_evict(size_t count)
+{
+	cache_page_t *page = pcache_lru_tail;
+	cache_page_t *previous;
+	void **slot;
+	size_t freed = 0;
+
+	// pages that are being read or are mapped can't go, and neither can
+	// anything that hasn't been written back
+	while(page && freed < count)
+	{
+		previous = page->lru_prev;
+		if(!page->references && !(page->flags & (PCACHE_DIRTY | PCACHE_WRITEBACK)))
+		{
+			slot = pcache_slot(&page->vnode->pages, page->index, 0);
+			if(slot)
+				*slot = NULL;
+
+			pcache_lru_remove(page);
+			pcache_free_page(page);
+			freed++;
+		}
+
+		page = previous;
+	}
+
+	return freed;
+}
+
+// pcache_reclaim(): Frees pages of the cache that nobody is using
+// Param:	size_t count - pages to free
+// Return:	size_t - pages actually freed
+
+size_t pcache_reclaim(size_t count)
+{
+	acquire_lock(&pcache_mutex);
+	size_t freed = pcache_evict(count);
+	release_lock(&pcache_mutex);
+	return freed;
+}
+
+// pcache_read_page(): Reads a new page from its filesystem
+// Param:	cache_page_t *page - page, not up to date yet
+// Return:	int - status code
+
+int pcache_read_page(cache_page_t *page)
+{
+	vnode_t *vnode = page->vnode;
+	int status = vnode->ops->readpage(vnode, page->index, page->data);
+
+	if(status == 0)
+	{
+		acquire_lock(&pcache_mutex);
+		page->flags |= PCACHE_UPTODATE;
+		release_lock(&pcache_mutex);
+		return 0;
+	}
+
+	// everyone waiting for it gives up, and the last of them frees it
+	acquire_lock(&pcache_mutex);
+	void **slot = pcache_slot(&vnode->pages, page->index, 0);
+	if(slot && *slot == page)
+		*slot = NULL;
+
+	pcache_lru_remove(page);
+	page->flags |= PCACHE_ERROR;
+	release_lock(&pcache_mutex);
+	return status;
+}
+
+// pcache_get(): Returns a page of a file, reading it if it isn't cached
+// Param:	vnode_t *vnode - file, whose filesystem has readpage()
+// Param:	size_t index - page index
+// Return:	cache_page_t * - page with a new reference, NULL on error
+
+cache_page_t *pcache_get(vnode_t *vnode, size_t index)
+{
+	return pcache_lookup(vnode, index, 1);
+}
+
+// pcache_lookup(): Returns a page of a file
+// Param:	vnode_t *vnode - file, whose filesystem has readpage()
+// Param:	size_t index - page index
+// Param:	int read - read the page if it isn't cached, or leave it to the caller
+// Return:	cache_page_t * - page with a new reference, NULL on error; if read
+//		is zero and it's new, it isn't up to date until the caller says so
+
+cache_page_t *pcache_lookup(vnode_t *vnode, size_t index, int read)
+{
+	acquire_lock(&pcache_mutex);
+
+	void **slot = pcache_slot(&vnode->pages, index, 1);
+	if(!slot)
+	{
+		release_lock(&pcache_mutex);
+		return NULL;
+	}
+
+	cache_page_t *page = (cache_page_t*)*slot;
+	if(page)
+	{
+		page->references++;
+		pcache_lru_remove(page);
+		pcache_lru_add(page);
+		release_lock(&pcache_mutex);
+
+		// someone else might still be reading it
+		while(!(page->flags & (PCACHE_UPTODATE | PCACHE_ERROR)))
+			asm volatile ("pause");
+
+		if(page->flags & PCACHE_ERROR)
+		{
+			pcache_put(page);
+			return NULL;
+		}
+
+		return page;
+	}
+
+	page = pcache_alloc(vnode, index);
+	if(!page)
+	{
+		release_lock(&pcache_mutex);
+		return NULL;
+	}
+
+	*slot = page;
+	release_lock(&pcache_mutex);
+
+	if(read && pcache_read_page(page) != 0)
+	{
+		pcache_put(page);
+		return NULL;
+	}
+
+	return page;
+}
+
+// pcache_put(): Drops a reference to a page
+// Param:	cache_page_t *page - page
+// Return:	Nothing
+
+void pcache_put(cache_page_t *page)
+{
+	acquire_lock(&pcache_mutex);
+
+	page->references--;
+
+	// pages that couldn't be read are already out of the cache
+	if(!page->references && (page->flags & PCACHE_ERROR))
+		pcache_free_page(page);
+
+	release_lock(&pcache_mutex);
+}
+
+// pcache_unmap(): Drops the reference a mapping has to a page
+// Param:	vnode_t *vnode - file
+// Param:	size_t index - page index
+// Return:	Nothing
+
+void pcache_unmap(vnode_t *vnode, size_t index)
+{
+	acquire_lock(&pcache_mutex);
+
+	void **slot = pcache_slot(&vnode->pages, index, 0);
+	if(slot && *slot)
+		((cache_page_t*)*slot)->references--;
+
+	release_lock(&pcache_mutex);
+}
+
+// pcache_fill(): Reads the pages of a range of a file that aren't cached
+// Param:	vnode_t *vnode - file, whose filesystem has readpage()
+// Param:	size_t start - first page index
+// Param:	size_t count - count of pages
+// Return:	Nothing
+
+void pcache_fill(vnode_t *vnode, size_t start, size_t count)
+{
+	size_t pages = (vnode->size + PAGE_SIZE - 1) >> PAGE_SIZE_SHIFT;
+	if(start >= pages)
+		return;
+
+	if(count > pages - start)
+		count = pages - start;
+
+	void **slot;
+	cache_page_t *page;
+	size_t index;
+
+	for(index = start; index < start + count; index++)
+	{
+		acquire_lock(&pcache_mutex);
+
+		slot = pcache_slot(&vnode->pages, index, 1);
+		if(!slot || *slot)
+		{
+			release_lock(&pcache_mutex);
+			continue;
+		}
+
+		// readahead is only a hint, so it stops when memory runs out
+		page = pcache_alloc(vnode, index);
+		if(!page)
+		{
+			release_lock(&pcache_mutex);
+			return;
+		}
+
+		*slot = page;
+		release_lock(&pcache_mutex);
+
+		pcache_read_page(page);
+		pcache_put(page);
+	}
+}
+
+// pcache_readahead(): Reads ahead of a read of an open file if it's sequential
+// Param:	file_t *file - open file
+// Param:	size_t first - first page the read wants
+// Param:	size_t last - last page the read wants
+// Return:	Nothing
+
+void pcache_readahead(file_t *file, size_t first, size_t last)
+{
+	vnode_t *vnode = (vnode_t*)file->node;
+	size_t start, end;
+
+	// a read that starts where the last one ended, or in the same page, is
+	// sequential, and anything else is random, so nothing is read ahead
+	if(first != file->readahead_next && first + 1 != file->readahead_next)
+	{
+		file->readahead_window = 0;
+		file->readahead_end = 0;
+		file->readahead_next = last + 1;
+		return;
+	}
+
+	// only read ahead again once reads are into the second half of what
+	// was read ahead last time, so the window is read in big pieces
+	if(last + 1 + (file->readahead_window >> 1) >= file->readahead_end)
+	{
+		if(!file->readahead_window)
+			file->readahead_window = PCACHE_READAHEAD_MIN;
+		else if(file->readahead_window < PCACHE_READAHEAD_MAX)
+			file->readahead_window <<= 1;
+
+		start = file->readahead_end > first ? file->readahead_end : first;
+		end = last + 1 + file->readahead_window;
+
+		pcache_fill(vnode, start, end - start);
+		file->readahead_end = end;
+	}
+
+	file->readahead_next = last + 1;
+}
+
+// pcache_readv(): Reads an open file through the page cache
+// Param:	file_t *file - open file, whose filesystem has readpage()
+// Param:	const struct iovec *iov - buffers to read into
+// Param:	int count - count of buffers
+// Param:	off_t position - byte offset within the file
+// Return:	ssize_t - bytes actually read, or error code
+
+ssize_t pcache_readv(file_t *file, const struct iovec *iov, int count, off_t position)
+{
+	vnode_t *vnode = (vnode_t*)file->node;
+	if(position >= vnode->size)
+		return 0;
+
+	size_t total = 0;
+	int i;
+	for(i = 0; i < count; i++)
+		total += iov[i].iov_len;
+
+	if(total > vnode->size - position)
+		total = vnode->size - position;
+
+	if(!total)
+		return 0;
+
+	pcache_readahead(file, position >> PAGE_SIZE_SHIFT, (position + total - 1) >> PAGE_SIZE_SHIFT);
+
+	cache_page_t *page;
+	size_t done = 0, offset, size;
+	size_t buffer_offset = 0;
+	i = 0;
+
+	while(done < total)
+	{
+		page = pcache_get(vnode, (position + done) >> PAGE_SIZE_SHIFT);
+		if(!page)
+			return done ? (ssize_t)done : EIO;
+
+		offset = (position + done) & (PAGE_SIZE-1);
+		size = PAGE_SIZE - offset;
+		if(size > total - done)
+			size = total - done;
+
+		pcache_copy(page->data + offset, iov, &i, &buffer_offset, size, 0);
+		done += size;
+		pcache_put(page);
+	}
+
+	return done;
+}
+
+// pcache_copy(): Copies between part of a page and a vector of buffers
+// One page can cover several buffers, and the other way around
+// Param:	uint8_t *data - part of the page
+// Param:	const struct iovec *iov - buffers
+// Param:	int *vector - current buffer, moved along
+// Param:	size_t *vector_offset - offset in the current buffer, moved along
+// Param:	size_t size - bytes to copy
+// Param:	int write - copy into the page instead of out of it
+// Return:	Nothing
+
+void pcache_copy(uint8_t *data, const struct iovec *iov, int *vector, size_t *vector_offset, size_t size, int write)
+{
+	size_t chunk;
+
+	while(size)
+	{
+		chunk = iov[*vector].iov_len - *vector_offset;
+		if(chunk > size)
+			chunk = size;
+
+		if(write)
+			memcpy(data, (uint8_t*)iov[*vector].iov_base + *vector_offset, chunk);
+		else
+			memcpy((uint8_t*)iov[*vector].iov_base + *vector_offset, data, chunk);
+
+		data += chunk;
+		size -= chunk;
+		*vector_offset += chunk;
+
+		if(*vector_offset == iov[*vector].iov_len)
+		{
+			*vector_offset = 0;
+			(*vector)++;
+		}
+	}
+}
+
+// pcache_writev(): Writes an open file through the page cache
+// Param:	file_t *file - open file, whose filesystem has readpage() and writepage()
+// Param:	const struct iovec *iov - buffers to write from
+// Param:	int count - count of buffers
+// Param:	off_t position - byte offset within the file
+// Return:	ssize_t - bytes actually written, or error code
+
+ssize_t pcache_writev(file_t *file, const struct iovec *iov, int count, off_t position)
+{
+	vnode_t *vnode = (vnode_t*)file->node;
+
+	size_t total = 0;
+	int i;
+	for(i = 0; i < count; i++)
+		total += iov[i].iov_len;
+
+	if(!total)
+		return 0;
+
+	// no filesystem can make files bigger yet
+	if(position >= vnode->size)
+		return EFBIG;
+
+	if(total > vnode->size - position)
+		total = vnode->size - position;
+
+	cache_page_t *page;
+	size_t done = 0, offset, size;
+	size_t buffer_offset = 0;
+	int whole;
+	i = 0;
+
+	while(done < total)
+	{
+		offset = (position + done) & (PAGE_SIZE-1);
+		size = PAGE_SIZE - offset;
+		if(size > total - done)
+			size = total - done;
+
+		// pages that are written all the way to the end of the page or
+		// the file don't have to be read first
+		whole = !offset && (size == PAGE_SIZE || position + done + size >= vnode->size);
+		page = pcache_lookup(vnode, (position + done) >> PAGE_SIZE_SHIFT, !whole);
+		if(!page)
+			return done ? (ssize_t)done : EIO;
+
+		if(!(page->flags & PCACHE_UPTODATE))
+			memset(page->data, 0, PAGE_SIZE);
+
+		pcache_copy(page->data + offset, iov, &i, &buffer_offset, size, 1);
+		done += size;
+
+		acquire_lock(&pcache_mutex);
+		page->flags |= PCACHE_UPTODATE;
+		pcache_mark_dirty(page);
+		release_lock(&pcache_mutex);
+
+		pcache_put(page);
+	}
+
+	int status;
+	if(file->flags & O_SYNC)
+	{
+		status = pcache_sync(vnode, position >> PAGE_SIZE_SHIFT, (position + done - 1) >> PAGE_SIZE_SHIFT);
+		if(status != 0)
+			return status;
+	} else if(pcache_dirty_count * 100 > pcache_limit * PCACHE_DIRTY_RATIO)
+	{
+		// writing faster than the device can keep up with, so help it
+		pcache_flush(vnode->mountpoint->dev, PCACHE_FLUSH_BATCH, 0);
+	}
+
+	return done;
+}
+
+// pcache_mark_dirty(): Marks a page dirty, with the cache locked
+// Param:	cache_page_t *page - page
+// Return:	Nothing
+
+void pcache_mark_dirty(cache_page_t *page)
+{
+	if(page->flags & PCACHE_DIRTY)
+		return;
+
+	writeback_t *writeback = &pcache_writeback[page->vnode->mountpoint->dev];
+
+	page->flags |= PCACHE_DIRTY;
+	page->dirtied = global_uptime;
+	page->dirty_next = NULL;
+	page->dirty_prev = writeback->dirty_tail;
+
+	if(writeback->dirty_tail)
+		writeback->dirty_tail->dirty_next = page;
+	else
+		writeback->dirty_head = page;
+
+	writeback->dirty_tail = page;
+	writeback->dirty_count++;
+	pcache_dirty_count++;
+}
+
+// pcache_dirty_remove(): Takes a page off its dirty list, with the cache locked
+// Param:	cache_page_t *page - dirty page
+// Return:	Nothing
+
+void pcache_dirty_remove(cache_page_t *page)
+{
+	writeback_t *writeback = &pcache_writeback[page->vnode->mountpoint->dev];
+
+	if(page->dirty_prev)
+		page->dirty_prev->dirty_next = page->dirty_next;
+	else
+		writeback->dirty_head = page->dirty_next;
+
+	if(page->dirty_next)
+		page->dirty_next->dirty_prev = page->dirty_prev;
+	else
+		writeback->dirty_tail = page->dirty_prev;
+
+	page->dirty_prev = NULL;
+	page->dirty_next = NULL;
+	page->flags &= ~PCACHE_DIRTY;
+	writeback->dirty_count--;
+	pcache_dirty_count--;
+}
+
+// pcache_writeback_start(): Takes a page off its dirty list to write it back
+// Param:	cache_page_t *page - page, with a reference
+// Return:	int - 1 if it has to be written back, 0 if it's clean
+
+int pcache_writeback_start(cache_page_t *page)
+{
+	acquire_lock(&pcache_mutex);
+
+	// whatever is writing it already might have started before the last
+	// write, so wait for it and look again
+	while(page->flags & PCACHE_WRITEBACK)
+	{
+		release_lock(&pcache_mutex);
+		asm volatile ("pause");
+		acquire_lock(&pcache_mutex);
+	}
+
+	if(!(page->flags & PCACHE_DIRTY))
+	{
+		release_lock(&pcache_mutex);
+		return 0;
+	}
+
+	// writes from now on dirty it again, so they aren't lost
+	pcache_dirty_remove(page);
+	page->flags |= PCACHE_WRITEBACK;
+	release_lock(&pcache_mutex);
+	return 1;
+}
+
+// pcache_writeback_end(): Finishes writing back a page
+// Param:	cache_page_t *page - page, from pcache_writeback_start()
+// Param:	int status - status code of the write
+// Return:	Nothing
+
+void pcache_writeback_end(cache_page_t *page, int status)
+{
+	acquire_lock(&pcache_mutex);
+	page->flags &= ~PCACHE_WRITEBACK;
+	if(status != 0)
+		pcache_mark_dirty(page);
+
+	release_lock(&pcache_mutex);
+}
+
+// pcache_writeback_page(): Writes a page back if it's dirty
+// Param:	cache_page_t *page - page, with a reference
+// Return:	int - status code
+
+int pcache_writeback_page(cache_page_t *page)
+{
+	if(!pcache_writeback_start(page))
+		return 0;
+
+	vnode_t *vnode = page->vnode;
+	int status = vnode->ops->writepage(vnode, page->index, page->data);
+
+	pcache_writeback_end(page, status);
+	return status;
+}
+
+// pcache_writeback_bio(): Fills in a bio to write back a page, if its filesystem can say where it goes
+// Param:	cache_page_t *page - page, from pcache_writeback_start()
+// Param:	bio_t *bio - bio to fill in
+// Return:	int - 1 if the bio has to be submitted, 0 to use writepage() instead
+
+int pcache_writeback_bio(cache_page_t *page, bio_t *bio)
+{
+	vnode_t *vnode = page->vnode;
+	dev_t device = vnode->mountpoint->dev;
+	uint64_t base;
+	size_t size;
+
+	if(!vnode->ops->bmap || device >= MAX_BLKDEVS || !blkdev_queues[device].ops)
+		return 0;
+
+	if(vnode->ops->bmap(vnode, page->index, &base, &size) != 0 || !size)
+		return 0;
+
+	// anything that isn't whole sectors needs the bytes around it read first
+	size_t sector_size = blkdevs[device].sector_size;
+	if((base % sector_size) || (size % sector_size) || size / sector_size > blkdev_queues[device].max_sectors)
+		return 0;
+
+	bio->device = device;
+	bio->operation = BIO_WRITE;
+	bio->lba = base / sector_size;
+	bio->count = size / sector_size;
+	bio->buffer = page->data;
+	bio->private = page;
+	return 1;
+}
+
+// pcache_write_batch(): Writes back a batch of pages in disk order
+// Param:	cache_page_t **batch - pages, with a reference each, which is dropped
+// Param:	size_t count - count of pages
+// Return:	size_t - pages written back, not counting any that failed
+
+size_t pcache_write_batch(cache_page_t **batch, size_t count)
+{
+	cache_page_t *page;
+	size_t i, j, written = 0;
+	int status;
+
+	// files are usually laid out in inode order, and pages in page order
+	for(i = 1; i < count; i++)
+	{
+		page = batch[i];
+		j = i;
+		while(j && (batch[j-1]->vnode->ino > page->vnode->ino || (batch[j-1]->vnode->ino == page->vnode->ino && batch[j-1]->index > page->index)))
+		{
+			batch[j] = batch[j-1];
+			j--;
+		}
+
+		batch[j] = page;
+	}
+
+	// every page goes at once in a bio of its own, so the ones next to
+	// each other on the disk merge into one request
+	bio_t *bios = kcalloc(sizeof(bio_t), count);
+	blk_plug_t plug;
+
+	blkdev_start_plug(&plug);
+
+	for(i = 0; i < count; i++)
+	{
+		bios[i].done = 1;
+		if(!pcache_writeback_start(batch[i]))
+			continue;
+
+		if(pcache_writeback_bio(batch[i], &bios[i]))
+		{
+			bios[i].done = 0;
+			blkdev_submit(&bios[i]);
+			continue;
+		}
+
+		// this waits for anything already plugged too
+		status = batch[i]->vnode->ops->writepage(batch[i]->vnode, batch[i]->index, batch[i]->data);
+		pcache_writeback_end(batch[i], status);
+		if(status == 0)
+			written++;
+	}
+
+	blkdev_finish_plug(&plug);
+
+	for(i = 0; i < count; i++)
+	{
+		if(bios[i].private)
+		{
+			status = blkdev_wait(&bios[i]) ? EIO : 0;
+			pcache_writeback_end(batch[i], status);
+			if(status == 0)
+				written++;
+		}
+
+		pcache_put(batch[i]);
+	}
+
+	kfree(bios);
+	return written;
+}
+
+// pcache_flush_device(): Writes back the oldest dirty pages of a device
+// Param:	writeback_t *writeback - device, which we're flushing
+// Param:	size_t max - most pages to write, at most PCACHE_FLUSH_BATCH
+// Param:	int expired_only - only pages that have been dirty too long
+// Return:	size_t - pages written back
+
+size_t pcache_flush_device(writeback_t *writeback, size_t max, int expired_only)
+{
+	cache_page_t **batch = kmalloc(PCACHE_FLUSH_BATCH * sizeof(cache_page_t *));
+	cache_page_t *page;
+	size_t count = 0;
+
+	if(max > PCACHE_FLUSH_BATCH)
+		max = PCACHE_FLUSH_BATCH;
+
+	// the list is oldest first, so the expired pages are all at the start
+	acquire_lock(&pcache_mutex);
+	page = writeback->dirty_head;
+	while(page && count < max)
+	{
+		if(expired_only && global_uptime - page->dirtied < PCACHE_DIRTY_EXPIRE)
+			break;
+
+		page->references++;
+		batch[count] = page;
+		count++;
+		page = page->dirty_next;
+	}
+
+	release_lock(&pcache_mutex);
+
+	// pages that fail are dirty again, so they don't count, and a device
+	// that keeps failing doesn't keep us busy
+	count = pcache_write_batch(batch, count);
+	kfree(batch);
+	return count;
+}
+
+// pcache_flush(): Writes back the oldest dirty pages of a device
+// Param:	dev_t device - block device
+// Param:	size_t max - most pages to write, at most PCACHE_FLUSH_BATCH
+// Param:	int expired_only - only pages that have been dirty too long
+// Return:	size_t - pages written back
+
+size_t pcache_flush(dev_t device, size_t max, int expired_only)
+{
+	writeback_t *writeback = &pcache_writeback[device];
+
+	acquire_lock(&writeback->flushing);
+	size_t count = pcache_flush_device(writeback, max, expired_only);
+	release_lock(&writeback->flushing);
+	return count;
+}
+
+// pcache_sync(): Writes back a range of a file and waits for it
+// Param:	vnode_t *vnode - file
+// Param:	size_t first - first page index
+// Param:	size_t last - last page index
+// Return:	int - status code
+
+int pcache_sync(vnode_t *vnode, size_t first, size_t last)
+{
+	size_t pages = (vnode->size + PAGE_SIZE - 1) >> PAGE_SIZE_SHIFT;
+	if(!vnode->ops->writepage || first >= pages)
+		return 0;
+
+	if(last >= pages)
+		last = pages - 1;
+
+	cache_page_t *page;
+	void **slot;
+	size_t index;
+	int status = 0, page_status;
+
+	// pages being written back by someone else count as well, because
+	// they aren't on the disk yet
+	for(index = first; index <= last; index++)
+	{
+		acquire_lock(&pcache_mutex);
+
+		slot = pcache_slot(&vnode->pages, index, 0);
+		page = slot ? (cache_page_t*)*slot : NULL;
+		if(page && (page->flags & (PCACHE_DIRTY | PCACHE_WRITEBACK)))
+			page->references++;
+		else
+			page = NULL;
+
+		release_lock(&pcache_mutex);
+
+		if(!page)
+			continue;
+
+		page_status = pcache_writeback_page(page);
+		if(page_status != 0 && !status)
+			status = page_status;
+
+		pcache_put(page);
+	}
+
+	return status;
+}
+
+// pcache_sync_all(): Writes back every dirty page
+// Param:	Nothing
+// Return:	Nothing
+
+void pcache_sync_all()
+{
+	size_t device, remaining, count;
+
+	for(device = 0; device < MAX_BLKDEVS; device++)
+	{
+		// pages that fail go back on the list, so don't go round forever
+		remaining = pcache_writeback[device].dirty_count;
+		while(remaining)
+		{
+			count = pcache_flush(device, remaining, 0);
+			if(!count || count >= remaining)
+				break;
+
+			remaining -= count;
+		}
+	}
+}
+
+// pcache_flush_poll(): Flushes devices that need it, called from the idle loop of each AP
+// Param:	size_t index - CPU index
+// Return:	int - 1 if anything was written back
+
+int pcache_flush_poll(size_t index)
+{
+	if(!pcache_dirty_count)
+		return 0;
+
+	int background = (pcache_dirty_count * 100 > pcache_limit * PCACHE_DIRTY_BACKGROUND);
+	writeback_t *writeback;
+	cache_page_t *oldest;
+	size_t device, count = 0;
+
+	for(device = 0; device < MAX_BLKDEVS; device++)
+	{
+		writeback = &pcache_writeback[device];
+
+		// descriptors are never freed, so looking at the oldest page
+		// without the lock is only ever out of date
+		oldest = writeback->dirty_head;
+		if(!oldest)
+			continue;
+
+		if(!background && global_uptime - oldest->dirtied < PCACHE_DIRTY_EXPIRE)
+			continue;
+
+		// another CPU already has this one
+		if(atomic_xchg(&writeback->flushing, 1))
+			continue;
+
+		count += pcache_flush_device(writeback, PCACHE_FLUSH_BATCH, !background);
+		release_lock(&writeback->flushing);
+	}
+
+	return count != 0;
+}
+
+// pcache_sleep(): Sets a timer for when the oldest dirty page is due, before an AP halts
+// Called with interrupts disabled, so the timer can't go off before the HLT,
+// and pages dirtied after this are due after the timer anyway
+// Param:	size_t index - CPU index
+// Return:	int - 1 if the CPU can halt
+
+int pcache_sleep(size_t index)
+{
+	if(!lapic_timer_frequency)
+		return 1;
+
+	// the first AP to come here does the timekeeping from now on
+	if(pcache_flush_cpu == PCACHE_NO_FLUSH_CPU)
+		atomic_cmpxchg(&pcache_flush_cpu, PCACHE_NO_FLUSH_CPU, index);
+
+	if(index != pcache_flush_cpu)
+		return 1;
+
+	uint64_t now = global_uptime;
+	uint64_t due = now + PCACHE_DIRTY_EXPIRE;
+	cache_page_t *oldest;
+	size_t device;
+
+	for(device = 0; device < MAX_BLKDEVS; device++)
+	{
+		// descriptors are never freed, so this is only ever out of date
+		oldest = pcache_writeback[device].dirty_head;
+		if(oldest && oldest->dirtied + PCACHE_DIRTY_EXPIRE < due)
+			due = oldest->dirtied + PCACHE_DIRTY_EXPIRE;
+	}
+
+	if(due <= now)
+		return 0;
+
+	lapic_timer_oneshot((uint32_t)(due - now));
+	return 1;
+}
+
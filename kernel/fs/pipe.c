@@ -0,0 +1,718 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <pipe.h>
+#include <vfs.h>
+#include <mm.h>
+#include <lock.h>
+#include <tasking.h>
+#include <string.h>
+
+// Pipes and FIFOs
+// The reader owns head and the writer owns tail, and each only needs a
+// barrier between the data and its index, so readers and writers never
+// wait for each other's locks. There can be more than one of each through
+// FIFOs and shared handles though, so readers hold the read lock and writers
+// the write lock, which nobody else is spinning on with just one of each;
+// holding it for the whole write also keeps writes from being interleaved.
+// A side that has to wait says so in its waiting flag, and the other side
+// checks that flag every time after it moves its index; anything watching
+// the pipe is told when it goes from empty to not empty, or from full to
+// not full.
+
+pipe_t *fifos = NULL;
+lock_t pipe_mutex = 0;
+
+pipe_t *pipe_create(const char *);
+void pipe_wait(volatile uint8_t *, pipe_t *, int);
+ssize_t pipe_read_locked(pipe_t *, char *, size_t, int);
+ssize_t pipe_write_locked(pipe_t *, char *, size_t, int);
+ssize_t pipe_splice_in_locked(pipe_t *, file_t *, off_t *, size_t, int);
+ssize_t pipe_splice_out_locked(pipe_t *, file_t *, off_t *, size_t, int);
+ssize_t pipe_readv(file_t *, const struct iovec *, int, off_t *);
+ssize_t pipe_writev(file_t *, const struct iovec *, int, off_t *);
+int pipe_fstat(file_t *, struct stat *);
+poll_list_t *pipe_poll_list(void *);
+void pipe_release(file_t *);
+
+const file_ops_t pipe_file_ops = {
+	.readv = &pipe_readv,
+	.writev = &pipe_writev,
+	.stat = &pipe_fstat,
+	.poll = &pipe_poll,
+	.poll_list = &pipe_poll_list,
+	.release = &pipe_release,
+};
+
+// pipe_create(): Creates an empty pipe
+// Param:	const char *path - path of FIFO, NULL for an anonymous pipe
+// Return:	pipe_t * - pipe
+
+pipe_t *pipe_create(const char *path)
+{
+	pipe_t *pipe = kcalloc(sizeof(pipe_t), 1);
+	pipe->buffer = kmalloc(PIPE_SIZE);
+
+	if(path)
+	{
+		pipe->path = kmalloc(strlen(path) + 1);
+		strcpy(pipe->path, path);
+	}
+
+	return pipe;
+}
+
+// pipe(): Creates an anonymous pipe
+// Param:	int *handles - destination, the read end first and the write end second
+// Return:	int - status code
+
+int pipe(int *handles)
+{
+	pipe_t *pipe = pipe_create(NULL);
+	pipe->readers = 1;
+	pipe->writers = 1;
+
+	file_t *reader = pipe_file(pipe, O_RDONLY);
+	file_t *writer = pipe_file(pipe, O_WRONLY);
+	pid_t pid = get_pid();
+
+	int read_handle = fd_alloc(pid, reader);
+	if(read_handle < 0)
+	{
+		file_put(reader);
+		file_put(writer);
+		return read_handle;
+	}
+
+	int write_handle = fd_alloc(pid, writer);
+	if(write_handle < 0)
+	{
+		file_put(fd_remove(pid, read_handle));
+		file_put(writer);
+		return write_handle;
+	}
+
+	handles[0] = read_handle;
+	handles[1] = write_handle;
+	return 0;
+}
+
+// pipe_file(): Makes an open file for one end of a pipe
+// Param:	pipe_t *pipe - pipe, already counting this end
+// Param:	int flags - open flags, which say which end
+// Return:	file_t * - open file
+
+file_t *pipe_file(pipe_t *pipe, int flags)
+{
+	return file_alloc(&pipe_file_ops, pipe, flags, S_IFIFO);
+}
+
+// fifo_open(): Opens one end of a named FIFO
+// Param:	const char *path - resolved path of FIFO
+// Param:	int flags - open flags, which say which end
+// Return:	pipe_t * - pipe
+
+pipe_t *fifo_open(const char *path, int flags)
+{
+	acquire_lock(&pipe_mutex);
+
+	pipe_t *pipe = fifos;
+	while(pipe)
+	{
+		if(strcmp(pipe->path, path) == 0)
+			break;
+
+		pipe = pipe->next;
+	}
+
+	if(!pipe)
+	{
+		pipe = pipe_create(path);
+		pipe->next = fifos;
+		fifos = pipe;
+	}
+
+	if(flags & O_RDONLY)
+		pipe->readers++;
+
+	if(flags & O_WRONLY)
+		pipe->writers++;
+
+	release_lock(&pipe_mutex);
+	return pipe;
+}
+
+// pipe_close(): Closes one end of a pipe
+// Param:	pipe_t *pipe - pipe
+// Param:	int flags - open flags of the handle
+// Return:	Nothing
+
+void pipe_close(pipe_t *pipe, int flags)
+{
+	acquire_lock(&pipe_mutex);
+
+	// the other side has to see end-of-file or a broken pipe
+	if(flags & O_RDONLY)
+	{
+		pipe->readers--;
+		if(!pipe->readers)
+			pipe_wake(pipe, PIPE_WRITABLE);
+	}
+
+	if(flags & O_WRONLY)
+	{
+		pipe->writers--;
+		if(!pipe->writers)
+			pipe_wake(pipe, PIPE_READABLE);
+	}
+
+	if(pipe->readers || pipe->writers)
+	{
+		release_lock(&pipe_mutex);
+		return;
+	}
+
+	if(pipe->path)
+	{
+		pipe_t **link = &fifos;
+		while(*link != pipe)
+			link = &(*link)->next;
+
+		*link = pipe->next;
+		kfree(pipe->path);
+	}
+
+	release_lock(&pipe_mutex);
+
+	poll_release(&pipe->poll);
+	kfree(pipe->buffer);
+	kfree(pipe);
+}
+
+// pipe_release(): Closes one end of a pipe after its last reference
+// Param:	file_t *file - open file
+// Return:	Nothing
+
+void pipe_release(file_t *file)
+{
+	pipe_close((pipe_t*)file->node, file->flags);
+}
+
+// pipe_fstat(): Returns stat information for one end of a pipe
+// Param:	file_t *file - open file
+// Param:	struct stat *destination - stat structure to store
+// Return:	int - status code
+
+int pipe_fstat(file_t *file, struct stat *destination)
+{
+	pipe_t *pipe = (pipe_t*)file->node;
+	if(pipe->path)
+		return stat(pipe->path, destination);
+
+	// anonymous pipes don't have a path, so make something up
+	memset(destination, 0, sizeof(struct stat));
+	destination->st_mode = S_IFIFO | S_IRUSR | S_IWUSR;
+	destination->st_size = pipe->tail - pipe->head;
+	destination->st_blksize = PAGE_SIZE;
+	return 0;
+}
+
+// pipe_wait(): Waits for the other side of a pipe
+// Param:	volatile uint8_t *waiting - waiting flag, cleared by the other side
+// Param:	pipe_t *pipe - pipe
+// Param:	int event - PIPE_READABLE or PIPE_WRITABLE
+// Return:	Nothing
+
+void pipe_wait(volatile uint8_t *waiting, pipe_t *pipe, int event)
+{
+	// set the flag before checking again, and the other side moves its
+	// index before checking the flag, so the wakeup can't be missed
+	*waiting = 1;
+	memory_barrier();
+
+	if(event == PIPE_READABLE && (pipe->tail != pipe->head || !pipe->writers))
+	{
+		*waiting = 0;
+		return;
+	}
+
+	if(event == PIPE_WRITABLE && (pipe->tail - pipe->head < PIPE_SIZE || !pipe->readers))
+	{
+		*waiting = 0;
+		return;
+	}
+
+	// there's no scheduler to block on yet
+	while(*waiting)
+		asm volatile ("pause");
+}
+
+// pipe_wake(): Wakes up the other side of a pipe, and anything watching it
+// Param:	pipe_t *pipe - pipe
+// Param:	int event - PIPE_READABLE or PIPE_WRITABLE
+// Return:	Nothing
+
+void pipe_wake(pipe_t *pipe, int event)
+{
+	memory_barrier();
+
+	if((event & PIPE_READABLE) && pipe->reader_waiting)
+		pipe->reader_waiting = 0;
+
+	if((event & PIPE_WRITABLE) && pipe->writer_waiting)
+		pipe->writer_waiting = 0;
+
+	if(!pipe->poll.items)
+		return;
+
+	uint32_t events = 0;
+	if(event & PIPE_READABLE)
+		events |= pipe->writers ? EPOLLIN : (EPOLLIN | EPOLLHUP);
+
+	if(event & PIPE_WRITABLE)
+		events |= pipe->readers ? EPOLLOUT : (EPOLLOUT | EPOLLERR);
+
+	poll_notify(&pipe->poll, events);
+}
+
+// pipe_poll(): Returns the current events of one end of a pipe
+// Param:	void *node - pipe
+// Param:	int flags - open flags of the handle
+// Return:	uint32_t - events
+
+uint32_t pipe_poll(void *node, int flags)
+{
+	pipe_t *pipe = (pipe_t*)node;
+	uint32_t events = 0;
+
+	if(flags & O_RDONLY)
+	{
+		if(pipe->tail != pipe->head)
+			events |= EPOLLIN;
+
+		if(!pipe->writers)
+			events |= EPOLLHUP;
+	}
+
+	if(flags & O_WRONLY)
+	{
+		if(pipe->tail - pipe->head < PIPE_SIZE)
+			events |= EPOLLOUT;
+
+		if(!pipe->readers)
+			events |= EPOLLERR;
+	}
+
+	return events;
+}
+
+// pipe_poll_list(): Returns the list of everything watching a pipe
+// Param:	void *node - pipe
+// Return:	poll_list_t * - watch list
+
+poll_list_t *pipe_poll_list(void *node)
+{
+	return &((pipe_t*)node)->poll;
+}
+
+// pipe_read(): Reads from a pipe
+// Param:	pipe_t *pipe - pipe
+// Param:	char *buffer - buffer to read into
+// Param:	size_t count - bytes to read
+// Param:	int flags - open flags of the handle
+// Return:	ssize_t - bytes actually read, 0 at end-of-file, or error code
+
+ssize_t pipe_read(pipe_t *pipe, char *buffer, size_t count, int flags)
+{
+	acquire_lock(&pipe->read_lock);
+	ssize_t status = pipe_read_locked(pipe, buffer, count, flags);
+	release_lock(&pipe->read_lock);
+	return status;
+}
+
+// pipe_read_locked(): Reads from a pipe, with the read lock held
+// Param:	pipe_t *pipe - pipe
+// Param:	char *buffer - buffer to read into
+// Param:	size_t count - bytes to read
+// Param:	int flags - open flags of the handle
+// Return:	ssize_t - bytes actually read, 0 at end-of-file, or error code
+
+ssize_t pipe_read_locked(pipe_t *pipe, char *buffer, size_t count, int flags)
+{
+	if(!count)
+		return 0;
+
+	uint32_t head = pipe->head;
+	uint32_t available = pipe->tail - head;
+
+	while(!available)
+	{
+		if(!pipe->writers)
+			return 0;
+
+		if(flags & O_NONBLOCK)
+			return EAGAIN;
+
+		pipe_wait(&pipe->reader_waiting, pipe, PIPE_READABLE);
+		available = pipe->tail - head;
+	}
+
+	// read the data only after the tail
+	memory_barrier();
+
+	if(count > available)
+		count = available;
+
+	size_t offset = head & (PIPE_SIZE - 1);
+	size_t first = PIPE_SIZE - offset;
+	if(first > count)
+		first = count;
+
+	memcpy(buffer, pipe->buffer + offset, first);
+	memcpy(buffer + first, pipe->buffer, count - first);
+
+	// and free the space only after it's been read
+	memory_barrier();
+	pipe->head = head + count;
+
+	// the space we saw is out of date by now, so a writer that filled
+	// the rest can be waiting already; see pipe_wait()
+	memory_barrier();
+	if(available == PIPE_SIZE || pipe->writer_waiting)
+		pipe_wake(pipe, PIPE_WRITABLE);
+
+	return count;
+}
+
+// pipe_write(): Writes to a pipe
+// Param:	pipe_t *pipe - pipe
+// Param:	char *buffer - buffer to write
+// Param:	size_t count - bytes to write
+// Param:	int flags - open flags of the handle
+// Return:	ssize_t - bytes actually written, or error code
+
+ssize_t pipe_write(pipe_t *pipe, char *buffer, size_t count, int flags)
+{
+	acquire_lock(&pipe->write_lock);
+	ssize_t status = pipe_write_locked(pipe, buffer, count, flags);
+	release_lock(&pipe->write_lock);
+	return status;
+}
+
+// pipe_write_locked(): Writes to a pipe, with the write lock held
+// Param:	pipe_t *pipe - pipe
+// Param:	char *buffer - buffer to write
+// Param:	size_t count - bytes to write
+// Param:	int flags - open flags of the handle
+// Return:	ssize_t - bytes actually written, or error code
+
+ssize_t pipe_write_locked(pipe_t *pipe, char *buffer, size_t count, int flags)
+{
+	size_t written = 0, size, offset, first;
+	uint32_t tail, space, available;
+
+	while(written < count)
+	{
+		if(!pipe->readers)
+			return written ? written : EPIPE;
+
+		tail = pipe->tail;
+		available = tail - pipe->head;
+		space = PIPE_SIZE - available;
+
+		// a small write that doesn't fit doesn't write anything
+		if(!space || (!written && count <= PIPE_BUF && space < count && (flags & O_NONBLOCK)))
+		{
+			if(flags & O_NONBLOCK)
+				return written ? written : EAGAIN;
+
+			pipe_wait(&pipe->writer_waiting, pipe, PIPE_WRITABLE);
+			continue;
+		}
+
+		// don't write over anything until the reader is done with it
+		memory_barrier();
+
+		size = count - written;
+		if(size > space)
+			size = space;
+
+		offset = tail & (PIPE_SIZE - 1);
+		first = PIPE_SIZE - offset;
+		if(first > size)
+			first = size;
+
+		memcpy(pipe->buffer + offset, buffer + written, first);
+		memcpy(pipe->buffer, buffer + written + first, size - first);
+
+		// and publish the data before the tail
+		memory_barrier();
+		pipe->tail = tail + size;
+		written += size;
+
+		// and the same for a reader that emptied it since
+		memory_barrier();
+		if(!available || pipe->reader_waiting)
+			pipe_wake(pipe, PIPE_READABLE);
+	}
+
+	return written;
+}
+
+// pipe_readv(): Reads from a pipe into several buffers
+// Param:	file_t *file - open file
+// Param:	const struct iovec *iov - buffers to read into
+// Param:	int count - count of buffers, at least one
+// Param:	off_t *position - unused
+// Return:	ssize_t - bytes actually read, 0 at end-of-file, or error code
+
+ssize_t pipe_readv(file_t *file, const struct iovec *iov, int count, off_t *position)
+{
+	pipe_t *pipe = (pipe_t*)file->node;
+	ssize_t total = 0, status;
+	int i;
+
+	acquire_lock(&pipe->read_lock);
+
+	for(i = 0; i < count; i++)
+	{
+		// only wait for the first buffer, so we don't block with data in hand
+		status = pipe_read_locked(pipe, iov[i].iov_base, iov[i].iov_len, i ? file->flags | O_NONBLOCK : file->flags);
+		if(status < 0)
+		{
+			if(!total)
+				total = status;
+
+			break;
+		}
+
+		total += status;
+		if(status < iov[i].iov_len)
+			break;
+	}
+
+	release_lock(&pipe->read_lock);
+	return total;
+}
+
+// pipe_writev(): Writes to a pipe from several buffers
+// Param:	file_t *file - open file
+// Param:	const struct iovec *iov - buffers to write
+// Param:	int count - count of buffers, at least one
+// Param:	off_t *position - unused
+// Return:	ssize_t - bytes actually written, or error code
+
+ssize_t pipe_writev(file_t *file, const struct iovec *iov, int count, off_t *position)
+{
+	pipe_t *pipe = (pipe_t*)file->node;
+	ssize_t total = 0, status;
+	size_t length = 0;
+	int i;
+
+	for(i = 0; i < count; i++)
+		length += iov[i].iov_len;
+
+	acquire_lock(&pipe->write_lock);
+
+	// a small write that doesn't fit doesn't write anything, even in pieces
+	if(length <= PIPE_BUF && (file->flags & O_NONBLOCK) && pipe->readers && PIPE_SIZE - (pipe->tail - pipe->head) < length)
+	{
+		release_lock(&pipe->write_lock);
+		return EAGAIN;
+	}
+
+	// and writes wait for everything, like write() does
+	for(i = 0; i < count; i++)
+	{
+		status = pipe_write_locked(pipe, iov[i].iov_base, iov[i].iov_len, file->flags);
+		if(status < 0)
+		{
+			if(!total)
+				total = status;
+
+			break;
+		}
+
+		total += status;
+		if(status < iov[i].iov_len)
+			break;
+	}
+
+	release_lock(&pipe->write_lock);
+	return total;
+}
+
+// pipe_splice_in(): Reads from a file straight into a pipe
+// Param:	pipe_t *pipe - pipe
+// Param:	file_t *in - open file to read from
+// Param:	off_t *position - position to read from, NULL for the file pointer
+// Param:	size_t count - bytes to move
+// Param:	int flags - open flags of the pipe handle
+// Return:	ssize_t - bytes actually moved, or error code
+
+ssize_t pipe_splice_in(pipe_t *pipe, file_t *in, off_t *position, size_t count, int flags)
+{
+	acquire_lock(&pipe->write_lock);
+	ssize_t status = pipe_splice_in_locked(pipe, in, position, count, flags);
+	release_lock(&pipe->write_lock);
+	return status;
+}
+
+// pipe_splice_in_locked(): Reads from a file straight into a pipe, with the write lock held
+// Param:	pipe_t *pipe - pipe
+// Param:	file_t *in - open file to read from
+// Param:	off_t *position - position to read from, NULL for the file pointer
+// Param:	size_t count - bytes to move
+// Param:	int flags - open flags of the pipe handle
+// Return:	ssize_t - bytes actually moved, or error code
+
+ssize_t pipe_splice_in_locked(pipe_t *pipe, file_t *in, off_t *position, size_t count, int flags)
+{
+	uint32_t tail = pipe->tail;
+	uint32_t available = tail - pipe->head;
+
+	while(available == PIPE_SIZE)
+	{
+		if(!pipe->readers)
+			return EPIPE;
+
+		if(flags & O_NONBLOCK)
+			return EAGAIN;
+
+		pipe_wait(&pipe->writer_waiting, pipe, PIPE_WRITABLE);
+		available = tail - pipe->head;
+	}
+
+	if(!pipe->readers)
+		return EPIPE;
+
+	memory_barrier();
+
+	if(count > PIPE_SIZE - available)
+		count = PIPE_SIZE - available;
+
+	// the free space is at most two pieces of the ring
+	struct iovec iov[2];
+	size_t offset = tail & (PIPE_SIZE - 1);
+
+	iov[0].iov_base = pipe->buffer + offset;
+	iov[0].iov_len = PIPE_SIZE - offset;
+	if(iov[0].iov_len > count)
+		iov[0].iov_len = count;
+
+	iov[1].iov_base = pipe->buffer;
+	iov[1].iov_len = count - iov[0].iov_len;
+
+	ssize_t status;
+	off_t current;
+	if(position)
+	{
+		current = *position;
+		status = file_readv(in, iov, iov[1].iov_len ? 2 : 1, &current);
+		if(status > 0)
+			*position += status;
+	} else
+	{
+		status = file_readv(in, iov, iov[1].iov_len ? 2 : 1, NULL);
+	}
+
+	if(status <= 0)
+		return status;
+
+	memory_barrier();
+	pipe->tail = tail + status;
+
+	memory_barrier();
+	if(!available || pipe->reader_waiting)
+		pipe_wake(pipe, PIPE_READABLE);
+
+	return status;
+}
+
+// pipe_splice_out(): Writes from a pipe straight to a file
+// Param:	pipe_t *pipe - pipe
+// Param:	file_t *out - open file to write to
+// Param:	off_t *position - position to write to, NULL for the file pointer
+// Param:	size_t count - bytes to move
+// Param:	int flags - open flags of the pipe handle
+// Return:	ssize_t - bytes actually moved, 0 at end-of-file, or error code
+
+ssize_t pipe_splice_out(pipe_t *pipe, file_t *out, off_t *position, size_t count, int flags)
+{
+	acquire_lock(&pipe->read_lock);
+	ssize_t status = pipe_splice_out_locked(pipe, out, position, count, flags);
+	release_lock(&pipe->read_lock);
+	return status;
+}
+
+// pipe_splice_out_locked(): Writes from a pipe straight to a file, with the read lock held
+// Param:	pipe_t *pipe - pipe
+// Param:	file_t *out - open file to write to
+// Param:	off_t *position - position to write to, NULL for the file pointer
+// Param:	size_t count - bytes to move
+// Param:	int flags - open flags of the pipe handle
+// Return:	ssize_t - bytes actually moved, 0 at end-of-file, or error code
+
+ssize_t pipe_splice_out_locked(pipe_t *pipe, file_t *out, off_t *position, size_t count, int flags)
+{
+	uint32_t head = pipe->head;
+	uint32_t available = pipe->tail - head;
+
+	while(!available)
+	{
+		if(!pipe->writers)
+			return 0;
+
+		if(flags & O_NONBLOCK)
+			return EAGAIN;
+
+		pipe_wait(&pipe->reader_waiting, pipe, PIPE_READABLE);
+		available = pipe->tail - head;
+	}
+
+	memory_barrier();
+
+	if(count > available)
+		count = available;
+
+	// and the data is at most two pieces too
+	struct iovec iov[2];
+	size_t offset = head & (PIPE_SIZE - 1);
+
+	iov[0].iov_base = pipe->buffer + offset;
+	iov[0].iov_len = PIPE_SIZE - offset;
+	if(iov[0].iov_len > count)
+		iov[0].iov_len = count;
+
+	iov[1].iov_base = pipe->buffer;
+	iov[1].iov_len = count - iov[0].iov_len;
+
+	ssize_t status;
+	off_t current;
+	if(position)
+	{
+		current = *position;
+		status = file_writev(out, iov, iov[1].iov_len ? 2 : 1, &current);
+		if(status > 0)
+			*position += status;
+	} else
+	{
+		status = file_writev(out, iov, iov[1].iov_len ? 2 : 1, NULL);
+	}
+
+	if(status <= 0)
+		return status;
+
+	memory_barrier();
+	pipe->head = head + status;
+
+	memory_barrier();
+	if(available == PIPE_SIZE || pipe->writer_waiting)
+		pipe_wake(pipe, PIPE_WRITABLE);
+
+	return status;
+}
+
@@ -0,0 +1,197 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <vfs.h>
+#include <devfs.h>
+#include <mm.h>
+#include <lock.h>
+#include <string.h>
+#include <pipe.h>
+#include <tasking.h>
+
+// Moving data between files without going through user space. When the
+// destination is memory, like the framebuffer, the source is read straight
+// into it, and for the initrd that's a single copy. Pipes are read or
+// written in place, and everything else goes through a kernel buffer.
+
+ssize_t splice_read(file_t *, off_t *, void *, size_t);
+ssize_t splice_write(file_t *, off_t *, void *, size_t);
+ssize_t splice_file(file_t *, off_t *, file_t *, off_t *, size_t, unsigned int);
+
+// splice_read(): Reads at a given position or at the file pointer
+// Param:	file_t *file - open file
+// Param:	off_t *position - position, moved by the bytes read, or NULL
+// Param:	void *buffer - buffer to read into
+// Param:	size_t count - bytes to read
+// Return:	ssize_t - bytes actually read, or error code
+
+ssize_t splice_read(file_t *file, off_t *position, void *buffer, size_t count)
+{
+	if(!position)
+		return file_read(file, buffer, count, NULL);
+
+	off_t current = *position;
+	ssize_t status = file_read(file, buffer, count, &current);
+	if(status > 0)
+		*position += status;
+
+	return status;
+}
+
+// splice_write(): Writes at a given position or at the file pointer
+// Param:	file_t *file - open file
+// Param:	off_t *position - position, moved by the bytes written, or NULL
+// Param:	void *buffer - buffer to write
+// Param:	size_t count - bytes to write
+// Return:	ssize_t - bytes actually written, or error code
+
+ssize_t splice_write(file_t *file, off_t *position, void *buffer, size_t count)
+{
+	if(!position)
+		return file_write(file, buffer, count, NULL);
+
+	off_t current = *position;
+	ssize_t status = file_write(file, buffer, count, &current);
+	if(status > 0)
+		*position += status;
+
+	return status;
+}
+
+// splice(): Moves data from one file to another
+// Param:	int in - file handle to read from
+// Param:	off_t *in_position - position to read from, NULL for the file pointer
+// Param:	int out - file handle to write to
+// Param:	off_t *out_position - position to write to, NULL for the file pointer
+// Param:	size_t count - bytes to move
+// Param:	unsigned int flags - SPLICE_F_* hints
+// Return:	ssize_t - bytes actually moved, or error code
+
+ssize_t splice(int in, off_t *in_position, int out, off_t *out_position, size_t count, unsigned int flags)
+{
+	pid_t pid = get_pid();
+	file_t *in_file = fd_get(pid, in);
+	file_t *out_file = fd_get(pid, out);
+	ssize_t status;
+
+	if(in_file && out_file)
+		status = splice_file(in_file, in_position, out_file, out_position, count, flags);
+	else
+		status = EBADF;
+
+	if(in_file)
+		file_put(in_file);
+
+	if(out_file)
+		file_put(out_file);
+
+	return status;
+}
+
+// splice_file(): Moves data from one open file to another
+// Param:	file_t *in - open file to read from
+// Param:	off_t *in_position - position to read from, NULL for the file pointer
+// Param:	file_t *out - open file to write to
+// Param:	off_t *out_position - position to write to, NULL for the file pointer
+// Param:	size_t count - bytes to move
+// Param:	unsigned int flags - SPLICE_F_* hints
+// Return:	ssize_t - bytes actually moved, or error code
+
+ssize_t splice_file(file_t *in, off_t *in_position, file_t *out, off_t *out_position, size_t count, unsigned int flags)
+{
+	if(!count)
+		return 0;
+
+	pipe_t *in_pipe = (in->mode & S_IFIFO) ? (pipe_t*)in->node : NULL;
+	pipe_t *out_pipe = (out->mode & S_IFIFO) ? (pipe_t*)out->node : NULL;
+	int pipe_flags = (flags & SPLICE_F_NONBLOCK) ? O_NONBLOCK : 0;
+
+	// pipes have no position, and their ring is used as the buffer
+	if((in_pipe && in_position) || (out_pipe && out_position))
+		return ESPIPE;
+
+	if(in_pipe)
+		return pipe_splice_out(in_pipe, out, out_position, count, pipe_flags);
+
+	if(out_pipe)
+		return pipe_splice_in(out_pipe, in, in_position, count, pipe_flags);
+
+	// memory on the other end can be read into directly, as far as
+	// it goes
+	void *direct = NULL;
+	size_t available;
+	if(out->ops->direct)
+		direct = out->ops->direct(out, out_position ? *out_position : out->position, &available);
+
+	ssize_t status;
+	if(direct)
+	{
+		if(count > available)
+			count = available;
+
+		status = splice_read(in, in_position, direct, count);
+		if(status <= 0)
+			return status;
+
+		if(out_position)
+			*out_position += status;
+		else
+			out->position += status;
+
+		return status;
+	}
+	// otherwise it's a copy in and a copy out, but still no user buffer
+	size_t buffer_size = count;
+	if(buffer_size > SPLICE_BUFFER_SIZE)
+		buffer_size = SPLICE_BUFFER_SIZE;
+
+	void *buffer = kmalloc(buffer_size);
+	ssize_t total = 0, written;
+	size_t size;
+
+	while(count)
+	{
+		size = count;
+		if(size > buffer_size)
+			size = buffer_size;
+
+		status = splice_read(in, in_position, buffer, size);
+		if(status <= 0)
+		{
+			kfree(buffer);
+			return total ? total : status;
+		}
+
+		written = splice_write(out, out_position, buffer, status);
+		if(written <= 0)
+		{
+			kfree(buffer);
+			return total ? total : written;
+		}
+
+		total += written;
+		count -= written;
+
+		if(written < status || status < size)
+			break;
+	}
+
+	kfree(buffer);
+	return total;
+}
+
+// sendfile(): Copies data from one file to another
+// Param:	int out - file handle to write to
+// Param:	int in - file handle to read from
+// Param:	off_t *position - position to read from, NULL for the file pointer
+// Param:	size_t count - bytes to copy
+// Return:	ssize_t - bytes actually copied, or error code
+
+ssize_t sendfile(int out, int in, off_t *position, size_t count)
+{
+	return splice(in, position, out, NULL, count, 0);
+}
+
@@ -9,150 +9,673 @@
 #include <kprintf.h>
 #include <string.h>
 #include <mm.h>
-
-// The kernel calls filesystem driver providing it a fully-resolved path or a
-// pointer to a file handle structure, and a pointer to a mountpoint structure
-// in kernel memory. The filesystem driver uses this information to read/write
-// raw bytes on the actual disk, using /dev/hdxpx or /dev/initrd.
-
-// ustar_get_file(): Internal function, returns pointer in bytes to a USTAR file entry
+#include <blkdev.h>
+#include <lock.h>
+
+// The kernel calls filesystem driver through the vnodes of its files, each of
+// which knows its mountpoint structure in kernel memory. The filesystem
+// driver uses this information to read/write raw bytes on the actual disk,
+// using the block device behind /dev/hdxpx or /dev/initrd.
+// Every header of the archive is read once at mount time into an index, a
+// hash table by path with each directory's children, so finding a file never
+// scans the archive again.
+
+lock_t ustar_mmap_mutex = 0;
+
+void *ustar_index_alloc(ustar_index_t *, size_t);
+uint32_t ustar_hash(uint32_t, const char *, size_t);
+ustar_node_t *ustar_lookup(ustar_index_t *, const char *, size_t);
+ustar_node_t *ustar_insert(ustar_index_t *, const char *, size_t);
+void ustar_rehash(ustar_index_t *);
+mode_t ustar_mode(ustar_entry_t *);
+int ustar_vnode_lookup(vnode_t *, const char *, size_t, vnode_t **);
+int ustar_vnode_stat(vnode_t *, struct stat *);
+ssize_t ustar_vnode_readv(vnode_t *, const struct iovec *, int, off_t);
+int ustar_vnode_mmap(vnode_t *, file_mapping_t *);
+int ustar_vnode_readdir(vnode_t *, size_t, directory_entry_t *);
+int ustar_vnode_readpage(vnode_t *, size_t, void *);
+int ustar_vnode_writepage(vnode_t *, size_t, void *);
+int ustar_vnode_bmap(vnode_t *, size_t, uint64_t *, size_t *);
+
+// files on a real disk go through the page cache
+const vnode_ops_t ustar_vnode_ops = {
+	.lookup = &ustar_vnode_lookup,
+	.stat = &ustar_vnode_stat,
+	.readdir = &ustar_vnode_readdir,
+	.readpage = &ustar_vnode_readpage,
+	.writepage = &ustar_vnode_writepage,
+	.bmap = &ustar_vnode_bmap,
+};
+
+// and files on a device that's in memory are already cached
+const vnode_ops_t ustar_memory_ops = {
+	.lookup = &ustar_vnode_lookup,
+	.stat = &ustar_vnode_stat,
+	.readv = &ustar_vnode_readv,
+	.mmap = &ustar_vnode_mmap,
+	.readdir = &ustar_vnode_readdir,
+};
+
+// ustar_mount(): Reads every header of an archive once, to index it
 // Param:	mountpoint_t *mountpoint - pointer to mountpoint structure
-// Param:	const char *path - path of file/directory
-// Param:	ustar_entry_t *destination - destination to copy entry info
-// Return:	uint64_t - offset in bytes, 1 on error
+// Return:	int - status code
 
-uint64_t ustar_get_file(mountpoint_t *mountpoint, const char *path, ustar_entry_t *destination)
+int ustar_mount(mountpoint_t *mountpoint)
 {
-	uint64_t block = 0;
-	size_t file_size;
+	ustar_index_t *index = kcalloc(sizeof(ustar_index_t), 1);
+	index->bucket_count = USTAR_INITIAL_BUCKETS;
+	index->buckets = kcalloc(sizeof(ustar_node_t *), index->bucket_count);
+	index->mountpoint = mountpoint;
+
+	index->root = ustar_insert(index, "", 0);
 
-	// open the disk device for reading
-	int handle = open(mountpoint->device, O_RDONLY);
 	ustar_entry_t *entry = kmalloc(sizeof(ustar_entry_t));
+	char *name = kmalloc(sizeof(entry->name_prefix) + sizeof(entry->name) + 2);
+	ustar_node_t *node;
+	uint64_t offset = 0, available;
+	size_t length;
 
-	while(read(handle, (char*)entry, sizeof(ustar_entry_t)) == sizeof(ustar_entry_t))
+	while(blkdev_read_bytes(mountpoint->dev, offset, sizeof(ustar_entry_t), entry) == 0)
 	{
 		if(memcmp(entry->signature, "ustar", 5) != 0)
 			break;
 
-		if(strcmp(entry->name, path) == 0)
+		// the name might be split in two, and usually starts with ./
+		name[0] = 0;
+		if(entry->name_prefix[0])
 		{
-			close(handle);
-			memcpy(destination, entry, sizeof(ustar_entry_t));
-			kfree(entry);
-			return block * USTAR_BLOCK_SIZE;
+			memcpy(name, entry->name_prefix, sizeof(entry->name_prefix));
+			name[sizeof(entry->name_prefix)] = 0;
+			strcpy(name + strlen(name), "/");
 		}
 
-		file_size = oct_to_dec(entry->size);
-		block += (file_size + USTAR_BLOCK_SIZE - 1) / USTAR_BLOCK_SIZE;
-		block++;
+		length = strlen(name);
+		memcpy(name + length, entry->name, sizeof(entry->name));
+		name[length + sizeof(entry->name)] = 0;
+
+		node = ustar_insert(index, name, strlen(name));
+		node->offset = offset;
+		node->vnode.size = oct_to_dec(entry->size);
+		node->vnode.mode = ustar_mode(entry);
+		node->uid = oct_to_dec(entry->uid);
+		node->gid = oct_to_dec(entry->gid);
+		node->mtime = oct_to_dec(entry->mtime);
+
+		// the data can be read straight out of a device that's in
+		// memory, and where it is only has to be found once
+		if(node->vnode.size)
+		{
+			node->data = blkdev_direct_access(mountpoint->dev, offset + USTAR_BLOCK_SIZE, &available);
+			if(node->data && available < node->vnode.size)
+				node->data = NULL;
 
-		lseek(handle, block * USTAR_BLOCK_SIZE, SEEK_SET);
+			if(node->data)
+				node->vnode.ops = &ustar_memory_ops;
+		}
+
+		offset += ((node->vnode.size + USTAR_BLOCK_SIZE - 1) / USTAR_BLOCK_SIZE) * USTAR_BLOCK_SIZE;
+		offset += USTAR_BLOCK_SIZE;
 	}
 
-	close(handle);
+	kfree(name);
 	kfree(entry);
-	return 1;
+
+	mountpoint->fs_data = index;
+	mountpoint->root = &index->root->vnode;
+	kprintf("ustar: indexed %d files on %s\n", index->count - 1, mountpoint->device);
+	return 0;
 }
 
-// ustar_stat(): stat() function for USTAR filesystem
-// Param:	mountpoint_t *mountpoint - pointer to mountpoint structure
-// Param:	const char *path - path of file/directory
-// Param:	struct stat *destination - destination to store stat information
-// Return:	int - status code
+// ustar_index_alloc(): Allocates memory that lasts as long as the index
+// Param:	ustar_index_t *index - index
+// Param:	size_t size - bytes to allocate, at most USTAR_POOL_SIZE
+// Return:	void * - memory
 
-int ustar_stat(mountpoint_t *mountpoint, const char *path, struct stat *destination)
+void *ustar_index_alloc(ustar_index_t *index, size_t size)
 {
-	// skip to the actual path
-	path += strlen(mountpoint->path);
+	// kmalloc() is page-granular, which is far too much for every node
+	size = (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+	if(size > index->pool_free)
+	{
+		index->pool = kmalloc(USTAR_POOL_SIZE);
+		index->pool_free = USTAR_POOL_SIZE;
+	}
 
-	// get the file entry
-	ustar_entry_t entry;
-	uint64_t offset = ustar_get_file(mountpoint, path, &entry);
-	if(offset == 1)
-		return ENOENT;
+	void *memory = index->pool;
+	index->pool += size;
+	index->pool_free -= size;
+	return memory;
+}
 
-	if(strcmp(mountpoint->device, "/dev/initrd") == 0)
-		destination->st_dev = 0;
-	else
-		destination->st_dev = (dev_t)mountpoint->device[7] - 48;
+// ustar_hash(): Hashes a path
+// Param:	uint32_t hash - USTAR_HASH_START, or the hash of what comes before
+// Param:	const char *name - path, without slashes around it
+// Param:	size_t length - length of path
+// Return:	uint32_t - hash
 
-	path -= strlen(mountpoint->path);
+uint32_t ustar_hash(uint32_t hash, const char *name, size_t length)
+{
+	size_t i;
 
-	destination->st_ino = offset / USTAR_BLOCK_SIZE;	// not really inodes, but okay
-	destination->st_nlink = 0;		// TO-DO...
-	destination->st_uid = oct_to_dec(entry.uid);
-	destination->st_gid = oct_to_dec(entry.gid);
-	destination->st_size = oct_to_dec(entry.size);
-	destination->st_mtime = oct_to_dec(entry.mtime);
-	destination->st_ctime = oct_to_dec(entry.mtime);
-	destination->st_atime = get_time();
-	destination->st_blksize = USTAR_BLOCK_SIZE;
-	destination->st_blocks = (destination->st_size + USTAR_BLOCK_SIZE - 1) / USTAR_BLOCK_SIZE;
+	for(i = 0; i < length; i++)		// FNV-1a
+	{
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+// ustar_lookup(): Finds a file in the index
+// Param:	ustar_index_t *index - index
+// Param:	const char *name - path, without slashes around it
+// Param:	size_t length - length of path, which doesn't have to end there
+// Return:	ustar_node_t * - node, NULL if there's no such file
+
+ustar_node_t *ustar_lookup(ustar_index_t *index, const char *name, size_t length)
+{
+	uint32_t hash = ustar_hash(USTAR_HASH_START, name, length);
+	ustar_node_t *node = index->buckets[hash & (index->bucket_count - 1)];
+
+	while(node)
+	{
+		if(node->hash == hash && memcmp(node->name, name, length) == 0 && !node->name[length])
+			return node;
+
+		node = node->hash_next;
+	}
+
+	return NULL;
+}
+
+// ustar_insert(): Finds or adds a file in the index, with its parents
+// Param:	ustar_index_t *index - index
+// Param:	const char *path - path as it is in the archive
+// Param:	size_t length - length of path
+// Return:	ustar_node_t * - node
+
+ustar_node_t *ustar_insert(ustar_index_t *index, const char *path, size_t length)
+{
+	// get rid of ./ and the slashes around the name
+	while(length >= 2 && path[0] == '.' && path[1] == '/')
+	{
+		path += 2;
+		length -= 2;
+	}
+
+	while(length && path[0] == '/')
+	{
+		path++;
+		length--;
+	}
+
+	while(length && path[length-1] == '/')
+		length--;
+
+	ustar_node_t *node = ustar_lookup(index, path, length);
+	if(node)
+		return node;
+
+	node = ustar_index_alloc(index, sizeof(ustar_node_t));
+	memset(node, 0, sizeof(ustar_node_t));
+	node->name = ustar_index_alloc(index, length + 1);
+	memcpy(node->name, path, length);
+	node->name[length] = 0;
+	node->hash = ustar_hash(USTAR_HASH_START, node->name, length);
+	node->offset = USTAR_NO_HEADER;
+	node->vnode.ops = &ustar_vnode_ops;
+	node->vnode.mountpoint = index->mountpoint;
+	node->vnode.mode = S_IFDIR | S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+	node->vnode.ino = index->count + 1;		// not really inodes, but okay
+	node->vnode.data = node;
+
+	node->hash_next = index->buckets[node->hash & (index->bucket_count - 1)];
+	index->buckets[node->hash & (index->bucket_count - 1)] = node;
+	index->count++;
+
+	if(index->count > index->bucket_count)
+		ustar_rehash(index);
+
+	if(!length)
+		return node;
+
+	// archives don't always have the directories, so make them up
+	while(length && node->name[length-1] != '/')
+		length--;
+
+	node->parent = ustar_insert(index, node->name, length);
+	node->sibling = node->parent->children;
+	node->parent->children = node;
+	return node;
+}
 
-	destination->st_mode = 0;
+// ustar_rehash(): Doubles the hash table of an index
+// Param:	ustar_index_t *index - index
+// Return:	Nothing
 
-	switch(entry.type)
+void ustar_rehash(ustar_index_t *index)
+{
+	size_t bucket_count = index->bucket_count << 1;
+	ustar_node_t **buckets = kcalloc(sizeof(ustar_node_t *), bucket_count);
+	ustar_node_t *node, *next;
+	size_t i;
+
+	for(i = 0; i < index->bucket_count; i++)
+	{
+		node = index->buckets[i];
+		while(node)
+		{
+			next = node->hash_next;
+			node->hash_next = buckets[node->hash & (bucket_count - 1)];
+			buckets[node->hash & (bucket_count - 1)] = node;
+			node = next;
+		}
+	}
+
+	kfree(index->buckets);
+	index->buckets = buckets;
+	index->bucket_count = bucket_count;
+}
+
+// ustar_mode(): Returns the mode of a USTAR file entry
+// Param:	ustar_entry_t *entry - file entry
+// Return:	mode_t - type and permissions
+
+mode_t ustar_mode(ustar_entry_t *entry)
+{
+	mode_t mode = 0;
+
+	switch(entry->type)
 	{
 	case USTAR_REG:
 	case 0:
-		destination->st_mode |= S_IFREG;
+		mode |= S_IFREG;
 		break;
 	case USTAR_HARD_LINK:
 	case USTAR_SYMLINK:
-		destination->st_mode |= S_IFLNK;
+		mode |= S_IFLNK;
 		break;
 	case USTAR_CHR:
-		destination->st_mode |= S_IFCHR;
+		mode |= S_IFCHR;
 		break;
 	case USTAR_BLK:
-		destination->st_mode |= S_IFBLK;
+		mode |= S_IFBLK;
 		break;
 	case USTAR_DIR:
-		destination->st_mode |= S_IFDIR;
+		mode |= S_IFDIR;
 		break;
 	case USTAR_FIFO:
-		destination->st_mode |= S_IFIFO;
+		mode |= S_IFIFO;
 		break;
 	default:
-		kprintf("ustar: %s: unknown file type %xb, ignoring...\n", path, entry.type);
+		kprintf("ustar: %s: unknown file type %xb, ignoring...\n", entry->name, entry->type);
 		break;
 	}
 
 	// now the file permissions
-	size_t permissions = oct_to_dec(entry.mode);
+	size_t permissions = oct_to_dec(entry->mode);
 	if(permissions & USTAR_READ_USER)
-		destination->st_mode |= S_IRUSR;
+		mode |= S_IRUSR;
 
 	if(permissions & USTAR_WRITE_USER)
-		destination->st_mode |= S_IWUSR;
+		mode |= S_IWUSR;
 
 	if(permissions & USTAR_EXECUTE_USER)
-		destination->st_mode |= S_IXUSR;
+		mode |= S_IXUSR;
 
 	if(permissions & USTAR_READ_GROUP)
-		destination->st_mode |= S_IRGRP;
+		mode |= S_IRGRP;
 
 	if(permissions & USTAR_WRITE_GROUP)
-		destination->st_mode |= S_IWGRP;
+		mode |= S_IWGRP;
 
 	if(permissions & USTAR_EXECUTE_GROUP)
-		destination->st_mode |= S_IXGRP;
+		mode |= S_IXGRP;
 
 	if(permissions & USTAR_READ_OTHER)
-		destination->st_mode |= S_IROTH;
+		mode |= S_IROTH;
 
 	if(permissions & USTAR_WRITE_OTHER)
-		destination->st_mode |= S_IWOTH;
+		mode |= S_IWOTH;
 
 	if(permissions & USTAR_EXECUTE_OTHER)
-		destination->st_mode |= S_IXOTH;
+		mode |= S_IXOTH;
+
+	return mode;
+}
+
+// ustar_vnode_lookup(): lookup() function for USTAR filesystem
+// Param:	vnode_t *directory - directory
+// Param:	const char *name - name in the directory, not terminated
+// Param:	size_t length - length of name
+// Param:	vnode_t **destination - vnode of the file
+// Return:	int - status code
+
+int ustar_vnode_lookup(vnode_t *directory, const char *name, size_t length, vnode_t **destination)
+{
+	ustar_node_t *parent = (ustar_node_t*)directory->data;
+	ustar_index_t *index = (ustar_index_t*)directory->mountpoint->fs_data;
+
+	// the index is by full path, which is the directory's path with the
+	// name after it, so the hash carries on from the directory's
+	uint32_t hash = parent->hash;
+	size_t prefix = strlen(parent->name);
+	if(prefix)
+	{
+		hash = ustar_hash(hash, "/", 1);
+		prefix++;
+	}
+
+	hash = ustar_hash(hash, name, length);
+
+	ustar_node_t *node = index->buckets[hash & (index->bucket_count - 1)];
+	while(node)
+	{
+		if(node->hash == hash && node->parent == parent && memcmp(node->name + prefix, name, length) == 0 && !node->name[prefix + length])
+		{
+			*destination = &node->vnode;
+			return 0;
+		}
+
+		node = node->hash_next;
+	}
+
+	return ENOENT;
+}
+
+// ustar_vnode_stat(): stat() function for USTAR filesystem
+// Param:	vnode_t *vnode - file
+// Param:	struct stat *destination - destination to store stat information
+// Return:	int - status code
+
+int ustar_vnode_stat(vnode_t *vnode, struct stat *destination)
+{
+	ustar_node_t *node = (ustar_node_t*)vnode->data;
+
+	destination->st_dev = vnode->mountpoint->dev;
+	destination->st_ino = vnode->ino;
+	destination->st_mode = vnode->mode;
+	destination->st_nlink = 0;		// TO-DO...
+	destination->st_uid = node->uid;
+	destination->st_gid = node->gid;
+	destination->st_size = vnode->size;
+	destination->st_mtime = node->mtime;
+	destination->st_ctime = node->mtime;
+	destination->st_atime = get_time();
+	destination->st_blksize = USTAR_BLOCK_SIZE;
+	destination->st_blocks = (destination->st_size + USTAR_BLOCK_SIZE - 1) / USTAR_BLOCK_SIZE;
+	return 0;
+}
+
+// ustar_vnode_readv(): readv() function for USTAR filesystem
+// Param:	vnode_t *vnode - file
+// Param:	const struct iovec *iov - buffers to read into
+// Param:	int count - count of buffers
+// Param:	off_t position - byte offset within the file
+// Return:	ssize_t - bytes actually read, or error code
+
+ssize_t ustar_vnode_readv(vnode_t *vnode, const struct iovec *iov, int count, off_t position)
+{
+	return ustar_readv(vnode->mountpoint, (ustar_node_t*)vnode->data, position, iov, count);
+}
+
+// ustar_vnode_mmap(): mmap() function for USTAR filesystem
+// Param:	vnode_t *vnode - file
+// Param:	file_mapping_t *mapping - mapping to fill in
+// Return:	int - status code
+
+int ustar_vnode_mmap(vnode_t *vnode, file_mapping_t *mapping)
+{
+	ustar_mapping_t *ustar_mapping = ustar_mmap(vnode->mountpoint, (ustar_node_t*)vnode->data);
+	if(!ustar_mapping)
+		return ENODEV;
+
+	mapping->pages = ustar_mapping->pages;
+	mapping->page_count = ustar_mapping->page_count;
+	return 0;
+}
+
+// ustar_vnode_readpage(): readpage() function for USTAR filesystem
+// Param:	vnode_t *vnode - file
+// Param:	size_t index - page index
+// Param:	void *buffer - page to read into
+// Return:	int - status code
+
+int ustar_vnode_readpage(vnode_t *vnode, size_t index, void *buffer)
+{
+	off_t position = (off_t)index << PAGE_SIZE_SHIFT;
+	size_t size = 0;
+
+	if(position < vnode->size)
+	{
+		size = vnode->size - position;
+		if(size > PAGE_SIZE)
+			size = PAGE_SIZE;
+
+		if(ustar_read(vnode->mountpoint, (ustar_node_t*)vnode->data, position, buffer, size) != (ssize_t)size)
+			return EIO;
+	}
+
+	// past the end of the file is zeroes
+	memset((uint8_t*)buffer + size, 0, PAGE_SIZE - size);
+	return 0;
+}
+
+// ustar_vnode_writepage(): writepage() function for USTAR filesystem
+// Param:	vnode_t *vnode - file
+// Param:	size_t index - page index
+// Param:	void *buffer - page to write from
+// Return:	int - status code
+
+int ustar_vnode_writepage(vnode_t *vnode, size_t index, void *buffer)
+{
+	off_t position = (off_t)index << PAGE_SIZE_SHIFT;
+	if(position >= vnode->size)
+		return 0;
+
+	size_t size = vnode->size - position;
+	if(size > PAGE_SIZE)
+		size = PAGE_SIZE;
+
+	// files are in one piece after their header, so they're written in place
+	ustar_node_t *node = (ustar_node_t*)vnode->data;
+	if(blkdev_write_bytes(vnode->mountpoint->dev, node->offset + USTAR_BLOCK_SIZE + position, size, buffer) != 0)
+		return EIO;
+
+	return 0;
+}
+
+// ustar_vnode_bmap(): bmap() function for USTAR filesystem
+// Param:	vnode_t *vnode - file
+// Param:	size_t index - page index
+// Param:	uint64_t *base - byte offset of the page on the device
+// Param:	size_t *size - bytes of the page that are on the device, 0 for none
+// Return:	int - status code
+
+int ustar_vnode_bmap(vnode_t *vnode, size_t index, uint64_t *base, size_t *size)
+{
+	off_t position = (off_t)index << PAGE_SIZE_SHIFT;
+	ustar_node_t *node = (ustar_node_t*)vnode->data;
+
+	*base = node->offset + USTAR_BLOCK_SIZE + position;
+	*size = 0;
+	if(position >= vnode->size)
+		return 0;
+
+	// the rest of the last block is padding, so it can be written too
+	*size = vnode->size - position;
+	*size = (*size + USTAR_BLOCK_SIZE - 1) & ~(USTAR_BLOCK_SIZE - 1);
+	if(*size > PAGE_SIZE)
+		*size = PAGE_SIZE;
+
+	return 0;
+}
+
+// ustar_vnode_readdir(): readdir() function for USTAR filesystem
+// Param:	vnode_t *vnode - directory
+// Param:	size_t index - index of file in the directory
+// Param:	directory_entry_t *entry - entry to store
+// Return:	int - status code, ENOENT past the last file
+
+int ustar_vnode_readdir(vnode_t *vnode, size_t index, directory_entry_t *entry)
+{
+	ustar_node_t *parent = (ustar_node_t*)vnode->data;
+	ustar_node_t *node = parent->children;
+
+	while(node && index)
+	{
+		node = node->sibling;
+		index--;
+	}
+
+	if(!node)
+		return ENOENT;
 
+	size_t prefix = strlen(parent->name);
+	strcpy(entry->filename, node->name + prefix + (prefix ? 1 : 0));
 	return 0;
 }
 
+// ustar_read(): read() function for USTAR filesystem
+// Param:	mountpoint_t *mountpoint - pointer to mountpoint structure
+// Param:	ustar_node_t *node - open file
+// Param:	off_t position - byte offset within the file
+// Param:	char *buffer - buffer to read into
+// Param:	size_t count - bytes to read
+// Return:	ssize_t - bytes actually read, or error code
+
+ssize_t ustar_read(mountpoint_t *mountpoint, ustar_node_t *node, off_t position, char *buffer, size_t count)
+{
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = count;
+
+	return ustar_readv(mountpoint, node, position, &iov, 1);
+}
+
+// ustar_readv(): readv() function for USTAR filesystem
+// Param:	mountpoint_t *mountpoint - pointer to mountpoint structure
+// Param:	ustar_node_t *node - open file
+// Param:	off_t position - byte offset within the file
+// Param:	const struct iovec *iov - buffers to read into
+// Param:	int count - count of buffers
+// Return:	ssize_t - bytes actually read, or error code
+
+ssize_t ustar_readv(mountpoint_t *mountpoint, ustar_node_t *node, off_t position, const struct iovec *iov, int count)
+{
+	if(position >= node->vnode.size)
+		return 0;
+
+	size_t remaining = node->vnode.size - position;
+	ssize_t total = 0;
+	size_t size;
+	int i = 0;
+
+	// that's a single copy, and nothing to allocate
+	if(node->data)
+	{
+		while(i < count && remaining)
+		{
+			size = iov[i].iov_len;
+			if(size > remaining)
+				size = remaining;
+
+			memcpy(iov[i].iov_base, node->data + position, size);
+			position += size;
+			remaining -= size;
+			total += size;
+			i++;
+		}
+
+		return total;
+	}
+
+	// trim the buffers to the end of the file, so the device doesn't read
+	// the next file's header into them
+	struct iovec *trimmed = kmalloc(count * sizeof(struct iovec));
+
+	while(i < count && remaining)
+	{
+		trimmed[i].iov_base = iov[i].iov_base;
+		trimmed[i].iov_len = iov[i].iov_len;
+		if(trimmed[i].iov_len > remaining)
+			trimmed[i].iov_len = remaining;
+
+		remaining -= trimmed[i].iov_len;
+		total += trimmed[i].iov_len;
+		i++;
+	}
+
+	// the file's data starts in the block after its header, and the whole
+	// vector goes to the device in one request
+	int status = blkdev_readv(mountpoint->dev, node->offset + USTAR_BLOCK_SIZE + position, trimmed, i);
+	kfree(trimmed);
+
+	if(status != 0)
+		return EIO;
+
+	return total;
+}
+
+// ustar_mmap(): mmap() function for USTAR filesystem
+// Param:	mountpoint_t *mountpoint - pointer to mountpoint structure
+// Param:	ustar_node_t *node - open file
+// Return:	ustar_mapping_t * - physical pages of the file, NULL on error
+
+ustar_mapping_t *ustar_mmap(mountpoint_t *mountpoint, ustar_node_t *node)
+{
+	uint64_t offset = node->offset;
+	if(!(node->vnode.mode & S_IFREG))
+		return NULL;
+
+	acquire_lock(&ustar_mmap_mutex);
+
+	ustar_mapping_t *mapping = node->mapping;
+	if(mapping)
+	{
+		release_lock(&ustar_mmap_mutex);
+		return mapping;
+	}
+
+	mapping = kcalloc(sizeof(ustar_mapping_t), 1);
+	mapping->size = node->vnode.size;
+	mapping->page_count = (mapping->size + PAGE_SIZE - 1) >> PAGE_SIZE_SHIFT;
+	mapping->pages = kcalloc(sizeof(size_t), mapping->page_count + 1);
+
+	// devices in memory, like the initrd, don't need copies of files
+	// that start on a page boundary, which are mapped straight from it
+	size_t physical = blkdev_physical(mountpoint->dev, offset + USTAR_BLOCK_SIZE);
 
+	size_t i;
+	if(physical && !(physical & (PAGE_SIZE-1)))
+	{
+		for(i = 0; i < mapping->page_count; i++)
+			mapping->pages[i] = physical + (i << PAGE_SIZE_SHIFT);
 
+		// except the last page, which would show the next file's header
+		// past the end of this one
+		if(mapping->size & (PAGE_SIZE-1))
+		{
+			mapping->copy = (void*)vmm_alloc(KERNEL_HEAP, 1, PAGE_PRESENT | PAGE_RW);
+			ustar_read(mountpoint, node, (off_t)(mapping->size & (~(PAGE_SIZE-1))), mapping->copy, mapping->size & (PAGE_SIZE-1));
+			mapping->pages[mapping->page_count-1] = vmm_get_page((size_t)mapping->copy) & (~(PAGE_SIZE-1));
+		}
+	} else if(mapping->page_count)
+	{
+		// everything else gets an aligned copy, made once; kmalloc()
+		// memory starts after its header, so it isn't page-aligned
+		mapping->copy = (void*)vmm_alloc(KERNEL_HEAP, mapping->page_count, PAGE_PRESENT | PAGE_RW);
+		ustar_read(mountpoint, node, 0, mapping->copy, mapping->size);
+
+		for(i = 0; i < mapping->page_count; i++)
+			mapping->pages[i] = vmm_get_page((size_t)mapping->copy + (i << PAGE_SIZE_SHIFT)) & (~(PAGE_SIZE-1));
+	}
+
+	node->mapping = mapping;
+
+	release_lock(&ustar_mmap_mutex);
+	return mapping;
+}
 
 
 
@@ -11,14 +11,37 @@
 #include <string.h>
 #include <devfs.h>
 #include <lock.h>
-#include <tty.h>
-#include <ustar.h>		// the only in-kernel FS
+#include <ioring.h>
+#include <pipe.h>
+#include <dcache.h>
+#include <pcache.h>
 
-file_handle_t *files;
 mountpoint_t *mountpoints;
 char full_path[1024];
 lock_t vfs_mutex = 0;
 struct stat root_stat;
+vnode_t vfs_root_vnode;
+
+int vfs_mmap_fault(vm_area_t *, size_t);
+int vfs_root_stat(vnode_t *, struct stat *);
+ssize_t vnode_file_readv(file_t *, const struct iovec *, int, off_t *);
+ssize_t vnode_file_writev(file_t *, const struct iovec *, int, off_t *);
+int vnode_file_stat(file_t *, struct stat *);
+int vnode_file_mmap(file_t *, file_mapping_t *);
+int vnode_file_fsync(file_t *);
+
+// the root directory when nothing's mounted on it, which only has /dev
+const vnode_ops_t vfs_root_ops = {
+	.stat = &vfs_root_stat,
+};
+
+const file_ops_t vnode_file_ops = {
+	.readv = &vnode_file_readv,
+	.writev = &vnode_file_writev,
+	.stat = &vnode_file_stat,
+	.mmap = &vnode_file_mmap,
+	.fsync = &vnode_file_fsync,
+};
 
 // vfs_init(): Initializes the virtual filesystem
 // Param:	Nothing
@@ -27,7 +50,6 @@ struct stat root_stat;
 void vfs_init()
 {
 	kprintf("vfs: initializing virtual filesystem...\n");
-	files = kcalloc(sizeof(file_handle_t), MAX_FILES);
 	mountpoints = kcalloc(sizeof(mountpoint_t), MAX_MOUNTPOINTS);
 
 	// stat for root filesystem
@@ -38,17 +60,15 @@ void vfs_init()
 	root_stat.st_mtime = timestamp;
 	root_stat.st_ctime = timestamp;
 
-	devfs_init();
-
-	// mark the first three file handles as used, for stdin, stdout, stderr
-	files[STDIN].present = 1;
-	strcpy(files[STDIN].path, "/dev/stdin");
-
-	files[STDOUT].present = 1;
-	strcpy(files[STDOUT].path, "/dev/stdout");
+	vfs_root_vnode.ops = &vfs_root_ops;
+	vfs_root_vnode.mode = root_stat.st_mode;
+	dcache_init();
+	pcache_init();
 
-	files[STDERR].present = 1;
-	strcpy(files[STDERR].path, "/dev/stderr");
+	// descriptor tables open stdin, stdout and stderr on /dev when
+	// they're made
+	devfs_init();
+	ioring_init();
 }
 
 // vfs_resolve_path(): Resolves a path
@@ -119,68 +139,330 @@ size_t vfs_resolve_path(char *fullpath, const char *path)
 	return strlen(fullpath);
 }
 
-// open(): Opens a file
-// Param:	const char *path - path of file
+// vfs_root_stat(): Returns stat information for the root directory
+// Param:	vnode_t *vnode - root vnode
+// Param:	struct stat *destination - stat structure to store
+// Return:	int - status code
+
+int vfs_root_stat(vnode_t *vnode, struct stat *destination)
+{
+	memcpy(destination, &root_stat, sizeof(struct stat));
+	return 0;
+}
+
+// vfs_lookup(): Finds a file in a directory, or what's mounted there instead
+// Param:	vnode_t *directory - directory
+// Param:	const char *path - fully resolved path of the file
+// Param:	const char *name - last component of path, not terminated
+// Param:	size_t length - length of name
+// Param:	vnode_t **destination - vnode of the file
+// Return:	int - status code
+
+int vfs_lookup(vnode_t *directory, const char *path, const char *name, size_t length, vnode_t **destination)
+{
+	vnode_t *vnode = vfs_mount_root(path);
+	if(vnode)
+	{
+		*destination = vnode;
+		return 0;
+	}
+
+	if(!directory->ops->lookup)
+		return ENOENT;
+
+	return directory->ops->lookup(directory, name, length, destination);
+}
+
+// vnode_open(): Opens a file of a filesystem
+// Param:	vnode_t *vnode - vnode of the file
 // Param:	int flags - open flags
-// Return:	int - file handle
+// Return:	file_t * - open file
 
-int open(const char *path, int flags, ...)
+file_t *vnode_open(vnode_t *vnode, int flags)
 {
-	struct stat file_info;
-	int status = stat(path, &file_info);
+	return file_alloc(&vnode_file_ops, vnode, flags, vnode->mode);
+}
 
-	if(status != 0)
-		return status;
+// vnode_file_readv(): Reads an open file of a filesystem
+// Param:	file_t *file - open file
+// Param:	const struct iovec *iov - buffers to read into
+// Param:	int count - count of buffers
+// Param:	off_t *position - byte offset within the file, moved by the bytes read
+// Return:	ssize_t - bytes actually read, or error code
+
+ssize_t vnode_file_readv(file_t *file, const struct iovec *iov, int count, off_t *position)
+{
+	vnode_t *vnode = (vnode_t*)file->node;
+	ssize_t status;
+
+	if(vnode->ops->readpage)
+		status = pcache_readv(file, iov, count, *position);
+	else if(vnode->ops->readv)
+		status = vnode->ops->readv(vnode, iov, count, *position);
+	else
+		return EIO;
+
+	if(status > 0)
+		*position += status;
+
+	return status;
+}
+
+// vnode_file_writev(): Writes an open file of a filesystem
+// Param:	file_t *file - open file
+// Param:	const struct iovec *iov - buffers to write from
+// Param:	int count - count of buffers
+// Param:	off_t *position - byte offset within the file, moved by the bytes written
+// Return:	ssize_t - bytes actually written, or error code
+
+ssize_t vnode_file_writev(file_t *file, const struct iovec *iov, int count, off_t *position)
+{
+	vnode_t *vnode = (vnode_t*)file->node;
+	ssize_t status;
+
+	if(vnode->mountpoint && (vnode->mountpoint->flags & MS_RDONLY))
+		return EROFS;
+
+	// filesystems that can write pages are written through the page cache
+	if(vnode->ops->readpage && vnode->ops->writepage)
+		status = pcache_writev(file, iov, count, *position);
+	else if(vnode->ops->writev)
+		status = vnode->ops->writev(vnode, iov, count, *position);
+	else
+		return EROFS;
+
+	if(status > 0)
+		*position += status;
+
+	return status;
+}
+
+// vnode_file_stat(): Returns stat information for an open file of a filesystem
+// Param:	file_t *file - open file
+// Param:	struct stat *destination - stat structure to store
+// Return:	int - status code
+
+int vnode_file_stat(file_t *file, struct stat *destination)
+{
+	vnode_t *vnode = (vnode_t*)file->node;
+	return vnode->ops->stat(vnode, destination);
+}
+
+// vnode_file_mmap(): Finds where the pages of an open file of a filesystem come from
+// Param:	file_t *file - open file
+// Param:	file_mapping_t *mapping - mapping to fill in
+// Return:	int - status code
+
+int vnode_file_mmap(file_t *file, file_mapping_t *mapping)
+{
+	vnode_t *vnode = (vnode_t*)file->node;
+	if(vnode->ops->mmap)
+		return vnode->ops->mmap(vnode, mapping);
+
+	// everything else is mapped from the page cache, a page at a time
+	if(!vnode->ops->readpage || !(vnode->mode & S_IFREG))
+		return ENODEV;
+
+	mapping->vnode = vnode;
+	mapping->page_count = (vnode->size + PAGE_SIZE - 1) >> PAGE_SIZE_SHIFT;
+	return 0;
+}
+
+// vnode_file_fsync(): Writes back everything written to an open file of a filesystem
+// Param:	file_t *file - open file
+// Return:	int - status code
+
+int vnode_file_fsync(file_t *file)
+{
+	vnode_t *vnode = (vnode_t*)file->node;
+	if(!vnode->ops->writepage)
+		return 0;
+
+	return pcache_sync(vnode, 0, (size_t)-1);
+}
+
+// file_open(): Opens a file, without giving it a descriptor
+// Param:	const char *path - path of file
+// Param:	int flags - open flags
+// Param:	file_t **destination - open file
+// Return:	int - status code
+
+int file_open(const char *path, int flags, file_t **destination)
+{
+	char *resolved = kmalloc(1024);
+	vnode_t *vnode;
+	int status;
 
 	acquire_lock(&vfs_mutex);
+	vfs_resolve_path(resolved, path);
 
-	if(!file_info.st_mode & S_IFBLK || !file_info.st_mode & S_IFCHR || !file_info.st_mode & S_IFIFO || !file_info.st_mode & S_IFREG)
+	// /dev isn't cached, and its devices have their own open files
+	if(memcmp(resolved, "/dev/", 5) == 0)
 	{
-		kprintf("vfs: can't open %s; it's not a file.\n");
 		release_lock(&vfs_mutex);
-		return ENOENT;
+		status = devfs_open(resolved + 5, flags, destination);
+		kfree(resolved);
+		return status;
 	}
 
-	// resolve the path
-	vfs_resolve_path(full_path, path);
+	// the file is found once here, and never by path again
+	status = dcache_lookup(resolved, &vnode);
+	release_lock(&vfs_mutex);
 
-	// check for the standard I/O stuff
-	if(strcmp(full_path, "/dev/stdin") == 0)
+	if(status == 0 && !(vnode->mode & (S_IFBLK | S_IFCHR | S_IFIFO | S_IFREG)))
 	{
-		release_lock(&vfs_mutex);
-		return STDIN;
-	} else if(strcmp(full_path, "/dev/stdout") == 0)
+		kprintf("vfs: can't open %s; it's not a file.\n", path);
+		status = ENOENT;
+	}
+
+	if(status == 0)
 	{
-		release_lock(&vfs_mutex);
-		return STDOUT;
-	} else if(strcmp(full_path, "/dev/stderr") == 0)
+		if(vnode->mode & S_IFIFO)
+			*destination = pipe_file(fifo_open(resolved, flags), flags);
+		else
+			*destination = vnode_open(vnode, flags);
+	}
+
+	kfree(resolved);
+	return status;
+}
+
+// file_readv(): Reads an open file into several buffers
+// Param:	file_t *file - open file
+// Param:	const struct iovec *iov - buffers to read into
+// Param:	int count - count of buffers
+// Param:	off_t *position - position in the file, NULL to use the file pointer
+// Return:	ssize_t - bytes actually read, or error code
+
+ssize_t file_readv(file_t *file, const struct iovec *iov, int count, off_t *position)
+{
+	if(count < 0 || count > IOV_MAX)
+		return EINVAL;
+
+	if(!count)
+		return 0;
+
+	if(!file->ops->readv)
+		return EIO;
+
+	// pipes don't have a position to read from
+	if(position)
 	{
-		release_lock(&vfs_mutex);
-		return STDERR;
+		if(file->mode & S_IFIFO)
+			return ESPIPE;
+
+		return file->ops->readv(file, iov, count, position);
 	}
 
-	// if not, we need to open the actual file
-	// find an empty handle
-	int handle = 0;
+	off_t current = file->position;
+	ssize_t status = file->ops->readv(file, iov, count, &current);
+	file->position = current;
+	return status;
+}
+
+// file_writev(): Writes an open file from several buffers
+// Param:	file_t *file - open file
+// Param:	const struct iovec *iov - buffers to write
+// Param:	int count - count of buffers
+// Param:	off_t *position - position in the file, NULL to use the file pointer
+// Return:	ssize_t - bytes actually written, or error code
+
+ssize_t file_writev(file_t *file, const struct iovec *iov, int count, off_t *position)
+{
+	if(count < 0 || count > IOV_MAX)
+		return EINVAL;
+
+	if(!count)
+		return 0;
 
-	while(files[handle].present != 0 && handle < MAX_FILES)
-		handle++;
+	// nothing is written to files that can't take it
+	if(!file->ops->writev)
+		return 0;
 
-	if(handle >= MAX_FILES)
+	if(position)
 	{
-		kprintf("vfs: no available file handles.\n");
-		release_lock(&vfs_mutex);
-		return ENOBUFS;
+		if(file->mode & S_IFIFO)
+			return ESPIPE;
+
+		return file->ops->writev(file, iov, count, position);
 	}
 
-	// create the file handle
-	files[handle].present = 1;
-	files[handle].position = 0;
-	files[handle].flags = flags;
-	files[handle].pid = get_pid();
-	strcpy(files[handle].path, full_path);
+	off_t current = file->position;
+	ssize_t status = file->ops->writev(file, iov, count, &current);
+	file->position = current;
+	return status;
+}
+
+// file_read(): Reads an open file
+// Param:	file_t *file - open file
+// Param:	char *buffer - buffer to read
+// Param:	size_t count - bytes to read
+// Param:	off_t *position - position in the file, NULL to use the file pointer
+// Return:	ssize_t - bytes actually read, or error code
+
+ssize_t file_read(file_t *file, char *buffer, size_t count, off_t *position)
+{
+	if(!count)
+		return 0;
+
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = count;
+
+	return file_readv(file, &iov, 1, position);
+}
+
+// file_write(): Writes an open file
+// Param:	file_t *file - open file
+// Param:	char *buffer - buffer to write
+// Param:	size_t count - bytes to write
+// Param:	off_t *position - position in the file, NULL to use the file pointer
+// Return:	ssize_t - bytes actually written, or error code
+
+ssize_t file_write(file_t *file, char *buffer, size_t count, off_t *position)
+{
+	if(!count)
+		return 0;
+
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = count;
+
+	return file_writev(file, &iov, 1, position);
+}
+
+// file_stat(): Returns stat information for an open file
+// Param:	file_t *file - open file
+// Param:	struct stat *destination - stat structure to store
+// Return:	int - status code
+
+int file_stat(file_t *file, struct stat *destination)
+{
+	if(!file->ops->stat)
+		return EINVAL;
+
+	return file->ops->stat(file, destination);
+}
+
+// open(): Opens a file
+// Param:	const char *path - path of file
+// Param:	int flags - open flags
+// Return:	int - file handle
+
+int open(const char *path, int flags, ...)
+{
+	file_t *file;
+	int status = file_open(path, flags, &file);
+	if(status != 0)
+		return status;
+
+	int handle = fd_alloc(get_pid(), file);
+	if(handle < 0)
+	{
+		kprintf("vfs: no available file handles.\n");
+		file_put(file);
+	}
 
-	release_lock(&vfs_mutex);
 	return handle;
 }
 
@@ -190,12 +472,12 @@ int open(const char *path, int flags, ...)
 
 int close(int handle)
 {
-	if(files[handle].present != 1)
+	file_t *file = fd_remove(get_pid(), handle);
+	if(!file)
 		return EBADF;
 
-	acquire_lock(&vfs_mutex);
-	memset(&files[handle], 0, sizeof(file_handle_t));
-	release_lock(&vfs_mutex);
+	// the file itself goes away with its last descriptor
+	file_put(file);
 	return 0;
 }
 
@@ -207,68 +489,136 @@ int close(int handle)
 
 ssize_t read(int handle, char *buffer, size_t count)
 {
-	if(!count)
-		return 0;
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
+		return EBADF;
 
-	// handle stdio stuff first
-	if(handle == STDIN)
-		return EIO;		// until I implement keyboard in userspace
+	ssize_t status = file_read(file, buffer, count, NULL);
+	file_put(file);
+	return status;
+}
 
-	// can't read from the output
-	if(handle == STDOUT || handle == STDERR)
-		return EIO;
+// write(): Writes a file
+// Param:	int handle - file handle
+// Param:	char *buffer - buffer to write
+// Param:	size_t count - bytes to write
+// Return:	size_t - bytes actually written
 
-	acquire_lock(&vfs_mutex);
-	if(files[handle].present != 1)
-	{
-		release_lock(&vfs_mutex);
+ssize_t write(int handle, char *buffer, size_t count)
+{
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
 		return EBADF;
-	}
 
-	if(memcmp(files[handle].path, "/dev/", 5) == 0)
-		return devfs_read(handle, buffer, count);
+	ssize_t status = file_write(file, buffer, count, NULL);
+	file_put(file);
+	return status;
+}
 
-	// for now
-	release_lock(&vfs_mutex);
-	return 0;
+// pread(): Reads a file at a given position, without moving the file pointer
+// Param:	int handle - file handle
+// Param:	char *buffer - buffer to read
+// Param:	size_t count - bytes to read
+// Param:	off_t position - position in the file
+// Return:	ssize_t - bytes actually read
+
+ssize_t pread(int handle, char *buffer, size_t count, off_t position)
+{
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
+		return EBADF;
+
+	ssize_t status = file_read(file, buffer, count, &position);
+	file_put(file);
+	return status;
 }
 
-// write(): Writes a file
+// pwrite(): Writes a file at a given position, without moving the file pointer
 // Param:	int handle - file handle
 // Param:	char *buffer - buffer to write
 // Param:	size_t count - bytes to write
-// Return:	size_t - bytes actually written
+// Param:	off_t position - position in the file
+// Return:	ssize_t - bytes actually written
 
-ssize_t write(int handle, char *buffer, size_t count)
+ssize_t pwrite(int handle, char *buffer, size_t count, off_t position)
 {
-	if(!count)
-		return 0;
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
+		return EBADF;
 
-	// handle the stdio stuff here to be faster
-	if(handle == STDOUT || handle == STDERR)
-	{
-		tty_write(buffer, count, get_tty());
-		return count;
-	}
+	ssize_t status = file_write(file, buffer, count, &position);
+	file_put(file);
+	return status;
+}
 
-	// can't write to the input
-	if(handle == STDIN)
-		return EIO;
+// readv(): Reads a file into several buffers
+// Param:	int handle - file handle
+// Param:	const struct iovec *iov - buffers to read into
+// Param:	int count - count of buffers
+// Return:	ssize_t - bytes actually read
 
-	// if we get here, it's probably a real file
-	acquire_lock(&vfs_mutex);
-	if(files[handle].present != 1)
-	{
-		release_lock(&vfs_mutex);
+ssize_t readv(int handle, const struct iovec *iov, int count)
+{
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
 		return EBADF;
-	}
 
-	if(memcmp(files[handle].path, "/dev/", 5) == 0)
-		return devfs_write(handle, buffer, count);
+	ssize_t status = file_readv(file, iov, count, NULL);
+	file_put(file);
+	return status;
+}
 
-	// for now
-	release_lock(&vfs_mutex);
-	return 0;
+// writev(): Writes a file from several buffers
+// Param:	int handle - file handle
+// Param:	const struct iovec *iov - buffers to write
+// Param:	int count - count of buffers
+// Return:	ssize_t - bytes actually written
+
+ssize_t writev(int handle, const struct iovec *iov, int count)
+{
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
+		return EBADF;
+
+	ssize_t status = file_writev(file, iov, count, NULL);
+	file_put(file);
+	return status;
+}
+
+// preadv(): Reads a file into several buffers, without moving the file pointer
+// Param:	int handle - file handle
+// Param:	const struct iovec *iov - buffers to read into
+// Param:	int count - count of buffers
+// Param:	off_t position - position in the file
+// Return:	ssize_t - bytes actually read
+
+ssize_t preadv(int handle, const struct iovec *iov, int count, off_t position)
+{
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
+		return EBADF;
+
+	ssize_t status = file_readv(file, iov, count, &position);
+	file_put(file);
+	return status;
+}
+
+// pwritev(): Writes a file from several buffers, without moving the file pointer
+// Param:	int handle - file handle
+// Param:	const struct iovec *iov - buffers to write
+// Param:	int count - count of buffers
+// Param:	off_t position - position in the file
+// Return:	ssize_t - bytes actually written
+
+ssize_t pwritev(int handle, const struct iovec *iov, int count, off_t position)
+{
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
+		return EBADF;
+
+	ssize_t status = file_writev(file, iov, count, &position);
+	file_put(file);
+	return status;
 }
 
 // lseek(): Moves the file pointer
@@ -279,78 +629,98 @@ ssize_t write(int handle, char *buffer, size_t count)
 
 int lseek(int handle, off_t position, int whence)
 {
-	if(files[handle].present != 1)
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
 		return EBADF;
 
+	if(file->mode & S_IFIFO)
+	{
+		file_put(file);
+		return ESPIPE;
+	}
+
 	struct stat file_info;
-	int status = fstat(handle, &file_info);
+	int status = file_stat(file, &file_info);
 	if(status != 0)
+	{
+		file_put(file);
 		return status;
+	}
 
-	acquire_lock(&vfs_mutex);
+	off_t new_position;
+	if(whence == SEEK_SET)
+		new_position = position;
+	else if(whence == SEEK_CUR)
+		new_position = file->position + position;
+	else if(whence == SEEK_END)
+		new_position = file_info.st_size - position;
+	else
+	{
+		// undefined whence here
+		file_put(file);
+		return EINVAL;
+	}
 
-	// for /dev files
-	if(memcmp(files[handle].path, "/dev/", 5) == 0)
+	// only devices can go past the end
+	if(!(file->mode & (S_IFCHR | S_IFBLK)) && new_position >= file_info.st_size)
 	{
-		if(whence == SEEK_SET)
-			files[handle].position = position;
+		file_put(file);
+		return EINVAL;
+	}
 
-		else if(whence == SEEK_CUR)
-			files[handle].position += position;
+	file->position = new_position;
+	file_put(file);
+	return new_position;
+}
 
-		else if(whence == SEEK_END)
-			files[handle].position = file_info.st_size - position;
+// link(): Makes a new name for a file
+// Param:	char *old_path - existing file
+// Param:	char *new_path - new name
+// Return:	int - status code
 
-		else
-		{
-			release_lock(&vfs_mutex);
-			return EINVAL;
-		}
+int link(char *old_path, char *new_path)
+{
+	// every filesystem we have is read-only
+	return EROFS;
+}
 
-		release_lock(&vfs_mutex);
-		return files[handle].position;
-	}
+// unlink(): Removes a name of a file
+// Param:	char *path - path of file
+// Return:	int - status code
 
-	// for other files
-	if(whence == SEEK_SET)
-	{
-		if(position >= file_info.st_size)
-		{
-			release_lock(&vfs_mutex);
-			return EINVAL;
-		}
+int unlink(char *path)
+{
+	return EROFS;
+}
 
-		files[handle].position = position;
-		release_lock(&vfs_mutex);
-		return files[handle].position;
-	} else if(whence == SEEK_CUR)
-	{
-		if((files[handle].position + position) >= file_info.st_size)
-		{
-			release_lock(&vfs_mutex);
-			return EINVAL;
-		}
+// chmod(): Changes the permissions of a file
+// Param:	const char *path - path of file
+// Param:	mode_t mode - new permissions
+// Return:	int - status code
 
-		files[handle].position += position;
-		release_lock(&vfs_mutex);
-		return files[handle].position;
-	} else if(whence == SEEK_END)
-	{
-		if((file_info.st_size - position) >= file_info.st_size)
-		{
-			release_lock(&vfs_mutex);
-			return EINVAL;
-		}
+int chmod(const char *path, mode_t mode)
+{
+	return EROFS;
+}
 
-		files[handle].position = file_info.st_size - position;
-		release_lock(&vfs_mutex);
-		return files[handle].position;
-	} else
-	{
-		// undefined whence here
-		release_lock(&vfs_mutex);
-		return EINVAL;
-	}
+// fchmod(): Changes the permissions of an open file
+// Param:	int handle - file handle
+// Param:	mode_t mode - new permissions
+// Return:	int - status code
+
+int fchmod(int handle, mode_t mode)
+{
+	return EROFS;
+}
+
+// mkdir(): Makes a directory
+// Param:	const char *path - path of directory
+// Param:	mode_t mode - permissions
+// Return:	int - status code
+
+int mkdir(const char *path, mode_t mode)
+{
+	return EROFS;
 }
 
 // stat(): Returns stat information for a file
@@ -360,73 +730,207 @@ int lseek(int handle, off_t position, int whence)
 
 int stat(const char *path, struct stat *destination)
 {
+	vnode_t *vnode;
 	int status;
 
 	acquire_lock(&vfs_mutex);
-
 	vfs_resolve_path(full_path, path);
-	if(memcmp(full_path, "/", 2) == 0)
+
+	// /dev is a table in memory already, and changes under the cache
+	if(memcmp(full_path, "/dev/", 5) == 0)
+		status = devstat(full_path + 5, destination);
+	else
 	{
-		memcpy(destination, &root_stat, sizeof(struct stat));
-		release_lock(&vfs_mutex);
-		return 0;
+		status = dcache_lookup(full_path, &vnode);
+		if(status == 0)
+			status = vnode->ops->stat(vnode, destination);
 	}
 
-	if(memcmp(full_path, "/dev", 5) == 0)
+	release_lock(&vfs_mutex);
+	return status;
+}
+
+// fstat(): Returns stat information for an open file
+// Param:	int handle - file handle
+// Param:	struct stat *destination - stat structure to store
+// Return:	int - status code
+
+int fstat(int handle, struct stat *destination)
+{
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
+		return EBADF;
+
+	int status = file_stat(file, destination);
+	file_put(file);
+	return status;
+}
+
+// mmap(): Maps a file into memory
+// Param:	void *address - address hint, or address to use with MAP_FIXED
+// Param:	size_t length - length of mapping in bytes
+// Param:	int protection - PROT_* flags
+// Param:	int flags - MAP_* flags
+// Param:	int handle - file handle
+// Param:	off_t offset - page-aligned offset in the file
+// Return:	void * - address of mapping, or error code
+
+void *mmap(void *address, size_t length, int protection, int flags, int handle, off_t offset)
+{
+	if(!length || (offset & (PAGE_SIZE-1)))
+		return (void*)(ssize_t)EINVAL;
+
+	if((flags & (MAP_SHARED | MAP_PRIVATE)) == 0 || (flags & (MAP_SHARED | MAP_PRIVATE)) == (MAP_SHARED | MAP_PRIVATE))
+		return (void*)(ssize_t)EINVAL;
+
+	// the page cache doesn't know when mapped pages are written yet
+	if(protection & PROT_WRITE)
+		return (void*)(ssize_t)EACCES;
+
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
+		return (void*)(ssize_t)EBADF;
+
+	// the filesystem gives us the physical pages of the file, and we map
+	// them as they're touched
+	file_mapping_t *mapping = kcalloc(sizeof(file_mapping_t), 1);
+	int status = file->ops->mmap ? file->ops->mmap(file, mapping) : ENODEV;
+	file_put(file);
+
+	if(status != 0)
 	{
-		memcpy(destination, &devfs_stat, sizeof(struct stat));
-		release_lock(&vfs_mutex);
-		return 0;
+		kfree(mapping);
+		return (void*)(ssize_t)status;
 	}
 
-	if(memcmp(full_path, "/dev/", 5) == 0)
+	length = (length + PAGE_SIZE - 1) & (~(PAGE_SIZE-1));
+	pid_t pid = get_pid();
+	size_t start = (size_t)address;
+
+	if(flags & MAP_FIXED)
 	{
-		status = devstat(path + 5, destination);
-		release_lock(&vfs_mutex);
-		return status;
-	}
+		if((start & (PAGE_SIZE-1)) || start < USER_BASE || start >= USER_LIMIT || length > USER_LIMIT - start)
+		{
+			kfree(mapping);
+			return (void*)(ssize_t)EINVAL;
+		}
 
-	// determine the mountpoint, to call the proper filesystem driver
-	int mountpoint = vfs_determine_mountpoint(full_path);
-	if(mountpoint < 0)
+		// anything in the way, even if it's inside the range
+		if(vma_find_range(pid, start, start + length))
+		{
+			kfree(mapping);
+			return (void*)(ssize_t)EBUSY;
+		}
+	} else
 	{
-		release_lock(&vfs_mutex);
-		return ENOENT;
+		start = vma_find_free(pid, length);
+		if(!start)
+		{
+			kfree(mapping);
+			return (void*)(ssize_t)ENOBUFS;
+		}
 	}
 
-	char *tmp_path = kmalloc(1024);
-	strcpy(tmp_path, full_path);
-	release_lock(&vfs_mutex);
+	mapping->offset = offset;
+	mapping->area.start = start;
+	mapping->area.end = start + length;
+	mapping->area.flags = PAGE_PRESENT | PAGE_USER;
+	mapping->area.fault = &vfs_mmap_fault;
+	mapping->area.data = mapping;
 
-	if(strcmp(mountpoints[mountpoint].fstype, "ustar") == 0)
-		status = ustar_stat(&mountpoints[mountpoint], tmp_path, destination);
-	else
+	vma_add(pid, &mapping->area);
+	return (void*)start;
+}
+
+// munmap(): Removes a mapping made by mmap()
+// Param:	void *address - address of mapping
+// Param:	size_t length - length of mapping in bytes
+// Return:	int - status code
+
+int munmap(void *address, size_t length)
+{
+	pid_t pid = get_pid();
+	vm_area_t *area = vma_find(pid, (size_t)address);
+
+	// only whole mappings can be removed
+	if(!area || area->fault != &vfs_mmap_fault || area->start != (size_t)address)
+		return EINVAL;
+
+	if(((length + PAGE_SIZE - 1) & (~(PAGE_SIZE-1))) != area->end - area->start)
+		return EINVAL;
+
+	vma_remove(pid, area);
+
+	// the pages belong to the filesystem or the page cache, so they're
+	// only unmapped here
+	file_mapping_t *mapping = (file_mapping_t*)area->data;
+	size_t page;
+	for(page = area->start; page < area->end; page += PAGE_SIZE)
 	{
-		kprintf("vfs: undefined filesystem type: %s\n", mountpoints[mountpoint].fstype);
-		status = ENOENT;
-	}
+		if(!(vmm_get_page(page) & PAGE_PRESENT))
+			continue;
 
-	kfree(tmp_path);
+		vmm_unmap(page, 1);
+		if(mapping->vnode)
+			pcache_unmap(mapping->vnode, (mapping->offset >> PAGE_SIZE_SHIFT) + ((page - area->start) >> PAGE_SIZE_SHIFT));
+	}
 
-	// TO-DO: Non-kernel filesystems will be added here
-	// ext2 and FAT32 are intended for the foreseeable future
-	return status;
+	kfree(area->data);
+	return 0;
 }
 
-// fstat(): Returns stat information for an open file
+// fsync(): Writes back everything written to a file and waits for it
 // Param:	int handle - file handle
-// Param:	struct stat *destination - stat structure to store
 // Return:	int - status code
 
-int fstat(int handle, struct stat *destination)
+int fsync(int handle)
 {
-	if(files[handle].present != 1)
+	file_t *file = fd_get(get_pid(), handle);
+	if(!file)
 		return EBADF;
 
-	// normal stat()
-	return stat(files[handle].path, destination);
+	int status = file->ops->fsync ? file->ops->fsync(file) : EINVAL;
+	file_put(file);
+	return status;
+}
+
+// sync(): Writes back everything that's been written to any file
+// Param:	Nothing
+// Return:	Nothing
+
+void sync()
+{
+	pcache_sync_all();
 }
 
+// vfs_mmap_fault(): Maps a page of a file mapping
+// Param:	vm_area_t *area - area of the mapping
+// Param:	size_t page - page-aligned virtual address
+// Return:	int - 0 on success
+
+int vfs_mmap_fault(vm_area_t *area, size_t page)
+{
+	file_mapping_t *mapping = (file_mapping_t*)area->data;
+	size_t index = (mapping->offset >> PAGE_SIZE_SHIFT) + ((page - area->start) >> PAGE_SIZE_SHIFT);
+
+	// past the end of the file
+	if(index >= mapping->page_count)
+		return EIO;
+
+	if(!mapping->vnode)
+	{
+		vmm_map(page, mapping->pages[index], 1, area->flags);
+		return 0;
+	}
+
+	// the mapping keeps its reference until munmap()
+	cache_page_t *cache_page = pcache_get(mapping->vnode, index);
+	if(!cache_page)
+		return EIO;
+
+	vmm_map(page, cache_page->physical, 1, area->flags);
+	return 0;
+}
 
 
 
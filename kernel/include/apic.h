@@ -16,9 +16,9 @@
 #define IRQ_BASE		0x30
 #define UNUSED_PIC_BASE		0x20
 
-// Limitations -- don't try to increase these --
-// -- because we have no xAPIC support.
-#define MAX_LAPICS		16		// # of CPUs
+// Limitations -- MAX_LAPICS also sizes the GDT, so keep it sane
+// x2APIC mode lets us go past 255 CPUs
+#define MAX_LAPICS		1024		// # of CPUs
 #define MAX_IOAPICS		16
 #define MAX_OVERRIDES		48
 
@@ -30,6 +30,7 @@
 #define MADT_ENTRY_LAPIC	0
 #define MADT_ENTRY_IOAPIC	1
 #define MADT_ENTRY_OVERRIDE	2
+#define MADT_ENTRY_X2APIC	9
 #define MADT_IRQ_ACTIVE_LOW	0x0002
 #define MADT_IRQ_LEVEL		0x0008
 
@@ -54,10 +55,39 @@
 #define LAPIC_SPURIOUS_IRQ	0x0F0
 #define LAPIC_COMMAND		0x300
 #define LAPIC_COMMAND_ID	0x310
+#define LAPIC_LVT_TIMER		0x320
 #define LAPIC_TIMER_INIT_COUNT	0x380
 #define LAPIC_TIMER_CURR_COUNT	0x390
 #define LAPIC_TIMER_DIVIDE	0x3E0
 
+// Local APIC timer, only ever used in one-shot mode
+#define LAPIC_LVT_MASK		0x00010000
+#define LAPIC_TIMER_DIVIDE_16	0x03
+#define LAPIC_TIMER_CALIBRATE	10		// ms
+
+// Local APIC Interrupt Command Register
+#define LAPIC_ICR_INIT		0x00000500
+#define LAPIC_ICR_STARTUP	0x00000600
+#define LAPIC_ICR_LOGICAL	0x00000800
+#define LAPIC_ICR_PENDING	0x00001000
+#define LAPIC_ICR_ASSERT	0x00004000
+#define LAPIC_ICR_LEVEL		0x00008000
+
+// x2APIC mode -- each xAPIC MMIO register has an MSR at 0x800 + (offset >> 4)
+#define LAPIC_BASE_X2APIC	0x400		// in MSR_APIC_BASE
+#define LAPIC_BASE_ENABLE	0x800
+#define X2APIC_MSR_BASE		0x800
+#define X2APIC_MSR_ICR		0x830		// 64-bit, destination in high half
+
+// Cross-CPU function calls
+#define SMP_CALL_VECTOR		0xF0
+
+// MSI-X from block devices, which only wake the CPU that polls them
+#define BLKDEV_VECTOR		0xE0
+
+// One-shot local APIC timer, which only wakes the CPU up too
+#define LAPIC_TIMER_VECTOR	0xE1
+
 // This can be an arbitrary number, we'll use this to represent "all CPUs"
 // but 0xFF is a good number because we're after all, it's a broadcast
 #define LAPIC_CLUSTER_ID	0xFF
@@ -82,6 +112,16 @@ typedef struct madt_lapic_t
 	uint32_t flags;
 }__attribute__((packed)) madt_lapic_t;
 
+typedef struct madt_x2apic_t
+{
+	uint8_t type;
+	uint8_t size;
+	uint16_t reserved;
+	uint32_t apic_id;
+	uint32_t flags;
+	uint32_t acpi_id;
+}__attribute__((packed)) madt_x2apic_t;
+
 typedef struct madt_ioapic_t
 {
 	uint8_t type;
@@ -105,9 +145,34 @@ typedef struct madt_override_t
 typedef struct lapic_t
 {
 	uint8_t present;
-	uint8_t apic_id;
+	uint8_t started;
+	uint32_t apic_id;
+	uint32_t logical_id;	// in x2APIC mode: cluster in high half, CPU bit in low half
 } lapic_t;
 
+// Set of CPUs, by CPU index
+#define CPUMASK_BITS		(sizeof(size_t) * 8)
+#define CPUMASK_WORDS		((MAX_LAPICS + CPUMASK_BITS - 1) / CPUMASK_BITS)
+
+typedef struct cpumask_t
+{
+	size_t bits[CPUMASK_WORDS];
+} cpumask_t;
+
+#define cpumask_set(mask, cpu)		((mask)->bits[(cpu) / CPUMASK_BITS] |= ((size_t)1 << ((cpu) % CPUMASK_BITS)))
+#define cpumask_clear(mask, cpu)	((mask)->bits[(cpu) / CPUMASK_BITS] &= ~((size_t)1 << ((cpu) % CPUMASK_BITS)))
+#define cpumask_test(mask, cpu)		(((mask)->bits[(cpu) / CPUMASK_BITS] >> ((cpu) % CPUMASK_BITS)) & 1)
+
+// A queued function call; each CPU owns one of these for each other CPU,
+// so it can't have two calls to the same CPU in flight
+typedef struct smp_call_t
+{
+	struct smp_call_t *next;
+	void (*function)(void *);
+	void *argument;
+	volatile uint8_t busy;		// set by the caller, cleared by the target
+} smp_call_t;
+
 typedef struct ioapic_t
 {
 	uint8_t present;
@@ -134,13 +199,18 @@ lapic_t *lapics;
 ioapic_t *ioapics;
 irq_override_t *overrides;
 size_t lapic_count, ioapic_count, override_count;
+size_t bsp_index;		// CPU index of the boot CPU, which isn't always 0
+size_t ap_started_count;
 
 void *lapic_base;
+uint8_t lapic_x2apic;
+uint32_t lapic_timer_frequency;		// ticks per ms, 0 if it's not calibrated
 
 void apic_init();
 void apic_parse();
 
 void apic_register_lapic(madt_lapic_t *);
+void apic_register_x2apic(madt_x2apic_t *);
 void apic_register_ioapic(madt_ioapic_t *);
 void apic_register_override(madt_override_t *);
 
@@ -153,16 +223,29 @@ uint8_t ioapic_configure(uint8_t, uint8_t);
 
 uint32_t lapic_read(size_t);
 void lapic_write(size_t, uint32_t);
-uint8_t lapic_get_id();
+uint32_t lapic_get_id();
+uint32_t lapic_read_id();
+void lapic_send_ipi(uint32_t, uint32_t);
+void lapic_send_ipi_logical(uint32_t, uint32_t);
+void lapic_detect_x2apic();
+void lapic_enable();
 void lapic_init();
 void lapic_eoi();
+void lapic_timer_calibrate();
+void lapic_timer_oneshot(uint32_t);
 extern void lapic_spurious_stub();
+extern void lapic_timer_stub();
 
 void smp_init();
 void smp_register_cpu(size_t);
 extern char trampoline16[];
 extern uint16_t trampoline16_size[];
 
+void smp_call_init();
+int smp_call_function(cpumask_t *, void (*)(void *), void *, int);
+int smp_call_function_single(size_t, void (*)(void *), void *, int);
+extern void smp_call_stub();
+
 
 
 
@@ -9,22 +9,35 @@
 #include <types.h>
 #include <boot.h>
 #include <vfs.h>
+#include <lock.h>
 
 #define MAX_BLKDEVS		256
 
 // Error codes
 #define BLKDEV_NODEV		1
 #define BLKDEV_IO		2
+#define BLKDEV_BUSY		3	// the driver can't take another request yet
 
-// Only an INITRD driver is built-in to the kernel
+// Request queues
+#define BLKDEV_QUEUE_DEPTH	32	// requests each hardware queue has at once, by default
+#define BLKDEV_MAX_SECTORS	256	// sectors in one request, by default
+#define BLKDEV_MAX_HW_QUEUES	64
+#define BLKDEV_PLUG_MAX		16	// requests a plug holds before it's flushed
+
+#define BIO_READ		0
+#define BIO_WRITE		1
+
+// INITRD, virtio and NVMe drivers are built-in to the kernel
 // ATA, AHCI and other stuff will be in external modules
 #define BLKDEV_NONE		0
 #define BLKDEV_INITRD		1
+#define BLKDEV_VIRTIO		2
+#define BLKDEV_NVME		3
 
 typedef struct blkdev_t
 {
 	uint8_t type;		// type of device as constants above
-	uint8_t reserved;
+	uint8_t hw_queues;	// submission queues the device has
 	uint16_t sector_size;
 	uint8_t data[188];	// type-specific data
 	char name[64];		// name of device
@@ -34,19 +47,138 @@ typedef struct blkdev_initrd_t
 {
 	uint16_t size;		// total size of this specific structure
 	void *base;
+	size_t physical;
 	uint32_t size_bytes;
 	uint32_t size_sectors;
 } blkdev_initrd_t;
 
+// One transfer between a range of sectors and one buffer
+typedef struct bio_t
+{
+	struct bio_t *next;		// in its request
+	dev_t device;
+	int operation;			// BIO_READ or BIO_WRITE
+	uint64_t lba;
+	uint64_t count;			// sectors, at most the queue's max_sectors
+	void *buffer;
+	void (*end)(struct bio_t *);	// owns the bio once it's called, or NULL to wait for it
+	void *private;			// belongs to whoever submitted it
+	volatile int status;
+	volatile int done;
+} bio_t;
+
+struct request_queue_t;
+struct blk_hw_queue_t;
+
+// Bios next to each other on the disk, which the driver does in one go
+typedef struct request_t
+{
+	struct request_t *next;
+	struct request_queue_t *queue;
+	struct blk_hw_queue_t *hw_queue;
+	size_t cpu;			// submitted here, and completed here
+	size_t tag;			// unique in its hardware queue while the driver has it
+	int operation;
+	uint64_t lba;
+	uint64_t count;
+	size_t segments;		// pages its buffers span
+	bio_t *bio_head;		// in order of LBA
+	bio_t *bio_tail;
+	int status;
+	void *driver_data;		// belongs to the driver while it has it
+} request_t;
+
+// What a driver does with requests
+typedef struct blkdev_ops_t
+{
+	int (*start)(struct blk_hw_queue_t *, request_t *);	// ends with blkdev_end_request(), now or later
+	int (*poll)(struct blk_hw_queue_t *);			// finishes what's done, returns how many
+	void (*commit)(struct blk_hw_queue_t *);		// tells the device about what was started, or NULL
+	void *(*direct_access)(dev_t, uint64_t, uint64_t *, size_t *);	// memory behind a byte, or NULL
+} blkdev_ops_t;
+
+// Requests submitted by one CPU to one device, waiting for its hardware queue
+typedef struct blk_sw_queue_t
+{
+	lock_t lock;			// only contended by whoever runs the hardware queue
+	request_t *head;		// oldest first
+	request_t *tail;
+	request_t * volatile completed;	// pushed to by the CPUs that complete them
+	struct blk_hw_queue_t *hw_queue;
+	size_t bio_count;		// statistics
+	size_t merge_count;		// bios that joined another request
+} blk_sw_queue_t;
+
+// One submission queue of a device, shared by a group of CPUs
+typedef struct blk_hw_queue_t
+{
+	lock_t lock;
+	struct request_queue_t *queue;
+	size_t index;
+	size_t depth;			// requests the driver can have at once
+	size_t max_depth;		// tags there are
+	request_t **tags;		// requests the driver has, by tag
+	size_t next_tag;
+	size_t in_flight;
+	size_t first_cpu;		// CPUs whose software queues feed this one
+	size_t cpu_count;
+	size_t next_cpu;		// taken from in turn
+	int running;			// one CPU starts requests at a time
+	size_t request_count;		// started by the driver
+	int wakes;			// the driver interrupts a CPU when requests finish
+	void *driver_data;
+} blk_hw_queue_t;
+
+// Everything waiting for one device
+typedef struct request_queue_t
+{
+	dev_t device;
+	const blkdev_ops_t *ops;	// NULL until a driver takes the device
+	size_t max_sectors;
+	size_t max_segments;		// pages one request can span, 0 for any
+	size_t boundary;		// bios in a request meet at a multiple of this, 0 for anywhere,
+					// set by the driver before blkdev_set_driver()
+	size_t hw_queue_count;
+	blk_hw_queue_t *hw_queues;
+	blk_sw_queue_t *sw_queues;	// by CPU index
+} request_queue_t;
+
+// Bios held back by one CPU so they can be merged before the driver sees them
+typedef struct blk_plug_t
+{
+	request_t *head;
+	request_t *tail;
+	size_t count;
+} blk_plug_t;
+
 blkdev_t *blkdevs;
 size_t blkdev_count;
+request_queue_t *blkdev_queues;
 
 void blkdev_init(multiboot_info_t *);
-dev_t blkdev_register(uint8_t, uint16_t, void *, char *);
+dev_t blkdev_register(uint8_t, uint16_t, size_t, void *, char *);
 int blkdev_read(dev_t, uint64_t, uint64_t, void *);
 int blkdev_write(dev_t, uint64_t, uint64_t, void *);
 int blkdev_read_bytes(dev_t, uint64_t, uint64_t, void *);
 int blkdev_write_bytes(dev_t, uint64_t, uint64_t, void *);
+size_t blkdev_physical(dev_t, uint64_t);
+void *blkdev_direct_access(dev_t, uint64_t, uint64_t *);
+int blkdev_readv(dev_t, uint64_t, const struct iovec *, int);
+
+void blkdev_set_driver(dev_t, const blkdev_ops_t *, size_t, size_t, size_t);
+size_t blkdev_queue_depth(dev_t);
+int blkdev_set_queue_depth(dev_t, size_t);
+void blkdev_submit(bio_t *);
+int blkdev_wait(bio_t *);
+void blkdev_end_request(request_t *, int);
+void blkdev_run_hw_queue(blk_hw_queue_t *);
+int blkdev_poll(size_t);
+int blkdev_sleep(size_t);
+void blkdev_start_plug(blk_plug_t *);
+void blkdev_finish_plug(blk_plug_t *);
+void blkdev_irq();
+
+extern void blkdev_irq_stub();
 
 
 
@@ -14,26 +14,93 @@
 #define GS_BASE			__attribute__((address_space(256)))
 #define FS_BASE			__attribute__((address_space(257)))
 
+// Model Specific Registers
+#define MSR_APIC_BASE		0x0000001B
+#define MSR_TSC_AUX		0xC0000103	// RDTSCP returns this in ECX
+
 #if __x86_64__
 
 // x86_64 Model Specific Registers
 #define MSR_FS_BASE		0xC0000100
 #define MSR_GS_BASE		0xC0000101
 #define MSR_KERNEL_GS_BASE	0xC0000102	// swapgs instruction
+#define MSR_EFER		0xC0000080
+#define MSR_STAR		0xC0000081	// SYSCALL/SYSRET segments
+#define MSR_LSTAR		0xC0000082	// 64-bit SYSCALL entry point
+#define MSR_SFMASK		0xC0000084	// RFLAGS bits SYSCALL clears
+
+#define EFER_SCE		0x00000001	// SYSCALL enable
+
+#endif
+
+#if __i386__
+
+// i386 Model Specific Registers
+#define MSR_SYSENTER_CS		0x00000174
+#define MSR_SYSENTER_ESP	0x00000175
+#define MSR_SYSENTER_EIP	0x00000176
 
 #endif
 
+// CPUID Feature Flags, leaf 1
+#define CPUID_EDX_HTT		0x10000000
+#define CPUID_ECX_X2APIC	0x00200000
+
+// CPUID Extended Feature Flags, leaf 0x80000001
+#define CPUID_EXTENDED		0x80000001
+#define CPUID_EXT_EDX_RDTSCP	0x08000000
+
+// CPUID Topology Leaves
+#define CPUID_CACHE		0x04
+#define CPUID_TOPOLOGY		0x0B
+#define CPUID_TOPOLOGY_V2	0x1F
+
+#define CPUID_LEVEL_INVALID	0
+#define CPUID_LEVEL_SMT		1
+#define CPUID_LEVEL_CORE	2
+
 typedef struct cpu_t
 {
 	size_t index;
-	void *stack;
+	void *stack;			// also the system call stack
+	size_t user_stack;		// x86_64 SYSCALL saves the user stack here
+
+	// the three fields above are used from assembly, keep them first
 	uint64_t timestamp;
 	uint32_t spurious_count;	// count of local APIC spurious IRQs
 	size_t process_count;
 	pid_t current_pid;
 	uint8_t tasking_enabled;
+
+	// cross-CPU function calls
+	struct smp_call_t * volatile call_queue;	// pushed to by other CPUs
+	struct smp_call_t *call_nodes;			// one for each target CPU
+	size_t call_count;				// calls sent by this CPU
+	size_t ipi_count;				// IPIs that carried them
+
+	// topology, from CPUID -- CPUs sharing something have the same ID
+	uint32_t apic_id;
+	uint32_t smt_id;		// thread within the core
+	uint32_t core_id;		// core within the package
+	uint32_t package_id;
+	uint32_t l2_id;
+	uint32_t llc_id;		// last level cache
+	uint32_t numa_node;		// memory allocations prefer this node
+
+	struct blk_plug_t *plug;	// bios this CPU is holding back, or NULL
+	volatile int blkdev_irq;	// a block device interrupted since the last poll
 } cpu_t;
 
+cpu_t **cpus;		// indexed by CPU index, NULL until the CPU starts
+
+typedef struct cpuid_t
+{
+	uint32_t eax;
+	uint32_t ebx;
+	uint32_t ecx;
+	uint32_t edx;
+} cpuid_t;
+
 #if __i386__
 extern void write_cr0(uint32_t);
 extern void write_cr3(uint32_t);
@@ -44,6 +111,9 @@ extern uint32_t read_cr2();
 extern uint32_t read_cr3();
 extern uint32_t read_cr4();
 extern void load_fs(uint16_t);
+
+extern void write_msr(uint32_t, uint64_t);
+extern uint64_t read_msr(uint32_t);
 #endif
 
 #if __x86_64__
@@ -61,6 +131,7 @@ extern uint64_t read_msr(uint32_t);
 #endif
 
 extern void flush_tlb(size_t, size_t);
+extern void read_cpuid(uint32_t, uint32_t, cpuid_t *);
 
 
 
@@ -0,0 +1,33 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+#include <vfs.h>
+
+#define DENTRY_NAME_SIZE		64		// longer names aren't cached
+#define DCACHE_SIZE			2048		// dentries, not counting the root
+#define DCACHE_BUCKETS			1024		// power of two
+
+// One component of a path that's been looked up, found or not
+typedef struct dentry_t
+{
+	struct dentry_t *hash_next;	// also the free list
+	struct dentry_t *lru_prev;
+	struct dentry_t *lru_next;
+	struct dentry_t *parent;
+	uint32_t hash;
+	size_t children;		// cached dentries under this one
+	int status;			// 0, or the error of a name that isn't there
+	char name[DENTRY_NAME_SIZE];
+	vnode_t *vnode;			// NULL if the name isn't there
+} dentry_t;
+
+void dcache_init();
+int dcache_lookup(char *, vnode_t **);
+void dcache_invalidate();
+
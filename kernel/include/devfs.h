@@ -8,23 +8,32 @@
 
 #include <vfs.h>
 #include <time.h>
+#include <epoll.h>
 
 #define MAX_DEVFS_ENTRIES		512
 #define DEVFS_MODE			(S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH)
 
+// Each device has its own handlers, found once when it's opened
 typedef struct devfs_entry_t
 {
 	char name[48];
 	struct stat information;
+	poll_list_t poll;		// epoll instances watching this
+	uint32_t events;		// from devfs_poll(), which never change yet
+	dev_t device;			// block devices
+	size_t minor;			// terminals
+	void *memory;			// memory-backed devices, like the framebuffer
+	size_t memory_size;
+	ssize_t (*read)(struct devfs_entry_t *, char *, size_t, off_t *);
+	ssize_t (*write)(struct devfs_entry_t *, char *, size_t, off_t *);
 } devfs_entry_t;
 
 struct stat devfs_stat;
+vnode_t devfs_vnode;		// /dev itself
 
 void devfs_init();
-void devfs_make_entry(char *, mode_t);
+devfs_entry_t *devfs_make_entry(char *, mode_t);
+devfs_entry_t *devfs_find(const char *);
 int devstat(const char *, struct stat *);
-ssize_t devfs_read(int, char *, size_t);
-ssize_t devfs_write(int, char *, size_t);
-
-
+int devfs_open(const char *, int, file_t **);
 
@@ -0,0 +1,133 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+#include <lock.h>
+#include <mm.h>
+
+#define ELF_MAGIC			0x464C457F	// "\x7FELF"
+
+#define ELF_CLASS_32			1
+#define ELF_CLASS_64			2
+#define ELF_DATA_LSB			1
+
+#define ELF_TYPE_EXEC			2
+#define ELF_TYPE_DYN			3		// position independent
+
+#define ELF_MACHINE_386			3
+#define ELF_MACHINE_X86_64		62
+
+#define ELF_SEGMENT_LOAD		1
+
+#define ELF_SEGMENT_EXECUTE		0x01
+#define ELF_SEGMENT_WRITE		0x02
+#define ELF_SEGMENT_READ		0x04
+
+#define ELF_MAX_SEGMENTS		16
+
+// elf_load() flags
+#define ELF_PREFAULT			0x01		// map everything now, for small binaries
+
+typedef struct elf32_header_t
+{
+	uint32_t magic;
+	uint8_t class;
+	uint8_t data;
+	uint8_t ident_version;
+	uint8_t abi;
+	uint8_t ident_reserved[8];
+
+	uint16_t type;
+	uint16_t machine;
+	uint32_t version;
+	uint32_t entry;
+	uint32_t program_offset;
+	uint32_t section_offset;
+	uint32_t flags;
+	uint16_t header_size;
+	uint16_t program_size;
+	uint16_t program_count;
+	uint16_t section_size;
+	uint16_t section_count;
+	uint16_t string_section;
+}__attribute__((packed)) elf32_header_t;
+
+typedef struct elf64_header_t
+{
+	uint32_t magic;
+	uint8_t class;
+	uint8_t data;
+	uint8_t ident_version;
+	uint8_t abi;
+	uint8_t ident_reserved[8];
+
+	uint16_t type;
+	uint16_t machine;
+	uint32_t version;
+	uint64_t entry;
+	uint64_t program_offset;
+	uint64_t section_offset;
+	uint32_t flags;
+	uint16_t header_size;
+	uint16_t program_size;
+	uint16_t program_count;
+	uint16_t section_size;
+	uint16_t section_count;
+	uint16_t string_section;
+}__attribute__((packed)) elf64_header_t;
+
+typedef struct elf32_program_t
+{
+	uint32_t type;
+	uint32_t offset;
+	uint32_t virtual;
+	uint32_t physical;
+	uint32_t file_size;
+	uint32_t memory_size;
+	uint32_t flags;
+	uint32_t alignment;
+}__attribute__((packed)) elf32_program_t;
+
+typedef struct elf64_program_t
+{
+	uint32_t type;
+	uint32_t flags;
+	uint64_t offset;
+	uint64_t virtual;
+	uint64_t physical;
+	uint64_t file_size;
+	uint64_t memory_size;
+	uint64_t alignment;
+}__attribute__((packed)) elf64_program_t;
+
+// One binary, shared by everything running it
+typedef struct elf_image_t
+{
+	struct elf_image_t *next;
+	char *path;
+	struct file_t *file;
+	size_t references;
+	size_t *pages;			// read-only pages by file page, 0 until loaded
+	size_t page_count;
+	lock_t lock;
+} elf_image_t;
+
+// One PT_LOAD segment of a process
+typedef struct elf_segment_t
+{
+	vm_area_t area;
+	elf_image_t *image;
+	size_t start;			// virtual address, not page-aligned
+	uint64_t offset;		// in the file
+	uint64_t file_size;
+	uint8_t shared;			// pages come from the image
+} elf_segment_t;
+
+int elf_load(pid_t, const char *, int, size_t *);
+void elf_unload(pid_t);
+
@@ -0,0 +1,83 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+#include <lock.h>
+#include <vfs.h>
+
+// Events
+#define EPOLLIN				0x00000001
+#define EPOLLOUT			0x00000004
+#define EPOLLERR			0x00000008
+#define EPOLLHUP			0x00000010
+#define EPOLLONESHOT			0x40000000
+#define EPOLLET				0x80000000
+
+// these are always reported, even if nobody asked
+#define EPOLL_ALWAYS			(EPOLLERR | EPOLLHUP)
+
+// epoll_ctl() operations
+#define EPOLL_CTL_ADD			1
+#define EPOLL_CTL_DEL			2
+#define EPOLL_CTL_MOD			3
+
+typedef union epoll_data_t
+{
+	void *ptr;
+	int fd;
+	uint32_t u32;
+	uint64_t u64;
+} epoll_data_t;
+
+struct epoll_event
+{
+	uint32_t events;
+	epoll_data_t data;
+}__attribute__((packed));
+
+// One watched file of an epoll instance
+typedef struct epoll_item_t
+{
+	struct epoll_item_t *next;		// interest list
+	struct epoll_item_t *ready_next;	// ready list
+	struct epoll_item_t *watch_next;	// watch list of the file
+	struct epoll_t *epoll;
+	struct poll_list_t *source;		// NULL once the file is gone
+	int handle;
+	const file_ops_t *ops;			// polls the node, which outlives
+	void *node;				// the descriptor until the source
+	int flags;				// says it's gone
+	uint32_t events;			// interest
+	uint32_t pending;			// pushed but not delivered yet
+	uint8_t ready;				// on the ready list
+	epoll_data_t data;
+} epoll_item_t;
+
+typedef struct epoll_t
+{
+	epoll_item_t *items;
+	epoll_item_t *ready;
+	epoll_item_t *ready_tail;
+	lock_t lock;
+} epoll_t;
+
+// Everything watching one file; drivers keep one of these for each file that
+// can be waited on, and push events to it with poll_notify()
+typedef struct poll_list_t
+{
+	epoll_item_t *items;
+	lock_t lock;
+} poll_list_t;
+
+int epoll_create(int);
+int epoll_ctl(int, int, int, struct epoll_event *);
+int epoll_wait(int, struct epoll_event *, int, int);
+void epoll_destroy(epoll_t *);
+void poll_notify(poll_list_t *, uint32_t);
+void poll_release(poll_list_t *);
+
@@ -14,14 +14,24 @@
 #define GDT_ENTRIES			(5 + MAX_LAPICS + MAX_LAPICS)
 #define GDT_CPU_INFO			5		// starting at index 5
 #define GDT_TSS				(GDT_CPU_INFO + MAX_LAPICS)
+
+// SYSENTER takes the kernel segments from here, and SYSEXIT the user segments
+// from 16 and 24 bytes past it
+#define GDT_KERNEL_CODE			0x08
 #endif
 
 #if __x86_64__
-// NULL, KCODE32, KDATA32, KCODE64, KDATA64, UCODE64, UDATA64, UCODE32, UDATA32 + one TSS for each CPU
+// NULL, KCODE32, KDATA32, KCODE64, KDATA64, UCODE32, UDATA32, UCODE64, UDATA64 + one TSS for each CPU
 // in 64-bit long mode, we don't need a segment for each AP because we can use
 // MSR_FS_BASE for CPU-specific information
 #define GDT_ENTRIES			(9 + MAX_LAPICS + MAX_LAPICS)	// each TSS takes two entries in long mode
 #define GDT_TSS				9
+
+// SYSCALL loads CS and SS from GDT_KERNEL_CODE and the next entry, and SYSRET
+// loads SS from 8 bytes and 64-bit CS from 16 bytes past GDT_USER_CODE32,
+// which is why the user segments are in that order
+#define GDT_KERNEL_CODE			0x18
+#define GDT_USER_CODE32			0x28
 #endif
 
 // GDT Access Byte
@@ -15,6 +15,7 @@
 void initrd_init(multiboot_info_t *);
 int initrd_read(blkdev_t *, uint64_t, uint64_t, void *);
 int initrd_write(blkdev_t *, uint64_t, uint64_t, void *);
+void *initrd_direct_access(dev_t, uint64_t, uint64_t *, size_t *);
 
 
 
@@ -0,0 +1,112 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+#include <lock.h>
+#include <vfs.h>
+
+#define MAX_IORINGS			64
+#define IORING_MAX_ENTRIES		4096		// power of two
+
+// Operations
+#define IORING_OP_NOP			0
+#define IORING_OP_READ			1
+#define IORING_OP_WRITE			2
+#define IORING_OP_STAT			3
+#define IORING_OP_FSTAT			4
+
+// offset of reads and writes that use the file pointer instead
+#define IORING_OFFSET_CURRENT		0xFFFFFFFFFFFFFFFF
+
+// ioring_setup() flags
+#define IORING_SETUP_POLL		0x01		// a CPU polls the submission ring
+
+// ioring_enter() flags
+#define IORING_ENTER_GETEVENTS		0x01		// wait for min_complete completions
+#define IORING_ENTER_SQ_WAKEUP		0x02		// wake up the polling CPU
+
+// Shared flags
+#define IORING_SQ_NEED_WAKEUP		0x01		// the polling CPU is asleep
+
+// ioring_poll_cpu before there is one
+#define IORING_NO_POLL_CPU		((size_t)-1)
+
+// spins of an idle polling CPU before it halts
+#define IORING_POLL_SPINS		100000
+
+// Submission queue entry
+typedef struct ioring_sqe_t
+{
+	uint8_t opcode;
+	uint8_t flags;			// none yet
+	uint16_t reserved;
+	int32_t handle;
+	uint64_t offset;		// or IORING_OFFSET_CURRENT
+	uint64_t buffer;		// data, or struct stat
+	uint64_t path;			// for IORING_OP_STAT
+	uint32_t length;
+	uint32_t reserved2;
+	uint64_t user_data;		// copied to the completion
+}__attribute__((packed)) ioring_sqe_t;
+
+// Completion queue entry
+typedef struct ioring_cqe_t
+{
+	uint64_t user_data;
+	int64_t result;			// same as the function would return
+}__attribute__((packed)) ioring_cqe_t;
+
+// Start of the memory shared with user space; the entries follow it
+typedef struct ioring_shared_t
+{
+	volatile uint32_t sq_head;	// written by the kernel
+	volatile uint32_t sq_tail;	// written by user space
+	volatile uint32_t cq_head;	// written by user space
+	volatile uint32_t cq_tail;	// written by the kernel
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	volatile uint32_t flags;
+	uint32_t reserved;
+	uint32_t sq_offset;		// in bytes from the start of this structure
+	uint32_t cq_offset;
+} ioring_shared_t;
+
+typedef struct ioring_params_t
+{
+	uint32_t flags;			// IORING_SETUP_*, cleared if not available
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	uint32_t reserved;
+	void *ring;			// ioring_shared_t
+	size_t size;			// in bytes
+} ioring_params_t;
+
+typedef struct ioring_t
+{
+	uint8_t present;
+	uint8_t flags;
+	pid_t pid;
+	ioring_shared_t *shared;
+	ioring_sqe_t *sq;
+	ioring_cqe_t *cq;
+	size_t pages;
+	lock_t lock;
+	uint8_t closing;		// ioring_destroy() is waiting for users
+	volatile uint32_t users;	// ioring_enter() calls using the shared pages
+} ioring_t;
+
+ioring_t *iorings;
+
+void ioring_init();
+int ioring_setup(uint32_t, ioring_params_t *);
+int ioring_enter(int, uint32_t, uint32_t, uint32_t);
+int ioring_destroy(int);
+void ioring_complete(ioring_t *, uint64_t, ssize_t);
+int ioring_poll(size_t);
+int ioring_sleep(size_t);
+
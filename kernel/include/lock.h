@@ -10,6 +10,12 @@
 
 typedef volatile uint32_t lock_t;
 
+// Atomic primitives for lock-free code, these are full barriers
+#define atomic_cmpxchg(ptr, old, new)	__sync_val_compare_and_swap(ptr, old, new)
+#define atomic_xchg(ptr, value)		__sync_lock_test_and_set(ptr, value)
+#define atomic_add(ptr, value)		__sync_fetch_and_add(ptr, value)
+#define memory_barrier()		__sync_synchronize()
+
 void acquire_lock(lock_t *);
 void release_lock(lock_t *);
 
@@ -31,6 +31,9 @@
 #define HW_FRAMEBUFFER			0xF0000000
 #define SW_FRAMEBUFFER			0xF4000000
 #define HEAP_ALIGNMENT			16		// SSE-aligned
+#define VDSO_BASE			0xD7FFA000	// just below the heap
+#define USER_BASE			0x40000000	// 1 GB
+#define USER_LIMIT			0xD0000000
 #endif
 
 #if __x86_64__
@@ -39,11 +42,31 @@
 #define HW_FRAMEBUFFER			0x8080000000	// 514 GB
 #define SW_FRAMEBUFFER			0x8084000000	// after HW framebuffer
 #define HEAP_ALIGNMENT			32		// 64-bit might use AVX, so do AVX alignment
+#define VDSO_BASE			0x807FFFA000	// just below HW framebuffer
+#define USER_BASE			0x18000000000	// 1536 GB, after physical memory
+#define USER_LIMIT			0x20000000000	// 2048 GB
 #endif
 
+// Page fault error code
+#define PAGE_FAULT_PRESENT		0x01		// protection violation
+#define PAGE_FAULT_WRITE		0x02
+#define PAGE_FAULT_USER			0x04
+
+// A range of virtual memory that's filled in when it's first touched
+typedef struct vm_area_t
+{
+	struct vm_area_t *next;
+	size_t start;			// page-aligned
+	size_t end;			// page-aligned, exclusive
+	uint8_t flags;			// page flags of the pages once they're mapped
+	int (*fault)(struct vm_area_t *, size_t);	// maps one page, 0 on success
+	void *data;			// belongs to whoever made the area
+} vm_area_t;
+
 extern uint64_t total_memory, usable_memory;
 extern uint8_t *pmm_bitmap;
 extern size_t total_pages, used_pages, reserved_pages;
+extern size_t highest_usable_address;
 
 // Generic Functions
 void *kmalloc(size_t);
@@ -59,6 +82,7 @@ void pmm_mark_used(size_t, size_t);
 void pmm_mark_free(size_t, size_t);
 uint8_t pmm_is_page_free(size_t);
 size_t pmm_find_range(size_t);
+size_t pmm_find_range_in(size_t, size_t, size_t);
 size_t pmm_alloc(size_t);
 
 // Virtual Memory Manager
@@ -72,5 +96,13 @@ size_t vmm_alloc(size_t, size_t, uint8_t);
 void vmm_free(size_t, size_t);
 size_t vmm_request_map(size_t, size_t, uint8_t);
 
+// Demand Paging
+void vma_add(pid_t, vm_area_t *);
+void vma_remove(pid_t, vm_area_t *);
+vm_area_t *vma_find(pid_t, size_t);
+vm_area_t *vma_find_range(pid_t, size_t, size_t);
+size_t vma_find_free(pid_t, size_t);
+int vmm_page_fault(size_t);
+
 
 
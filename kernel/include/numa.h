@@ -0,0 +1,108 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <acpi.h>
+
+#define MAX_NUMA_NODES		64
+#define MAX_NUMA_ZONES		128
+#define MAX_NUMA_CPUS		1024		// same as MAX_LAPICS
+#define NUMA_NO_NODE		0xFFFFFFFF
+
+// distances when there is no SLIT, same as the spec's defaults
+#define NUMA_LOCAL_DISTANCE	10
+#define NUMA_REMOTE_DISTANCE	20
+
+// ACPI SRAT Table Fields
+#define SRAT_ENTRY_CPU		0
+#define SRAT_ENTRY_MEMORY	1
+#define SRAT_ENTRY_X2APIC	2
+#define SRAT_ENABLED		0x0001
+
+typedef struct acpi_srat_t
+{
+	acpi_header_t header;
+	uint32_t reserved1;
+	uint64_t reserved2;
+
+	uint8_t records[];
+}__attribute__((packed)) acpi_srat_t;
+
+typedef struct srat_cpu_t
+{
+	uint8_t type;
+	uint8_t size;
+	uint8_t domain_low;
+	uint8_t apic_id;
+	uint32_t flags;
+	uint8_t sapic_eid;
+	uint8_t domain_high[3];
+	uint32_t clock_domain;
+}__attribute__((packed)) srat_cpu_t;
+
+typedef struct srat_memory_t
+{
+	uint8_t type;
+	uint8_t size;
+	uint32_t domain;
+	uint16_t reserved1;
+	uint64_t base;
+	uint64_t length;
+	uint32_t reserved2;
+	uint32_t flags;
+	uint64_t reserved3;
+}__attribute__((packed)) srat_memory_t;
+
+typedef struct srat_x2apic_t
+{
+	uint8_t type;
+	uint8_t size;
+	uint16_t reserved1;
+	uint32_t domain;
+	uint32_t apic_id;
+	uint32_t flags;
+	uint32_t clock_domain;
+	uint32_t reserved2;
+}__attribute__((packed)) srat_x2apic_t;
+
+typedef struct acpi_slit_t
+{
+	acpi_header_t header;
+	uint64_t localities;
+	uint8_t distances[];		// localities * localities
+}__attribute__((packed)) acpi_slit_t;
+
+typedef struct numa_node_t
+{
+	uint32_t domain;		// ACPI proximity domain
+	size_t total_pages;
+	size_t used_pages;
+} numa_node_t;
+
+typedef struct numa_zone_t
+{
+	uint64_t base;
+	uint64_t end;
+	uint32_t node;
+} numa_zone_t;
+
+typedef struct numa_cpu_t
+{
+	uint32_t apic_id;
+	uint32_t node;
+} numa_cpu_t;
+
+numa_node_t *numa_nodes;
+size_t numa_node_count;
+
+void numa_init();
+uint32_t numa_cpu_node(uint32_t);
+uint32_t numa_current_node();
+uint8_t numa_distance(uint32_t, uint32_t);
+void numa_account(size_t, int);
+size_t numa_find_range(size_t);
+
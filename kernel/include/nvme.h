@@ -0,0 +1,159 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+#include <pci.h>
+#include <lock.h>
+
+// PCI class of NVMe controllers
+#define NVME_CLASS			0x01
+#define NVME_SUBCLASS			0x08
+#define NVME_PROG_IF			0x02
+
+#define MAX_NVME			16
+
+// Controller registers
+#define NVME_CAP			0x00
+#define NVME_VS				0x08
+#define NVME_INTMS			0x0C
+#define NVME_INTMC			0x10
+#define NVME_CC				0x14
+#define NVME_CSTS			0x1C
+#define NVME_AQA			0x24
+#define NVME_ASQ			0x28
+#define NVME_ACQ			0x30
+#define NVME_DOORBELLS			0x1000
+
+#define NVME_CAP_MQES(cap)		((cap) & 0xFFFF)		// zero-based
+#define NVME_CAP_TO(cap)		(((cap) >> 24) & 0xFF)		// in 500 ms units
+#define NVME_CAP_DSTRD(cap)		(((cap) >> 32) & 0x0F)
+#define NVME_CAP_MPSMIN(cap)		(((cap) >> 48) & 0x0F)
+
+#define NVME_CC_ENABLE			0x00000001
+#define NVME_CC_IOSQES			(6 << 16)	// 64-byte entries
+#define NVME_CC_IOCQES			(4 << 20)	// 16-byte entries
+
+#define NVME_CSTS_READY			0x00000001
+#define NVME_CSTS_FATAL			0x00000002
+
+// Queues
+#define NVME_ADMIN_QUEUE_SIZE		32
+#define NVME_QUEUE_SIZE			64		// a page of submission entries
+#define NVME_MAX_SEGMENTS		256		// a page of SGL descriptors
+#define NVME_ADMIN_TIMEOUT		5000		// ms
+
+// Admin commands
+#define NVME_ADMIN_CREATE_SQ		0x01
+#define NVME_ADMIN_CREATE_CQ		0x05
+#define NVME_ADMIN_IDENTIFY		0x06
+#define NVME_ADMIN_SET_FEATURES		0x09
+
+#define NVME_IDENTIFY_NAMESPACE		0x00
+#define NVME_IDENTIFY_CONTROLLER	0x01
+#define NVME_FEATURE_QUEUES		0x07
+
+#define NVME_QUEUE_CONTIGUOUS		0x0001
+#define NVME_QUEUE_INTERRUPTS		0x0002
+
+// I/O commands
+#define NVME_CMD_WRITE			0x01
+#define NVME_CMD_READ			0x02
+
+#define NVME_PSDT_SGL			(1 << 14)	// data pointer is an SGL
+
+// SGL descriptor types
+#define NVME_SGL_DATA			0x00
+#define NVME_SGL_LAST_SEGMENT		0x30
+
+// Identify data
+#define NVME_ID_MDTS			77
+#define NVME_ID_NN			516
+#define NVME_ID_SGLS			536
+#define NVME_ID_NSZE			0
+#define NVME_ID_FLBAS			26
+#define NVME_ID_LBAF			128
+
+typedef struct nvme_command_t
+{
+	uint32_t cdw0;			// opcode, and the command ID in the high word
+	uint32_t nsid;
+	uint64_t reserved;
+	uint64_t metadata;
+	uint64_t prp1;			// or the first 8 bytes of an SGL descriptor
+	uint64_t prp2;
+	uint32_t cdw10;
+	uint32_t cdw11;
+	uint32_t cdw12;
+	uint32_t cdw13;
+	uint32_t cdw14;
+	uint32_t cdw15;
+}__attribute__((packed)) nvme_command_t;
+
+typedef struct nvme_completion_t
+{
+	uint32_t result;
+	uint32_t reserved;
+	uint16_t sq_head;
+	uint16_t sq_id;
+	uint16_t id;
+	uint16_t status;		// phase in the lowest bit
+}__attribute__((packed)) nvme_completion_t;
+
+typedef struct nvme_sgl_t
+{
+	uint64_t address;
+	uint32_t length;
+	uint8_t reserved[3];
+	uint8_t type;
+}__attribute__((packed)) nvme_sgl_t;
+
+// A submission and completion queue pair, which is one hardware queue of
+// the block layer
+typedef struct nvme_queue_t
+{
+	size_t id;
+	size_t size;
+	nvme_command_t *sq;
+	volatile nvme_completion_t *cq;
+	volatile uint32_t *sq_doorbell;
+	volatile uint32_t *cq_doorbell;
+	uint16_t sq_tail;		// only changed by whoever starts requests
+	uint16_t sq_committed;		// what the device was last told
+	uint16_t cq_head;		// only changed by whoever is polling
+	uint16_t phase;
+	lock_t polling;
+	uint8_t *lists;			// a page of PRPs or SGL descriptors for each tag
+	size_t lists_physical;
+} nvme_queue_t;
+
+typedef struct nvme_t
+{
+	pci_device_t *pci;
+	volatile uint8_t *regs;
+	volatile uint8_t *doorbells;
+	size_t doorbell_stride;
+	nvme_queue_t admin;
+	uint16_t admin_id;
+	uint32_t namespace;
+	uint64_t sectors;
+	size_t sector_size;
+	size_t max_sectors;
+	int sgl;			// the controller takes SGLs as well as PRPs
+	size_t queue_count;
+	nvme_queue_t *queues;
+} nvme_t;
+
+// block device information
+typedef struct blkdev_nvme_t
+{
+	uint16_t size;
+	nvme_t *nvme;
+} blkdev_nvme_t;
+
+void nvme_init();
+
@@ -0,0 +1,82 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+#include <vfs.h>
+#include <lock.h>
+
+#if __i386__
+#define PCACHE_RADIX_SHIFT		10		// a page of pointers for each node
+#endif
+
+#if __x86_64__
+#define PCACHE_RADIX_SHIFT		9
+#endif
+
+#define PCACHE_RADIX_SLOTS		(1 << PCACHE_RADIX_SHIFT)
+#define PCACHE_RADIX_MASK		(PCACHE_RADIX_SLOTS - 1)
+
+#define PCACHE_READAHEAD_MIN		4		// pages
+#define PCACHE_READAHEAD_MAX		128
+#define PCACHE_MEMORY_FRACTION		4		// at most this much of memory
+
+// Writeback
+#define PCACHE_DIRTY_EXPIRE		5000		// ms a page can stay dirty
+#define PCACHE_DIRTY_BACKGROUND		10		// % of the cache, flushed whatever their age
+#define PCACHE_DIRTY_RATIO		20		// % of the cache, writers flush themselves
+#define PCACHE_FLUSH_BATCH		256		// pages written back in one go
+#define PCACHE_NO_FLUSH_CPU		((size_t)-1)	// pcache_flush_cpu before there is one
+
+// Page flags
+#define PCACHE_UPTODATE			0x01		// read from the filesystem
+#define PCACHE_ERROR			0x02		// couldn't be read
+#define PCACHE_DIRTY			0x04		// written, but not written back
+#define PCACHE_WRITEBACK		0x08		// being written back
+
+// One page of a file in memory, shared by read() and every mapping of it
+typedef struct cache_page_t
+{
+	struct cache_page_t *lru_prev;
+	struct cache_page_t *lru_next;
+	struct cache_page_t *dirty_prev;
+	struct cache_page_t *dirty_next;
+	vnode_t *vnode;
+	size_t index;			// in pages, in the file
+	uint8_t *data;			// page-aligned
+	size_t physical;
+	volatile size_t references;	// readers and mappings, which can't lose it
+	volatile uint8_t flags;
+	uint64_t dirtied;		// global_uptime when it became dirty
+} cache_page_t;
+
+// Dirty pages of one block device, oldest first, written back by whichever
+// idle CPU gets to them
+typedef struct writeback_t
+{
+	cache_page_t *dirty_head;
+	cache_page_t *dirty_tail;
+	size_t dirty_count;
+	lock_t flushing;		// one CPU flushes each device at a time
+} writeback_t;
+
+size_t pcache_dirty_count;
+
+void pcache_init();
+cache_page_t *pcache_get(vnode_t *, size_t);
+void pcache_put(cache_page_t *);
+void pcache_unmap(vnode_t *, size_t);
+ssize_t pcache_readv(file_t *, const struct iovec *, int, off_t);
+ssize_t pcache_writev(file_t *, const struct iovec *, int, off_t);
+void pcache_fill(vnode_t *, size_t, size_t);
+size_t pcache_reclaim(size_t);
+int pcache_sync(vnode_t *, size_t, size_t);
+size_t pcache_flush(dev_t, size_t, int);
+void pcache_sync_all();
+int pcache_flush_poll(size_t);
+int pcache_sleep(size_t);
+
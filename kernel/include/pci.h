@@ -0,0 +1,86 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+
+#define MAX_PCI_DEVICES			256
+
+// Configuration mechanism #1
+#define PCI_CONFIG_ADDRESS		0xCF8
+#define PCI_CONFIG_DATA			0xCFC
+
+// Configuration space
+#define PCI_VENDOR			0x00
+#define PCI_DEVICE_ID			0x02
+#define PCI_COMMAND			0x04
+#define PCI_STATUS			0x06
+#define PCI_PROG_IF			0x09
+#define PCI_SUBCLASS			0x0A
+#define PCI_CLASS			0x0B
+#define PCI_HEADER_TYPE			0x0E
+#define PCI_BAR0			0x10
+#define PCI_CAPABILITIES		0x34
+#define PCI_INTERRUPT_LINE		0x3C
+
+#define PCI_COMMAND_IO			0x0001
+#define PCI_COMMAND_MMIO		0x0002
+#define PCI_COMMAND_MASTER		0x0004
+#define PCI_COMMAND_INTX_DISABLE	0x0400
+
+#define PCI_STATUS_CAPABILITIES		0x0010
+#define PCI_HEADER_MULTIFUNCTION	0x80
+
+#define PCI_BAR_IO			0x01
+#define PCI_BAR_64			0x04
+
+// Capabilities
+#define PCI_CAP_VENDOR			0x09
+#define PCI_CAP_MSIX			0x11
+
+// MSI-X
+#define PCI_MSIX_CONTROL		0x02		// from the capability
+#define PCI_MSIX_TABLE			0x04
+#define PCI_MSIX_ENABLE			0x8000
+#define PCI_MSIX_FUNCTION_MASK		0x4000
+#define PCI_MSIX_ENTRY_MASKED		0x00000001
+#define PCI_MSI_ADDRESS			0xFEE00000
+
+typedef struct pci_device_t
+{
+	uint8_t bus;
+	uint8_t slot;
+	uint8_t function;
+	uint8_t irq;
+	uint16_t vendor;
+	uint16_t device;
+	uint8_t class;
+	uint8_t subclass;
+	uint8_t prog_if;
+	uint8_t msix;			// offset of the MSI-X capability, 0 if there's none
+	uint16_t msix_count;		// entries in the MSI-X table
+	volatile uint32_t *msix_table;	// NULL until MSI-X is enabled
+} pci_device_t;
+
+pci_device_t *pci_devices;
+size_t pci_device_count;
+
+void pci_init();
+uint32_t pci_read(pci_device_t *, uint8_t);
+void pci_write(pci_device_t *, uint8_t, uint32_t);
+uint16_t pci_read16(pci_device_t *, uint8_t);
+uint8_t pci_read8(pci_device_t *, uint8_t);
+void pci_write16(pci_device_t *, uint8_t, uint16_t);
+pci_device_t *pci_find(uint16_t, uint16_t, size_t);
+pci_device_t *pci_find_class(uint8_t, uint8_t, uint8_t, size_t);
+uint8_t pci_find_capability(pci_device_t *, uint8_t, uint8_t);
+uint64_t pci_bar(pci_device_t *, int);
+void *pci_map(pci_device_t *, int, size_t, size_t);
+void pci_enable(pci_device_t *);
+int pci_msix_enable(pci_device_t *);
+int pci_msix_route(pci_device_t *, size_t, uint8_t, size_t);
+
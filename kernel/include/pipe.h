@@ -0,0 +1,49 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+#include <lock.h>
+#include <vfs.h>
+#include <epoll.h>
+
+#define PIPE_SIZE			0x10000		// 16 pages, power of two
+#define PIPE_BUF			4096		// writes this small are never split
+
+// Events passed to pipe_wake()
+#define PIPE_READABLE			0x01
+#define PIPE_WRITABLE			0x02
+
+// A ring of pages. The reader only ever moves head and the writer only ever
+// moves tail, and each side's lock makes sure there's only one of each.
+typedef struct pipe_t
+{
+	struct pipe_t *next;		// named FIFOs only
+	char *path;			// NULL for anonymous pipes
+	uint8_t *buffer;
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	volatile uint32_t readers;
+	volatile uint32_t writers;
+	volatile uint8_t reader_waiting;
+	volatile uint8_t writer_waiting;
+	lock_t read_lock;
+	lock_t write_lock;
+	poll_list_t poll;		// epoll instances watching this
+} pipe_t;
+
+int pipe(int *);
+pipe_t *fifo_open(const char *, int);
+file_t *pipe_file(pipe_t *, int);
+void pipe_close(pipe_t *, int);
+ssize_t pipe_read(pipe_t *, char *, size_t, int);
+ssize_t pipe_write(pipe_t *, char *, size_t, int);
+ssize_t pipe_splice_in(pipe_t *, file_t *, off_t *, size_t, int);
+ssize_t pipe_splice_out(pipe_t *, file_t *, off_t *, size_t, int);
+void pipe_wake(pipe_t *, int);
+uint32_t pipe_poll(void *, int);
+
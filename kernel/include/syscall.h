@@ -0,0 +1,70 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+#include <cpu.h>
+
+// System call numbers
+#define SYS_NULL			0		// does nothing, for benchmarking
+#define SYS_OPEN			1
+#define SYS_CLOSE			2
+#define SYS_READ			3
+#define SYS_WRITE			4
+#define SYS_LSEEK			5
+#define SYS_STAT			6
+#define SYS_FSTAT			7
+#define SYS_LINK			8
+#define SYS_UNLINK			9
+#define SYS_CHMOD			10
+#define SYS_FCHMOD			11
+#define SYS_MKDIR			12
+#define SYS_MOUNT			13
+#define SYS_UMOUNT			14
+#define SYS_UMOUNT2			15
+#define SYS_GETPID			16
+#define SYS_MMAP			17
+#define SYS_MUNMAP			18
+#define SYS_IORING_SETUP		19
+#define SYS_IORING_ENTER		20
+#define SYS_IORING_DESTROY		21
+#define SYS_PREAD			22
+#define SYS_PWRITE			23
+#define SYS_READV			24
+#define SYS_WRITEV			25
+#define SYS_SENDFILE			26
+#define SYS_SPLICE			27
+#define SYS_PIPE			28
+#define SYS_EPOLL_CREATE		29
+#define SYS_EPOLL_CTL			30
+#define SYS_EPOLL_WAIT			31
+#define SYS_FSYNC			32
+#define SYS_SYNC			33
+#define SYS_PREADV			34
+#define SYS_PWRITEV			35
+
+#define SYSCALL_COUNT			36		// keep in sync with syscall.asm
+
+// only the benchmark uses this, and only while it's running
+#define SYSCALL_BENCH_EXIT		0xFFFF
+#define SYSCALL_BENCH_ITERATIONS	100000
+
+// SYSCALL clears these RFLAGS bits: TF, IF, DF, IOPL, NT and AC
+#define SYSCALL_RFLAGS_MASK		0x47700
+
+typedef size_t (*syscall_t)(size_t, size_t, size_t, size_t, size_t, size_t);
+
+syscall_t syscall_table[SYSCALL_COUNT];
+
+void syscall_init(cpu_t *);
+void syscall_benchmark();
+
+extern void syscall_entry();
+extern size_t syscall_bench_enter(size_t, size_t, size_t);
+extern uint8_t syscall_bench_code[];
+extern uint16_t syscall_bench_size[];
+
@@ -7,6 +7,8 @@
 #pragma once
 
 #include <types.h>
+#include <cpu.h>
+#include <apic.h>
 
 #define MAX_PROCESSES			512
 
@@ -36,6 +38,8 @@ typedef struct process_t
 	size_t pmem_base;
 	size_t pmem_size;
 	size_t tty;
+	struct vm_area_t *areas;	// demand-paged memory
+	struct fd_table_t *fd_table;	// open files, made on first use
 
 	char path[1024];
 } process_t;
@@ -69,6 +73,8 @@ typedef struct process_t
 	size_t pmem_base;
 	size_t pmem_size;
 	size_t tty;
+	struct vm_area_t *areas;	// demand-paged memory
+	struct fd_table_t *fd_table;	// open files, made on first use
 
 	char path[1024];
 } process_t;
@@ -76,9 +82,30 @@ typedef struct process_t
 
 process_t *processes;
 
+// Scheduling domains, from the smallest to the largest
+#define SCHED_DOMAIN_SMT		0		// threads of one core
+#define SCHED_DOMAIN_LLC		1		// cores sharing the last level cache
+#define SCHED_DOMAIN_PACKAGE		2		// one physical package
+#define SCHED_DOMAIN_SYSTEM		3		// everything
+#define SCHED_DOMAIN_LEVELS		4
+
+typedef struct sched_domain_t
+{
+	cpumask_t span;
+	size_t count;
+} sched_domain_t;
+
+sched_domain_t *sched_domains;		// SCHED_DOMAIN_LEVELS for each CPU
+
 void tasking_init();
 char *get_path(char *);
 pid_t get_pid();
 size_t get_tty();
 
+// CPU topology
+void topology_detect(cpu_t *);
+void sched_build_domains();
+sched_domain_t *sched_get_domain(size_t, int);
+size_t sched_select_cpu(size_t);
+
 
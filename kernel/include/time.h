@@ -8,8 +8,17 @@
 
 #include <types.h>
 
+#define CLOCK_REALTIME			0
+#define CLOCK_MONOTONIC			1
+
 typedef int64_t time_t;
 
+struct timespec
+{
+	time_t tv_sec;
+	long tv_nsec;
+};
+
 time_t get_time();
 
 
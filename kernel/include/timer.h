@@ -9,14 +9,21 @@
 #include <types.h>
 
 #define TIMER_FREQUENCY			1000	// Hz
+#define PIT_FREQUENCY			1193182	// Hz
 
 extern void timer_irq_stub();
 
 uint64_t global_uptime;
 uint8_t timer_irq_line;
+uint64_t tsc_frequency;		// ticks per microsecond
 
 void timer_init();
 void pit_init();
 
+// TSC
+void tsc_init();
+uint64_t rdtsc();
+void udelay(uint64_t);
+
 
 
@@ -42,6 +42,7 @@ typedef struct tty_t
 extern uint8_t bootfont[];
 
 tty_t *ttys;
+size_t screen_size;
 
 void screen_init(vbe_mode_t *);
 void screen_redraw();
@@ -49,8 +49,52 @@ typedef struct ustar_entry_t
 	char reserved[12];
 }__attribute__((packed)) ustar_entry_t;
 
-int ustar_stat(mountpoint_t *, const char *, struct stat *);
+#define USTAR_NO_HEADER			0xFFFFFFFFFFFFFFFF	// directories only implied by paths
+#define USTAR_POOL_SIZE			0x10000		// index memory is allocated in these
+#define USTAR_INITIAL_BUCKETS		64
+#define USTAR_HASH_START		2166136261	// FNV-1a offset basis
 
+// A file that's been mmap()ed, kept for as long as the kernel runs
+typedef struct ustar_mapping_t
+{
+	size_t size;
+	size_t *pages;			// physical pages by file page
+	size_t page_count;
+	void *copy;			// aligned copy, if the file can't be mapped in place
+} ustar_mapping_t;
 
+// One file of a mounted archive; they're all found when it's mounted, and
+// the rest of the kernel only ever sees their vnodes
+typedef struct ustar_node_t
+{
+	vnode_t vnode;			// data points back here
+	struct ustar_node_t *hash_next;
+	struct ustar_node_t *parent;
+	struct ustar_node_t *children;	// directories only
+	struct ustar_node_t *sibling;
+	char *name;			// full path in the archive, without slashes around it
+	uint32_t hash;
+	uint64_t offset;		// of the header on the device, or USTAR_NO_HEADER
+	uid_t uid;
+	gid_t gid;
+	time_t mtime;
+	void *data;			// in memory-backed devices, found at mount time
+	ustar_mapping_t *mapping;	// made on the first mmap()
+} ustar_node_t;
 
+// Index of a mounted archive, a hash table by path
+typedef struct ustar_index_t
+{
+	ustar_node_t **buckets;
+	size_t bucket_count;		// power of two
+	size_t count;
+	ustar_node_t *root;
+	mountpoint_t *mountpoint;
+	uint8_t *pool;			// nodes and names are carved out of this
+	size_t pool_free;
+} ustar_index_t;
 
+int ustar_mount(mountpoint_t *);
+ssize_t ustar_read(mountpoint_t *, ustar_node_t *, off_t, char *, size_t);
+ssize_t ustar_readv(mountpoint_t *, ustar_node_t *, off_t, const struct iovec *, int);
+ustar_mapping_t *ustar_mmap(mountpoint_t *, ustar_node_t *);
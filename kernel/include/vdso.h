@@ -0,0 +1,65 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+#include <time.h>
+#include <cpu.h>
+#include <apic.h>
+#include <mm.h>
+
+// The vDSO is a few read-only data pages and one code page, mapped at the same
+// address for every process. Offsets in here are used by vdso.asm, so keep
+// the two in sync.
+#define VDSO_DATA_PAGES			5
+#define VDSO_DATA			VDSO_BASE
+#define VDSO_CODE			(VDSO_BASE + (VDSO_DATA_PAGES << PAGE_SIZE_SHIFT))
+
+// entry points in the code page
+#define VDSO_CLOCK_GETTIME		(VDSO_CODE + 0)
+#define VDSO_TIME			(VDSO_CODE + 8)
+#define VDSO_GETPID			(VDSO_CODE + 16)
+
+#define VDSO_FLAGS_RDTSCP		0x0001		// TSC_AUX holds the CPU index
+
+// nanoseconds = (ticks * tsc_mult) >> VDSO_TSC_SHIFT
+#define VDSO_TSC_SHIFT			24
+
+// what a process on a CPU sees as its own
+typedef struct vdso_cpu_t
+{
+	volatile uint32_t sequence;	// odd while being changed
+	pid_t pid;
+	uint32_t tty;
+	uint32_t reserved;
+}__attribute__((packed)) vdso_cpu_t;
+
+typedef struct vdso_data_t
+{
+	volatile uint32_t sequence;	// odd while being changed
+	uint32_t flags;
+	uint64_t tsc_base;		// TSC at the last update
+	uint64_t ns_base;		// nanoseconds since boot at tsc_base
+	time_t wall_base;		// Unix time at boot
+	time_t wall_seconds;		// Unix time at the last update
+	uint32_t tsc_mult;
+	uint32_t tsc_shift;
+	uint8_t reserved[16];
+
+	vdso_cpu_t cpus[MAX_LAPICS];	// indexed by TSC_AUX
+}__attribute__((packed)) vdso_data_t;
+
+vdso_data_t *vdso_data;		// the kernel's writable mapping
+
+void vdso_init();
+void vdso_cpu_init(cpu_t *);
+void vdso_update();
+void vdso_set_process(size_t, pid_t, size_t);
+
+extern uint8_t vdso_code[];
+extern uint16_t vdso_code_size[];
+
@@ -9,6 +9,7 @@
 #include <types.h>
 #include <time.h>
 #include <lock.h>
+#include <mm.h>
 
 #define MAX_FILES			512
 #define MAX_MOUNTPOINTS			32
@@ -29,6 +30,12 @@
 #define ENODEV				-13
 #define ENOTBLK				-14
 #define EBUSY				-15
+#define ENOSYS				-16
+#define EAGAIN				-17
+#define EPIPE				-18
+#define ESPIPE				-19
+#define EROFS				-20
+#define EFBIG				-21
 
 // open() flags
 #define O_RDONLY			0x0001
@@ -36,10 +43,11 @@
 #define O_RDWR				(O_RDONLY | O_WRONLY)
 #define O_ACCMODE			(~O_RDWR)
 #define O_APPEND			0x0004
-#define O_NONBLOCK			0x0000		// we don't use this
+#define O_NONBLOCK			0x0200		// only pipes use this for now
 #define O_NDELAY			O_NONBLOCK
-#define O_FSYNC				0x0000		// not using this either
-#define O_SYNC				O_FSYNC
+#define O_SYNC				0x0400		// written back before write() returns
+#define O_FSYNC				O_SYNC
+#define O_DSYNC				O_SYNC
 #define O_NOATIME			0x0008
 #define O_CREAT				0x0010
 #define O_EXCL				0x0020
@@ -78,6 +86,27 @@
 #define SEEK_CUR			2
 #define SEEK_END			3
 
+// mmap() protection and flags
+#define PROT_NONE			0x0000
+#define PROT_READ			0x0001
+#define PROT_WRITE			0x0002
+#define PROT_EXEC			0x0004
+
+#define MAP_SHARED			0x0001
+#define MAP_PRIVATE			0x0002
+#define MAP_FIXED			0x0010
+
+// most buffers one readv() or writev() can take
+#define IOV_MAX				1024
+
+// splice() flags, which are only hints
+#define SPLICE_F_MOVE			0x0001
+#define SPLICE_F_NONBLOCK		0x0002
+#define SPLICE_F_MORE			0x0004
+
+// size of the kernel buffer splice() uses when it can't copy directly
+#define SPLICE_BUFFER_SIZE		0x10000
+
 // Standard file descriptor numbers
 #define STDIN				0
 #define STDOUT				1
@@ -96,6 +125,10 @@
 #define MS_NOATIME			0x0100
 #define MS_NODIRATIME			0x0200
 
+// umount2() flags
+#define MNT_FORCE			0x0001
+#define MNT_DETACH			0x0002
+
 typedef uint64_t ino_t;
 typedef uint32_t mode_t;
 typedef uint32_t gid_t;
@@ -106,22 +139,12 @@ typedef size_t off_t;
 typedef uint16_t blksize_t;
 typedef size_t blkcnt_t;
 
-typedef struct file_handle_t
-{
-	char present;
-	char path[1024];
-	off_t position;
-	int flags;
-	pid_t pid;
-} file_handle_t;
-
-file_handle_t *files;
-
 typedef struct directory_t
 {
 	char path[1024];
 	size_t index;
 	size_t size;
+	struct vnode_t *vnode;
 } directory_t;
 
 typedef struct directory_entry_t
@@ -132,14 +155,33 @@ typedef struct directory_entry_t
 typedef struct mountpoint_t
 {
 	char present;
+	dev_t dev;			// block device number
 	char fstype[16];
 	char path[1024];
 	char device[64];		// '/dev/hdxpx'
 	unsigned long int flags;
 	uid_t uid;
 	gid_t gid;
+	void *fs_data;			// belongs to the filesystem driver
+	struct vnode_t *root;		// set up by the filesystem driver
 } mountpoint_t;
 
+// A file mapped into a process
+typedef struct file_mapping_t
+{
+	vm_area_t area;
+	off_t offset;			// page-aligned, in the file
+	size_t *pages;			// physical pages of the file, or
+	struct vnode_t *vnode;		// the file, whose pages are in the page cache
+	size_t page_count;
+} file_mapping_t;
+
+struct iovec
+{
+	void *iov_base;
+	size_t iov_len;
+};
+
 struct stat
 {
 	dev_t st_dev;
@@ -157,20 +199,135 @@ struct stat
 	blkcnt_t st_blocks;
 };
 
+struct file_t;
+struct poll_list_t;
+
+// What each kind of open file can do, set up by whatever opened it
+// Positions are never NULL here, and files without one ignore them
+typedef struct file_ops_t
+{
+	ssize_t (*readv)(struct file_t *, const struct iovec *, int, off_t *);
+	ssize_t (*writev)(struct file_t *, const struct iovec *, int, off_t *);
+	int (*stat)(struct file_t *, struct stat *);
+	uint32_t (*poll)(void *, int);				// node and open flags
+	struct poll_list_t *(*poll_list)(void *);		// node
+	void *(*direct)(struct file_t *, off_t, size_t *);	// memory behind the file, and how much
+	int (*mmap)(struct file_t *, file_mapping_t *);		// fills in the pages
+	int (*fsync)(struct file_t *);
+	void (*release)(struct file_t *);			// last reference is gone
+} file_ops_t;
+
+struct vnode_t;
+
+// What each filesystem can do with its files, so the VFS never has to look
+// at what kind of filesystem it's talking to
+// Names given to lookup() aren't terminated, and every operation but stat()
+// is optional
+typedef struct vnode_ops_t
+{
+	int (*lookup)(struct vnode_t *, const char *, size_t, struct vnode_t **);
+	int (*stat)(struct vnode_t *, struct stat *);
+	ssize_t (*readv)(struct vnode_t *, const struct iovec *, int, off_t);
+	ssize_t (*writev)(struct vnode_t *, const struct iovec *, int, off_t);
+	int (*mmap)(struct vnode_t *, file_mapping_t *);
+	int (*readdir)(struct vnode_t *, size_t, directory_entry_t *);
+	int (*readpage)(struct vnode_t *, size_t, void *);	// goes through the page cache
+	int (*writepage)(struct vnode_t *, size_t, void *);	// writes go through it as well
+	int (*bmap)(struct vnode_t *, size_t, uint64_t *, size_t *);	// where a page is, to write it back in bios
+} vnode_ops_t;
+
+// Pages of a file in the page cache, a radix tree by page index
+typedef struct page_tree_t
+{
+	void **root;
+	size_t height;			// levels, 0 if it's empty
+} page_tree_t;
+
+// A file or directory in memory; lookups return these, the dentry cache
+// keeps them, and open files point at them, so a path is only looked up
+// once, and they last as long as their filesystem does
+typedef struct vnode_t
+{
+	const vnode_ops_t *ops;
+	mountpoint_t *mountpoint;	// NULL outside of filesystems
+	ino_t ino;
+	mode_t mode;
+	off_t size;
+	void *data;			// belongs to the filesystem driver
+	page_tree_t pages;
+} vnode_t;
+
+// A kind of filesystem that can be mounted
+typedef struct filesystem_t
+{
+	const char *name;
+	int (*mount)(mountpoint_t *);	// indexes the device and sets up root
+} filesystem_t;
+
+// An open file, shared by every descriptor that refers to it
+typedef struct file_t
+{
+	const file_ops_t *ops;
+	void *node;			// belongs to the driver, or a vnode
+	mode_t mode;			// file type, from S_IFMT
+	int flags;
+	off_t position;
+	volatile size_t references;
+	size_t readahead_next;		// page a sequential read would start at
+	size_t readahead_window;	// pages, grows while reads are sequential
+	size_t readahead_end;		// first page that hasn't been read ahead
+} file_t;
+
+// Descriptors of one process, the lowest free one is found with a bitmap
+#define FD_BITMAP_SIZE			(MAX_FILES / (sizeof(size_t) * 8))
+
+typedef struct fd_table_t
+{
+	file_t *files[MAX_FILES];
+	size_t bitmap[FD_BITMAP_SIZE];	// set for descriptors in use
+	lock_t lock;
+} fd_table_t;
+
 lock_t vfs_mutex;
-file_handle_t *files;
 mountpoint_t *mountpoints;
 char full_path[1024];
+vnode_t vfs_root_vnode;
 
 void vfs_init();
 size_t vfs_resolve_path(char *, const char *);
-int vfs_determine_mountpoint(char *);
+vnode_t *vfs_mount_root(const char *);
+int vfs_lookup(vnode_t *, const char *, const char *, size_t, vnode_t **);
+file_t *vnode_open(vnode_t *, int);
+
+// Open files and descriptors
+file_t *file_alloc(const file_ops_t *, void *, int, mode_t);
+void file_get(file_t *);
+void file_put(file_t *);
+int file_open(const char *, int, file_t **);
+ssize_t file_readv(file_t *, const struct iovec *, int, off_t *);
+ssize_t file_writev(file_t *, const struct iovec *, int, off_t *);
+ssize_t file_read(file_t *, char *, size_t, off_t *);
+ssize_t file_write(file_t *, char *, size_t, off_t *);
+int file_stat(file_t *, struct stat *);
+fd_table_t *fd_table(pid_t);
+int fd_alloc(pid_t, file_t *);
+file_t *fd_get(pid_t, int);
+file_t *fd_remove(pid_t, int);
 
 // Public functions
 int open(const char *, int, ...);
 int close(int);
 ssize_t read(int, char *, size_t);
 ssize_t write(int, char *, size_t);
+ssize_t pread(int, char *, size_t, off_t);
+ssize_t pwrite(int, char *, size_t, off_t);
+ssize_t readv(int, const struct iovec *, int);
+ssize_t writev(int, const struct iovec *, int);
+ssize_t preadv(int, const struct iovec *, int, off_t);
+ssize_t pwritev(int, const struct iovec *, int, off_t);
+ssize_t sendfile(int, int, off_t *, size_t);
+ssize_t splice(int, off_t *, int, off_t *, size_t, unsigned int);
+int pipe(int *);
 int link(char *, char *);
 int unlink(char *);
 int lseek(int, off_t, int);
@@ -182,6 +339,10 @@ int mkdir(const char *, mode_t);
 int mount(const char *, const char *, const char *, unsigned long int, void *);
 int umount(const char *);
 int umount2(const char *, int);
+void *mmap(void *, size_t, int, int, int, off_t);
+int munmap(void *, size_t);
+int fsync(int);
+void sync();
 
 // Non-standard functions
 directory_t *dir_open(char *);
@@ -0,0 +1,168 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#pragma once
+
+#include <types.h>
+#include <pci.h>
+#include <lock.h>
+
+#define VIRTIO_VENDOR			0x1AF4
+#define VIRTIO_BLK_DEVICE		0x1042		// modern
+#define VIRTIO_BLK_TRANSITIONAL		0x1001
+
+#define MAX_VIRTIO_BLK			16
+
+// Vendor capabilities
+#define VIRTIO_CAP_TYPE			0x03
+#define VIRTIO_CAP_BAR			0x04
+#define VIRTIO_CAP_OFFSET		0x08
+#define VIRTIO_CAP_LENGTH		0x0C
+#define VIRTIO_CAP_NOTIFY_MULTIPLIER	0x10
+
+#define VIRTIO_CAP_COMMON		1
+#define VIRTIO_CAP_NOTIFY		2
+#define VIRTIO_CAP_ISR			3
+#define VIRTIO_CAP_DEVICE		4
+
+// Common configuration
+#define VIRTIO_DEVICE_FEATURE_SELECT	0x00
+#define VIRTIO_DEVICE_FEATURE		0x04
+#define VIRTIO_DRIVER_FEATURE_SELECT	0x08
+#define VIRTIO_DRIVER_FEATURE		0x0C
+#define VIRTIO_MSIX_CONFIG		0x10
+#define VIRTIO_NUM_QUEUES		0x12
+#define VIRTIO_STATUS			0x14
+#define VIRTIO_QUEUE_SELECT		0x16
+#define VIRTIO_QUEUE_SIZE		0x18
+#define VIRTIO_QUEUE_MSIX_VECTOR	0x1A
+#define VIRTIO_QUEUE_ENABLE		0x1C
+#define VIRTIO_QUEUE_NOTIFY_OFF		0x1E
+#define VIRTIO_QUEUE_DESC		0x20
+#define VIRTIO_QUEUE_DRIVER		0x28
+#define VIRTIO_QUEUE_DEVICE		0x30
+
+#define VIRTIO_NO_VECTOR		0xFFFF
+
+// Device status
+#define VIRTIO_STATUS_ACKNOWLEDGE	0x01
+#define VIRTIO_STATUS_DRIVER		0x02
+#define VIRTIO_STATUS_DRIVER_OK		0x04
+#define VIRTIO_STATUS_FEATURES_OK	0x08
+#define VIRTIO_STATUS_FAILED		0x80
+
+// Feature bits
+#define VIRTIO_BLK_F_SEG_MAX		((uint64_t)1 << 2)
+#define VIRTIO_BLK_F_RO			((uint64_t)1 << 5)
+#define VIRTIO_BLK_F_MQ			((uint64_t)1 << 12)
+#define VIRTIO_F_INDIRECT_DESC		((uint64_t)1 << 28)
+#define VIRTIO_F_EVENT_IDX		((uint64_t)1 << 29)
+#define VIRTIO_F_VERSION_1		((uint64_t)1 << 32)
+
+// Device configuration of virtio-blk
+#define VIRTIO_BLK_CAPACITY		0x00		// in 512-byte sectors, always
+#define VIRTIO_BLK_SEG_MAX		0x0C
+#define VIRTIO_BLK_NUM_QUEUES		0x22
+
+#define VIRTIO_BLK_SECTOR_SIZE		512
+
+// Requests
+#define VIRTIO_BLK_T_IN			0
+#define VIRTIO_BLK_T_OUT		1
+#define VIRTIO_BLK_S_OK			0
+
+// Split virtqueues
+#define VIRTIO_MAX_QUEUE_SIZE		256		// descriptors at most, each of them one request
+#define VIRTIO_BLK_DEPTH		64		// requests each queue has at once
+
+#define VRING_DESC_F_NEXT		0x0001
+#define VRING_DESC_F_WRITE		0x0002		// the device writes to it
+#define VRING_DESC_F_INDIRECT		0x0004
+#define VRING_USED_F_NO_NOTIFY		0x0001
+
+// The page of each tag has its indirect table, then the header and status
+#define VIRTIO_BLK_TABLE_ENTRIES	254
+#define VIRTIO_BLK_MAX_SEGMENTS		(VIRTIO_BLK_TABLE_ENTRIES - 2)
+#define VIRTIO_BLK_HEADER		4064
+#define VIRTIO_BLK_STATUS		4080
+
+typedef struct vring_desc_t
+{
+	uint64_t address;
+	uint32_t length;
+	uint16_t flags;
+	uint16_t next;
+}__attribute__((packed)) vring_desc_t;
+
+// followed by used_event, with EVENT_IDX
+typedef struct vring_avail_t
+{
+	uint16_t flags;
+	volatile uint16_t index;
+	uint16_t ring[];
+} vring_avail_t;
+
+typedef struct vring_used_elem_t
+{
+	uint32_t id;
+	uint32_t length;
+}__attribute__((packed)) vring_used_elem_t;
+
+// followed by avail_event, with EVENT_IDX
+typedef struct vring_used_t
+{
+	volatile uint16_t flags;
+	volatile uint16_t index;
+	volatile vring_used_elem_t ring[];
+} vring_used_t;
+
+typedef struct virtio_blk_header_t
+{
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t sector;
+}__attribute__((packed)) virtio_blk_header_t;
+
+// One virtqueue, which is one hardware queue of the block layer
+typedef struct virtqueue_t
+{
+	size_t size;
+	vring_desc_t *desc;
+	vring_avail_t *avail;
+	vring_used_t *used;
+	volatile uint16_t *used_event;		// in the avail ring
+	volatile uint16_t *avail_event;		// in the used ring
+	volatile uint16_t *notify;
+	uint16_t avail_index;			// only changed by whoever starts requests
+	uint16_t last_used;			// only changed by whoever is polling
+	lock_t polling;
+	uint8_t *tables;			// a page for each tag
+	size_t tables_physical;
+} virtqueue_t;
+
+typedef struct virtio_blk_t
+{
+	pci_device_t *pci;
+	volatile uint8_t *common;
+	volatile uint8_t *config;
+	volatile uint8_t *notify_base;
+	uint32_t notify_multiplier;
+	uint64_t features;
+	uint64_t capacity;
+	size_t max_segments;
+	size_t queue_count;
+	virtqueue_t *queues;
+} virtio_blk_t;
+
+// block device information
+typedef struct blkdev_virtio_t
+{
+	uint16_t size;
+	virtio_blk_t *virtio;
+} blkdev_virtio_t;
+
+void virtio_blk_init();
+
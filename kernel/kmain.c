@@ -16,8 +16,13 @@
 #include <vfs.h>
 #include <tasking.h>
 #include <blkdev.h>
+#include <pci.h>
 #include <string.h>
 #include <rand.h>
+#include <numa.h>
+#include <syscall.h>
+#include <vdso.h>
+#include <pcache.h>
 
 void *kend;
 
@@ -57,9 +62,14 @@ void kmain(uint32_t multiboot_magic, multiboot_info_t *multiboot_info, vbe_mode_
 	gdt_init();
 	install_exceptions();
 	acpi_init();
+	numa_init();
+	tsc_init();		// SMP bring-up needs calibrated delays
 	apic_init();
 	timer_init();
+	pci_init();
+	vdso_init();
 	tasking_init();
+	syscall_benchmark();
 	vfs_init();
 	blkdev_init(multiboot_info);
 	mount("/dev/initrd", "/", "ustar", 0, 0);
@@ -132,8 +142,15 @@ void kmain(uint32_t multiboot_magic, multiboot_info_t *multiboot_info, vbe_mode_
 
 	kprintf("Boot finished, %d MB used, %d MB free\n", used_pages/256, (total_pages-used_pages) / 256);
 
+	// without any APs to stand in for the flusher, dirty pages are written
+	// back from here instead, and the timer wakes us up every tick anyway
 	while(1)
+	{
+		if(!ap_started_count && pcache_flush_poll(bsp_index))
+			continue;
+
 		asm volatile ("sti\nhlt");
+	}
 }
 
 
@@ -44,13 +44,14 @@ void gdt_init()
 	gdt_set_entry(3, 0, GDT_ACCESS_RW | GDT_ACCESS_EXEC | GDT_ACCESS_PRESENT, GDT_FLAGS_LONG_MODE | GDT_FLAGS_PAGE_GRANULARITY);
 	gdt_set_entry(4, 0, GDT_ACCESS_RW | GDT_ACCESS_PRESENT, GDT_FLAGS_LONG_MODE | GDT_FLAGS_PAGE_GRANULARITY);
 
-	// 64-bit user code/data segments
-	gdt_set_entry(5, 0, (3 << GDT_ACCESS_RING_SHIFT) | GDT_ACCESS_RW | GDT_ACCESS_EXEC | GDT_ACCESS_PRESENT, GDT_FLAGS_LONG_MODE | GDT_FLAGS_PAGE_GRANULARITY);
-	gdt_set_entry(6, 0, (3 << GDT_ACCESS_RING_SHIFT) | GDT_ACCESS_RW | GDT_ACCESS_PRESENT, GDT_FLAGS_LONG_MODE | GDT_FLAGS_PAGE_GRANULARITY);
-
 	// 32-bit user code/data segments
-	gdt_set_entry(7, 0, (3 << GDT_ACCESS_RING_SHIFT) | GDT_ACCESS_RW | GDT_ACCESS_EXEC | GDT_ACCESS_PRESENT, GDT_FLAGS_PMODE | GDT_FLAGS_PAGE_GRANULARITY);
-	gdt_set_entry(8, 0, (3 << GDT_ACCESS_RING_SHIFT) | GDT_ACCESS_RW | GDT_ACCESS_PRESENT, GDT_FLAGS_PMODE | GDT_FLAGS_PAGE_GRANULARITY);
+	// SYSRET needs these right before the 64-bit ones, see gdt.h
+	gdt_set_entry(5, 0, (3 << GDT_ACCESS_RING_SHIFT) | GDT_ACCESS_RW | GDT_ACCESS_EXEC | GDT_ACCESS_PRESENT, GDT_FLAGS_PMODE | GDT_FLAGS_PAGE_GRANULARITY);
+	gdt_set_entry(6, 0, (3 << GDT_ACCESS_RING_SHIFT) | GDT_ACCESS_RW | GDT_ACCESS_PRESENT, GDT_FLAGS_PMODE | GDT_FLAGS_PAGE_GRANULARITY);
+
+	// 64-bit user code/data segments
+	gdt_set_entry(7, 0, (3 << GDT_ACCESS_RING_SHIFT) | GDT_ACCESS_RW | GDT_ACCESS_EXEC | GDT_ACCESS_PRESENT, GDT_FLAGS_LONG_MODE | GDT_FLAGS_PAGE_GRANULARITY);
+	gdt_set_entry(8, 0, (3 << GDT_ACCESS_RING_SHIFT) | GDT_ACCESS_RW | GDT_ACCESS_PRESENT, GDT_FLAGS_LONG_MODE | GDT_FLAGS_PAGE_GRANULARITY);
 
 	flush_gdt(gdtr, 0x18, 0x20);
 #endif
@@ -0,0 +1,390 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <numa.h>
+#include <acpi.h>
+#include <mm.h>
+#include <cpu.h>
+#include <gdt.h>
+#include <kprintf.h>
+
+// NUMA Memory Affinity
+// The SRAT tells us which proximity domain each range of memory and each CPU
+// belongs to, and the SLIT tells us how far apart the domains are. Domains are
+// renumbered into dense node numbers, and every node gets a list of all the
+// nodes sorted by distance, which the physical memory allocator falls back on
+// when the nearest node is full. Without an SRAT, there is just one node.
+
+numa_node_t *numa_nodes = NULL;
+size_t numa_node_count = 0;
+
+numa_zone_t *numa_zones;
+size_t numa_zone_count = 0;
+numa_cpu_t *numa_cpus;
+size_t numa_cpu_count = 0;
+size_t numa_detected_count = 0;	// nodes found so far, before they're usable
+uint32_t *numa_order;		// numa_node_count * numa_node_count
+acpi_slit_t *slit = NULL;
+numa_zone_t *numa_last_zone = NULL;
+
+uint32_t numa_add_node(uint32_t);
+void numa_add_zone(uint32_t, uint64_t, uint64_t);
+void numa_add_cpu(uint32_t, uint32_t);
+void numa_sort_nodes(uint32_t);
+void numa_count_pages(uint32_t);
+
+// numa_init(): Detects NUMA nodes from the ACPI SRAT and SLIT
+// Param:	Nothing
+// Return:	Nothing
+
+void numa_init()
+{
+	// allocations made in here don't know about nodes yet, which is fine
+	// because numa_node_count stays zero until everything is ready
+	numa_node_t *nodes = kcalloc(sizeof(numa_node_t), MAX_NUMA_NODES);
+	numa_zones = kcalloc(sizeof(numa_zone_t), MAX_NUMA_ZONES);
+	numa_cpus = kcalloc(sizeof(numa_cpu_t), MAX_NUMA_CPUS);
+	numa_nodes = nodes;
+
+	acpi_srat_t *srat = acpi_scan("SRAT", 0);
+
+	if(!srat)
+	{
+		kprintf("numa: ACPI SRAT not present, using one node for all memory.\n");
+		numa_add_zone(numa_add_node(0), 0, (uint64_t)highest_usable_address);
+	} else
+	{
+		srat_cpu_t *cpu;
+		srat_memory_t *memory;
+		srat_x2apic_t *x2apic;
+		uint32_t domain;
+
+		uint8_t *ptr = srat->records;
+		size_t bytes = sizeof(acpi_srat_t);
+
+		while(bytes < srat->header.length)
+		{
+			if(ptr[1] == 0)		// corrupt table, don't loop forever
+				break;
+
+			switch(ptr[0])
+			{
+			case SRAT_ENTRY_CPU:
+				cpu = (srat_cpu_t*)ptr;
+				if(cpu->flags & SRAT_ENABLED)
+				{
+					domain = cpu->domain_low | (cpu->domain_high[0] << 8) | (cpu->domain_high[1] << 16) | (cpu->domain_high[2] << 24);
+					numa_add_cpu(cpu->apic_id, numa_add_node(domain));
+				}
+				break;
+
+			case SRAT_ENTRY_MEMORY:
+				memory = (srat_memory_t*)ptr;
+				if((memory->flags & SRAT_ENABLED) && memory->length)
+					numa_add_zone(numa_add_node(memory->domain), memory->base, memory->base + memory->length);
+				break;
+
+			case SRAT_ENTRY_X2APIC:
+				x2apic = (srat_x2apic_t*)ptr;
+				if(x2apic->flags & SRAT_ENABLED)
+					numa_add_cpu(x2apic->apic_id, numa_add_node(x2apic->domain));
+				break;
+			}
+
+			bytes += ptr[1];
+			ptr += ptr[1];
+		}
+
+		// a node with CPUs and no memory is fine, but no memory at all isn't
+		if(!numa_zone_count)
+		{
+			kprintf("numa: SRAT doesn't describe any memory, using one node for all memory.\n");
+			if(!numa_detected_count)
+				numa_add_node(0);
+
+			numa_add_zone(0, 0, (uint64_t)highest_usable_address);
+		}
+
+		slit = acpi_scan("SLIT", 0);
+	}
+
+	// numa_node_count has to stay zero until the order table exists
+	size_t node_count = numa_detected_count;
+	numa_order = kcalloc(sizeof(uint32_t), node_count * node_count);
+	numa_sort_nodes(node_count);
+	numa_count_pages(node_count);
+
+	numa_node_count = node_count;
+
+	size_t i;
+	for(i = 0; i < numa_node_count; i++)
+	{
+		kprintf("numa: node %d (domain %d): %d MB, %d MB used\n", i, numa_nodes[i].domain, numa_nodes[i].total_pages >> 8, numa_nodes[i].used_pages >> 8);
+	}
+
+	if(slit)
+		kprintf("numa: using SLIT with %d localities.\n", (size_t)slit->localities);
+}
+
+// numa_add_node(): Finds or creates the node of a proximity domain
+// Param:	uint32_t domain - ACPI proximity domain
+// Return:	uint32_t - node number
+
+uint32_t numa_add_node(uint32_t domain)
+{
+	uint32_t i;
+	for(i = 0; i < numa_detected_count; i++)
+	{
+		if(numa_nodes[i].domain == domain)
+			return i;
+	}
+
+	if(numa_detected_count < MAX_NUMA_NODES)
+	{
+		numa_nodes[i].domain = domain;
+		numa_detected_count++;
+		return i;
+	}
+
+	kprintf("numa: too many proximity domains, putting domain %d on node 0\n", domain);
+	return 0;
+}
+
+// numa_add_zone(): Adds a memory range to a node
+// Param:	uint32_t node - node number
+// Param:	uint64_t base - start of the range
+// Param:	uint64_t end - end of the range
+// Return:	Nothing
+
+void numa_add_zone(uint32_t node, uint64_t base, uint64_t end)
+{
+	if(numa_zone_count >= MAX_NUMA_ZONES)
+	{
+		kprintf("numa: too many memory ranges, ignoring 0x%xq-0x%xq\n", base, end);
+		return;
+	}
+
+	numa_zones[numa_zone_count].base = base;
+	numa_zones[numa_zone_count].end = end;
+	numa_zones[numa_zone_count].node = node;
+	numa_zone_count++;
+}
+
+// numa_add_cpu(): Records the node of a CPU
+// Param:	uint32_t apic_id - local APIC ID
+// Param:	uint32_t node - node number
+// Return:	Nothing
+
+void numa_add_cpu(uint32_t apic_id, uint32_t node)
+{
+	if(numa_cpu_count >= MAX_NUMA_CPUS)
+		return;
+
+	numa_cpus[numa_cpu_count].apic_id = apic_id;
+	numa_cpus[numa_cpu_count].node = node;
+	numa_cpu_count++;
+}
+
+// numa_sort_nodes(): Builds the fallback order of every node
+// Param:	uint32_t node_count - count of nodes
+// Return:	Nothing
+
+void numa_sort_nodes(uint32_t node_count)
+{
+	uint32_t i, j, k, tmp;
+	uint32_t *order;
+
+	for(i = 0; i < node_count; i++)
+	{
+		order = &numa_order[i * node_count];
+		for(j = 0; j < node_count; j++)
+			order[j] = j;
+
+		// there are never more than a handful of nodes, so insertion sort
+		// the node itself is always at distance 10 and ends up first
+		for(j = 1; j < node_count; j++)
+		{
+			k = j;
+			while(k > 0 && numa_distance(i, order[k]) < numa_distance(i, order[k-1]))
+			{
+				tmp = order[k];
+				order[k] = order[k-1];
+				order[k-1] = tmp;
+				k--;
+			}
+		}
+	}
+}
+
+// numa_count_pages(): Counts the total and used pages of every node
+// Param:	uint32_t node_count - count of nodes
+// Return:	Nothing
+
+void numa_count_pages(uint32_t node_count)
+{
+	size_t i, page, end;
+	for(i = 0; i < node_count; i++)
+	{
+		numa_nodes[i].total_pages = 0;
+		numa_nodes[i].used_pages = 0;
+	}
+
+	// only memory the physical memory manager knows about counts
+	for(i = 0; i < numa_zone_count; i++)
+	{
+		if(numa_zones[i].base >= highest_usable_address)
+			continue;
+
+		page = (size_t)numa_zones[i].base & (~(PAGE_SIZE-1));
+		end = (size_t)numa_zones[i].end;
+		if(numa_zones[i].end > highest_usable_address)
+			end = highest_usable_address;
+
+		while(page < end)
+		{
+			numa_nodes[numa_zones[i].node].total_pages++;
+			if(pmm_is_page_free(page))
+				numa_nodes[numa_zones[i].node].used_pages++;
+
+			page += PAGE_SIZE;
+		}
+	}
+}
+
+// numa_cpu_node(): Returns the node of a CPU
+// Param:	uint32_t apic_id - local APIC ID
+// Return:	uint32_t - node number, 0 if the SRAT doesn't mention the CPU
+
+uint32_t numa_cpu_node(uint32_t apic_id)
+{
+	size_t i;
+	for(i = 0; i < numa_cpu_count; i++)
+	{
+		if(numa_cpus[i].apic_id == apic_id)
+			return numa_cpus[i].node;
+	}
+
+	return 0;
+}
+
+// numa_current_node(): Returns the node of the current CPU
+// Param:	Nothing
+// Return:	uint32_t - node number
+
+uint32_t numa_current_node()
+{
+	if(numa_node_count <= 1)
+		return 0;
+
+	// CPUs allocate memory before their CPU-specific information is set up
+#if __i386__
+	uint16_t fs;
+	asm volatile ("mov %%fs, %0" : "=r"(fs));
+	if(fs < (GDT_CPU_INFO << 3))
+		return 0;
+#endif
+
+#if __x86_64__
+	if(!read_msr(MSR_FS_BASE))
+		return 0;
+#endif
+
+	cpu_t FS_BASE *cpu = (cpu_t FS_BASE*)0;
+	uint32_t node = cpu->numa_node;
+	if(node >= numa_node_count)
+		return 0;
+
+	return node;
+}
+
+// numa_distance(): Returns the distance between two nodes
+// Param:	uint32_t from - node number
+// Param:	uint32_t to - node number
+// Return:	uint8_t - relative distance, 10 is local
+
+uint8_t numa_distance(uint32_t from, uint32_t to)
+{
+	uint64_t a = numa_nodes[from].domain;
+	uint64_t b = numa_nodes[to].domain;
+
+	if(slit && a < slit->localities && b < slit->localities)
+		return slit->distances[(size_t)((a * slit->localities) + b)];
+
+	if(from == to)
+		return NUMA_LOCAL_DISTANCE;
+
+	return NUMA_REMOTE_DISTANCE;
+}
+
+// numa_account(): Updates the page counters of the node a page belongs to
+// Param:	size_t page - physical address of page
+// Param:	int delta - 1 when allocated, -1 when freed
+// Return:	Nothing
+
+void numa_account(size_t page, int delta)
+{
+	if(!numa_node_count)
+		return;
+
+	// pages are usually allocated and freed in runs, so try the last zone
+	numa_zone_t *zone = numa_last_zone;
+	if(!zone || page < zone->base || page >= zone->end)
+	{
+		size_t i;
+		for(i = 0; i < numa_zone_count; i++)
+		{
+			if(page >= numa_zones[i].base && page < numa_zones[i].end)
+				break;
+		}
+
+		if(i >= numa_zone_count)
+			return;
+
+		zone = &numa_zones[i];
+		numa_last_zone = zone;
+	}
+
+	numa_nodes[zone->node].used_pages += delta;
+}
+
+// numa_find_range(): Finds free pages, preferring the current CPU's node
+// Falls back on other nodes by distance, and on any memory at all last
+// Param:	size_t count - count of pages
+// Return:	size_t - start of 4KB-aligned page, NULL on error
+
+size_t numa_find_range(size_t count)
+{
+	if(numa_node_count <= 1)
+		return pmm_find_range(count);
+
+	uint32_t *order = &numa_order[numa_current_node() * numa_node_count];
+	size_t i, j, memory, end;
+
+	for(i = 0; i < numa_node_count; i++)
+	{
+		for(j = 0; j < numa_zone_count; j++)
+		{
+			if(numa_zones[j].node != order[i])
+				continue;
+
+			// 32-bit kernels can't use memory above 4 GB
+			if(numa_zones[j].base > (size_t)-1)
+				continue;
+
+			end = (size_t)-1;
+			if(numa_zones[j].end < end)
+				end = (size_t)numa_zones[j].end;
+
+			memory = pmm_find_range_in((size_t)numa_zones[j].base, end, count);
+			if(memory)
+				return memory;
+		}
+	}
+
+	// the SRAT may not describe all of memory
+	return pmm_find_range(count);
+}
+
@@ -9,6 +9,7 @@
 #include <kprintf.h>
 #include <string.h>
 #include <lock.h>
+#include <numa.h>
 
 #if __x86_64__
 
@@ -158,6 +159,7 @@ void pmm_mark_page_used(size_t page)
 
 	pmm_bitmap[group] |= flag;
 	used_pages++;
+	numa_account(page, 1);
 }
 
 // pmm_mark_page_free(): Marks a single page as free
@@ -175,6 +177,7 @@ void pmm_mark_page_free(size_t page)
 
 	pmm_bitmap[group] &= (~flag);
 	used_pages--;
+	numa_account(page, -1);
 }
 
 // pmm_mark_used(): Marks a range of pages as used
@@ -235,27 +238,44 @@ uint8_t pmm_is_page_free(size_t page)
 // Return:	size_t - start of 4KB-aligned page, NULL on error
 
 size_t pmm_find_range(size_t count)
+{
+	return pmm_find_range_in(0, highest_usable_address, count);
+}
+
+// pmm_find_range_in(): Finds a range of contiguous physical pages within bounds
+// Param:	size_t start - lowest physical address to use
+// Param:	size_t end - highest physical address to use
+// Param:	size_t count - count of pages
+// Return:	size_t - start of 4KB-aligned page, NULL on error
+
+size_t pmm_find_range_in(size_t start, size_t end, size_t count)
 {
 	if(!count)
 		return NULL;
 
 	// we have reserved the lowest 48 MB for the kernel
 	// so start looking from 48 MB
-	size_t current_return = 0x3000000;
+	if(start < 0x3000000)
+		start = 0x3000000;
+
+	if(end > highest_usable_address)
+		end = highest_usable_address;
+
+	size_t current_return = (start + PAGE_SIZE - 1) & (~(PAGE_SIZE-1));
 	size_t free_count = 0;
 
 	while(free_count < count)
 	{
+		if(current_return + (count << PAGE_SIZE_SHIFT) > end)
+			return NULL;
+
 		if(pmm_is_page_free(current_return + (free_count << PAGE_SIZE_SHIFT)) == 0)
 			free_count++;
 
 		else
 		{
-			current_return += PAGE_SIZE;
-
-			if(current_return >= highest_usable_address)
-				return NULL;
-
+			// skip past the used page, nothing before it can fit
+			current_return += (free_count + 1) << PAGE_SIZE_SHIFT;
 			free_count = 0;
 		}
 	}
@@ -271,7 +291,8 @@ size_t pmm_alloc(size_t count)
 {
 	acquire_lock(&pmm_mutex);
 
-	size_t memory = pmm_find_range(count);
+	// prefer memory close to this CPU
+	size_t memory = numa_find_range(count);
 	if(!memory)
 		panic("Out of memory.");
 
@@ -0,0 +1,159 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <mm.h>
+#include <cpu.h>
+#include <lock.h>
+#include <tasking.h>
+#include <kprintf.h>
+
+// Demand Paging
+// Each process has a list of areas that aren't mapped until they're touched.
+// A page fault in one of them calls the area's fault function to map the
+// page, and everything else is a real page fault.
+
+lock_t vma_mutex = 0;
+
+// vma_add(): Adds a demand-paged area to a process
+// Param:	pid_t pid - process ID
+// Param:	vm_area_t *area - area, which the caller keeps ownership of
+// Return:	Nothing
+
+void vma_add(pid_t pid, vm_area_t *area)
+{
+	acquire_lock(&vma_mutex);
+	area->next = processes[pid].areas;
+	processes[pid].areas = area;
+	release_lock(&vma_mutex);
+}
+
+// vma_remove(): Removes a demand-paged area from a process
+// Param:	pid_t pid - process ID
+// Param:	vm_area_t *area - area
+// Return:	Nothing
+
+void vma_remove(pid_t pid, vm_area_t *area)
+{
+	acquire_lock(&vma_mutex);
+
+	vm_area_t **link = &processes[pid].areas;
+	while(*link)
+	{
+		if(*link == area)
+		{
+			*link = area->next;
+			break;
+		}
+
+		link = &(*link)->next;
+	}
+
+	release_lock(&vma_mutex);
+}
+
+// vma_find(): Finds the demand-paged area containing an address
+// Param:	pid_t pid - process ID
+// Param:	size_t address - virtual address
+// Return:	vm_area_t * - area, NULL if none
+
+vm_area_t *vma_find(pid_t pid, size_t address)
+{
+	acquire_lock(&vma_mutex);
+
+	vm_area_t *area = processes[pid].areas;
+	while(area)
+	{
+		if(address >= area->start && address < area->end)
+			break;
+
+		area = area->next;
+	}
+
+	release_lock(&vma_mutex);
+	return area;
+}
+
+// vma_find_range(): Finds a demand-paged area that overlaps a range
+// Param:	pid_t pid - process ID
+// Param:	size_t start - start of range
+// Param:	size_t end - end of range, exclusive
+// Return:	vm_area_t * - area, NULL if none
+
+vm_area_t *vma_find_range(pid_t pid, size_t start, size_t end)
+{
+	acquire_lock(&vma_mutex);
+
+	vm_area_t *area = processes[pid].areas;
+	while(area)
+	{
+		if(area->start < end && area->end > start)
+			break;
+
+		area = area->next;
+	}
+
+	release_lock(&vma_mutex);
+	return area;
+}
+
+// vma_find_free(): Finds user memory not used by any area, from the top down
+// Param:	pid_t pid - process ID
+// Param:	size_t size - size in bytes, page-aligned
+// Return:	size_t - virtual address, 0 if there isn't enough space
+
+size_t vma_find_free(pid_t pid, size_t size)
+{
+	if(!size || size > USER_LIMIT - USER_BASE)
+		return 0;
+
+	acquire_lock(&vma_mutex);
+
+	size_t address = USER_LIMIT - size;
+	vm_area_t *area = processes[pid].areas;
+	while(area)
+	{
+		if(address < area->end && address + size > area->start)
+		{
+			// overlaps, so try right below this one and start over
+			if(area->start < USER_BASE + size)
+			{
+				release_lock(&vma_mutex);
+				return 0;
+			}
+
+			address = area->start - size;
+			area = processes[pid].areas;
+			continue;
+		}
+
+		area = area->next;
+	}
+
+	release_lock(&vma_mutex);
+	return address;
+}
+
+// vmm_page_fault(): Page fault handler, called before the exception handler
+// Param:	size_t error - page fault error code
+// Return:	int - 1 if the fault was handled
+
+int vmm_page_fault(size_t error)
+{
+	// only not-present pages are ever demand-paged
+	if(error & PAGE_FAULT_PRESENT)
+		return 0;
+
+	size_t address = (size_t)read_cr2();
+	vm_area_t *area = vma_find(get_pid(), address);
+	if(!area)
+		return 0;
+
+	if((error & PAGE_FAULT_WRITE) && !(area->flags & PAGE_RW))
+		return 0;
+
+	return area->fault(area, address & (~(PAGE_SIZE-1))) == 0;
+}
+
@@ -0,0 +1,445 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <elf.h>
+#include <mm.h>
+#include <vfs.h>
+#include <tasking.h>
+#include <string.h>
+#include <lock.h>
+#include <kprintf.h>
+
+// ELF Loader
+// Nothing is read from the binary at load time except its headers. Each
+// PT_LOAD segment becomes a demand-paged area, and its pages are read from
+// the file when they're first touched. Read-only pages are kept with the
+// image and shared by every process running the same binary, and writable
+// pages and BSS are private and start out as zeroes.
+
+elf_image_t *elf_images = NULL;
+lock_t elf_mutex = 0;
+
+elf_image_t *elf_get_image(const char *);
+void elf_put_image(elf_image_t *);
+ssize_t elf_read(elf_image_t *, uint64_t, void *, size_t);
+int elf_fault(vm_area_t *, size_t);
+int elf_add_segment(pid_t, elf_image_t *, size_t, uint64_t, uint64_t, uint64_t, uint32_t);
+
+// elf_get_image(): Finds or opens the image of a binary
+// Param:	const char *path - path of binary
+// Return:	elf_image_t * - image with a new reference, NULL on error
+
+elf_image_t *elf_get_image(const char *path)
+{
+	char *resolved = kmalloc(1024);
+	vfs_resolve_path(resolved, path);
+
+	acquire_lock(&elf_mutex);
+
+	elf_image_t *image = elf_images;
+	while(image)
+	{
+		if(strcmp(image->path, resolved) == 0)
+		{
+			image->references++;
+			release_lock(&elf_mutex);
+			kfree(resolved);
+			return image;
+		}
+
+		image = image->next;
+	}
+
+	release_lock(&elf_mutex);
+
+	struct stat file_info;
+	if(stat(resolved, &file_info) != 0 || !(file_info.st_mode & S_IFREG))
+	{
+		kfree(resolved);
+		return NULL;
+	}
+
+	file_t *file;
+	if(file_open(resolved, O_RDONLY, &file) != 0)
+	{
+		kfree(resolved);
+		return NULL;
+	}
+
+	image = kcalloc(sizeof(elf_image_t), 1);
+	image->path = resolved;
+	image->file = file;
+	image->references = 1;
+	image->page_count = (file_info.st_size + PAGE_SIZE - 1) >> PAGE_SIZE_SHIFT;
+	image->pages = kcalloc(sizeof(size_t), image->page_count + 1);
+
+	acquire_lock(&elf_mutex);
+	image->next = elf_images;
+	elf_images = image;
+	release_lock(&elf_mutex);
+
+	return image;
+}
+
+// elf_put_image(): Drops a reference to an image, freeing it with the last one
+// Param:	elf_image_t *image - image
+// Return:	Nothing
+
+void elf_put_image(elf_image_t *image)
+{
+	acquire_lock(&elf_mutex);
+
+	image->references--;
+	if(image->references)
+	{
+		release_lock(&elf_mutex);
+		return;
+	}
+
+	elf_image_t **link = &elf_images;
+	while(*link != image)
+		link = &(*link)->next;
+
+	*link = image->next;
+	release_lock(&elf_mutex);
+
+	size_t i;
+	for(i = 0; i < image->page_count; i++)
+	{
+		if(image->pages[i])
+			pmm_mark_free(image->pages[i], 1);
+	}
+
+	file_put(image->file);
+	kfree(image->pages);
+	kfree(image->path);
+	kfree(image);
+}
+
+// elf_read(): Reads from a binary, with the image locked
+// Param:	elf_image_t *image - image
+// Param:	uint64_t offset - byte offset in the file
+// Param:	void *buffer - buffer to read into
+// Param:	size_t count - bytes to read
+// Return:	ssize_t - bytes read, or error code
+
+ssize_t elf_read(elf_image_t *image, uint64_t offset, void *buffer, size_t count)
+{
+	off_t position = (off_t)offset;
+	return file_read(image->file, buffer, count, &position);
+}
+
+// elf_fault(): Maps a page of an ELF segment
+// Param:	vm_area_t *area - area of the segment
+// Param:	size_t page - page-aligned virtual address
+// Return:	int - 0 on success
+
+int elf_fault(vm_area_t *area, size_t page)
+{
+	elf_segment_t *segment = (elf_segment_t*)area->data;
+	elf_image_t *image = segment->image;
+	size_t physical;
+
+	acquire_lock(&image->lock);
+
+	// the page is filled in through a writable mapping, and then mapped
+	// with the segment's flags
+	if(segment->shared)
+	{
+		// segments are page-congruent with the file, so each page of the
+		// segment is exactly one page of the file
+		size_t file_page = (size_t)((segment->offset + (page - segment->start)) >> PAGE_SIZE_SHIFT);
+		if(file_page >= image->page_count)
+			file_page = image->page_count;		// past the end, all zeroes
+
+		physical = image->pages[file_page];
+		if(physical)
+		{
+			vmm_map(page, physical, 1, area->flags);
+			release_lock(&image->lock);
+			return 0;
+		}
+
+		physical = pmm_alloc(1);
+		vmm_map(page, physical, 1, PAGE_PRESENT | PAGE_RW);
+		memset((void*)page, 0, PAGE_SIZE);
+
+		if(file_page < image->page_count)
+			elf_read(image, (uint64_t)file_page << PAGE_SIZE_SHIFT, (void*)page, PAGE_SIZE);
+
+		image->pages[file_page] = physical;
+	} else
+	{
+		physical = pmm_alloc(1);
+		vmm_map(page, physical, 1, PAGE_PRESENT | PAGE_RW);
+		memset((void*)page, 0, PAGE_SIZE);
+
+		// only the part of the page that's in the file is read, and the
+		// rest, including all of BSS, stays zero
+		size_t start = page, end = page + PAGE_SIZE;
+		if(start < segment->start)
+			start = segment->start;
+
+		if(end > segment->start + segment->file_size)
+			end = segment->start + segment->file_size;
+
+		if(start < end)
+			elf_read(image, segment->offset + (start - segment->start), (void*)start, end - start);
+	}
+
+	if(area->flags != (PAGE_PRESENT | PAGE_RW))
+		vmm_map(page, physical, 1, area->flags);
+
+	release_lock(&image->lock);
+	return 0;
+}
+
+// elf_add_segment(): Makes a demand-paged area for a PT_LOAD segment
+// Param:	pid_t pid - process ID
+// Param:	elf_image_t *image - image, which this segment takes a reference to
+// Param:	size_t start - virtual address of segment
+// Param:	uint64_t offset - offset of segment in the file
+// Param:	uint64_t file_size - size of segment in the file
+// Param:	uint64_t memory_size - size of segment in memory
+// Param:	uint32_t flags - ELF segment flags
+// Return:	int - 0 on success
+
+int elf_add_segment(pid_t pid, elf_image_t *image, size_t start, uint64_t offset, uint64_t file_size, uint64_t memory_size, uint32_t flags)
+{
+	if(file_size > memory_size || !memory_size)
+		return EINVAL;
+
+	if(start < USER_BASE || start >= USER_LIMIT || memory_size > USER_LIMIT - start)
+		return EINVAL;
+
+	elf_segment_t *segment = kcalloc(sizeof(elf_segment_t), 1);
+	segment->image = image;
+	segment->start = start;
+	segment->offset = offset;
+	segment->file_size = file_size;
+
+	// read-only pages can be shared if they're the same as the file's pages
+	if(!(flags & ELF_SEGMENT_WRITE) && file_size == memory_size && (start & (PAGE_SIZE-1)) == (offset & (PAGE_SIZE-1)))
+		segment->shared = 1;
+
+	segment->area.start = start & (~(PAGE_SIZE-1));
+	segment->area.end = (start + (size_t)memory_size + PAGE_SIZE - 1) & (~(PAGE_SIZE-1));
+	segment->area.flags = PAGE_PRESENT | PAGE_USER;
+	segment->area.fault = &elf_fault;
+	segment->area.data = segment;
+
+	if(flags & ELF_SEGMENT_WRITE)
+		segment->area.flags |= PAGE_RW;
+
+	acquire_lock(&elf_mutex);
+	image->references++;
+	release_lock(&elf_mutex);
+
+	vma_add(pid, &segment->area);
+	return 0;
+}
+
+// elf_load(): Loads an ELF binary into a process
+// Param:	pid_t pid - process ID
+// Param:	const char *path - path of binary
+// Param:	int flags - ELF_PREFAULT to map everything right away
+// Param:	size_t *entry - destination to store entry point
+// Return:	int - 0 on success
+
+int elf_load(pid_t pid, const char *path, int flags, size_t *entry)
+{
+	elf_image_t *image = elf_get_image(path);
+	if(!image)
+		return ENOENT;
+
+	// the 64-bit header is the bigger one
+	elf64_header_t header;
+	memset(&header, 0, sizeof(elf64_header_t));
+
+	acquire_lock(&image->lock);
+	ssize_t size = elf_read(image, 0, &header, sizeof(elf64_header_t));
+	release_lock(&image->lock);
+
+	if(size < (ssize_t)sizeof(elf32_header_t) || header.magic != ELF_MAGIC || header.data != ELF_DATA_LSB)
+	{
+		elf_put_image(image);
+		return EINVAL;
+	}
+
+	elf32_header_t *header32 = (elf32_header_t*)&header;
+	uint16_t type, machine, program_size, program_count;
+	uint64_t program_offset, entry_point;
+
+	if(header.class == ELF_CLASS_64)
+	{
+		type = header.type;
+		machine = header.machine;
+		program_offset = header.program_offset;
+		program_size = header.program_size;
+		program_count = header.program_count;
+		entry_point = header.entry;
+	} else if(header.class == ELF_CLASS_32)
+	{
+		type = header32->type;
+		machine = header32->machine;
+		program_offset = header32->program_offset;
+		program_size = header32->program_size;
+		program_count = header32->program_count;
+		entry_point = header32->entry;
+	} else
+	{
+		elf_put_image(image);
+		return EINVAL;
+	}
+
+	// 64-bit kernels run 32-bit binaries in compatibility mode
+#if __i386__
+	if(machine != ELF_MACHINE_386 || header.class != ELF_CLASS_32)
+#endif
+#if __x86_64__
+	if((machine != ELF_MACHINE_X86_64 || header.class != ELF_CLASS_64) && (machine != ELF_MACHINE_386 || header.class != ELF_CLASS_32))
+#endif
+	{
+		elf_put_image(image);
+		return EINVAL;
+	}
+
+	if((type != ELF_TYPE_EXEC && type != ELF_TYPE_DYN) || !program_count || program_count > ELF_MAX_SEGMENTS * 4)
+	{
+		elf_put_image(image);
+		return EINVAL;
+	}
+
+	if((header.class == ELF_CLASS_64 && program_size < sizeof(elf64_program_t)) || (header.class == ELF_CLASS_32 && program_size < sizeof(elf32_program_t)))
+	{
+		elf_put_image(image);
+		return EINVAL;
+	}
+
+	// position independent binaries go at the start of user memory
+	size_t base = 0;
+	if(type == ELF_TYPE_DYN)
+		base = USER_BASE;
+
+	uint8_t *programs = kmalloc(program_size * program_count);
+
+	acquire_lock(&image->lock);
+	size = elf_read(image, program_offset, programs, program_size * program_count);
+	release_lock(&image->lock);
+
+	if(size != program_size * program_count)
+	{
+		kfree(programs);
+		elf_put_image(image);
+		return EIO;
+	}
+
+	elf32_program_t *program32;
+	elf64_program_t *program64;
+	size_t i, segment_count = 0;
+	int status = 0;
+
+	for(i = 0; i < program_count && status == 0; i++)
+	{
+		if(header.class == ELF_CLASS_64)
+		{
+			program64 = (elf64_program_t*)(programs + (i * program_size));
+			if(program64->type != ELF_SEGMENT_LOAD)
+				continue;
+
+			status = elf_add_segment(pid, image, base + (size_t)program64->virtual, program64->offset, program64->file_size, program64->memory_size, program64->flags);
+		} else
+		{
+			program32 = (elf32_program_t*)(programs + (i * program_size));
+			if(program32->type != ELF_SEGMENT_LOAD)
+				continue;
+
+			status = elf_add_segment(pid, image, base + program32->virtual, program32->offset, program32->file_size, program32->memory_size, program32->flags);
+		}
+
+		segment_count++;
+		if(segment_count > ELF_MAX_SEGMENTS)
+			status = EINVAL;
+	}
+
+	kfree(programs);
+
+	// each segment has its own reference now
+	elf_put_image(image);
+
+	if(status != 0 || !segment_count)
+	{
+		elf_unload(pid);
+		return status ? status : EINVAL;
+	}
+
+	// small binaries are cheaper to map all at once than to fault in
+	vm_area_t *area;
+	size_t page;
+	if(flags & ELF_PREFAULT)
+	{
+		area = processes[pid].areas;
+		while(area)
+		{
+			if(area->fault == &elf_fault)
+			{
+				for(page = area->start; page < area->end; page += PAGE_SIZE)
+				{
+					if(!(vmm_get_page(page) & PAGE_PRESENT))
+						elf_fault(area, page);
+				}
+			}
+
+			area = area->next;
+		}
+	}
+
+	*entry = base + (size_t)entry_point;
+	return 0;
+}
+
+// elf_unload(): Unmaps all ELF segments of a process
+// Param:	pid_t pid - process ID
+// Return:	Nothing
+
+void elf_unload(pid_t pid)
+{
+	vm_area_t *area = processes[pid].areas;
+	vm_area_t *next;
+	elf_segment_t *segment;
+	size_t page, physical;
+
+	while(area)
+	{
+		next = area->next;
+		if(area->fault != &elf_fault)
+		{
+			area = next;
+			continue;
+		}
+
+		segment = (elf_segment_t*)area->data;
+		vma_remove(pid, area);
+
+		// shared pages belong to the image, and go away with it
+		for(page = area->start; page < area->end; page += PAGE_SIZE)
+		{
+			physical = vmm_get_page(page);
+			if(!(physical & PAGE_PRESENT))
+				continue;
+
+			if(!segment->shared)
+				pmm_mark_free(physical & (~(PAGE_SIZE-1)), 1);
+
+			vmm_unmap(page, 1);
+		}
+
+		elf_put_image(segment->image);
+		kfree(segment);
+		area = next;
+	}
+}
+
@@ -0,0 +1,338 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <syscall.h>
+#include <cpu.h>
+#include <gdt.h>
+#include <mm.h>
+#include <vfs.h>
+#include <ioring.h>
+#include <epoll.h>
+#include <tasking.h>
+#include <string.h>
+#include <kprintf.h>
+
+// System Calls
+// x86_64 enters through SYSCALL and i386 through SYSENTER, and both go
+// straight to the function in syscall_table[] with the arguments still in
+// the registers they came in. See syscall.asm for the register conventions.
+// There is no separate user address space yet, so pointers are passed on as
+// they are.
+
+size_t sys_null();
+size_t sys_open(size_t, size_t, size_t);
+size_t sys_close(size_t);
+size_t sys_read(size_t, size_t, size_t);
+size_t sys_write(size_t, size_t, size_t);
+size_t sys_lseek(size_t, size_t, size_t);
+size_t sys_stat(size_t, size_t);
+size_t sys_fstat(size_t, size_t);
+size_t sys_link(size_t, size_t);
+size_t sys_unlink(size_t);
+size_t sys_chmod(size_t, size_t);
+size_t sys_fchmod(size_t, size_t);
+size_t sys_mkdir(size_t, size_t);
+size_t sys_mount(size_t, size_t, size_t, size_t, size_t);
+size_t sys_umount(size_t);
+size_t sys_umount2(size_t, size_t);
+size_t sys_getpid();
+size_t sys_mmap(size_t, size_t, size_t, size_t, size_t, size_t);
+size_t sys_munmap(size_t, size_t);
+size_t sys_ioring_setup(size_t, size_t);
+size_t sys_ioring_enter(size_t, size_t, size_t, size_t);
+size_t sys_ioring_destroy(size_t);
+size_t sys_pread(size_t, size_t, size_t, size_t);
+size_t sys_pwrite(size_t, size_t, size_t, size_t);
+size_t sys_readv(size_t, size_t, size_t);
+size_t sys_writev(size_t, size_t, size_t);
+size_t sys_sendfile(size_t, size_t, size_t, size_t);
+size_t sys_splice(size_t, size_t, size_t, size_t, size_t, size_t);
+size_t sys_pipe(size_t);
+size_t sys_epoll_create(size_t);
+size_t sys_epoll_ctl(size_t, size_t, size_t, size_t);
+size_t sys_epoll_wait(size_t, size_t, size_t, size_t);
+size_t sys_fsync(size_t);
+size_t sys_sync();
+size_t sys_preadv(size_t, size_t, size_t, size_t);
+size_t sys_pwritev(size_t, size_t, size_t, size_t);
+
+syscall_t syscall_table[SYSCALL_COUNT] =
+{
+	(syscall_t)&sys_null,		// SYS_NULL
+	(syscall_t)&sys_open,		// SYS_OPEN
+	(syscall_t)&sys_close,		// SYS_CLOSE
+	(syscall_t)&sys_read,		// SYS_READ
+	(syscall_t)&sys_write,		// SYS_WRITE
+	(syscall_t)&sys_lseek,		// SYS_LSEEK
+	(syscall_t)&sys_stat,		// SYS_STAT
+	(syscall_t)&sys_fstat,		// SYS_FSTAT
+	(syscall_t)&sys_link,		// SYS_LINK
+	(syscall_t)&sys_unlink,		// SYS_UNLINK
+	(syscall_t)&sys_chmod,		// SYS_CHMOD
+	(syscall_t)&sys_fchmod,		// SYS_FCHMOD
+	(syscall_t)&sys_mkdir,		// SYS_MKDIR
+	(syscall_t)&sys_mount,		// SYS_MOUNT
+	(syscall_t)&sys_umount,		// SYS_UMOUNT
+	(syscall_t)&sys_umount2,	// SYS_UMOUNT2
+	(syscall_t)&sys_getpid,		// SYS_GETPID
+	(syscall_t)&sys_mmap,		// SYS_MMAP
+	(syscall_t)&sys_munmap,		// SYS_MUNMAP
+	(syscall_t)&sys_ioring_setup,	// SYS_IORING_SETUP
+	(syscall_t)&sys_ioring_enter,	// SYS_IORING_ENTER
+	(syscall_t)&sys_ioring_destroy,	// SYS_IORING_DESTROY
+	(syscall_t)&sys_pread,		// SYS_PREAD
+	(syscall_t)&sys_pwrite,		// SYS_PWRITE
+	(syscall_t)&sys_readv,		// SYS_READV
+	(syscall_t)&sys_writev,		// SYS_WRITEV
+	(syscall_t)&sys_sendfile,	// SYS_SENDFILE
+	(syscall_t)&sys_splice,		// SYS_SPLICE
+	(syscall_t)&sys_pipe,		// SYS_PIPE
+	(syscall_t)&sys_epoll_create,	// SYS_EPOLL_CREATE
+	(syscall_t)&sys_epoll_ctl,	// SYS_EPOLL_CTL
+	(syscall_t)&sys_epoll_wait,	// SYS_EPOLL_WAIT
+	(syscall_t)&sys_fsync,		// SYS_FSYNC
+	(syscall_t)&sys_sync,		// SYS_SYNC
+	(syscall_t)&sys_preadv,		// SYS_PREADV
+	(syscall_t)&sys_pwritev,	// SYS_PWRITEV
+};
+
+// syscall_init(): Sets up system call entry on the current CPU
+// Param:	cpu_t *cpu - CPU-specific information of the current CPU
+// Return:	Nothing
+
+void syscall_init(cpu_t *cpu)
+{
+#if __i386__
+	// SYSENTER doesn't touch FS, so the entry point finds this CPU's FS
+	// selector in the 16 bytes we leave free above the stack
+	uint32_t *stack = (uint32_t*)cpu->stack;
+	stack[-1] = (GDT_CPU_INFO + cpu->index) << 3;
+
+	write_msr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+	write_msr(MSR_SYSENTER_ESP, (uint32_t)cpu->stack - 16);
+	write_msr(MSR_SYSENTER_EIP, (uint32_t)&syscall_entry);
+#endif
+
+#if __x86_64__
+	write_msr(MSR_EFER, read_msr(MSR_EFER) | EFER_SCE);
+	write_msr(MSR_STAR, ((uint64_t)GDT_KERNEL_CODE << 32) | ((uint64_t)(GDT_USER_CODE32 | 3) << 48));
+	write_msr(MSR_LSTAR, (uint64_t)&syscall_entry);
+	write_msr(MSR_SFMASK, SYSCALL_RFLAGS_MASK);
+
+	// the kernel uses FS for CPU-specific information, but FS belongs to
+	// user space in a system call; swapgs gets us to it through GS instead
+	write_msr(MSR_KERNEL_GS_BASE, (uint64_t)cpu);
+#endif
+}
+
+// syscall_benchmark(): Measures the cost of a null system call
+// Runs a loop of SYS_NULL calls in user mode with IRQs disabled, timed with
+// the TSC from user mode, so it covers the full round trip
+// Param:	Nothing
+// Return:	Nothing
+
+void syscall_benchmark()
+{
+	// code and stack, in one user page each
+	size_t code = vmm_alloc(KERNEL_HEAP, 2, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+	if(!code)
+		return;
+
+	memcpy((void*)code, syscall_bench_code, syscall_bench_size[0]);
+	size_t stack = code + (PAGE_SIZE * 2) - 16;
+
+	size_t cycles = syscall_bench_enter(code, stack, SYSCALL_BENCH_ITERATIONS);
+	kprintf("syscall: %d cycles per null system call\n", cycles / SYSCALL_BENCH_ITERATIONS);
+
+	vmm_free(code, 2);
+}
+
+// sys_null(): Does nothing
+// Param:	Nothing
+// Return:	size_t - 0
+
+size_t sys_null()
+{
+	return 0;
+}
+
+// Wrappers around the VFS functions, which have their own documentation
+
+size_t sys_open(size_t path, size_t flags, size_t mode)
+{
+	return (size_t)open((const char *)path, (int)flags, (mode_t)mode);
+}
+
+size_t sys_close(size_t handle)
+{
+	return (size_t)close((int)handle);
+}
+
+size_t sys_read(size_t handle, size_t buffer, size_t count)
+{
+	return (size_t)read((int)handle, (char *)buffer, count);
+}
+
+size_t sys_write(size_t handle, size_t buffer, size_t count)
+{
+	return (size_t)write((int)handle, (char *)buffer, count);
+}
+
+size_t sys_lseek(size_t handle, size_t offset, size_t whence)
+{
+	return (size_t)lseek((int)handle, (off_t)offset, (int)whence);
+}
+
+size_t sys_stat(size_t path, size_t destination)
+{
+	return (size_t)stat((const char *)path, (struct stat *)destination);
+}
+
+size_t sys_fstat(size_t handle, size_t destination)
+{
+	return (size_t)fstat((int)handle, (struct stat *)destination);
+}
+
+size_t sys_link(size_t old_path, size_t new_path)
+{
+	return (size_t)link((char *)old_path, (char *)new_path);
+}
+
+size_t sys_unlink(size_t path)
+{
+	return (size_t)unlink((char *)path);
+}
+
+size_t sys_chmod(size_t path, size_t mode)
+{
+	return (size_t)chmod((const char *)path, (mode_t)mode);
+}
+
+size_t sys_fchmod(size_t handle, size_t mode)
+{
+	return (size_t)fchmod((int)handle, (mode_t)mode);
+}
+
+size_t sys_mkdir(size_t path, size_t mode)
+{
+	return (size_t)mkdir((const char *)path, (mode_t)mode);
+}
+
+size_t sys_mount(size_t source, size_t target, size_t type, size_t flags, size_t data)
+{
+	return (size_t)mount((const char *)source, (const char *)target, (const char *)type, (unsigned long int)flags, (void *)data);
+}
+
+size_t sys_umount(size_t target)
+{
+	return (size_t)umount((const char *)target);
+}
+
+size_t sys_umount2(size_t target, size_t flags)
+{
+	return (size_t)umount2((const char *)target, (int)flags);
+}
+
+size_t sys_getpid()
+{
+	return (size_t)get_pid();
+}
+
+size_t sys_mmap(size_t address, size_t length, size_t protection, size_t flags, size_t handle, size_t offset)
+{
+	return (size_t)mmap((void *)address, length, (int)protection, (int)flags, (int)handle, (off_t)offset);
+}
+
+size_t sys_munmap(size_t address, size_t length)
+{
+	return (size_t)munmap((void *)address, length);
+}
+
+size_t sys_ioring_setup(size_t entries, size_t params)
+{
+	return (size_t)ioring_setup((uint32_t)entries, (ioring_params_t *)params);
+}
+
+size_t sys_ioring_enter(size_t ring, size_t to_submit, size_t min_complete, size_t flags)
+{
+	return (size_t)ioring_enter((int)ring, (uint32_t)to_submit, (uint32_t)min_complete, (uint32_t)flags);
+}
+
+size_t sys_ioring_destroy(size_t ring)
+{
+	return (size_t)ioring_destroy((int)ring);
+}
+
+size_t sys_pread(size_t handle, size_t buffer, size_t count, size_t position)
+{
+	return (size_t)pread((int)handle, (char *)buffer, count, (off_t)position);
+}
+
+size_t sys_pwrite(size_t handle, size_t buffer, size_t count, size_t position)
+{
+	return (size_t)pwrite((int)handle, (char *)buffer, count, (off_t)position);
+}
+
+size_t sys_readv(size_t handle, size_t iov, size_t count)
+{
+	return (size_t)readv((int)handle, (const struct iovec *)iov, (int)count);
+}
+
+size_t sys_writev(size_t handle, size_t iov, size_t count)
+{
+	return (size_t)writev((int)handle, (const struct iovec *)iov, (int)count);
+}
+
+size_t sys_sendfile(size_t out, size_t in, size_t position, size_t count)
+{
+	return (size_t)sendfile((int)out, (int)in, (off_t *)position, count);
+}
+
+size_t sys_splice(size_t in, size_t in_position, size_t out, size_t out_position, size_t count, size_t flags)
+{
+	return (size_t)splice((int)in, (off_t *)in_position, (int)out, (off_t *)out_position, count, (unsigned int)flags);
+}
+
+size_t sys_pipe(size_t handles)
+{
+	return (size_t)pipe((int *)handles);
+}
+
+size_t sys_epoll_create(size_t size)
+{
+	return (size_t)epoll_create((int)size);
+}
+
+size_t sys_epoll_ctl(size_t epoll, size_t operation, size_t handle, size_t event)
+{
+	return (size_t)epoll_ctl((int)epoll, (int)operation, (int)handle, (struct epoll_event *)event);
+}
+
+size_t sys_epoll_wait(size_t epoll, size_t events, size_t max_events, size_t timeout)
+{
+	return (size_t)epoll_wait((int)epoll, (struct epoll_event *)events, (int)max_events, (int)timeout);
+}
+
+size_t sys_fsync(size_t handle)
+{
+	return (size_t)fsync((int)handle);
+}
+
+size_t sys_sync()
+{
+	sync();
+	return 0;
+}
+
+size_t sys_preadv(size_t handle, size_t iov, size_t count, size_t position)
+{
+	return (size_t)preadv((int)handle, (const struct iovec *)iov, (int)count, (off_t)position);
+}
+
+size_t sys_pwritev(size_t handle, size_t iov, size_t count, size_t position)
+{
+	return (size_t)pwritev((int)handle, (const struct iovec *)iov, (int)count, (off_t)position);
+}
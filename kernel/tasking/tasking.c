@@ -9,6 +9,7 @@
 #include <mm.h>
 #include <string.h>
 #include <kprintf.h>
+#include <vdso.h>
 
 process_t *processes;
 
@@ -26,6 +27,13 @@ void tasking_init()
 	processes[0].tty = 0;
 	processes[0].path[0] = '/';
 	processes[0].path[1] = 0;
+
+	// all CPUs are up by now
+	sched_build_domains();
+
+	size_t i;
+	for(i = 0; i < lapic_count; i++)
+		vdso_set_process(i, 0, 0);
 }
 
 // get_path(): Returns the path of the current process
@@ -0,0 +1,286 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <tasking.h>
+#include <cpu.h>
+#include <apic.h>
+#include <mm.h>
+#include <kprintf.h>
+
+// CPU topology and scheduling domains
+// Each CPU reads its own place in the topology from CPUID when it starts up,
+// and once they're all up, the scheduler groups them into domains: threads
+// of one core, CPUs sharing the last level cache, packages and the system.
+
+sched_domain_t *sched_domains = NULL;
+
+uint32_t topology_shift(uint32_t);
+int sched_cpu_idle(size_t);
+int sched_core_idle(size_t);
+
+// topology_shift(): Returns how many APIC ID bits a number of CPUs takes
+// Param:	uint32_t count - count of CPUs
+// Return:	uint32_t - bit count
+
+uint32_t topology_shift(uint32_t count)
+{
+	uint32_t shift = 0;
+	while(shift < 31 && ((uint32_t)1 << shift) < count)
+		shift++;
+
+	return shift;
+}
+
+// topology_detect(): Detects the topology of the current CPU
+// Param:	cpu_t *cpu - CPU-specific information of the current CPU
+// Return:	Nothing
+
+void topology_detect(cpu_t *cpu)
+{
+	cpuid_t cpuid;
+	uint32_t smt_shift = 0, package_shift = 0;
+	uint32_t leaf = 0, level;
+
+	read_cpuid(0, 0, &cpuid);
+	uint32_t max_leaf = cpuid.eax;
+
+	read_cpuid(1, 0, &cpuid);
+	cpu->apic_id = cpuid.ebx >> 24;
+
+	// some hypervisors set HTT and still say zero
+	uint32_t logical_count = 1;
+	if((cpuid.edx & CPUID_EDX_HTT) && ((cpuid.ebx >> 16) & 0xFF))
+		logical_count = (cpuid.ebx >> 16) & 0xFF;
+
+	// prefer leaf 0x1F, which knows about dies and modules, then leaf 0x0B
+	if(max_leaf >= CPUID_TOPOLOGY_V2)
+	{
+		read_cpuid(CPUID_TOPOLOGY_V2, 0, &cpuid);
+		if(cpuid.ebx != 0)
+			leaf = CPUID_TOPOLOGY_V2;
+	}
+
+	if(!leaf && max_leaf >= CPUID_TOPOLOGY)
+	{
+		read_cpuid(CPUID_TOPOLOGY, 0, &cpuid);
+		if(cpuid.ebx != 0)
+			leaf = CPUID_TOPOLOGY;
+	}
+
+	if(leaf)
+	{
+		// each level tells us how far to shift the x2APIC ID to get to
+		// the next level, so the last one gets us to the package
+		level = 0;
+		while(1)
+		{
+			read_cpuid(leaf, level, &cpuid);
+			if(((cpuid.ecx >> 8) & 0xFF) == CPUID_LEVEL_INVALID)
+				break;
+
+			if(((cpuid.ecx >> 8) & 0xFF) == CPUID_LEVEL_SMT)
+				smt_shift = cpuid.eax & 0x1F;
+
+			package_shift = cpuid.eax & 0x1F;
+			cpu->apic_id = cpuid.edx;
+			level++;
+		}
+	} else
+	{
+		// older CPUs: logical CPUs per package from leaf 1, cores from leaf 4
+		uint32_t core_count = 1;
+		if(max_leaf >= CPUID_CACHE)
+		{
+			read_cpuid(CPUID_CACHE, 0, &cpuid);
+			core_count = (cpuid.eax >> 26) + 1;
+		}
+
+		if(core_count > logical_count)
+			core_count = logical_count;
+
+		package_shift = topology_shift(logical_count);
+		smt_shift = topology_shift(logical_count / core_count);
+	}
+
+	cpu->smt_id = cpu->apic_id & (((uint32_t)1 << smt_shift) - 1);
+	cpu->core_id = (cpu->apic_id & (((uint32_t)1 << package_shift) - 1)) >> smt_shift;
+	cpu->package_id = cpu->apic_id >> package_shift;
+
+	// without leaf 4, assume a private L2 per core and a shared LLC per package
+	cpu->l2_id = cpu->apic_id >> smt_shift;
+	cpu->llc_id = cpu->apic_id >> package_shift;
+
+	if(max_leaf < CPUID_CACHE)
+		return;
+
+	// CPUs sharing a cache have the same APIC ID above the cache's shift
+	uint32_t highest = 0, cache_level;
+	level = 0;
+	while(1)
+	{
+		read_cpuid(CPUID_CACHE, level, &cpuid);
+		if((cpuid.eax & 0x1F) == 0)
+			break;
+
+		cache_level = (cpuid.eax >> 5) & 7;
+		uint32_t shift = topology_shift(((cpuid.eax >> 14) & 0xFFF) + 1);
+
+		if(cache_level == 2)
+			cpu->l2_id = cpu->apic_id >> shift;
+
+		if(cache_level >= highest)
+		{
+			highest = cache_level;
+			cpu->llc_id = cpu->apic_id >> shift;
+		}
+
+		level++;
+	}
+}
+
+// sched_build_domains(): Groups the running CPUs into scheduling domains
+// Param:	Nothing
+// Return:	Nothing
+
+void sched_build_domains()
+{
+	sched_domains = kcalloc(sizeof(sched_domain_t), lapic_count * SCHED_DOMAIN_LEVELS);
+
+	size_t i, j;
+	sched_domain_t *domains;
+	for(i = 0; i < lapic_count; i++)
+	{
+		if(!cpus[i])
+			continue;
+
+		domains = &sched_domains[i * SCHED_DOMAIN_LEVELS];
+
+		for(j = 0; j < lapic_count; j++)
+		{
+			if(!cpus[j])
+				continue;
+
+			if(cpus[j]->package_id == cpus[i]->package_id && cpus[j]->core_id == cpus[i]->core_id)
+			{
+				cpumask_set(&domains[SCHED_DOMAIN_SMT].span, j);
+				domains[SCHED_DOMAIN_SMT].count++;
+			}
+
+			if(cpus[j]->llc_id == cpus[i]->llc_id)
+			{
+				cpumask_set(&domains[SCHED_DOMAIN_LLC].span, j);
+				domains[SCHED_DOMAIN_LLC].count++;
+			}
+
+			if(cpus[j]->package_id == cpus[i]->package_id)
+			{
+				cpumask_set(&domains[SCHED_DOMAIN_PACKAGE].span, j);
+				domains[SCHED_DOMAIN_PACKAGE].count++;
+			}
+
+			cpumask_set(&domains[SCHED_DOMAIN_SYSTEM].span, j);
+			domains[SCHED_DOMAIN_SYSTEM].count++;
+		}
+
+		kprintf("topology: CPU index %d: package %d core %d thread %d, L2 %d LLC %d, %d siblings, %d sharing LLC\n", i, cpus[i]->package_id, cpus[i]->core_id, cpus[i]->smt_id, cpus[i]->l2_id, cpus[i]->llc_id, domains[SCHED_DOMAIN_SMT].count - 1, domains[SCHED_DOMAIN_LLC].count);
+	}
+}
+
+// sched_get_domain(): Returns a scheduling domain of a CPU
+// Param:	size_t cpu - CPU index
+// Param:	int level - domain level
+// Return:	sched_domain_t * - domain, NULL if not built
+
+sched_domain_t *sched_get_domain(size_t cpu, int level)
+{
+	if(!sched_domains || cpu >= lapic_count || level >= SCHED_DOMAIN_LEVELS)
+		return NULL;
+
+	return &sched_domains[(cpu * SCHED_DOMAIN_LEVELS) + level];
+}
+
+// sched_cpu_idle(): Checks if a CPU has nothing to run
+// Param:	size_t cpu - CPU index
+// Return:	int - 1 if idle
+
+int sched_cpu_idle(size_t cpu)
+{
+	return cpus[cpu] && cpus[cpu]->process_count == 0;
+}
+
+// sched_core_idle(): Checks if all threads of a CPU's core are idle
+// Param:	size_t cpu - CPU index
+// Return:	int - 1 if idle
+
+int sched_core_idle(size_t cpu)
+{
+	sched_domain_t *smt = sched_get_domain(cpu, SCHED_DOMAIN_SMT);
+
+	size_t i;
+	for(i = 0; i < lapic_count; i++)
+	{
+		if(cpumask_test(&smt->span, i) && !sched_cpu_idle(i))
+			return 0;
+	}
+
+	return 1;
+}
+
+// sched_select_cpu(): Selects a CPU to move work to
+// An idle core beats an idle thread of a busy core, and we only look outside
+// the last level cache when nothing that shares it is idle
+// Param:	size_t cpu - CPU index the work is coming from
+// Return:	size_t - CPU index to move the work to
+
+size_t sched_select_cpu(size_t cpu)
+{
+	if(!sched_domains || cpu >= lapic_count)
+		return cpu;
+
+	if(sched_core_idle(cpu))
+		return cpu;
+
+	sched_domain_t *domain;
+	size_t i, sibling;
+	int level;
+
+	for(level = SCHED_DOMAIN_LLC; level < SCHED_DOMAIN_LEVELS; level++)
+	{
+		domain = sched_get_domain(cpu, level);
+		sibling = lapic_count;
+
+		for(i = 0; i < lapic_count; i++)
+		{
+			if(!cpumask_test(&domain->span, i) || !sched_cpu_idle(i))
+				continue;
+
+			if(sched_core_idle(i))
+				return i;
+
+			if(sibling == lapic_count)
+				sibling = i;
+		}
+
+		if(sibling != lapic_count)
+			return sibling;
+	}
+
+	// everything is busy, so stay cache-warm: least loaded CPU sharing our LLC
+	domain = sched_get_domain(cpu, SCHED_DOMAIN_LLC);
+	size_t best = cpu;
+
+	for(i = 0; i < lapic_count; i++)
+	{
+		if(!cpumask_test(&domain->span, i) || !cpus[i])
+			continue;
+
+		if(cpus[i]->process_count < cpus[best]->process_count)
+			best = i;
+	}
+
+	return best;
+}
+
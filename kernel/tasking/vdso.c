@@ -0,0 +1,123 @@
+
+/*
+ * lux OS kernel
+ * copyright (c) 2018 by Omar Mohammad
+ */
+
+#include <vdso.h>
+#include <timer.h>
+#include <time.h>
+#include <mm.h>
+#include <cpu.h>
+#include <string.h>
+#include <kprintf.h>
+
+// vDSO: time and process identity without a system call
+// The kernel keeps a clocksource snapshot in the data page, and the code page
+// turns it into the current time with the TSC. The BSP refreshes the snapshot
+// on every timer tick, and readers retry if the sequence number changed under
+// them. getpid() finds its CPU's slot through RDTSCP.
+
+vdso_data_t *vdso_data = NULL;
+uint8_t vdso_rdtscp = 0;
+
+// vdso_init(): Creates the vDSO pages and maps them for user space
+// Param:	Nothing
+// Return:	Nothing
+
+void vdso_init()
+{
+	size_t data_phys = pmm_alloc(VDSO_DATA_PAGES);
+	size_t code_phys = pmm_alloc(1);
+
+	// user space gets read-only mappings, we write through our own
+	vdso_data_t *data = (vdso_data_t*)vmm_request_map(data_phys, VDSO_DATA_PAGES, PAGE_PRESENT | PAGE_RW);
+	void *code = (void*)vmm_request_map(code_phys, 1, PAGE_PRESENT | PAGE_RW);
+
+	memset(data, 0, VDSO_DATA_PAGES << PAGE_SIZE_SHIFT);
+	memset(code, 0, PAGE_SIZE);
+	memcpy(code, vdso_code, vdso_code_size[0]);
+
+	vmm_map(VDSO_DATA, data_phys, VDSO_DATA_PAGES, PAGE_PRESENT | PAGE_USER);
+	vmm_map(VDSO_CODE, code_phys, 1, PAGE_PRESENT | PAGE_USER);
+
+	if(vdso_rdtscp)
+		data->flags |= VDSO_FLAGS_RDTSCP;
+
+	data->tsc_mult = (uint32_t)(((uint64_t)1000 << VDSO_TSC_SHIFT) / tsc_frequency);
+	data->tsc_shift = VDSO_TSC_SHIFT;
+	data->tsc_base = rdtsc();
+	data->ns_base = global_uptime * 1000000;	// milliseconds
+	data->wall_base = get_time() - (time_t)(global_uptime / 1000);
+	data->wall_seconds = data->wall_base + (time_t)(global_uptime / 1000);
+
+	vdso_data = data;
+
+	kprintf("vdso: mapped at 0x%xq, code at 0x%xq\n", (uint64_t)VDSO_DATA, (uint64_t)VDSO_CODE);
+}
+
+// vdso_cpu_init(): Lets the vDSO know which CPU it's running on
+// Param:	cpu_t *cpu - CPU-specific information of the current CPU
+// Return:	Nothing
+
+void vdso_cpu_init(cpu_t *cpu)
+{
+	cpuid_t cpuid;
+	read_cpuid(0x80000000, 0, &cpuid);		// highest extended leaf
+	if(cpuid.eax < CPUID_EXTENDED)
+		return;
+
+	read_cpuid(CPUID_EXTENDED, 0, &cpuid);
+	if(!(cpuid.edx & CPUID_EXT_EDX_RDTSCP))
+		return;
+
+	write_msr(MSR_TSC_AUX, cpu->index);
+	vdso_rdtscp = 1;
+}
+
+// vdso_update(): Refreshes the clocksource snapshot, called on timer ticks
+// Param:	Nothing
+// Return:	Nothing
+
+void vdso_update()
+{
+	if(!vdso_data)
+		return;
+
+	uint64_t tsc = rdtsc();
+
+	vdso_data->sequence++;
+	asm volatile ("" : : : "memory");
+
+	// advance with the same math the readers use, so time never jumps
+	vdso_data->ns_base += ((tsc - vdso_data->tsc_base) * vdso_data->tsc_mult) >> VDSO_TSC_SHIFT;
+	vdso_data->tsc_base = tsc;
+	vdso_data->wall_seconds = vdso_data->wall_base + (time_t)(vdso_data->ns_base / 1000000000);
+
+	asm volatile ("" : : : "memory");
+	vdso_data->sequence++;
+}
+
+// vdso_set_process(): Sets the process a CPU is running, for getpid()
+// Param:	size_t cpu - CPU index
+// Param:	pid_t pid - process ID
+// Param:	size_t tty - tty of the process
+// Return:	Nothing
+
+void vdso_set_process(size_t cpu, pid_t pid, size_t tty)
+{
+	if(!vdso_data || cpu >= MAX_LAPICS)
+		return;
+
+	vdso_cpu_t *slot = &vdso_data->cpus[cpu];
+
+	slot->sequence++;
+	asm volatile ("" : : : "memory");
+
+	slot->pid = pid;
+	slot->tty = (uint32_t)tty;
+
+	asm volatile ("" : : : "memory");
+	slot->sequence++;
+}
+